@@ -1,7 +1,7 @@
 /*
  * gnote
  *
- * Copyright (C) 2012-2014,2017 Aurimas Cernius
+ * Copyright (C) 2012-2014,2017,2019 Aurimas Cernius
  *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -55,11 +55,17 @@ void NoteDirectoryWatcherApplicationAddin::initialize()
   m_signal_note_saved_cid = manager.signal_note_saved
     .connect(sigc::mem_fun(*this, &NoteDirectoryWatcherApplicationAddin::handle_note_saved));
 
-  Glib::RefPtr<Gio::File> file = Gio::File::create_for_path(note_path);
-  m_file_system_watcher = file->monitor_directory();
+  // packed notes are not separate files, nothing to watch for
+  if(dynamic_cast<gnote::PackedNoteStorage*>(&manager.storage()) == NULL) {
+    Glib::RefPtr<Gio::File> file = Gio::File::create_for_path(note_path);
+    m_file_system_watcher = file->monitor_directory();
 
-  m_signal_changed_cid = m_file_system_watcher->signal_changed()
-    .connect(sigc::mem_fun(*this, &NoteDirectoryWatcherApplicationAddin::handle_file_system_change_event));
+    m_signal_changed_cid = m_file_system_watcher->signal_changed()
+      .connect(sigc::mem_fun(*this, &NoteDirectoryWatcherApplicationAddin::handle_file_system_change_event));
+  }
+  else {
+    DBG_OUT("NoteDirectoryWatcher: notes are packed, not watching %s", note_path.c_str());
+  }
 
   Glib::RefPtr<Gio::Settings> settings = gnote::Preferences::obj().get_schema_settings(SCHEMA_NOTE_DIRECTORY_WATCHER);
   m_check_interval = settings->get_int(CHECK_INTERVAL);
@@ -72,7 +78,10 @@ void NoteDirectoryWatcherApplicationAddin::initialize()
 
 void NoteDirectoryWatcherApplicationAddin::shutdown()
 {
-  m_file_system_watcher->cancel();
+  if(m_file_system_watcher) {
+    m_file_system_watcher->cancel();
+    m_file_system_watcher.reset();
+  }
   m_signal_note_saved_cid.disconnect();
   m_signal_changed_cid.disconnect();
   m_signal_settings_changed_cid.disconnect();
@@ -102,6 +111,11 @@ void NoteDirectoryWatcherApplicationAddin::handle_file_system_change_event(
     return;
   }
 
+  // only note files and their temporary copies, not the packed note store
+  if(file->get_basename().find(".note") == std::string::npos) {
+    return;
+  }
+
   Glib::ustring note_id = get_id(file->get_path());
 
   DBG_OUT("NoteDirectoryWatcher: %s has %d (note_id=%s)", file->get_path().c_str(), int(event_type), note_id.c_str());
@@ -73,6 +73,7 @@ private:
       set_column_types(m_columns);
       build_stats();
       nm.signal_note_added.connect(sigc::mem_fun(*this, &StatisticsModel::on_note_list_changed));
+      nm.signal_notes_added.connect(sigc::mem_fun(*this, &StatisticsModel::on_notes_added));
       nm.signal_note_deleted.connect(sigc::mem_fun(*this, &StatisticsModel::on_note_list_changed));
       gnote::notebooks::NotebookManager::obj().signal_note_added_to_notebook()
         .connect(sigc::mem_fun(*this, &StatisticsModel::on_notebook_note_list_changed));
@@ -127,6 +128,14 @@ private:
         nb_stat->set_value(1, Glib::ustring::compose(fmt, nb.second));
       }
 
+      gnote::NoteBufferCache & buffer_cache = m_note_manager.buffer_cache();
+      iter = append();
+      stat = _("Loaded Notes:");
+      iter->set_value(0, stat);
+      // TRANSLATORS: %1 is the number of notes, %2 is the size of loaded text in kilobytes.
+      iter->set_value(1, Glib::ustring::compose(_("%1 (%2 KB)"), buffer_cache.resident_buffers(),
+                                                buffer_cache.resident_bytes() / 1024));
+
       DBG_OUT("Statistics updated");
     }
 
@@ -135,6 +144,11 @@ private:
       update();
     }
 
+  void on_notes_added(const gnote::NoteBase::List &)
+    {
+      update();
+    }
+
   void on_notebook_note_list_changed(const gnote::Note &, const gnote::notebooks::Notebook::Ptr &)
     {
       update();
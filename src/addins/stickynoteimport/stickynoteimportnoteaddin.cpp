@@ -238,6 +238,8 @@ void StickyNoteImportNoteAddin::import_notes(xmlDocPtr xml_doc,
   int numSuccessful = 0;
   const xmlChar * defaultTitle = (const xmlChar *)_("Untitled");
 
+  // report all imported notes at once
+  manager.begin_bulk_add();
   for(sharp::XmlNodeSet::const_iterator iter = nodes.begin();
       iter != nodes.end(); ++iter) {
 
@@ -263,6 +265,7 @@ void StickyNoteImportNoteAddin::import_notes(xmlDocPtr xml_doc,
       xmlFree(titleAttr);
     }
   }
+  manager.end_bulk_add();
 
   if (showResultsDialog) {
     show_results_dialog (numSuccessful, nodes.size());
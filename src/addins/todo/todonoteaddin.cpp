@@ -1,7 +1,7 @@
 /*
  * gnote
  *
- * Copyright (C) 2013,2017 Aurimas Cernius
+ * Copyright (C) 2013,2017,2019 Aurimas Cernius
  * Copyright (c) 2009 Romain Tartière <romain@blogreen.org>
  *
  * This program is free software: you can redistribute it and/or modify
@@ -19,12 +19,16 @@
  */
 
 
+#include "handlertiming.hpp"
 #include "todonoteaddin.hpp"
+#include "trie.hpp"
 
 
 namespace todo {
 
 static std::vector<Glib::ustring> s_todo_patterns;
+// keywords are the patterns followed by ':', payload is the tag name
+static gnote::TrieTree<Glib::ustring> s_todo_trie(true);
 
 TodoModule::TodoModule()
 {
@@ -32,6 +36,11 @@ TodoModule::TodoModule()
     s_todo_patterns.push_back("FIXME");
     s_todo_patterns.push_back("TODO");
     s_todo_patterns.push_back("XXX");
+
+    for(auto pattern : s_todo_patterns) {
+      s_todo_trie.add_keyword(pattern + ":", pattern);
+    }
+    s_todo_trie.compute_failure_graph();
   }
 
   ADD_INTERFACE_IMPL(Todo);
@@ -64,13 +73,18 @@ void Todo::on_note_opened()
   highlight_note();
 }
 
-void Todo::on_insert_text(const Gtk::TextIter & pos, const Glib::ustring & /*text*/, int /*bytes*/)
+void Todo::on_insert_text(const Gtk::TextIter & pos, const Glib::ustring & text, int /*bytes*/)
 {
-  highlight_region(pos, pos);
+  gnote::HandlerTimer timer("Todo::on_insert_text");
+  // pos is at the end of inserted text, which can span several lines when pasted
+  Gtk::TextIter start = pos;
+  start.backward_chars(text.size());
+  highlight_region(start, pos);
 }
 
 void Todo::on_delete_range(const Gtk::TextBuffer::iterator & start, const Gtk::TextBuffer::iterator & end)
 {
+  gnote::HandlerTimer timer("Todo::on_delete_range");
   highlight_region(start, end);
 }
 
@@ -91,19 +105,40 @@ void Todo::highlight_region(Gtk::TextIter start, Gtk::TextIter end)
     end.forward_line();
   }
 
+  // only touch tags, that are actually present in the region
   for(auto pattern : s_todo_patterns) {
-    highlight_region(pattern, start, end);
-  }    
+    Glib::RefPtr<Gtk::TextTag> tag = get_buffer()->get_tag_table()->lookup(pattern);
+    if(has_tag_in_region(tag, start, end)) {
+      get_buffer()->remove_tag(tag, start, end);
+    }
+  }
+
+  Glib::ustring text = start.get_slice(end);
+  // most of the edits and notes have no markers, skip searching them
+  if(text.find(':') == Glib::ustring::npos) {
+    return;
+  }
+
+  // single pass for all patterns; get_slice keeps offsets in sync with iterators
+  gnote::TrieHit<Glib::ustring>::ListPtr hits = s_todo_trie.find_matches(text);
+  int offset = start.get_offset();
+  for(auto hit : *hits) {
+    Gtk::TextIter region_start = get_buffer()->get_iter_at_offset(offset + hit->start());
+    Gtk::TextIter region_end = get_buffer()->get_iter_at_offset(offset + hit->end());
+    get_buffer()->apply_tag_by_name(hit->value(), region_start, region_end);
+  }
 }
 
-void Todo::highlight_region(const Glib::ustring & pattern, Gtk::TextIter start, Gtk::TextIter end)
+bool Todo::has_tag_in_region(const Glib::RefPtr<Gtk::TextTag> & tag, const Gtk::TextIter & start, const Gtk::TextIter & end)
 {
-  get_buffer()->remove_tag_by_name(pattern, start, end);
-  Gtk::TextIter region_start = start;
-  while(start.forward_search(pattern + ":", Gtk::TEXT_SEARCH_TEXT_ONLY, region_start, start, end)) {
-    Gtk::TextIter region_end = start;
-    get_buffer()->apply_tag_by_name(pattern, region_start, region_end);
+  if(!tag) {
+    return false;
+  }
+  if(start.has_tag(tag)) {
+    return true;
   }
+  Gtk::TextIter iter = start;
+  return iter.forward_to_tag_toggle(tag) && iter < end;
 }
 
 }
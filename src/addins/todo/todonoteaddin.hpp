@@ -1,7 +1,7 @@
 /*
  * gnote
  *
- * Copyright (C) 2013,2017 Aurimas Cernius
+ * Copyright (C) 2013,2017,2019 Aurimas Cernius
  * Copyright (c) 2009 Romain Tartière <romain@blogreen.org>
  *
  * This program is free software: you can redistribute it and/or modify
@@ -52,7 +52,7 @@ private:
   void on_delete_range(const Gtk::TextBuffer::iterator & start, const Gtk::TextBuffer::iterator & end);
   void highlight_note();
   void highlight_region(Gtk::TextIter start, Gtk::TextIter end);
-  void highlight_region(const Glib::ustring & pattern, Gtk::TextIter start, Gtk::TextIter end);
+  static bool has_tag_in_region(const Glib::RefPtr<Gtk::TextTag> & tag, const Gtk::TextIter & start, const Gtk::TextIter & end);
 };
 
 }
@@ -66,24 +66,18 @@ bool TomboyImportAddin::first_run(gnote::NoteManager & manager)
 {
   int to_import = 0;
   int imported = 0;
-  bool success;
+  bool success = false;
 
   DBG_OUT("import path is %s", m_tomboy_path.c_str());
 
   if(sharp::directory_exists(m_tomboy_path)) {
     std::vector<Glib::ustring> files = sharp::directory_get_files_with_ext(m_tomboy_path, ".note");
+    to_import = files.size();
 
-    for(auto file_path : files) {
-      to_import++;
-
-      gnote::NoteBase::Ptr note = manager.import_note(file_path);
-
-      if(note) {
-        DBG_OUT("success");
-        success = true;
-        imported++;
-      }
-    }
+    gnote::NoteBase::List notes = manager.import_notes(files);
+    imported = notes.size();
+    success = imported > 0;
+    DBG_OUT("imported %d of %d notes", imported, to_import);
   }
 
   return success;
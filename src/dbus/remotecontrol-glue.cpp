@@ -52,6 +52,8 @@ RemoteControl_adaptor::RemoteControl_adaptor(const Glib::RefPtr<Gio::DBus::Conne
   m_stubs["GetNoteContents"] = &RemoteControl_adaptor::GetNoteContents_stub;
   m_stubs["GetNoteContentsXml"] = &RemoteControl_adaptor::GetNoteContentsXml_stub;
   m_stubs["GetNoteCreateDate"] = &RemoteControl_adaptor::GetNoteCreateDate_stub;
+  m_stubs["GetNoteHistory"] = &RemoteControl_adaptor::GetNoteHistory_stub;
+  m_stubs["GetNoteHistoryVersion"] = &RemoteControl_adaptor::GetNoteHistoryVersion_stub;
   m_stubs["GetNoteTitle"] = &RemoteControl_adaptor::GetNoteTitle_stub;
   m_stubs["GetTagsForNote"] = &RemoteControl_adaptor::GetTagsForNote_stub;
   m_stubs["HideNote"] = &RemoteControl_adaptor::HideNote_stub;
@@ -222,6 +224,18 @@ Glib::VariantContainerBase RemoteControl_adaptor::GetNoteCreateDate_stub(const G
 }
 
 
+Glib::VariantContainerBase RemoteControl_adaptor::GetNoteHistory_stub(const Glib::VariantContainerBase & parameters)
+{
+  return stub_vectorint64_string(parameters, &RemoteControl_adaptor::GetNoteHistory);
+}
+
+
+Glib::VariantContainerBase RemoteControl_adaptor::GetNoteHistoryVersion_stub(const Glib::VariantContainerBase & parameters)
+{
+  return stub_string_string_int(parameters, &RemoteControl_adaptor::GetNoteHistoryVersion);
+}
+
+
 Glib::VariantContainerBase RemoteControl_adaptor::GetNoteTitle_stub(const Glib::VariantContainerBase & parameters)
 {
   return stub_string_string(parameters, &RemoteControl_adaptor::GetNoteTitle);
@@ -358,6 +372,36 @@ Glib::VariantContainerBase RemoteControl_adaptor::stub_string_string(const Glib:
 }
 
 
+Glib::VariantContainerBase RemoteControl_adaptor::stub_string_string_int(const Glib::VariantContainerBase & parameters,
+                                                                         string_string_int_func func)
+{
+  Glib::ustring result;
+  if(parameters.get_n_children() == 2) {
+    Glib::Variant<Glib::ustring> param1;
+    parameters.get_child(param1, 0);
+    Glib::Variant<gint32> param2;
+    parameters.get_child(param2, 1);
+    result = (this->*func)(param1.get(), param2.get());
+  }
+
+  return Glib::VariantContainerBase::create_tuple(Glib::Variant<Glib::ustring>::create(result));
+}
+
+
+Glib::VariantContainerBase RemoteControl_adaptor::stub_vectorint64_string(const Glib::VariantContainerBase & parameters,
+                                                                          vectorint64_string_func func)
+{
+  std::vector<gint64> result;
+  if(parameters.get_n_children() == 1) {
+    Glib::Variant<Glib::ustring> param;
+    parameters.get_child(param);
+    result = (this->*func)(param.get());
+  }
+
+  return Glib::VariantContainerBase::create_tuple(Glib::Variant<std::vector<gint64> >::create(result));
+}
+
+
 Glib::VariantContainerBase RemoteControl_adaptor::stub_vectorstring_void(const Glib::VariantContainerBase &,
                                                                          vectorstring_void_func func)
 {
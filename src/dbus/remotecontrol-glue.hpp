@@ -49,6 +49,8 @@ public:
   virtual Glib::ustring GetNoteContents(const Glib::ustring& uri) = 0;
   virtual Glib::ustring GetNoteContentsXml(const Glib::ustring& uri) = 0;
   virtual int32_t GetNoteCreateDate(const Glib::ustring& uri) = 0;
+  virtual std::vector<gint64> GetNoteHistory(const Glib::ustring& uri) = 0;
+  virtual Glib::ustring GetNoteHistoryVersion(const Glib::ustring& uri, const int32_t& index) = 0;
   virtual Glib::ustring GetNoteTitle(const Glib::ustring& uri) = 0;
   virtual std::vector<Glib::ustring> GetTagsForNote(const Glib::ustring& uri) = 0;
   virtual bool HideNote(const Glib::ustring& uri) = 0;
@@ -89,6 +91,8 @@ private:
   Glib::VariantContainerBase GetNoteContents_stub(const Glib::VariantContainerBase &);
   Glib::VariantContainerBase GetNoteContentsXml_stub(const Glib::VariantContainerBase &);
   Glib::VariantContainerBase GetNoteCreateDate_stub(const Glib::VariantContainerBase &);
+  Glib::VariantContainerBase GetNoteHistory_stub(const Glib::VariantContainerBase &);
+  Glib::VariantContainerBase GetNoteHistoryVersion_stub(const Glib::VariantContainerBase &);
   Glib::VariantContainerBase GetNoteTitle_stub(const Glib::VariantContainerBase &);
   Glib::VariantContainerBase GetTagsForNote_stub(const Glib::VariantContainerBase &);
   Glib::VariantContainerBase HideNote_stub(const Glib::VariantContainerBase &);
@@ -111,6 +115,10 @@ private:
   Glib::VariantContainerBase stub_int_string(const Glib::VariantContainerBase &, int_string_func);
   typedef Glib::ustring (RemoteControl_adaptor::*string_string_func)(const Glib::ustring &);
   Glib::VariantContainerBase stub_string_string(const Glib::VariantContainerBase &, string_string_func);
+  typedef Glib::ustring (RemoteControl_adaptor::*string_string_int_func)(const Glib::ustring &, const int32_t &);
+  Glib::VariantContainerBase stub_string_string_int(const Glib::VariantContainerBase &, string_string_int_func);
+  typedef std::vector<gint64> (RemoteControl_adaptor::*vectorint64_string_func)(const Glib::ustring &);
+  Glib::VariantContainerBase stub_vectorint64_string(const Glib::VariantContainerBase &, vectorint64_string_func);
   typedef std::vector<Glib::ustring> (RemoteControl_adaptor::*vectorstring_void_func)();
   Glib::VariantContainerBase stub_vectorstring_void(const Glib::VariantContainerBase &, vectorstring_void_func);
   typedef std::vector<Glib::ustring> (RemoteControl_adaptor::*vectorstring_string_func)(const Glib::ustring &);
@@ -45,6 +45,8 @@ namespace gnote {
     DBG_OUT("initialized remote control");
     m_manager.signal_note_added.connect(
       sigc::mem_fun(*this, &RemoteControl::on_note_added));
+    m_manager.signal_notes_added.connect(
+      sigc::mem_fun(*this, &RemoteControl::on_notes_added));
     m_manager.signal_note_deleted.connect(
       sigc::mem_fun(*this, &RemoteControl::on_note_deleted));
     m_manager.signal_note_saved.connect(
@@ -225,6 +227,28 @@ namespace gnote {
   }
 
 
+  std::vector<gint64> RemoteControl::GetNoteHistory(const Glib::ustring& uri)
+  {
+    std::vector<gint64> times;
+    NoteBase::Ptr note = m_manager.find_by_uri(uri);
+    if (!note)
+      return times;
+    for(gint64 time : m_manager.history().list(note->id())) {
+      times.push_back(time / G_USEC_PER_SEC);
+    }
+    return times;
+  }
+
+
+  Glib::ustring RemoteControl::GetNoteHistoryVersion(const Glib::ustring& uri, const int32_t& index)
+  {
+    NoteBase::Ptr note = m_manager.find_by_uri(uri);
+    if (!note || index < 0)
+      return "";
+    return m_manager.history().read(note->id(), index);
+  }
+
+
   Glib::ustring RemoteControl::GetNoteTitle(const Glib::ustring& uri)
   {
     NoteBase::Ptr note = m_manager.find_by_uri(uri);
@@ -372,6 +396,14 @@ void RemoteControl::on_note_added(const NoteBase::Ptr & note)
 }
 
 
+void RemoteControl::on_notes_added(const NoteBase::List & notes)
+{
+  for(const NoteBase::Ptr & note : notes) {
+    on_note_added(note);
+  }
+}
+
+
 void RemoteControl::on_note_deleted(const NoteBase::Ptr & note)
 {
   if(note) {
@@ -58,6 +58,8 @@ public:
   virtual Glib::ustring GetNoteContents(const Glib::ustring& uri) override;
   virtual Glib::ustring GetNoteContentsXml(const Glib::ustring& uri) override;
   virtual int32_t GetNoteCreateDate(const Glib::ustring& uri) override;
+  virtual std::vector<gint64> GetNoteHistory(const Glib::ustring& uri) override;
+  virtual Glib::ustring GetNoteHistoryVersion(const Glib::ustring& uri, const int32_t& index) override;
   virtual Glib::ustring GetNoteTitle(const Glib::ustring& uri) override;
   virtual std::vector<Glib::ustring> GetTagsForNote(const Glib::ustring& uri) override;
   virtual bool HideNote(const Glib::ustring& uri) override;
@@ -72,6 +74,7 @@ public:
 
 private:
   void on_note_added(const NoteBase::Ptr &);
+  void on_notes_added(const NoteBase::List &);
   void on_note_deleted(const NoteBase::Ptr &);
   void on_note_saved(const NoteBase::Ptr &);
   MainWindow & present_note(const NoteBase::Ptr &);
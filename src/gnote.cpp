@@ -41,6 +41,7 @@
 #include "addinmanager.hpp"
 #include "applicationaddin.hpp"
 #include "debug.hpp"
+#include "handlertiming.hpp"
 #include "notemanager.hpp"
 #include "notewindow.hpp"
 #include "preferencesdialog.hpp"
@@ -94,6 +95,9 @@ namespace gnote {
 
     int retval = run(argc, argv);
     signal_quit();
+    if(HandlerTiming::enabled()) {
+      HandlerTiming::print_stats();
+    }
     return retval;
   }
 
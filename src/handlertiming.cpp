@@ -0,0 +1,131 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "handlertiming.hpp"
+
+
+namespace gnote {
+
+namespace {
+
+// samples kept per handler, older ones are overwritten
+const size_t MAX_SAMPLES = 100000;
+
+struct Samples
+{
+  Samples()
+    : count(0)
+    , total(0)
+    {}
+  std::vector<gint64> times;
+  size_t count;
+  gint64 total;
+};
+
+std::mutex s_lock;
+std::map<std::string, Samples> s_samples;
+
+double percentile(const std::vector<gint64> & sorted, double p)
+{
+  size_t index = size_t(p * sorted.size());
+  if(index >= sorted.size()) {
+    index = sorted.size() - 1;
+  }
+  return sorted[index] / 1000.0;
+}
+
+}
+
+
+bool HandlerTiming::s_enabled = getenv("GNOTE_HANDLER_TIMING") != NULL;
+
+
+void HandlerTiming::enable(bool enabled)
+{
+  s_enabled = enabled;
+}
+
+
+void HandlerTiming::record(const char *handler, gint64 usec)
+{
+  std::lock_guard<std::mutex> lock(s_lock);
+  Samples & samples = s_samples[handler];
+  if(samples.times.size() < MAX_SAMPLES) {
+    samples.times.push_back(usec);
+  }
+  else {
+    samples.times[samples.count % MAX_SAMPLES] = usec;
+  }
+  ++samples.count;
+  samples.total += usec;
+}
+
+
+std::vector<HandlerTiming::Stats> HandlerTiming::stats()
+{
+  std::vector<Stats> result;
+  std::lock_guard<std::mutex> lock(s_lock);
+  for(auto & handler : s_samples) {
+    if(handler.second.times.empty()) {
+      continue;
+    }
+    std::vector<gint64> sorted(handler.second.times);
+    std::sort(sorted.begin(), sorted.end());
+    Stats stats;
+    stats.handler = handler.first;
+    stats.count = handler.second.count;
+    stats.p50 = percentile(sorted, 0.5);
+    stats.p99 = percentile(sorted, 0.99);
+    stats.max = sorted.back() / 1000.0;
+    stats.total = handler.second.total / 1000.0;
+    result.push_back(stats);
+  }
+  // the most expensive first
+  std::sort(result.begin(), result.end(), [](const Stats & a, const Stats & b) { return a.total > b.total; });
+  return result;
+}
+
+
+void HandlerTiming::reset()
+{
+  std::lock_guard<std::mutex> lock(s_lock);
+  s_samples.clear();
+}
+
+
+void HandlerTiming::print_stats()
+{
+  fprintf(stderr, "%-50s %8s %10s %10s %10s %12s\n", "handler", "calls", "p50 ms", "p99 ms", "max ms", "total ms");
+  for(const Stats & stats : HandlerTiming::stats()) {
+    fprintf(stderr, "%-50s %8zu %10.3f %10.3f %10.3f %12.1f\n", stats.handler.c_str(), stats.count,
+            stats.p50, stats.p99, stats.max, stats.total);
+  }
+}
+
+}
@@ -0,0 +1,88 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef _HANDLERTIMING_HPP_
+#define _HANDLERTIMING_HPP_
+
+#include <vector>
+
+#include <glib.h>
+#include <glibmm/ustring.h>
+
+#include "noncopyable.hpp"
+
+
+namespace gnote {
+
+// Collects the time spent in buffer signal handlers, to find out what makes
+// editing large notes slow. Off unless GNOTE_HANDLER_TIMING is set in the
+// environment, in which case a summary is printed when gnote exits.
+class HandlerTiming
+{
+public:
+  struct Stats
+  {
+    Glib::ustring handler;
+    size_t count;
+    // times in milliseconds
+    double p50;
+    double p99;
+    double max;
+    double total;
+  };
+
+  static bool enabled()
+    {
+      return s_enabled;
+    }
+  static void enable(bool enabled);
+  static void record(const char *handler, gint64 usec);
+  static std::vector<Stats> stats();
+  static void reset();
+  static void print_stats();
+private:
+  static bool s_enabled;
+};
+
+
+// Records the time until it goes out of scope, put at the start of a handler
+class HandlerTimer
+  : public NonCopyable
+{
+public:
+  explicit HandlerTimer(const char *handler)
+    : m_handler(HandlerTiming::enabled() ? handler : NULL)
+    , m_start(m_handler ? g_get_monotonic_time() : 0)
+    {}
+  ~HandlerTimer()
+    {
+      if(m_handler) {
+        HandlerTiming::record(m_handler, g_get_monotonic_time() - m_start);
+      }
+    }
+private:
+  const char *m_handler;
+  gint64 m_start;
+};
+
+}
+
+#endif
@@ -24,6 +24,10 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+#include <uuid.h>
+#include <algorithm>
+
 #include <glibmm/i18n.h>
 #include <gtkmm/button.h>
 #include <gtkmm/stock.h>
@@ -36,9 +40,11 @@
 #include "notewindow.hpp"
 #include "utils.hpp"
 #include "debug.hpp"
+#include "handlertiming.hpp"
 #include "notebooks/notebookmanager.hpp"
 #include "sharp/exception.hpp"
 #include "sharp/fileinfo.hpp"
+#include "sharp/files.hpp"
 #include "sharp/string.hpp"
 
 
@@ -89,21 +95,14 @@ namespace gnote {
   }
 
   namespace {
-    
-    void show_io_error_dialog (Gtk::Window * parent)
+
+    // Packed storage has no file per note, make up a date then.
+    sharp::DateTime file_date(const Glib::ustring & filepath)
     {
-      utils::HIGMessageDialog dialog(
-                              parent,
-                              GTK_DIALOG_DESTROY_WITH_PARENT,
-                              Gtk::MESSAGE_ERROR,
-                              Gtk::BUTTONS_OK,
-                              _("Error saving note data."),
-                              _("An error occurred while saving your notes. "
-                                "Please check that you have sufficient disk "
-                                "space, and that you have appropriate rights "
-                                "on ~/.local/share/gnote. Error details can be found in "
-                                "~/.gnote.log."));
-      dialog.run();
+      if(sharp::file_exists(filepath)) {
+        return sharp::DateTime(sharp::file_modification_time(filepath));
+      }
+      return sharp::DateTime::now();
     }
 
     void place_cursor_and_selection(const NoteData & data, const Glib::RefPtr<NoteBuffer> & buffer)
@@ -134,13 +133,133 @@ namespace gnote {
 
   const int  NoteData::s_noPosition = -1;
 
+  namespace {
+    const char NOTE_URI_PREFIX[] = "note://gnote/";
+    const gsize NOTE_URI_PREFIX_LEN = sizeof(NOTE_URI_PREFIX) - 1;
+    const gint64 INVALID_DATE = G_MININT64;
+
+    // Parse the GUID part of a note URI, accepting only the canonical
+    // lowercase form, so that the URI can be rebuilt byte for byte.
+    bool parse_note_uri(const Glib::ustring & uri, uuid_t guid)
+    {
+      const std::string & raw = uri.raw();
+      if(raw.size() != NOTE_URI_PREFIX_LEN + 36 || raw.compare(0, NOTE_URI_PREFIX_LEN, NOTE_URI_PREFIX) != 0) {
+        return false;
+      }
+      const char *guid_str = raw.c_str() + NOTE_URI_PREFIX_LEN;
+      if(uuid_parse(guid_str, guid) != 0) {
+        return false;
+      }
+      char out[37];
+      uuid_unparse_lower(guid, out);
+      return strcmp(out, guid_str) == 0;
+    }
+  }
+
+  bool NoteData::TagSet::contains(const Glib::ustring & normalized_name) const
+  {
+    auto iter = lower_bound(normalized_name);
+    return iter != m_tags.end() && (*iter)->normalized_name() == normalized_name;
+  }
+
+  bool NoteData::TagSet::insert(const Tag::Ptr & tag)
+  {
+    auto iter = lower_bound(tag->normalized_name());
+    if(iter != m_tags.end() && (*iter)->normalized_name() == tag->normalized_name()) {
+      return false;
+    }
+    m_tags.insert(m_tags.begin() + (iter - m_tags.begin()), tag);
+    return true;
+  }
+
+  bool NoteData::TagSet::erase(const Glib::ustring & normalized_name)
+  {
+    auto iter = lower_bound(normalized_name);
+    if(iter == m_tags.end() || (*iter)->normalized_name() != normalized_name) {
+      return false;
+    }
+    m_tags.erase(m_tags.begin() + (iter - m_tags.begin()));
+    return true;
+  }
+
+  std::vector<Tag::Ptr>::const_iterator NoteData::TagSet::lower_bound(const Glib::ustring & normalized_name) const
+  {
+    return std::lower_bound(m_tags.begin(), m_tags.end(), normalized_name,
+      [](const Tag::Ptr & tag, const Glib::ustring & name) { return tag->normalized_name() < name; });
+  }
+
+
   NoteData::NoteData(const Glib::ustring & _uri)
-    : m_uri(_uri)
+    : m_create_date(INVALID_DATE)
+    , m_change_date(INVALID_DATE)
+    , m_metadata_change_date(INVALID_DATE)
     , m_cursor_pos(s_noPosition)
     , m_selection_bound_pos(s_noPosition)
     , m_width(0)
     , m_height(0)
   {
+    if(!parse_note_uri(_uri, m_guid)) {
+      uuid_clear(m_guid);
+      m_foreign_uri.reset(new Glib::ustring(_uri));
+    }
+  }
+
+  NoteData::NoteData(const NoteData & other)
+    : m_foreign_uri(other.m_foreign_uri ? new Glib::ustring(*other.m_foreign_uri) : NULL)
+    , m_title(other.m_title)
+    , m_text(other.m_text)
+    , m_create_date(other.m_create_date)
+    , m_change_date(other.m_change_date)
+    , m_metadata_change_date(other.m_metadata_change_date)
+    , m_cursor_pos(other.m_cursor_pos)
+    , m_selection_bound_pos(other.m_selection_bound_pos)
+    , m_width(other.m_width)
+    , m_height(other.m_height)
+    , m_tags(other.m_tags)
+  {
+    memcpy(m_guid, other.m_guid, sizeof(m_guid));
+  }
+
+  Glib::ustring NoteData::uri() const
+  {
+    if(m_foreign_uri) {
+      return *m_foreign_uri;
+    }
+    char out[NOTE_URI_PREFIX_LEN + 37];
+    strcpy(out, NOTE_URI_PREFIX);
+    uuid_unparse_lower(m_guid, out + NOTE_URI_PREFIX_LEN);
+    return out;
+  }
+
+  bool NoteData::has_uri(const Glib::ustring & _uri) const
+  {
+    if(m_foreign_uri) {
+      return *m_foreign_uri == _uri;
+    }
+    uuid_t guid;
+    return parse_note_uri(_uri, guid) && uuid_compare(guid, m_guid) == 0;
+  }
+
+  gint64 NoteData::pack_date(const sharp::DateTime & date)
+  {
+    if(!date.is_valid()) {
+      return INVALID_DATE;
+    }
+    return gint64(date.sec()) * G_USEC_PER_SEC + date.usec();
+  }
+
+  sharp::DateTime NoteData::unpack_date(gint64 date)
+  {
+    if(date == INVALID_DATE) {
+      return sharp::DateTime();
+    }
+    gint64 sec = date / G_USEC_PER_SEC;
+    gint64 usec = date % G_USEC_PER_SEC;
+    if(usec < 0) {
+      --sec;
+      usec += G_USEC_PER_SEC;
+    }
+    return sharp::DateTime(time_t(sec), glong(usec));
   }
 
 
@@ -158,14 +277,55 @@ namespace gnote {
     return (m_width != 0) && (m_height != 0);
   }
 
+  guint64 NoteData::content_hash() const
+  {
+    // FNV-1a over everything that goes into the note file
+    guint64 hash = 14695981039346656037ULL;
+    auto add = [&hash](const void *data, size_t length) {
+      const guchar *bytes = static_cast<const guchar*>(data);
+      for(size_t i = 0; i < length; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+      }
+    };
+    auto add_string = [&add](const Glib::ustring & str) {
+      add(str.data(), str.bytes() + 1);
+    };
+
+    add_string(m_title);
+    add_string(m_text);
+    add(&m_create_date, sizeof(m_create_date));
+    add(&m_change_date, sizeof(m_change_date));
+    add(&m_metadata_change_date, sizeof(m_metadata_change_date));
+    add(&m_cursor_pos, sizeof(m_cursor_pos));
+    add(&m_selection_bound_pos, sizeof(m_selection_bound_pos));
+    add(&m_width, sizeof(m_width));
+    add(&m_height, sizeof(m_height));
+    for(const Tag::Ptr & tag : m_tags) {
+      add_string(tag->name());
+    }
+    return hash;
+  }
+
   void NoteDataBufferSynchronizer::set_buffer(const Glib::RefPtr<NoteBuffer> & b)
   {
+    for(sigc::connection & cid : m_buffer_cids) {
+      cid.disconnect();
+    }
+    m_buffer_cids.clear();
+    m_serializer.reset();
     m_buffer = b;
-    m_buffer->signal_changed().connect(sigc::mem_fun(*this, &NoteDataBufferSynchronizer::buffer_changed));
-    m_buffer->signal_apply_tag()
-      .connect(sigc::mem_fun(*this, &NoteDataBufferSynchronizer::buffer_tag_applied));
-    m_buffer->signal_remove_tag()
-      .connect(sigc::mem_fun(*this, &NoteDataBufferSynchronizer::buffer_tag_removed));
+    if(!m_buffer) {
+      return;
+    }
+
+    m_serializer.reset(new NoteBufferSerializer(m_buffer));
+
+    m_buffer_cids.push_back(m_buffer->signal_changed()
+      .connect(sigc::mem_fun(*this, &NoteDataBufferSynchronizer::buffer_changed)));
+    m_buffer_cids.push_back(m_buffer->signal_apply_tag()
+      .connect(sigc::mem_fun(*this, &NoteDataBufferSynchronizer::buffer_tag_applied)));
+    m_buffer_cids.push_back(m_buffer->signal_remove_tag()
+      .connect(sigc::mem_fun(*this, &NoteDataBufferSynchronizer::buffer_tag_removed)));
 
     synchronize_buffer();
 
@@ -197,7 +357,11 @@ namespace gnote {
   void NoteDataBufferSynchronizer::synchronize_text() const
   {
     if(is_text_invalid() && m_buffer) {
-      const_cast<NoteData&>(data()).text() = NoteBufferArchiver::serialize(m_buffer);
+      HandlerTimer timer("NoteDataBufferSynchronizer::synchronize_text");
+      // serialize straight into note text, avoiding a copy of the whole note
+      sharp::XmlWriter xml(&const_cast<NoteData&>(data()).text());
+      m_serializer->serialize(xml);
+      xml.close();
     }
   }
 
@@ -213,12 +377,16 @@ namespace gnote {
       NoteBufferArchiver::deserialize (m_buffer,
                                        m_buffer->begin(),
                                        data().text());
+      // the whole buffer was replaced, nothing cached is of use
+      m_serializer->invalidate();
       m_buffer->set_modified(false);
 
       place_cursor_and_selection(data(), m_buffer);
 
       // New events should create Undo actions
       m_buffer->undoer().thaw_undo ();
+      // and the old ones refer to the text that is gone
+      m_buffer->undoer().clear_undo_history();
     }
   }
 
@@ -245,7 +413,7 @@ namespace gnote {
     }
   }
 
-  Note::Note(NoteData * _data, const Glib::ustring & filepath, NoteManager & _manager)
+  Note::Note(NoteData * _data, const Glib::ustring & filepath, NoteManagerBase & _manager)
     : NoteBase(_data, filepath, _manager)
     , m_data(_data)
     , m_save_needed(false)
@@ -253,11 +421,11 @@ namespace gnote {
     , m_note_window_embedded(false)
     , m_focus_widget(NULL)
     , m_window(NULL)
+    , m_buffer_holds(0)
     , m_tag_table(NULL)
   {
-    for(NoteData::TagMap::const_iterator iter = _data->tags().begin();
-        iter != _data->tags().end(); ++iter) {
-      add_tag(iter->second);
+    for(const Tag::Ptr & tag : _data->tags()) {
+      add_tag(tag);
     }
     m_save_timeout = new utils::InterruptableTimeout();
     m_save_timeout->signal_timeout.connect(sigc::mem_fun(*this, &Note::on_save_timeout));
@@ -286,12 +454,12 @@ namespace gnote {
   /// </returns>
   Note::Ptr Note::create_new_note(const Glib::ustring & title,
                                   const Glib::ustring & filename,
-                                  NoteManager & manager)
+                                  NoteManagerBase & manager)
   {
     NoteData * note_data = new NoteData(url_from_path(filename));
     note_data->title() = title;
     sharp::DateTime date(sharp::DateTime::now());
-    note_data->create_date() = date;
+    note_data->set_create_date(date);
     note_data->set_change_date(date);
       
     return Note::Ptr(new Note(note_data, filename, manager));
@@ -299,19 +467,17 @@ namespace gnote {
 
   Note::Ptr Note::create_existing_note(NoteData *data,
                                  Glib::ustring filepath,
-                                 NoteManager & manager)
+                                 NoteManagerBase & manager)
   {
     if (!data->change_date().is_valid()) {
-      sharp::DateTime d(sharp::file_modification_time(filepath));
-      data->set_change_date(d);
+      data->set_change_date(file_date(filepath));
     }
     if (!data->create_date().is_valid()) {
       if(data->change_date().is_valid()) {
-        data->create_date() = data->change_date();
+        data->set_create_date(data->change_date());
       }
       else {
-        sharp::DateTime d(sharp::file_modification_time(filepath));
-        data->create_date() = d;
+        data->set_create_date(file_date(filepath));
       }
     }
     return Note::Ptr(new Note(data, filepath, manager));
@@ -321,11 +487,18 @@ namespace gnote {
   {
     m_is_deleting = true;
     m_save_timeout->cancel ();
+    manager().buffer_cache().remove(*this);
+    if(m_buffer) {
+      m_buffer->undoer().close_history();
+    }
+    Glib::ustring undo_history = manager().undo_history_path(*this);
+    if(sharp::file_exists(undo_history)) {
+      sharp::file_delete(undo_history);
+    }
     
     // Remove the note from all the tags
-    for(NoteData::TagMap::const_iterator iter = m_data.data().tags().begin();
-        iter != m_data.data().tags().end(); ++iter) {
-      remove_tag(iter->second);
+    for(const Tag::Ptr & tag : m_data.data().tags()) {
+      remove_tag(tag);
     }
 
     if (m_window) {
@@ -339,6 +512,7 @@ namespace gnote {
       }
       delete m_window; 
       m_window = NULL;
+      unhold_buffer();
     }
       
     // Remove note URI from GConf entry menu_pinned_notes
@@ -349,8 +523,16 @@ namespace gnote {
   Note::Ptr Note::load(const Glib::ustring & read_file, NoteManager & manager)
   {
     NoteData *data = new NoteData(url_from_path(read_file));
-    NoteArchiver::read(read_file, *data);
-    return create_existing_note(data, read_file, manager);
+    Glib::ustring version = manager.storage().read(read_file, *data);
+    Note::Ptr note = create_existing_note(data, read_file, manager);
+    if(version == NoteArchiver::CURRENT_VERSION) {
+      note->mark_saved();
+    }
+    else {
+      DBG_OUT("Note %s has format %s, will be updated", read_file.c_str(), version.c_str());
+      manager.queue_format_update(note);
+    }
+    return note;
   }
 
   
@@ -366,23 +548,46 @@ namespace gnote {
     if (!m_save_needed)
       return;
 
-    DBG_OUT("Saving '%s'...", m_data.data().title().c_str());
-
-    try {
-      NoteArchiver::write(file_path(), m_data.synchronized_data());
-    } 
-    catch (const sharp::Exception & e) {
-      // Probably IOException or UnauthorizedAccessException?
-      ERR_OUT(_("Exception while saving note: %s"), e.what());
-      show_io_error_dialog(dynamic_cast<Gtk::Window*>(m_window->host()));
+    // Buffer signals report changes that often leave the note as it was,
+    // e.g. re-applied tags, so check before writing and bumping the dates.
+    NoteData & data(m_data.synchronized_data());
+    if(!needs_write(data, true)) {
+      DBG_OUT("Note '%s' unchanged, not saving", data.title().c_str());
+      manager().count_save(false);
+      return;
     }
 
+    DBG_OUT("Saving '%s'...", data.title().c_str());
+    manager().count_save(true);
+
+    // Writing is done by the save queue thread, hand it a copy
+    manager().save_queue().enqueue(file_path(), new NoteData(data));
+
     signal_saved(shared_from_this());
   }
 
+  void Note::write_failed()
+  {
+    NoteBase::write_failed();
+    if(!m_is_deleting) {
+      // write again on next save, at the latest when quitting
+      m_save_needed = true;
+    }
+  }
+
+  void Note::rewrite()
+  {
+    if(m_is_deleting) {
+      return;
+    }
+    manager().save_queue().enqueue(file_path(), new NoteData(m_data.synchronized_data()));
+    mark_saved();
+  }
+
   
   void Note::on_buffer_changed()
   {
+    HandlerTimer timer("Note::on_buffer_changed");
     DBG_OUT("on_buffer_changed queuein save");
     queue_save(CONTENT_CHANGED);
   }
@@ -391,6 +596,7 @@ namespace gnote {
                                    const Gtk::TextBuffer::iterator &, 
                                    const Gtk::TextBuffer::iterator &)
   {
+    HandlerTimer timer("Note::on_buffer_tag_applied");
     if(NoteTagTable::tag_is_serializable(tag)) {
       DBG_OUT("BufferTagApplied queueing save: %s", tag->property_name().get_value().c_str());
       queue_save(get_tag_table()->get_change_type(tag));
@@ -401,6 +607,7 @@ namespace gnote {
                                    const Gtk::TextBuffer::iterator &,
                                    const Gtk::TextBuffer::iterator &)
   {
+    HandlerTimer timer("Note::on_buffer_tag_removed");
     if(NoteTagTable::tag_is_serializable(tag)) {
       DBG_OUT("BufferTagRemoved queueing save: %s", tag->property_name().get_value().c_str());
       queue_save(get_tag_table()->get_change_type(tag));
@@ -442,6 +649,10 @@ namespace gnote {
   bool Note::on_window_destroyed(GdkEventAny * /*ev*/)
   {
     m_window = NULL;
+    unhold_buffer();
+    if(m_buffer) {
+      manager().buffer_cache().touch(*this);
+    }
     return false;
   }
 
@@ -459,6 +670,7 @@ namespace gnote {
 
   void Note::on_save_timeout()
   {
+    HandlerTimer timer("Note::on_save_timeout");
     try {
       save();
       m_save_needed = false;
@@ -472,14 +684,12 @@ namespace gnote {
   void Note::remove_tag(Tag & tag)
   {
     Glib::ustring tag_name = tag.normalized_name();
-    NoteData::TagMap & thetags(m_data.data().tags());
-    NoteData::TagMap::iterator iter;
+    NoteData::TagSet & thetags(m_data.data().tags());
 
     // if we are deleting the note, no need to check for the tag, we 
     // know it is there.
     if(!m_is_deleting) {
-      iter = thetags.find(tag_name);
-      if (iter == thetags.end())  {
+      if(!thetags.contains(tag_name)) {
         return;
       }
     }
@@ -490,7 +700,7 @@ namespace gnote {
     // This will invalidate the iterator.
     // see bug 579839.
     if(!m_is_deleting) {
-      thetags.erase(iter);
+      thetags.erase(tag_name);
     }
     tag.remove_note(*this);
 
@@ -533,6 +743,7 @@ namespace gnote {
 
       Glib::ustring old_title = m_data.data().title();
       m_data.data().title() = new_title;
+      manager().note_title_changed(shared_from_this());
 
       if (from_user_action) {
         process_rename_link_update(old_title);
@@ -711,27 +922,73 @@ namespace gnote {
     if(!m_buffer) {
       DBG_OUT("Creating buffer for %s", m_data.data().title().c_str());
       m_buffer = NoteBuffer::create(get_tag_table(), *this);
+      m_buffer->undoer().set_memory_limit(manager().undo_memory_limit());
       m_data.set_buffer(m_buffer);
-
-      m_buffer->signal_changed().connect(
-        sigc::mem_fun(*this, &Note::on_buffer_changed));
-      m_buffer->signal_apply_tag().connect(
-        sigc::mem_fun(*this, &Note::on_buffer_tag_applied));
-      m_buffer->signal_remove_tag().connect(
-        sigc::mem_fun(*this, &Note::on_buffer_tag_removed));
+      // after the text is loaded, the saved history only applies to the same text
+      m_buffer->undoer().set_history_file(manager().undo_history_path(*this));
+
+      m_buffer_cids.push_back(m_buffer->signal_changed().connect(
+        sigc::mem_fun(*this, &Note::on_buffer_changed)));
+      m_buffer_cids.push_back(m_buffer->signal_apply_tag().connect(
+        sigc::mem_fun(*this, &Note::on_buffer_tag_applied)));
+      m_buffer_cids.push_back(m_buffer->signal_remove_tag().connect(
+        sigc::mem_fun(*this, &Note::on_buffer_tag_removed)));
       m_mark_set_conn = m_buffer->signal_mark_set().connect(
         sigc::mem_fun(*this, &Note::on_buffer_mark_set));
       m_mark_deleted_conn = m_buffer->signal_mark_deleted().connect(
         sigc::mem_fun(*this, &Note::on_buffer_mark_deleted));
     }
+    // open note can not be released, it is marked used when window goes away
+    if(!m_window) {
+      manager().buffer_cache().touch(*this);
+    }
     return m_buffer;
   }
 
+  void Note::unhold_buffer()
+  {
+    if(m_buffer_holds > 0) {
+      --m_buffer_holds;
+    }
+    else {
+      ERR_OUT("Note buffer released more times than held: %s", m_data.data().title().c_str());
+    }
+  }
+
+  bool Note::release_buffer()
+  {
+    // Once note is shown, addins and editor use the buffer
+    if(!m_buffer || m_buffer_holds > 0 || m_note_window_embedded || m_is_deleting
+       || !m_child_widget_queue.empty()) {
+      return false;
+    }
+    // changes are released after they are written
+    if(m_save_needed) {
+      return false;
+    }
+
+    DBG_OUT("Releasing buffer for %s, undo history used %u bytes", m_data.data().title().c_str(),
+            (unsigned) m_buffer->undoer().get_memory_size());
+    // serialize buffer content to note data
+    m_data.synchronized_data();
+    m_data.set_buffer(Glib::RefPtr<NoteBuffer>());
+    for(sigc::connection & cid : m_buffer_cids) {
+      cid.disconnect();
+    }
+    m_buffer_cids.clear();
+    m_mark_set_conn.disconnect();
+    m_mark_deleted_conn.disconnect();
+    m_buffer->undoer().save_history();
+    m_buffer.reset();
+    return true;
+  }
+
 
   NoteWindow * Note::create_window()
   {
     if(!m_window) {
       m_window = new NoteWindow(*this);
+      hold_buffer();
       m_window->signal_delete_event().connect(
         sigc::mem_fun(*this, &Note::on_window_destroyed));
 
@@ -82,6 +82,10 @@ private:
                           const Gtk::TextBuffer::iterator &);
 
   Glib::RefPtr<NoteBuffer> m_buffer;
+  // keeps serialized blocks of the buffer, so that saving a long note after
+  // a small change does not serialize all of it
+  std::unique_ptr<NoteBufferSerializer> m_serializer;
+  std::vector<sigc::connection> m_buffer_cids;
 };
 
 
@@ -98,15 +102,18 @@ public:
 
   static Note::Ptr create_new_note(const Glib::ustring & title,
                                    const Glib::ustring & filename,
-                                   NoteManager & manager);
+                                   NoteManagerBase & manager);
 
   static Note::Ptr create_existing_note(NoteData *data,
                                         Glib::ustring filepath,
-                                        NoteManager & manager);
+                                        NoteManagerBase & manager);
   virtual void delete_note() override;
   static Note::Ptr load(const Glib::ustring &, NoteManager &);
   virtual void save() override;
   virtual void queue_save(ChangeType c) override;
+  virtual void write_failed() override;
+  // Write note even if it has not changed, e.g. to update file format.
+  void rewrite();
   using NoteBase::remove_tag;
   virtual void remove_tag(Tag &) override;
   void add_child_widget(const Glib::RefPtr<Gtk::TextChildAnchor> & child_anchor,
@@ -125,6 +132,24 @@ public:
       return (bool)m_buffer;
     }
   const Glib::RefPtr<NoteBuffer> & get_buffer();
+  // Existing buffer, if any, without creating it or counting as a use.
+  const Glib::RefPtr<NoteBuffer> & buffer() const
+    {
+      return m_buffer;
+    }
+  // Keep the buffer, while it is used outside of note, e.g. across idle callbacks.
+  // Open window holds it too.
+  void hold_buffer()
+    {
+      ++m_buffer_holds;
+    }
+  void unhold_buffer();
+  // Store buffer content in note data and free the buffer, if note is not in use.
+  bool release_buffer();
+  int buffer_char_count() const
+    {
+      return m_buffer ? m_buffer->get_char_count() : 0;
+    }
   bool has_window() const 
     { 
       return (m_window != NULL); 
@@ -182,7 +207,7 @@ private:
   void on_note_window_embedded();
   void on_note_window_foregrounded();
 
-  Note(NoteData * data, const Glib::ustring & filepath, NoteManager & manager);
+  Note(NoteData * data, const Glib::ustring & filepath, NoteManagerBase & manager);
 
   struct ChildWidgetData
   {
@@ -204,6 +229,7 @@ private:
   Gtk::Widget               *m_focus_widget;
   NoteWindow                *m_window;
   Glib::RefPtr<NoteBuffer>   m_buffer;
+  int                        m_buffer_holds;
   Glib::RefPtr<NoteTagTable> m_tag_table;
 
   utils::InterruptableTimeout *m_save_timeout;
@@ -213,6 +239,7 @@ private:
 
   sigc::connection m_mark_set_conn;
   sigc::connection m_mark_deleted_conn;
+  std::vector<sigc::connection> m_buffer_cids;
 };
 
 namespace noteutils {
@@ -0,0 +1,370 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <glibmm/fileutils.h>
+#include <glibmm/i18n.h>
+#include <glibmm/miscutils.h>
+
+#include "debug.hpp"
+#include "notebackupstore.hpp"
+#include "notebase.hpp"
+#include "sharp/directory.hpp"
+#include "sharp/exception.hpp"
+#include "sharp/files.hpp"
+
+
+namespace gnote {
+
+namespace {
+
+const char INDEX_FILE_NAME[] = "index";
+const char OBJECTS_DIR_NAME[] = "objects";
+const char OBJECT_EXTENSION[] = ".gz";
+
+// runs all of data through a zlib converter
+std::string convert(GConverter *converter, const char *data, size_t length)
+{
+  std::string result;
+  char buffer[16384];
+  GConverterResult res;
+  do {
+    gsize bytes_read = 0, bytes_written = 0;
+    GError *error = NULL;
+    res = g_converter_convert(converter, data, length, buffer, sizeof(buffer), G_CONVERTER_INPUT_AT_END,
+                              &bytes_read, &bytes_written, &error);
+    if(res == G_CONVERTER_ERROR) {
+      Glib::ustring message = error->message;
+      g_error_free(error);
+      throw sharp::Exception(message);
+    }
+    data += bytes_read;
+    length -= bytes_read;
+    result.append(buffer, bytes_written);
+  }
+  while(res != G_CONVERTER_FINISHED);
+  return result;
+}
+
+std::string compress(const std::string & data)
+{
+  GZlibCompressor *compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+  try {
+    std::string result = convert(G_CONVERTER(compressor), data.data(), data.size());
+    g_object_unref(compressor);
+    return result;
+  }
+  catch(...) {
+    g_object_unref(compressor);
+    throw;
+  }
+}
+
+std::string decompress(const std::string & data)
+{
+  GZlibDecompressor *decompressor = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+  try {
+    std::string result = convert(G_CONVERTER(decompressor), data.data(), data.size());
+    g_object_unref(decompressor);
+    return result;
+  }
+  catch(...) {
+    g_object_unref(decompressor);
+    throw;
+  }
+}
+
+// index is tab separated, one entry per line
+Glib::ustring escape(const Glib::ustring & str)
+{
+  Glib::ustring result;
+  for(gunichar ch : str) {
+    switch(ch) {
+    case '\\':
+      result += "\\\\";
+      break;
+    case '\t':
+      result += "\\t";
+      break;
+    case '\n':
+      result += "\\n";
+      break;
+    default:
+      result += ch;
+      break;
+    }
+  }
+  return result;
+}
+
+Glib::ustring unescape(const std::string & str)
+{
+  std::string result;
+  for(size_t i = 0; i < str.size(); ++i) {
+    if(str[i] == '\\' && i + 1 < str.size()) {
+      ++i;
+      result += str[i] == 't' ? '\t' : str[i] == 'n' ? '\n' : str[i];
+    }
+    else {
+      result += str[i];
+    }
+  }
+  return result;
+}
+
+}
+
+
+NoteBackupStore::NoteBackupStore(const Glib::ustring & directory)
+  : m_directory(directory)
+  , m_index_path(Glib::build_filename(directory, INDEX_FILE_NAME))
+  , m_max_age_days(0)
+  , m_max_versions(0)
+{
+  if(!sharp::directory_exists(m_directory)) {
+    sharp::directory_create(m_directory);
+  }
+  load_index();
+  import_loose_files();
+}
+
+void NoteBackupStore::retention(int max_age_days, int max_versions_per_note)
+{
+  m_max_age_days = max_age_days;
+  m_max_versions = max_versions_per_note;
+}
+
+Glib::ustring NoteBackupStore::object_path(const std::string & hash) const
+{
+  return Glib::build_filename(m_directory, OBJECTS_DIR_NAME, hash.substr(0, 2), hash + OBJECT_EXTENSION);
+}
+
+void NoteBackupStore::add(const Glib::ustring & guid, const Glib::ustring & title, const std::string & xml)
+{
+  add(guid, title, xml, g_get_real_time());
+}
+
+void NoteBackupStore::add(const Glib::ustring & guid, const Glib::ustring & title, const std::string & xml, gint64 time)
+{
+  gchar *checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA256, reinterpret_cast<const guchar*>(xml.data()),
+                                                xml.size());
+  std::string hash(checksum);
+  g_free(checksum);
+
+  // same content is already there, only the index grows
+  if(m_refs.find(hash) == m_refs.end()) {
+    Glib::ustring path = object_path(hash);
+    Glib::ustring dir = Glib::path_get_dirname(path);
+    if(!sharp::directory_exists(dir)) {
+      g_mkdir_with_parents(dir.c_str(), S_IRWXU);
+    }
+    sharp::file_write_atomic(path, compress(xml), NoteArchiver::obj().file_sync());
+  }
+
+  Entry entry;
+  entry.time = time;
+  entry.guid = guid;
+  entry.title = title;
+  entry.hash = hash;
+  ++m_refs[hash];
+  m_entries.push_back(entry);
+  append_index(entry);
+  expire();
+}
+
+std::vector<NoteBackupStore::Entry> NoteBackupStore::list() const
+{
+  return std::vector<Entry>(m_entries.rbegin(), m_entries.rend());
+}
+
+std::string NoteBackupStore::read(const Entry & entry) const
+{
+  return decompress(Glib::file_get_contents(object_path(entry.hash)));
+}
+
+void NoteBackupStore::prune()
+{
+  expire();
+  drop_unreferenced_objects();
+}
+
+void NoteBackupStore::expire()
+{
+  gint64 cutoff = G_MININT64;
+  if(m_max_age_days > 0) {
+    cutoff = g_get_real_time() - gint64(m_max_age_days) * 24 * 3600 * G_USEC_PER_SEC;
+  }
+
+  bool changed = false;
+  std::map<Glib::ustring, int> versions;
+  std::vector<Entry> kept;
+  std::vector<std::string> unreferenced;
+  for(auto iter = m_entries.rbegin(); iter != m_entries.rend(); ++iter) {
+    int & count = versions[iter->guid];
+    if(iter->time >= cutoff && (m_max_versions <= 0 || count < m_max_versions)) {
+      ++count;
+      kept.push_back(*iter);
+    }
+    else {
+      changed = true;
+      if(release(iter->hash)) {
+        unreferenced.push_back(iter->hash);
+      }
+    }
+  }
+  if(!changed) {
+    return;
+  }
+
+  std::reverse(kept.begin(), kept.end());
+  m_entries.swap(kept);
+  // the index must not refer to removed content, even after a crash
+  write_index();
+  for(const std::string & hash : unreferenced) {
+    g_unlink(object_path(hash).c_str());
+  }
+}
+
+bool NoteBackupStore::release(const std::string & hash)
+{
+  auto iter = m_refs.find(hash);
+  if(iter != m_refs.end() && --iter->second <= 0) {
+    m_refs.erase(iter);
+    return true;
+  }
+  return false;
+}
+
+void NoteBackupStore::drop_unreferenced_objects()
+{
+  // left behind by a crash between writing content and the index
+  Glib::ustring objects_dir = Glib::build_filename(m_directory, OBJECTS_DIR_NAME);
+  for(const Glib::ustring & dir : sharp::directory_get_directories(objects_dir)) {
+    for(const Glib::ustring & file : sharp::directory_get_files_with_ext(dir, OBJECT_EXTENSION)) {
+      Glib::ustring name = sharp::file_filename(file);
+      std::string hash = name.substr(0, name.size() - strlen(OBJECT_EXTENSION));
+      if(m_refs.find(hash) == m_refs.end()) {
+        DBG_OUT("Removing unreferenced backup %s", file.c_str());
+        g_unlink(file.c_str());
+      }
+    }
+    // or during writing content
+    for(const Glib::ustring & file : sharp::directory_get_files_with_ext(dir, ".tmp")) {
+      DBG_OUT("Removing partially written backup %s", file.c_str());
+      g_unlink(file.c_str());
+    }
+  }
+}
+
+void NoteBackupStore::load_index()
+{
+  if(!sharp::file_exists(m_index_path)) {
+    return;
+  }
+
+  std::string contents = Glib::file_get_contents(m_index_path);
+  size_t pos = 0;
+  while(pos < contents.size()) {
+    size_t end = contents.find('\n', pos);
+    if(end == std::string::npos) {
+      // torn last line
+      break;
+    }
+    std::string line = contents.substr(pos, end - pos);
+    pos = end + 1;
+
+    size_t tab1 = line.find('\t');
+    size_t tab2 = tab1 == std::string::npos ? tab1 : line.find('\t', tab1 + 1);
+    size_t tab3 = tab2 == std::string::npos ? tab2 : line.find('\t', tab2 + 1);
+    if(tab3 == std::string::npos) {
+      ERR_OUT(_("Skipping malformed line in %s"), m_index_path.c_str());
+      continue;
+    }
+    Entry entry;
+    entry.time = g_ascii_strtoll(line.c_str(), NULL, 10);
+    entry.guid = line.substr(tab1 + 1, tab2 - tab1 - 1);
+    entry.hash = line.substr(tab2 + 1, tab3 - tab2 - 1);
+    entry.title = unescape(line.substr(tab3 + 1));
+    ++m_refs[entry.hash];
+    m_entries.push_back(entry);
+  }
+}
+
+void NoteBackupStore::write_index()
+{
+  std::string contents;
+  for(const Entry & entry : m_entries) {
+    contents += Glib::ustring::compose("%1\t%2\t%3\t%4\n", entry.time, entry.guid, entry.hash, escape(entry.title)).raw();
+  }
+  sharp::file_write_atomic(m_index_path, contents, NoteArchiver::obj().file_sync());
+}
+
+void NoteBackupStore::append_index(const Entry & entry)
+{
+  std::string line =
+    Glib::ustring::compose("%1\t%2\t%3\t%4\n", entry.time, entry.guid, entry.hash, escape(entry.title)).raw();
+  int fd = g_open(m_index_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+  if(fd < 0) {
+    throw sharp::Exception(Glib::ustring::compose("Failed to open file %1: %2", m_index_path, g_strerror(errno)));
+  }
+  ssize_t written = write(fd, line.data(), line.size());
+  int err = errno;
+  close(fd);
+  if(written != ssize_t(line.size())) {
+    throw sharp::Exception(Glib::ustring::compose("Failed to write to file %1: %2", m_index_path, g_strerror(err)));
+  }
+}
+
+void NoteBackupStore::import_loose_files()
+{
+  // backups from before the store existed
+  std::vector<sharp::DirectoryEntry> files = sharp::directory_get_file_entries(m_directory, ".note");
+  std::sort(files.begin(), files.end(), [](const sharp::DirectoryEntry & a, const sharp::DirectoryEntry & b) {
+    return a.modification_time < b.modification_time;
+  });
+  // Stamp them with import time, not the file time. Retention would otherwise drop
+  // all of them right away and upgrading would silently lose old backups.
+  gint64 now = g_get_real_time();
+  for(const sharp::DirectoryEntry & file : files) {
+    try {
+      std::string xml = Glib::file_get_contents(file.path);
+      Glib::ustring title = NoteArchiver::obj().get_title_from_note_xml(xml);
+      add(sharp::file_basename(file.path), title, xml, now);
+      sharp::file_delete(file.path);
+    }
+    catch(const Glib::Exception & e) {
+      ERR_OUT(_("Failed to move backup %s into store: %s"), file.path.c_str(), e.what().c_str());
+    }
+    catch(const std::exception & e) {
+      ERR_OUT(_("Failed to move backup %s into store: %s"), file.path.c_str(), e.what());
+    }
+  }
+}
+
+}
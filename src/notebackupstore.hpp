@@ -0,0 +1,86 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef _NOTEBACKUPSTORE_HPP_
+#define _NOTEBACKUPSTORE_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <glibmm/ustring.h>
+
+
+namespace gnote {
+
+/**
+ * Copies of deleted notes.
+ * Note XML is stored compressed under its SHA-256, so identical content
+ * takes space only once. A small index maps notes to their copies.
+ * Main thread only.
+ */
+class NoteBackupStore
+{
+public:
+  struct Entry
+  {
+    gint64 time; // microseconds since epoch
+    Glib::ustring guid;
+    Glib::ustring title;
+    std::string hash;
+  };
+
+  // Loose .note files found in directory are taken into the store.
+  explicit NoteBackupStore(const Glib::ustring & directory);
+
+  // 0 means no limit.
+  void retention(int max_age_days, int max_versions_per_note);
+  void add(const Glib::ustring & guid, const Glib::ustring & title, const std::string & xml);
+  // Newest first.
+  std::vector<Entry> list() const;
+  std::string read(const Entry & entry) const;
+  // Drop backups beyond retention limits and content nobody refers to.
+  void prune();
+private:
+  Glib::ustring object_path(const std::string & hash) const;
+  void add(const Glib::ustring & guid, const Glib::ustring & title, const std::string & xml, gint64 time);
+  void load_index();
+  void write_index();
+  void append_index(const Entry & entry);
+  void import_loose_files();
+  // Drops entries beyond retention limits, rewrites the index and removes
+  // content, that is no longer referenced.
+  void expire();
+  // Returns true, if hash is no longer referenced.
+  bool release(const std::string & hash);
+  void drop_unreferenced_objects();
+
+  Glib::ustring m_directory;
+  Glib::ustring m_index_path;
+  std::vector<Entry> m_entries; // oldest first
+  std::map<std::string, int> m_refs;
+  int m_max_age_days;
+  int m_max_versions;
+};
+
+}
+
+#endif
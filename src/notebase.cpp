@@ -21,6 +21,7 @@
 
 #include <algorithm>
 #include <functional>
+#include <string.h>
 
 #include <glibmm/i18n.h>
 
@@ -29,9 +30,9 @@
 #include "itagmanager.hpp"
 #include "notebase.hpp"
 #include "notemanagerbase.hpp"
+#include "notescanner.hpp"
 #include "sharp/exception.hpp"
 #include "sharp/files.hpp"
-#include "sharp/map.hpp"
 #include "sharp/string.hpp"
 #include "sharp/xml.hpp"
 #include "sharp/xmlconvert.hpp"
@@ -89,6 +90,8 @@ NoteBase::NoteBase(NoteData *, const Glib::ustring & filepath, NoteManagerBase &
   : m_manager(_manager)
   , m_file_path(filepath)
   , m_enabled(true)
+  , m_saved_hash(0)
+  , m_date_bumped(false)
 {
 }
 
@@ -98,11 +101,16 @@ int NoteBase::get_hash_code() const
   return h(get_title());
 }
 
-const Glib::ustring & NoteBase::uri() const
+const Glib::ustring NoteBase::uri() const
 {
   return data_synchronizer().data().uri();
 }
 
+bool NoteBase::has_uri(const Glib::ustring & _uri) const
+{
+  return data_synchronizer().data().has_uri(_uri);
+}
+
 const Glib::ustring NoteBase::id() const
 {
   return sharp::string_replace_first(data_synchronizer().data().uri(), "note://gnote/","");
@@ -123,6 +131,7 @@ void NoteBase::set_title(const Glib::ustring & new_title, bool from_user_action)
   if(data_synchronizer().data().title() != new_title) {
     Glib::ustring old_title = data_synchronizer().data().title();
     data_synchronizer().data().title() = new_title;
+    m_manager.note_title_changed(shared_from_this());
 
     if(from_user_action) {
       process_rename_link_update(old_title);
@@ -152,6 +161,7 @@ void NoteBase::rename_without_link_update(const Glib::ustring & newTitle)
 {
   if(data_synchronizer().data().title() != newTitle) {
     data_synchronizer().data().title() = newTitle;
+    m_manager.note_title_changed(shared_from_this());
 
     // HACK:
     signal_renamed(shared_from_this(), newTitle);
@@ -168,6 +178,14 @@ void NoteBase::queue_save(ChangeType c)
 
 void NoteBase::set_change_type(ChangeType c)
 {
+  if(c != NO_CHANGE && !m_date_bumped) {
+    // remember dates as written, the change may turn out to be no change at all
+    const NoteData & data(data_synchronizer().data());
+    m_unbumped_change_date = data.change_date();
+    m_unbumped_metadata_change_date = data.metadata_change_date();
+    m_date_bumped = true;
+  }
+
   switch(c)
   {
   case CONTENT_CHANGED:
@@ -179,26 +197,72 @@ void NoteBase::set_change_type(ChangeType c)
     // to know when non-content note data has changed,
     // but order of notes in menu and search UI is
     // unaffected.
-    data_synchronizer().data().metadata_change_date() = sharp::DateTime::now();
+    data_synchronizer().data().set_metadata_change_date(sharp::DateTime::now());
     break;
   default:
     break;
   }
 }
 
+bool NoteBase::needs_write(NoteData & data, bool undo_date_bumps)
+{
+  if(m_date_bumped) {
+    m_date_bumped = false;
+    if(undo_date_bumps && m_saved_hash) {
+      sharp::DateTime change_date = data.change_date();
+      sharp::DateTime metadata_change_date = data.metadata_change_date();
+      data.set_change_date(m_unbumped_change_date);
+      data.set_metadata_change_date(m_unbumped_metadata_change_date);
+      if(data.content_hash() == m_saved_hash) {
+        return false;
+      }
+      data.set_change_date(change_date);
+      data.set_metadata_change_date(metadata_change_date);
+    }
+  }
+
+  guint64 hash = data.content_hash();
+  if(hash == m_saved_hash) {
+    return false;
+  }
+  m_saved_hash = hash;
+  return true;
+}
+
+void NoteBase::mark_saved()
+{
+  m_saved_hash = data_synchronizer().data().content_hash();
+  m_date_bumped = false;
+}
+
 void NoteBase::save()
 {
+  // explicit save, keep whatever dates the caller has set
+  NoteData & data(data_synchronizer().data());
+  if(!needs_write(data, false)) {
+    m_manager.count_save(false);
+    return;
+  }
+  m_manager.count_save(true);
+
   try {
-    NoteArchiver::write(m_file_path, data_synchronizer().data());
+    manager().storage().write(m_file_path, data);
   } 
   catch (const sharp::Exception & e) {
     // Probably IOException or UnauthorizedAccessException?
     ERR_OUT(_("Exception while saving note: %s"), e.what());
+    write_failed();
   }
 
   signal_saved(shared_from_this());
 }
 
+void NoteBase::write_failed()
+{
+  // whatever is on disk, it is not what was last saved
+  m_saved_hash = 0;
+}
+
 void NoteBase::rename_links(const Glib::ustring & old_title, const Ptr & renamed)
 {
   handle_link_rename(old_title, renamed, true);
@@ -215,10 +279,10 @@ void NoteBase::handle_link_rename(const Glib::ustring &, const Ptr &, bool)
 
 void NoteBase::delete_note()
 {
-  // Remove the note from all the tags
-  for(NoteData::TagMap::const_iterator iter = data_synchronizer().data().tags().begin();
-      iter != data_synchronizer().data().tags().end(); ++iter) {
-    remove_tag(iter->second);
+  // Remove the note from all the tags; iterate over a copy, since
+  // remove_tag() erases from the note's tag set
+  for(const Tag::Ptr & tag : get_tags()) {
+    remove_tag(tag);
   }
 }
 
@@ -229,9 +293,7 @@ void NoteBase::add_tag(const Tag::Ptr & tag)
   }
   tag->add_note(*this);
 
-  NoteData::TagMap & thetags(data_synchronizer().data().tags());
-  if(thetags.find(tag->normalized_name()) == thetags.end()) {
-    thetags[tag->normalized_name()] = tag;
+  if(data_synchronizer().data().tags().insert(tag)) {
 
     signal_tag_added(*this, tag);
 
@@ -243,17 +305,15 @@ void NoteBase::add_tag(const Tag::Ptr & tag)
 void NoteBase::remove_tag(Tag & tag)
 {
   Glib::ustring tag_name = tag.normalized_name();
-  NoteData::TagMap & thetags(data_synchronizer().data().tags());
-  NoteData::TagMap::iterator iter;
+  NoteData::TagSet & thetags(data_synchronizer().data().tags());
 
-  iter = thetags.find(tag_name);
-  if(iter == thetags.end())  {
+  if(!thetags.contains(tag_name))  {
     return;
   }
 
   signal_tag_removing(*this, tag);
 
-  thetags.erase(iter);
+  thetags.erase(tag_name);
   tag.remove_note(*this);
 
   signal_tag_removed(shared_from_this(), tag_name);
@@ -274,8 +334,7 @@ bool NoteBase::contains_tag(const Tag::Ptr & tag) const
   if(!tag) {
     return false;
   }
-  const NoteData::TagMap & thetags(data_synchronizer().data().tags());
-  return (thetags.find(tag->normalized_name()) != thetags.end());
+  return data_synchronizer().data().tags().contains(tag->normalized_name());
 }
 
 Glib::ustring NoteBase::get_complete_note_xml()
@@ -326,10 +385,10 @@ void NoteBase::load_foreign_note_xml(const Glib::ustring & foreignNoteXml, Chang
         data_synchronizer().data().set_change_date(sharp::XmlConvert::to_date_time(xml.read_string()));
       }
       else if(name == "last-metadata-change-date") {
-        data_synchronizer().data().metadata_change_date() = sharp::XmlConvert::to_date_time(xml.read_string());
+        data_synchronizer().data().set_metadata_change_date(sharp::XmlConvert::to_date_time(xml.read_string()));
       }
       else if(name == "create-date") {
-        data_synchronizer().data().create_date() = sharp::XmlConvert::to_date_time(xml.read_string());
+        data_synchronizer().data().set_create_date(sharp::XmlConvert::to_date_time(xml.read_string()));
       }
       else if(name == "tags") {
         xmlDocPtr doc2 = xmlParseDoc((const xmlChar*)xml.read_outer_xml().c_str());
@@ -370,7 +429,7 @@ void NoteBase::load_foreign_note_xml(const Glib::ustring & foreignNoteXml, Chang
 
 std::vector<Tag::Ptr> NoteBase::get_tags() const
 {
-  return sharp::map_get_values(data_synchronizer().data().tags());
+  return data_synchronizer().data().tags().values();
 }
 
 const NoteData & NoteBase::data() const
@@ -383,17 +442,17 @@ NoteData & NoteBase::data()
   return data_synchronizer().synchronized_data();
 }
 
-const sharp::DateTime & NoteBase::create_date() const
+sharp::DateTime NoteBase::create_date() const
 {
   return data_synchronizer().data().create_date();
 }
 
-const sharp::DateTime & NoteBase::change_date() const
+sharp::DateTime NoteBase::change_date() const
 {
   return data_synchronizer().data().change_date();
 }
 
-const sharp::DateTime & NoteBase::metadata_change_date() const
+sharp::DateTime NoteBase::metadata_change_date() const
 {
   return data_synchronizer().data().metadata_change_date();
 }
@@ -416,28 +475,174 @@ const char *NoteArchiver::CURRENT_VERSION = "0.3";
 //instance
 NoteArchiver NoteArchiver::s_obj;
 
+NoteArchiver::NoteArchiver()
+  : m_file_sync(sharp::FILE_SYNC_NONE)
+{
+}
+
 void NoteArchiver::read(const Glib::ustring & read_file, NoteData & data)
 {
-  return obj().read_file(read_file, data);
+  obj().read_file(read_file, data);
 }
 
-void NoteArchiver::read_file(const Glib::ustring & file, NoteData & data)
+Glib::ustring NoteArchiver::read_file(const Glib::ustring & file, NoteData & data)
 {
   Glib::ustring version;
-  sharp::XmlReader xml(file);
-  _read(xml, data, version);
-  if(version != NoteArchiver::CURRENT_VERSION) {
-    try {
-      // Note has old format, so rewrite it.  No need
-      // to reread, since we are not adding anything.
-      DBG_OUT("Updating note XML from %s to newest format...", version.c_str());
-      NoteArchiver::write(file, data);
+  if(!_read_mapped(file, data, version)) {
+    sharp::XmlReader xml(file);
+    _read(xml, data, version);
+  }
+  return version;
+}
+
+Glib::ustring NoteArchiver::read_file(const Glib::ustring & file, NoteData & data, std::vector<Glib::ustring> & tag_names)
+{
+  Glib::ustring version;
+  if(!_read_mapped(file, data, version, &tag_names)) {
+    sharp::XmlReader xml(file);
+    _read(xml, data, version, &tag_names);
+  }
+  return version;
+}
+
+Glib::ustring NoteArchiver::read_buffer(const std::string & xml, NoteData & data)
+{
+  Glib::ustring version;
+  if(!_read_scanned(xml.data(), xml.size(), data, version)) {
+    sharp::XmlReader reader;
+    reader.load_buffer(xml);
+    _read(reader, data, version);
+  }
+  return version;
+}
+
+bool NoteArchiver::_read_mapped(const Glib::ustring & file, NoteData & data, Glib::ustring & version,
+                                std::vector<Glib::ustring> *tag_names)
+{
+  GMappedFile *mapped = g_mapped_file_new(file.c_str(), FALSE, NULL);
+  if(!mapped) {
+    // let the XML reader report the error
+    return false;
+  }
+
+  bool success = _read_scanned(g_mapped_file_get_contents(mapped), g_mapped_file_get_length(mapped),
+                               data, version, tag_names);
+  g_mapped_file_unref(mapped);
+  return success;
+}
+
+bool NoteArchiver::_read_scanned(const char *contents, gsize length, NoteData & data, Glib::ustring & version,
+                                 std::vector<Glib::ustring> *tag_names)
+{
+  NoteScanner scanner(contents, length);
+  if(!scanner.scan()) {
+    return false;
+  }
+
+  // check everything that can fail before touching data
+  int cursor_position = 0, selection_bound_position = 0, width = 0, height = 0;
+  if((scanner.cursor_position().is_set() && !NoteScanner::to_int(scanner.cursor_position(), cursor_position))
+     || (scanner.selection_bound_position().is_set()
+         && !NoteScanner::to_int(scanner.selection_bound_position(), selection_bound_position))
+     || (scanner.width().is_set() && !NoteScanner::to_int(scanner.width(), width))
+     || (scanner.height().is_set() && !NoteScanner::to_int(scanner.height(), height))) {
+    return false;
+  }
+
+  version = scanner.version().ustr();
+  if(scanner.title().is_set()) {
+    data.title() = NoteScanner::unescape(scanner.title());
+  }
+  // NOTE: Use .text here to avoid triggering a save.
+  data.text() = scanner.text().ustr();
+  normalize_content_start(data.text());
+  if(scanner.last_change_date().is_set()) {
+    data.set_change_date(sharp::XmlConvert::to_date_time(scanner.last_change_date().ustr()));
+  }
+  if(scanner.last_metadata_change_date().is_set()) {
+    data.set_metadata_change_date(sharp::XmlConvert::to_date_time(scanner.last_metadata_change_date().ustr()));
+  }
+  if(scanner.create_date().is_set()) {
+    data.set_create_date(sharp::XmlConvert::to_date_time(scanner.create_date().ustr()));
+  }
+  if(scanner.cursor_position().is_set()) {
+    data.set_cursor_position(cursor_position);
+  }
+  if(scanner.selection_bound_position().is_set()) {
+    data.set_selection_bound_position(selection_bound_position);
+  }
+  if(scanner.width().is_set()) {
+    data.width() = width;
+  }
+  if(scanner.height().is_set()) {
+    data.height() = height;
+  }
+  for(const NoteScanner::Span & tag_span : scanner.tags()) {
+    Glib::ustring tag_str = NoteScanner::unescape(tag_span);
+    if(tag_names) {
+      tag_names->push_back(tag_str);
+    }
+    else {
+      data.tags().insert(ITagManager::obj().get_or_create_tag(tag_str));
+    }
+  }
+
+  return true;
+}
+
+void NoteArchiver::normalize_content_start(Glib::ustring & content)
+{
+  const char *NOTE_CONTENT = "<note-content";
+  const std::string & text = content.raw();
+  std::string::size_type start = text.find_first_not_of(" \t\n");
+  if(start == std::string::npos || text.compare(start, strlen(NOTE_CONTENT), NOTE_CONTENT) != 0) {
+    return;
+  }
+
+  // keep ordinary attributes and namespaces other than the ones always declared
+  std::string tag = NOTE_CONTENT;
+  std::string::size_type pos = start + strlen(NOTE_CONTENT);
+  while(true) {
+    std::string::size_type name_start = text.find_first_not_of(" \t\n", pos);
+    if(name_start == std::string::npos) {
+      return;
+    }
+    if(text[name_start] == '>') {
+      pos = name_start + 1;
+      break;
+    }
+    if(text[name_start] == '/') {
+      // empty note, nothing to declare namespaces for
+      return;
+    }
+    std::string::size_type eq = text.find('=', name_start);
+    if(eq == std::string::npos || eq + 1 >= text.size()) {
+      return;
     }
-    catch(sharp::Exception & e) {
-      // write failure, but not critical
-      ERR_OUT(_("Failed to update note format: %s"), e.what());
+    char quote = text[eq + 1];
+    std::string::size_type value_end = quote == '"' || quote == '\'' ? text.find(quote, eq + 2) : std::string::npos;
+    if(value_end == std::string::npos) {
+      return;
     }
+    if(text.compare(name_start, eq - name_start, "xmlns") != 0
+       && text.compare(name_start, eq - name_start, "xmlns:link") != 0
+       && text.compare(name_start, eq - name_start, "xmlns:size") != 0) {
+      tag += ' ';
+      tag.append(text, name_start, value_end + 1 - name_start);
+    }
+    pos = value_end + 1;
+  }
+  tag += " xmlns:link=\"http://beatniksoftware.com/tomboy/link\""
+         " xmlns:size=\"http://beatniksoftware.com/tomboy/size\">";
+
+  // notes written by gnote have it already
+  if(text.compare(start, pos - start, tag) == 0) {
+    return;
   }
+  // only the start tag is replaced, the rest of the text stays where it is
+  Glib::ustring::iterator tag_begin(content.begin().base() + start);
+  Glib::ustring::iterator tag_end(content.begin().base() + pos);
+  content.replace(tag_begin, tag_end, tag.c_str());
 }
 
 void NoteArchiver::read(sharp::XmlReader & xml, NoteData & data)
@@ -447,7 +652,8 @@ void NoteArchiver::read(sharp::XmlReader & xml, NoteData & data)
 }
 
 
-void NoteArchiver::_read(sharp::XmlReader & xml, NoteData & data, Glib::ustring & version)
+void NoteArchiver::_read(sharp::XmlReader & xml, NoteData & data, Glib::ustring & version,
+                         std::vector<Glib::ustring> *tag_names)
 {
   Glib::ustring name;
 
@@ -466,15 +672,16 @@ void NoteArchiver::_read(sharp::XmlReader & xml, NoteData & data, Glib::ustring
         // <text> is just a wrapper around <note-content>
         // NOTE: Use .text here to avoid triggering a save.
         data.text() = xml.read_inner_xml();
+        normalize_content_start(data.text());
       }
       else if(name == "last-change-date") {
         data.set_change_date(sharp::XmlConvert::to_date_time (xml.read_string()));
       }
       else if(name == "last-metadata-change-date") {
-        data.metadata_change_date() = sharp::XmlConvert::to_date_time(xml.read_string());
+        data.set_metadata_change_date(sharp::XmlConvert::to_date_time(xml.read_string()));
       }
       else if(name == "create-date") {
-        data.create_date() = sharp::XmlConvert::to_date_time (xml.read_string());
+        data.set_create_date(sharp::XmlConvert::to_date_time(xml.read_string()));
       }
       else if(name == "cursor-position") {
         data.set_cursor_position(STRING_TO_INT(xml.read_string()));
@@ -493,9 +700,14 @@ void NoteArchiver::_read(sharp::XmlReader & xml, NoteData & data, Glib::ustring
 
         if(doc2) {
           std::vector<Glib::ustring> tag_strings = NoteBase::parse_tags(doc2->children);
-          for(const Glib::ustring & tag_str : tag_strings) {
-            Tag::Ptr tag = ITagManager::obj().get_or_create_tag(tag_str);
-            data.tags()[tag->normalized_name()] = tag;
+          if(tag_names) {
+            tag_names->insert(tag_names->end(), tag_strings.begin(), tag_strings.end());
+          }
+          else {
+            for(const Glib::ustring & tag_str : tag_strings) {
+              Tag::Ptr tag = ITagManager::obj().get_or_create_tag(tag_str);
+              data.tags().insert(tag);
+            }
           }
           xmlFreeDoc(doc2);
         }
@@ -515,10 +727,9 @@ void NoteArchiver::_read(sharp::XmlReader & xml, NoteData & data, Glib::ustring
 Glib::ustring NoteArchiver::write_string(const NoteData & note)
 {
   Glib::ustring str;
-  sharp::XmlWriter xml;
+  sharp::XmlWriter xml(&str);
   obj().write(xml, note);
   xml.close();
-  str = xml.to_string();
   return str;
 }
   
@@ -530,36 +741,14 @@ void NoteArchiver::write(const Glib::ustring & write_file, const NoteData & data
 
 void NoteArchiver::write_file(const Glib::ustring & _write_file, const NoteData & data)
 {
-  try {
-    Glib::ustring tmp_file = _write_file + ".tmp";
-    // TODO Xml doc settings
-    sharp::XmlWriter xml(tmp_file); //, XmlEncoder::DocumentSettings);
+  // Write to a temp file and rename it over the note, so that the
+  // note file is always either the old or the new version.
+  // Errors are left to the caller, so that they can be reported to user.
+  sharp::file_write_atomic(_write_file, [this, &data](int fd) {
+    sharp::XmlWriter xml(fd);
     write(xml, data);
     xml.close();
-
-    if(sharp::file_exists(_write_file)) {
-      Glib::ustring backup_path = _write_file + "~";
-      if(sharp::file_exists(backup_path)) {
-        sharp::file_delete(backup_path);
-      }
-
-      // Backup the to a ~ file, just in case
-      sharp::file_move(_write_file, backup_path);
-
-      // Move the temp file to write_file
-      sharp::file_move(tmp_file, _write_file);
-
-      // Delete the ~ file
-      sharp::file_delete(backup_path);
-    } 
-    else {
-      // Move the temp file to write_file
-      sharp::file_move(tmp_file, _write_file);
-    }
-  }
-  catch(const std::exception & e) {
-    ERR_OUT(_("Filesystem error: %s"), e.what());
-  }
+  }, file_sync());
 }
 
 void NoteArchiver::write(sharp::XmlWriter & xml, const NoteData & data)
@@ -612,10 +801,9 @@ void NoteArchiver::write(sharp::XmlWriter & xml, const NoteData & data)
 
   if(data.tags().size() > 0) {
     xml.write_start_element("", "tags", "");
-    for(NoteData::TagMap::const_iterator iter = data.tags().begin();
-        iter != data.tags().end(); ++iter) {
+    for(const Tag::Ptr & tag : data.tags()) {
       xml.write_start_element("", "tag", "");
-      xml.write_string(iter->second->name());
+      xml.write_string(tag->name());
       xml.write_end_element();
     }
     xml.write_end_element();
@@ -22,7 +22,9 @@
 #ifndef _NOTEBASE_HPP_
 #define _NOTEBASE_HPP_
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <vector>
 
 #include <glibmm/ustring.h>
@@ -31,6 +33,7 @@
 #include "base/singleton.hpp"
 #include "tag.hpp"
 #include "sharp/datetime.hpp"
+#include "sharp/files.hpp"
 #include "sharp/xmlreader.hpp"
 #include "sharp/xmlwriter.hpp"
 
@@ -43,16 +46,51 @@ class NoteManagerBase;
 class NoteData
 {
 public:
-  typedef std::map<Glib::ustring, Tag::Ptr> TagMap;
+  /// Tags of a note, kept as a small vector sorted by normalized name.
+  /// Tag objects are shared through the tag manager, so each entry is
+  /// just a handle to the interned tag.
+  class TagSet
+  {
+  public:
+    typedef std::vector<Tag::Ptr>::const_iterator const_iterator;
+
+    const_iterator begin() const
+      {
+        return m_tags.begin();
+      }
+    const_iterator end() const
+      {
+        return m_tags.end();
+      }
+    size_t size() const
+      {
+        return m_tags.size();
+      }
+    bool empty() const
+      {
+        return m_tags.empty();
+      }
+    const std::vector<Tag::Ptr> & values() const
+      {
+        return m_tags;
+      }
+    bool contains(const Glib::ustring & normalized_name) const;
+    bool insert(const Tag::Ptr & tag);
+    bool erase(const Glib::ustring & normalized_name);
+  private:
+    std::vector<Tag::Ptr>::const_iterator lower_bound(const Glib::ustring & normalized_name) const;
+
+    std::vector<Tag::Ptr> m_tags;
+  };
 
   static const int s_noPosition;
 
   NoteData(const Glib::ustring & _uri);
+  // Deep copy, e.g. a snapshot to be written by a different thread
+  NoteData(const NoteData & other);
 
-  const Glib::ustring & uri() const
-    {
-      return m_uri;
-    }
+  Glib::ustring uri() const;
+  bool has_uri(const Glib::ustring & uri) const;
   const Glib::ustring & title() const
     {
       return m_title;
@@ -69,30 +107,29 @@ public:
     { 
       return m_text;
     }
-  const sharp::DateTime & create_date() const
+  sharp::DateTime create_date() const
     {
-      return m_create_date;
+      return unpack_date(m_create_date);
     }
-  sharp::DateTime & create_date()
+  void set_create_date(const sharp::DateTime & date)
     {
-      return m_create_date;
+      m_create_date = pack_date(date);
     }
-  const sharp::DateTime & change_date() const
+  sharp::DateTime change_date() const
     {
-      return m_change_date;
+      return unpack_date(m_change_date);
     }
   void set_change_date(const sharp::DateTime & date)
     {
-      m_change_date = date;
-      m_metadata_change_date = date;
+      m_change_date = m_metadata_change_date = pack_date(date);
     }
-  const sharp::DateTime & metadata_change_date() const
+  sharp::DateTime metadata_change_date() const
     {
-      return m_metadata_change_date;
+      return unpack_date(m_metadata_change_date);
     }
-  sharp::DateTime & metadata_change_date()
+  void set_metadata_change_date(const sharp::DateTime & date)
     {
-      return m_metadata_change_date;
+      m_metadata_change_date = pack_date(date);
     }
   int cursor_position() const
     {
@@ -126,30 +163,38 @@ public:
     {
       return m_height;
     }
-  const TagMap & tags() const
+  const TagSet & tags() const
     {
       return m_tags;
     }
-  TagMap & tags()
+  TagSet & tags()
     {
       return m_tags;
     }
 
   void set_extent(int width, int height);
   bool has_extent();
+  // Changes whenever the serialized note would.
+  guint64 content_hash() const;
 
 private:
-  const Glib::ustring m_uri;
+  static gint64 pack_date(const sharp::DateTime & date);
+  static sharp::DateTime unpack_date(gint64 date);
+
+  // URIs of the form note://gnote/<guid> are kept as the 16 raw bytes of
+  // the GUID; anything else is stored verbatim in m_foreign_uri.
+  unsigned char     m_guid[16];
+  std::unique_ptr<Glib::ustring> m_foreign_uri;
   Glib::ustring     m_title;
   Glib::ustring     m_text;
-  sharp::DateTime             m_create_date;
-  sharp::DateTime             m_change_date;
-  sharp::DateTime             m_metadata_change_date;
+  gint64            m_create_date;
+  gint64            m_change_date;
+  gint64            m_metadata_change_date;
   int               m_cursor_pos;
   int               m_selection_bound_pos;
   int               m_width, m_height;
 
-  TagMap m_tags;
+  TagSet m_tags;
 };
 
 
@@ -207,7 +252,8 @@ public:
     }
 
   int get_hash_code() const;
-  const Glib::ustring & uri() const;
+  const Glib::ustring uri() const;
+  bool has_uri(const Glib::ustring & uri) const;
   const Glib::ustring id() const;
   const Glib::ustring & get_title() const;
   void set_title(const Glib::ustring & new_title);
@@ -216,6 +262,8 @@ public:
 
   virtual void queue_save(ChangeType c);
   virtual void save();
+  // Last write of the note did not reach the disk, next save has to write it again.
+  virtual void write_failed();
   void rename_links(const Glib::ustring & old_title, const Ptr & renamed);
   void remove_links(const Glib::ustring & old_title, const Ptr & renamed);
   virtual void delete_note();
@@ -239,9 +287,9 @@ public:
   const NoteData & data() const;
   NoteData & data();
 
-  const sharp::DateTime & create_date() const;
-  const sharp::DateTime & change_date() const;
-  const sharp::DateTime & metadata_change_date() const;
+  sharp::DateTime create_date() const;
+  sharp::DateTime change_date() const;
+  sharp::DateTime metadata_change_date() const;
   bool is_new() const;
   bool enabled() const
     {
@@ -265,10 +313,20 @@ protected:
   virtual void process_rename_link_update(const Glib::ustring & old_title);
   void set_change_type(ChangeType c);
   virtual void handle_link_rename(const Glib::ustring & old_title, const Ptr & renamed, bool rename);
+  // False if data is the same as when last written. If undo_date_bumps is set,
+  // dates updated by set_change_type since then are not considered a change
+  // and are put back, when nothing else has changed.
+  bool needs_write(NoteData & data, bool undo_date_bumps);
+  // Note data matches what is on disk.
+  void mark_saved();
 private:
   NoteManagerBase & m_manager;
   Glib::ustring m_file_path;
   bool m_enabled;
+  guint64 m_saved_hash;
+  bool m_date_bumped;
+  sharp::DateTime m_unbumped_change_date;
+  sharp::DateTime m_unbumped_metadata_change_date;
 };
 
 
@@ -278,20 +336,48 @@ class NoteArchiver
 public:
   static const char *CURRENT_VERSION;
 
+  NoteArchiver();
   static void read(const Glib::ustring & read_file, NoteData & data);
   static Glib::ustring write_string(const NoteData & data);
   static void write(const Glib::ustring & write_file, const NoteData & data);
-  void read_file(const Glib::ustring & file, NoteData & data);
+  // Returns note format version found in file, the file itself is left as is.
+  Glib::ustring read_file(const Glib::ustring & file, NoteData & data);
+  // Read note, but only collect tag names instead of resolving them.
+  // Touches nothing but data, so is safe to call outside of main thread.
+  // Returns note format version found in file.
+  Glib::ustring read_file(const Glib::ustring & file, NoteData & data, std::vector<Glib::ustring> & tag_names);
+  // Read note from XML in memory. Returns note format version found.
+  Glib::ustring read_buffer(const std::string & xml, NoteData & data);
   void read(sharp::XmlReader & xml, NoteData & data);
   void write_file(const Glib::ustring & write_file, const NoteData & data);
   void write(sharp::XmlWriter & xml, const NoteData & data);
 
   Glib::ustring get_renamed_note_xml(const Glib::ustring &, const Glib::ustring &, const Glib::ustring &) const;
   Glib::ustring get_title_from_note_xml(const Glib::ustring & noteXml) const;
+  // Set from main thread, used by whatever thread writes notes.
+  void file_sync(sharp::FileSync sync)
+    {
+      m_file_sync = sync;
+    }
+  sharp::FileSync file_sync() const
+    {
+      return static_cast<sharp::FileSync>(m_file_sync.load());
+    }
 protected:
-  void _read(sharp::XmlReader & xml, NoteData & data, Glib::ustring & version);
+  void _read(sharp::XmlReader & xml, NoteData & data, Glib::ustring & version,
+             std::vector<Glib::ustring> *tag_names = NULL);
+  // Fast path for files in current format, returns false if libxml2 has to be used
+  bool _read_mapped(const Glib::ustring & file, NoteData & data, Glib::ustring & version,
+                    std::vector<Glib::ustring> *tag_names = NULL);
+  bool _read_scanned(const char *contents, gsize length, NoteData & data, Glib::ustring & version,
+                     std::vector<Glib::ustring> *tag_names);
+  // Both read paths return note text with the same <note-content> start tag, the way
+  // NoteBufferArchiver writes it, whatever namespace declarations libxml2 added.
+  // Only the start tag is changed in place, if it differs.
+  static void normalize_content_start(Glib::ustring & content);
 
   static NoteArchiver s_obj;
+  std::atomic<int> m_file_sync;
 };
 
 
@@ -70,6 +70,8 @@ namespace gnote {
 
       nm.signal_note_added.connect(
         sigc::mem_fun(*this, &NotebookApplicationAddin::on_note_added));
+      nm.signal_notes_added.connect(
+        sigc::mem_fun(*this, &NotebookApplicationAddin::on_notes_added));
       nm.signal_note_deleted.connect(
         sigc::mem_fun(*this, &NotebookApplicationAddin::on_note_deleted));
 
@@ -151,6 +153,13 @@ namespace gnote {
           sigc::mem_fun(*this, &NotebookApplicationAddin::on_tag_removed));
     }
 
+    void NotebookApplicationAddin::on_notes_added(const NoteBase::List & notes)
+    {
+      for(const NoteBase::Ptr & note : notes) {
+        on_note_added(note);
+      }
+    }
+
 
     void NotebookApplicationAddin::on_note_deleted(const NoteBase::Ptr &)
     {
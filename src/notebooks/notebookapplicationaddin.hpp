@@ -45,6 +45,7 @@ namespace gnote {
       void on_tag_added(const NoteBase&, const Tag::Ptr&);
       void on_tag_removed(const NoteBase::Ptr&, const Glib::ustring&);
       void on_note_added(const NoteBase::Ptr &);
+      void on_notes_added(const NoteBase::List &);
       void on_note_deleted(const NoteBase::Ptr &);
       void on_new_notebook_action(const Glib::VariantBase&);
 
@@ -22,12 +22,14 @@
 
 #include <algorithm>
 #include <array>
+#include <vector>
 
 #include <glibmm/i18n.h>
 #include <glibmm/main.h>
 
 #include "config.h"
 #include "debug.hpp"
+#include "handlertiming.hpp"
 #include "notebuffer.hpp"
 #include "notetag.hpp"
 #include "note.hpp"
@@ -53,6 +55,11 @@ namespace gnote {
     return false;
   }
 
+  Glib::ustring NoteBuffer::get_bullet(int depth)
+  {
+    return Glib::ustring(1, s_indent_bullets [depth % NUM_INDENT_BULLETS]) + " ";
+  }
+
   bool NoteBuffer::get_enable_auto_bulleted_lists() const
   {
     return Preferences::obj().get_schema_settings(Preferences::SCHEMA_GNOTE)->get_boolean(
@@ -165,6 +172,7 @@ namespace gnote {
   void NoteBuffer::on_tag_applied(const Glib::RefPtr<Gtk::TextTag> & tag1,
                                   const Gtk::TextIter & start_char, const Gtk::TextIter &end_char)
   {
+    HandlerTimer timer("NoteBuffer::on_tag_applied");
     DepthNoteTag::Ptr dn_tag = DepthNoteTag::Ptr::cast_dynamic(tag1);
     if (!dn_tag) {
       // Remove the tag from any bullets in the selection
@@ -266,6 +274,7 @@ namespace gnote {
   // Apply active_tags to inserted text
   void NoteBuffer::text_insert_event(const Gtk::TextIter & pos, const Glib::ustring & text, int bytes)
   {
+    HandlerTimer timer("NoteBuffer::text_insert_event");
     // Check for bullet paste
     if(text.size() == 2 && is_bullet(text[0])) {
       signal_change_text_depth(pos.get_line(), true);
@@ -667,6 +676,7 @@ namespace gnote {
   //   constantly toggle tags.
   void NoteBuffer::mark_set_event(const Gtk::TextIter &,const Glib::RefPtr<Gtk::TextBuffer::Mark> & mark)
   {
+    HandlerTimer timer("NoteBuffer::mark_set_event");
     if (mark != get_insert()) {
       return;
     }
@@ -933,10 +943,7 @@ namespace gnote {
 
     DepthNoteTag::Ptr tag = note_table->get_depth_tag(depth);
 
-    Glib::ustring bullet =
-      Glib::ustring(1, s_indent_bullets [depth % NUM_INDENT_BULLETS]) + " ";
-
-    iter = insert_with_tag (iter, bullet, tag);
+    iter = insert_with_tag (iter, get_bullet(depth), tag);
   }
 
   void NoteBuffer::remove_bullet(Gtk::TextIter & iter)
@@ -1039,7 +1046,7 @@ namespace gnote {
   }
 
 
-  DepthNoteTag::Ptr NoteBuffer::find_depth_tag(Gtk::TextIter & iter)
+  DepthNoteTag::Ptr NoteBuffer::find_depth_tag(const Gtk::TextIter & iter)
   {
     DepthNoteTag::Ptr depth_tag;
 
@@ -1076,11 +1083,11 @@ namespace gnote {
                                             const Gtk::TextIter & start,
                                             const Gtk::TextIter & end)
   {
-    sharp::XmlWriter xml;
+    Glib::ustring serializedBuffer;
+    sharp::XmlWriter xml(&serializedBuffer);
     
     serialize(buffer, start, end, xml);
     xml.close();
-    Glib::ustring serializedBuffer = xml.to_string();
     // FIXME: there is some sort of attempt to ensure the endline are the
     // same on all platforms.
     return serializedBuffer;
@@ -1104,6 +1111,33 @@ namespace gnote {
     }
   }
 
+  void NoteBufferArchiver::write_text(const Gtk::TextIter & start, const Gtk::TextIter & end,
+                                      sharp::XmlWriter & xml)
+  {
+    // U+FFFC stands for an embedded widget or image, everything else is written as is
+    static const char OBJECT_REPLACEMENT[] = "\xEF\xBF\xBC";
+    const std::string text = start.get_slice(end).raw();
+    std::string::size_type written = 0;
+    std::string::size_type pos;
+    while((pos = text.find(OBJECT_REPLACEMENT, written)) != std::string::npos) {
+      if(pos > written) {
+        xml.write_string(text.substr(written, pos - written));
+      }
+      Gtk::TextIter iter = start;
+      iter.forward_chars(g_utf8_strlen(text.data(), pos));
+      if(iter.get_child_anchor()) {
+        const char * serialize = (const char*)(iter.get_child_anchor()->get_data(Glib::Quark("serialize")));
+        if(serialize) {
+          xml.write_raw(serialize);
+        }
+      }
+      written = pos + sizeof(OBJECT_REPLACEMENT) - 1;
+    }
+    if(written < text.size()) {
+      xml.write_string(text.substr(written));
+    }
+  }
+
   bool NoteBufferArchiver::tag_ends_here (const Glib::RefPtr<const Gtk::TextTag> & tag,
                                           const Gtk::TextIter & iter,
                                           const Gtk::TextIter & next_iter)
@@ -1112,24 +1146,17 @@ namespace gnote {
   }
 
   
-  // This is taken almost directly from GAIM.  There must be a
-  // better way to do this...
   void NoteBufferArchiver::serialize(const Glib::RefPtr<Gtk::TextBuffer> & buffer, 
                                      const Gtk::TextIter & start,
                                      const Gtk::TextIter & end, sharp::XmlWriter & xml)
   {
-    std::stack<Glib::RefPtr<const Gtk::TextTag> > tag_stack;
-    std::stack<Glib::RefPtr<const Gtk::TextTag> > replay_stack;
-    std::stack<Glib::RefPtr<const Gtk::TextTag> > continue_stack;
-
-    Gtk::TextIter iter = start;
-    Gtk::TextIter next_iter = start;
-    next_iter.forward_char();
-
-    bool line_has_depth = false;
-    int prev_depth_line = -1;
-    int prev_depth = -1;
+    write_content_start(xml);
+    serialize_content(buffer, start, end, xml);
+    xml.write_end_element (); // </note-content>
+  }
 
+  void NoteBufferArchiver::write_content_start(sharp::XmlWriter & xml)
+  {
     xml.write_start_element ("", "note-content", "");
     xml.write_attribute_string ("", "version", "", "0.1");
     xml.write_attribute_string("xmlns",
@@ -1140,6 +1167,29 @@ namespace gnote {
                                "size",
                                "",
                                "http://beatniksoftware.com/tomboy/size");
+  }
+
+  // This is taken almost directly from GAIM.  There must be a
+  // better way to do this...
+  void NoteBufferArchiver::serialize_content(const Glib::RefPtr<Gtk::TextBuffer> & buffer,
+                                             const Gtk::TextIter & start,
+                                             const Gtk::TextIter & end, sharp::XmlWriter & xml)
+  {
+    std::stack<Glib::RefPtr<const Gtk::TextTag> > tag_stack;
+    std::stack<Glib::RefPtr<const Gtk::TextTag> > replay_stack;
+    std::stack<Glib::RefPtr<const Gtk::TextTag> > continue_stack;
+
+    Gtk::TextIter iter = start;
+    Gtk::TextIter next_iter = start;
+    next_iter.forward_char();
+
+    bool line_has_depth = false;
+    int prev_depth_line = -1;
+    int prev_depth = -1;
+    // whether the line after next_line_has_depth_line has depth, it is the same for all of the line
+    int line_count = buffer->get_line_count();
+    int next_line_has_depth_line = -1;
+    bool next_line_has_depth = false;
 
     // Insert any active tags at start into tag_stack...
     Glib::SListHandle<Glib::RefPtr<const Gtk::TextTag> > tag_list = start.get_tags();
@@ -1153,7 +1203,34 @@ namespace gnote {
     }
 
     while ((iter != end) && iter.get_char()) {
-      DepthNoteTag::Ptr depth_tag = NoteBuffer::Ptr::cast_static(buffer)->find_depth_tag (iter);
+      // Characters between tag toggles, away from line start and end, need none
+      // of the bookkeeping below, so they are written out as a single run.
+      // The last character before a toggle or line end may close tags or lists,
+      // so it is left to the loop.
+      if (iter.get_line_offset() >= 2 && !iter.toggles_tag()) {
+        Gtk::TextIter run_end = iter;
+        run_end.forward_to_tag_toggle(Glib::RefPtr<Gtk::TextTag>());
+        Gtk::TextIter line_end = iter;
+        if (!line_end.ends_line()) {
+          line_end.forward_to_line_end();
+        }
+        if (line_end < run_end) {
+          run_end = line_end;
+        }
+        if (end < run_end) {
+          run_end = end;
+        }
+        run_end.backward_char();
+        if (iter < run_end && !NoteBuffer::find_depth_tag(iter)) {
+          write_text(iter, run_end, xml);
+          iter = run_end;
+          next_iter = run_end;
+          next_iter.forward_char();
+          continue;
+        }
+      }
+
+      DepthNoteTag::Ptr depth_tag = NoteBuffer::find_depth_tag (iter);
 
       // If we are at a character with a depth tag we are at the
       // start of a bulleted line
@@ -1257,11 +1334,13 @@ namespace gnote {
 
       bool end_of_depth_line = line_has_depth && next_iter.ends_line ();
 
-      bool next_line_has_depth = false;
-      if (iter.get_line() < buffer->get_line_count() - 1) {
-        Gtk::TextIter next_line = buffer->get_iter_at_line(iter.get_line()+1);
-        next_line_has_depth =
-          (bool)NoteBuffer::Ptr::cast_static(buffer)->find_depth_tag (next_line);
+      if (iter.get_line() != next_line_has_depth_line) {
+        next_line_has_depth_line = iter.get_line();
+        next_line_has_depth = false;
+        if (next_line_has_depth_line < line_count - 1) {
+          Gtk::TextIter next_line = buffer->get_iter_at_line(next_line_has_depth_line + 1);
+          next_line_has_depth = (bool)NoteBuffer::find_depth_tag (next_line);
+        }
       }
 
       bool at_empty_line = iter.ends_line () && iter.starts_line ();
@@ -1350,8 +1429,6 @@ namespace gnote {
       tag_stack.pop();
       write_tag (tail_tag, xml, false);
     }
-
-    xml.write_end_element (); // </note-content>
   }
 
 
@@ -1367,26 +1444,51 @@ namespace gnote {
     }
   }
 
+  struct TagSpan
+  {
+    TagSpan(const Glib::RefPtr<Gtk::TextTag> & t, int s, int e)
+      : tag(t)
+      , start(s)
+      , end(e)
+      {}
+    Glib::RefPtr<Gtk::TextTag> tag;
+    int start;
+    int end;
+  };
+
   struct TagStart 
   {
     TagStart()
       : start(0)
+      , start_byte(0)
+      , first_span(0)
       {}
     int start;
+    // where the element starts in text being built
+    std::string::size_type start_byte;
+    // spans closed before the element started
+    std::vector<TagSpan>::size_type first_span;
     Glib::RefPtr<Gtk::TextTag> tag;
   };
 
 
+  // The text is collected first and inserted at once, followed by the tags,
+  // so that buffer watchers see a single insert instead of one per text node.
   void NoteBufferArchiver::deserialize(const Glib::RefPtr<Gtk::TextBuffer> & buffer, 
                                        const Gtk::TextIter & start,
                                        sharp::XmlReader & xml)
   {
-    int offset = start.get_offset();
+    // offsets are relative to start
+    int offset = 0;
+    std::string text;
+    std::vector<TagSpan> spans;
     std::stack<TagStart> tag_stack;
     TagStart tag_start;
     Glib::ustring value;
 
     NoteTagTable::Ptr note_table = NoteTagTable::Ptr::cast_dynamic(buffer->get_tag_table());
+    // a list item at the very end can only find a bullet in what follows in the buffer
+    bool depth_at_start = NoteBuffer::find_depth_tag(start);
 
     int curr_depth = -1;
 
@@ -1397,7 +1499,6 @@ namespace gnote {
 
     try {
       while (xml.read ()) {
-        Gtk::TextIter insert_at;
         switch (xml.get_node_type()) {
         case XML_READER_TYPE_ELEMENT:
           if (xml.get_name() == "note-content")
@@ -1405,6 +1506,8 @@ namespace gnote {
 
           tag_start = TagStart();
           tag_start.start = offset;
+          tag_start.start_byte = text.size();
+          tag_start.first_span = spans.size();
 
           if (note_table &&
               note_table->is_dynamic_tag_registered (xml.get_name())) {
@@ -1445,9 +1548,8 @@ namespace gnote {
         case XML_READER_TYPE_TEXT:
         case XML_READER_TYPE_WHITESPACE:
         case XML_READER_TYPE_SIGNIFICANT_WHITESPACE:
-          insert_at = buffer->get_iter_at_offset (offset);
           value = xml.get_value();
-          buffer->insert (insert_at, value);
+          text += value.raw();
 
           // we need the # of chars *Unicode) and not bytes (ASCII)
           // see bug #587070
@@ -1473,11 +1575,6 @@ namespace gnote {
           tag_start = tag_stack.top();
           tag_stack.pop();
           if (tag_start.tag) {
-
-            Gtk::TextIter apply_start, apply_end;
-            apply_start = buffer->get_iter_at_offset (tag_start.start);
-            apply_end = buffer->get_iter_at_offset (offset);
-
             if (NoteTag::Ptr::cast_dynamic(tag_start.tag)) {
               NoteTag::Ptr::cast_dynamic(tag_start.tag)->read (xml, false);
             }
@@ -1488,18 +1585,30 @@ namespace gnote {
             DepthNoteTag::Ptr depth_tag = DepthNoteTag::Ptr::cast_dynamic(tag_start.tag);
 
             if (depth_tag && list_stack.front ()) {
-              NoteBuffer::Ptr note_buffer = NoteBuffer::Ptr::cast_dynamic(buffer);
               // Do not insert bullet if it's already there
               // this happens when using double identation in bullet list
-              if(!note_buffer->find_depth_tag(apply_start)) {
-                note_buffer->insert_bullet(apply_start, depth_tag->get_depth());
-                buffer->remove_all_tags (apply_start, apply_start);
+              bool has_bullet = tag_start.start == offset && depth_at_start;
+              for (auto iter = spans.begin() + tag_start.first_span; iter != spans.end(); ++iter) {
+                if (iter->start == tag_start.start && DepthNoteTag::Ptr::cast_dynamic(iter->tag)) {
+                  has_bullet = true;
+                  break;
+                }
+              }
+              if (!has_bullet) {
+                Glib::ustring bullet = NoteBuffer::get_bullet(depth_tag->get_depth());
+                text.insert(tag_start.start_byte, bullet.raw());
+                // everything inside the list item moves past the bullet
+                for (auto iter = spans.begin() + tag_start.first_span; iter != spans.end(); ++iter) {
+                  iter->start += 2;
+                  iter->end += 2;
+                }
+                spans.push_back(TagSpan(depth_tag, tag_start.start, tag_start.start + 2));
                 offset += 2;
               }
               list_stack.pop_front();
             } 
             else if (!depth_tag) {
-              buffer->apply_tag (tag_start.tag, apply_start, apply_end);
+              spans.push_back(TagSpan(tag_start.tag, tag_start.start, offset));
             }
           }
           break;
@@ -1513,6 +1622,243 @@ namespace gnote {
     catch(const std::exception & e) {
       ERR_OUT(_("Exception: %s"), e.what());
     }
+
+    if (text.empty()) {
+      return;
+    }
+    int start_offset = start.get_offset();
+    buffer->insert(start, text.data(), text.data() + text.size());
+    for (const TagSpan & span : spans) {
+      buffer->apply_tag(span.tag, buffer->get_iter_at_offset(start_offset + span.start),
+                        buffer->get_iter_at_offset(start_offset + span.end));
+    }
+  }
+
+
+
+  namespace {
+    // a block takes at least this many characters, a mark per line would cost more than it saves
+    const int MIN_BLOCK_CHARS = 1024;
+  }
+
+  NoteBufferSerializer::NoteBufferSerializer(const Glib::RefPtr<Gtk::TextBuffer> & buffer)
+    : m_buffer(buffer.operator->())
+  {
+    m_connections.push_back(m_buffer->signal_insert()
+      .connect(sigc::mem_fun(*this, &NoteBufferSerializer::on_insert)));
+    m_connections.push_back(m_buffer->signal_erase()
+      .connect(sigc::mem_fun(*this, &NoteBufferSerializer::on_erase)));
+    m_connections.push_back(m_buffer->signal_apply_tag()
+      .connect(sigc::mem_fun(*this, &NoteBufferSerializer::on_tag_changed)));
+    m_connections.push_back(m_buffer->signal_remove_tag()
+      .connect(sigc::mem_fun(*this, &NoteBufferSerializer::on_tag_changed)));
+  }
+
+  NoteBufferSerializer::~NoteBufferSerializer()
+  {
+    for(sigc::connection & cid : m_connections) {
+      cid.disconnect();
+    }
+    invalidate();
+  }
+
+  Glib::ustring NoteBufferSerializer::serialize()
+  {
+    Glib::ustring serialized;
+    sharp::XmlWriter xml(&serialized);
+    serialize(xml);
+    xml.close();
+    return serialized;
+  }
+
+  void NoteBufferSerializer::serialize(sharp::XmlWriter & xml)
+  {
+    update_blocks();
+    NoteBufferArchiver::write_content_start(xml);
+    for(const Block & block : m_blocks) {
+      if(!block.xml.empty()) {
+        xml.write_raw(block.xml);
+      }
+    }
+    xml.write_end_element(); // </note-content>
+  }
+
+  void NoteBufferSerializer::invalidate()
+  {
+    for(Block & block : m_blocks) {
+      m_buffer->delete_mark(block.start);
+    }
+    m_blocks.clear();
+  }
+
+  void NoteBufferSerializer::on_insert(const Gtk::TextIter & pos, const Glib::ustring & text, int)
+  {
+    HandlerTimer timer("NoteBufferSerializer::on_insert");
+    // pos is at the end of the inserted text
+    Gtk::TextIter start = pos;
+    start.backward_chars(text.length());
+    mark_dirty(start.get_line(), pos.get_line());
+  }
+
+  void NoteBufferSerializer::on_erase(const Gtk::TextIter & start, const Gtk::TextIter & end)
+  {
+    HandlerTimer timer("NoteBufferSerializer::on_erase");
+    mark_dirty(start.get_line(), end.get_line());
+  }
+
+  void NoteBufferSerializer::on_tag_changed(const Glib::RefPtr<Gtk::TextTag> & tag, const Gtk::TextIter & start,
+                                            const Gtk::TextIter & end)
+  {
+    HandlerTimer timer("NoteBufferSerializer::on_tag_changed");
+    // spell checking and other view-only tags do not change the XML
+    if(!NoteTagTable::tag_is_serializable(tag)) {
+      return;
+    }
+    mark_dirty(start.get_line(), end.get_line());
+  }
+
+  void NoteBufferSerializer::mark_dirty(int start_line, int end_line)
+  {
+    if(m_blocks.empty()) {
+      return;
+    }
+
+    // A line is serialized differently when the next one is in a list and the
+    // place of a block boundary depends on both lines around it, so the lines
+    // next to the changed ones are dirty too.
+    int start = m_buffer->get_iter_at_line(std::max(start_line - 1, 0)).get_offset();
+    Gtk::TextIter end_iter = m_buffer->get_iter_at_line(end_line);
+    end_iter.forward_line();
+    int end = end_iter.get_offset();
+
+    block_index first = 0, last = m_blocks.size();
+    while(first < last) {
+      block_index middle = (first + last) / 2;
+      if(block_end(middle) < start) {
+        first = middle + 1;
+      }
+      else {
+        last = middle;
+      }
+    }
+    for(block_index i = first; i < m_blocks.size() && block_start(i) <= end; ++i) {
+      m_blocks[i].dirty = true;
+    }
+  }
+
+  int NoteBufferSerializer::block_start(block_index i) const
+  {
+    return m_buffer->get_iter_at_mark(m_blocks[i].start).get_offset();
+  }
+
+  int NoteBufferSerializer::block_end(block_index i) const
+  {
+    if(i + 1 < m_blocks.size()) {
+      return block_start(i + 1);
+    }
+    return m_buffer->end().get_offset();
+  }
+
+  bool NoteBufferSerializer::is_block_boundary(const Gtk::TextIter & iter)
+  {
+    // lists are kept in a single block, list items depend on the lines around them
+    if(NoteBuffer::find_depth_tag(iter)) {
+      return false;
+    }
+    Gtk::TextIter prev_line = iter;
+    prev_line.backward_line();
+    if(NoteBuffer::find_depth_tag(prev_line)) {
+      return false;
+    }
+
+    // a tag continuing from the previous line would be closed and reopened
+    Glib::SListHandle<Glib::RefPtr<Gtk::TextTag> > tags = iter.get_tags();
+    for(Glib::SListHandle<Glib::RefPtr<Gtk::TextTag> >::const_iterator tag_iter = tags.begin();
+        tag_iter != tags.end(); ++tag_iter) {
+      if(NoteTagTable::tag_is_serializable(*tag_iter) && !iter.begins_tag(*tag_iter)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  void NoteBufferSerializer::update_blocks()
+  {
+    std::vector<Block> blocks;
+    if(m_blocks.empty()) {
+      add_blocks(blocks, m_buffer->begin(), m_buffer->end());
+      m_blocks.swap(blocks);
+      return;
+    }
+
+    // Runs of dirty blocks are split into blocks again. They start and end at
+    // boundaries of clean blocks, which no change has come close to.
+    blocks.reserve(m_blocks.size());
+    block_index i = 0;
+    while(i < m_blocks.size()) {
+      if(!m_blocks[i].dirty) {
+        blocks.push_back(m_blocks[i]);
+        ++i;
+        continue;
+      }
+
+      int start = block_start(i);
+      block_index next = i;
+      for(; next < m_blocks.size() && m_blocks[next].dirty; ++next) {
+        m_buffer->delete_mark(m_blocks[next].start);
+      }
+      Gtk::TextIter end = next < m_blocks.size() ? m_buffer->get_iter_at_mark(m_blocks[next].start) : m_buffer->end();
+      add_blocks(blocks, m_buffer->get_iter_at_offset(start), end);
+      i = next;
+    }
+    m_blocks.swap(blocks);
+  }
+
+  void NoteBufferSerializer::add_blocks(std::vector<Block> & blocks, const Gtk::TextIter & start,
+                                        const Gtk::TextIter & end)
+  {
+    Gtk::TextIter block_start = start;
+    Gtk::TextIter iter = start;
+    while(iter.forward_line() && iter < end) {
+      if(iter.get_offset() - block_start.get_offset() >= MIN_BLOCK_CHARS && is_block_boundary(iter)) {
+        Block block;
+        block.start = m_buffer->create_mark(block_start, true);
+        block.xml = serialize_block(block_start, iter);
+        blocks.push_back(block);
+        block_start = iter;
+      }
+    }
+    if(block_start < end) {
+      Block block;
+      block.start = m_buffer->create_mark(block_start, true);
+      block.xml = serialize_block(block_start, end);
+      blocks.push_back(block);
+    }
+  }
+
+  Glib::ustring NoteBufferSerializer::serialize_block(const Gtk::TextIter & start, const Gtk::TextIter & end) const
+  {
+    static const char BLOCK_START[] = "<block>";
+    static const char BLOCK_END[] = "</block>";
+
+    Glib::ustring serialized;
+    {
+      sharp::XmlWriter xml(&serialized);
+      // text is only escaped inside of an element, the element is stripped below
+      xml.write_start_element("", "block", "");
+      NoteBufferArchiver::serialize_content(start.get_buffer(), start, end, xml);
+      xml.write_end_element();
+      xml.close();
+    }
+
+    const std::string & raw = serialized.raw();
+    std::string::size_type content_end = raw.rfind(BLOCK_END);
+    if(raw.compare(0, sizeof(BLOCK_START) - 1, BLOCK_START) != 0 || content_end == std::string::npos) {
+      // nothing written, the element was closed as empty
+      return "";
+    }
+    return raw.substr(sizeof(BLOCK_START) - 1, content_end - (sizeof(BLOCK_START) - 1));
   }
 
 }
@@ -25,12 +25,14 @@
 #define __NOTE_BUFFER_HPP_
 
 #include <queue>
+#include <vector>
 
 #include <gtkmm/textbuffer.h>
 #include <gtkmm/textiter.h>
 #include <gtkmm/texttag.h>
 #include <gtkmm/widget.h>
 
+#include "noncopyable.hpp"
 #include "notetag.hpp"
 
 namespace sharp {
@@ -111,8 +113,10 @@ public:
   void remove_bullet(Gtk::TextIter & iter);
   void increase_depth(Gtk::TextIter & start);
   void decrease_depth(Gtk::TextIter & start);
-  DepthNoteTag::Ptr find_depth_tag(Gtk::TextIter &);
+  static DepthNoteTag::Ptr find_depth_tag(const Gtk::TextIter &);
   static bool is_bullet(gunichar c);
+  // Bullet character followed by a space, as inserted at the start of list lines
+  static Glib::ustring get_bullet(int depth);
   void select_note_body();
 protected: 
   NoteBuffer(const NoteTagTable::Ptr &, Note &);
@@ -172,10 +176,15 @@ public:
                           const Glib::ustring & );
   static void deserialize(const Glib::RefPtr<Gtk::TextBuffer> & buffer, 
                           const Gtk::TextIter & iter, sharp::XmlReader & xml);
+  // Writes the range without the enclosing note-content element
+  static void serialize_content(const Glib::RefPtr<Gtk::TextBuffer> & buffer, const Gtk::TextIter & start,
+                                const Gtk::TextIter & end, sharp::XmlWriter & xml);
+  static void write_content_start(sharp::XmlWriter & xml);
 private:
 
   static void write_tag(const Glib::RefPtr<const Gtk::TextTag> & tag, sharp::XmlWriter & xml, 
                         bool start);
+  static void write_text(const Gtk::TextIter & start, const Gtk::TextIter & end, sharp::XmlWriter & xml);
   static bool tag_ends_here (const Glib::RefPtr<const Gtk::TextTag> & tag,
                              const Gtk::TextIter & iter,
                              const Gtk::TextIter & next_iter);
@@ -184,6 +193,52 @@ private:
 };
 
 
+// Serializes a buffer the same way as NoteBufferArchiver::serialize(), but
+// keeps the XML of blocks of whole lines and follows the changes to the buffer,
+// so that only the blocks around changed lines are serialized again.
+// Blocks only end where no tag continues into the next line and neither line
+// is part of a list, so the pieces can be joined as they are.
+class NoteBufferSerializer
+  : public NonCopyable
+{
+public:
+  // Does not keep a reference, buffer must outlive the serializer.
+  explicit NoteBufferSerializer(const Glib::RefPtr<Gtk::TextBuffer> & buffer);
+  ~NoteBufferSerializer();
+  Glib::ustring serialize();
+  void serialize(sharp::XmlWriter & xml);
+  // Drops all the cached XML, useful when the whole buffer is replaced
+  void invalidate();
+private:
+  struct Block
+  {
+    Block()
+      : dirty(false)
+      {}
+    Glib::RefPtr<Gtk::TextMark> start;
+    Glib::ustring xml;
+    bool dirty;
+  };
+  typedef std::vector<Block>::size_type block_index;
+
+  void on_insert(const Gtk::TextIter & pos, const Glib::ustring & text, int bytes);
+  void on_erase(const Gtk::TextIter & start, const Gtk::TextIter & end);
+  void on_tag_changed(const Glib::RefPtr<Gtk::TextTag> & tag, const Gtk::TextIter & start,
+                      const Gtk::TextIter & end);
+  void mark_dirty(int start_line, int end_line);
+  int block_start(block_index i) const;
+  int block_end(block_index i) const;
+  static bool is_block_boundary(const Gtk::TextIter & iter);
+  void update_blocks();
+  void add_blocks(std::vector<Block> & blocks, const Gtk::TextIter & start, const Gtk::TextIter & end);
+  Glib::ustring serialize_block(const Gtk::TextIter & start, const Gtk::TextIter & end) const;
+
+  Gtk::TextBuffer *m_buffer;
+  std::vector<Block> m_blocks;
+  std::vector<sigc::connection> m_connections;
+};
+
+
 }
 
 #endif
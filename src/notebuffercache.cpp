@@ -0,0 +1,135 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <glibmm/main.h>
+
+#include "debug.hpp"
+#include "notebuffercache.hpp"
+
+
+namespace gnote {
+
+NoteBufferCache::NoteBufferCache()
+  : m_budget(0)
+{
+}
+
+NoteBufferCache::~NoteBufferCache()
+{
+  m_trim_cid.disconnect();
+}
+
+void NoteBufferCache::touch(Note & note)
+{
+  auto iter = m_index.find(&note);
+  if(iter != m_index.end()) {
+    if(iter->second != m_lru.begin()) {
+      m_lru.splice(m_lru.begin(), m_lru, iter->second);
+    }
+    return;
+  }
+
+  Entry entry;
+  entry.key = &note;
+  entry.note = std::static_pointer_cast<Note>(note.shared_from_this());
+  m_lru.push_front(entry);
+  m_index[&note] = m_lru.begin();
+  if(m_budget > 0) {
+    schedule_trim();
+  }
+}
+
+void NoteBufferCache::remove(const Note & note)
+{
+  auto iter = m_index.find(&note);
+  if(iter != m_index.end()) {
+    m_lru.erase(iter->second);
+    m_index.erase(iter);
+  }
+}
+
+void NoteBufferCache::set_budget(size_t budget)
+{
+  m_budget = budget;
+  if(m_budget > 0) {
+    schedule_trim();
+  }
+}
+
+size_t NoteBufferCache::resident_bytes() const
+{
+  size_t bytes = 0;
+  for(const Entry & entry : m_lru) {
+    Note::Ptr note = entry.note.lock();
+    if(note) {
+      bytes += note->buffer_char_count();
+    }
+  }
+  return bytes;
+}
+
+void NoteBufferCache::trim()
+{
+  if(m_budget == 0) {
+    return;
+  }
+
+  // walk from most recently used, release everything that does not fit
+  size_t bytes = 0;
+  unsigned released = 0;
+  for(LruList::iterator iter = m_lru.begin(); iter != m_lru.end();) {
+    Note::Ptr note = iter->note.lock();
+    if(!note || !note->has_buffer()) {
+      m_index.erase(iter->key);
+      iter = m_lru.erase(iter);
+      continue;
+    }
+
+    size_t size = note->buffer_char_count();
+    if(bytes + size > m_budget && note->release_buffer()) {
+      m_index.erase(iter->key);
+      iter = m_lru.erase(iter);
+      ++released;
+      continue;
+    }
+
+    bytes += size;
+    ++iter;
+  }
+
+  DBG_OUT("Released %u note buffers, %u resident buffers using %u bytes",
+          released, unsigned(m_index.size()), unsigned(bytes));
+}
+
+void NoteBufferCache::schedule_trim()
+{
+  if(!m_trim_cid.connected()) {
+    m_trim_cid = Glib::signal_idle().connect(sigc::mem_fun(*this, &NoteBufferCache::on_trim_idle));
+  }
+}
+
+bool NoteBufferCache::on_trim_idle()
+{
+  trim();
+  return false;
+}
+
+}
+
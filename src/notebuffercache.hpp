@@ -0,0 +1,85 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _NOTEBUFFERCACHE_HPP_
+#define _NOTEBUFFERCACHE_HPP_
+
+#include <list>
+#include <map>
+
+#include <sigc++/connection.h>
+
+#include "note.hpp"
+
+
+namespace gnote {
+
+/**
+ * Keeps track of notes, that have their text buffers created.
+ * When buffers take more than the budget, buffers of least recently used
+ * notes, that are not open in a window, are released.
+ * Their content stays in NoteData and buffer is recreated when needed.
+ */
+class NoteBufferCache
+{
+public:
+  NoteBufferCache();
+  ~NoteBufferCache();
+
+  // Note buffer has been used, mark note as most recently used one.
+  // Notes do this when buffer is created or used while note is not open.
+  void touch(Note & note);
+  void remove(const Note & note);
+  // Budget in bytes, 0 means unlimited.
+  void set_budget(size_t budget);
+  size_t budget() const
+    {
+      return m_budget;
+    }
+  // Release buffers until within budget.
+  void trim();
+
+  size_t resident_buffers() const
+    {
+      return m_index.size();
+    }
+  // Approximation, buffer text is assumed to be one byte per character.
+  size_t resident_bytes() const;
+private:
+  struct Entry
+  {
+    const Note *key;
+    Note::WeakPtr note;
+  };
+  typedef std::list<Entry> LruList;
+
+  void schedule_trim();
+  bool on_trim_idle();
+
+  LruList m_lru;  // most recently used first
+  std::map<const Note*, LruList::iterator> m_index;
+  size_t m_budget;
+  sigc::connection m_trim_cid;
+};
+
+}
+
+#endif
+
@@ -1,7 +1,7 @@
 /*
  * gnote
  *
- * Copyright (C) 2010-2013,2016-2017 Aurimas Cernius
+ * Copyright (C) 2010-2013,2016-2017,2019 Aurimas Cernius
  * Copyright (C) 2009 Hubert Figuiere
  *
  * This program is free software: you can redistribute it and/or modify
@@ -270,6 +270,19 @@ namespace gnote {
     }
 
 
+  void NoteEditor::get_visible_range(Gtk::TextIter & start, Gtk::TextIter & end)
+  {
+    Gdk::Rectangle rect;
+    get_visible_rect(rect);
+    get_iter_at_location(start, rect.get_x(), rect.get_y());
+    get_iter_at_location(end, rect.get_x(), rect.get_y() + rect.get_height());
+    start.set_line_offset(0);
+    if(!end.ends_line()) {
+      end.forward_to_line_end();
+    }
+  }
+
+
   bool NoteEditor::button_pressed (GdkEventButton * )
   {
     NoteBuffer::Ptr::cast_static(get_buffer())->check_selection();
@@ -42,6 +42,8 @@ public:
     {
       return 8;
     }
+  // whole lines currently shown in the editor
+  void get_visible_range(Gtk::TextIter & start, Gtk::TextIter & end);
 
 protected:
   virtual void on_drag_data_received(const Glib::RefPtr<Gdk::DragContext> & context,
@@ -0,0 +1,497 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <glib/gstdio.h>
+#include <glibmm/fileutils.h>
+#include <glibmm/i18n.h>
+#include <glibmm/miscutils.h>
+
+#include "debug.hpp"
+#include "notehistory.hpp"
+#include "sharp/directory.hpp"
+#include "sharp/exception.hpp"
+#include "sharp/files.hpp"
+
+
+namespace gnote {
+
+namespace {
+
+const char HISTORY_EXTENSION[] = ".history";
+const char HISTORY_MAGIC[] = "GNOTEHS1";
+const size_t HISTORY_HEADER_LENGTH = sizeof(HISTORY_MAGIC) - 1;
+// body length, checksum
+const size_t RECORD_HEADER_LENGTH = 4 + 4;
+// time, type
+const size_t RECORD_BODY_HEADER_LENGTH = 8 + 1;
+// delta payload starts with prefix and suffix lengths
+const size_t DELTA_HEADER_LENGTH = 4 + 4;
+// a full copy after this many deltas
+const unsigned FULL_COPY_INTERVAL = 32;
+
+void put_u32(std::string & str, guint32 value)
+{
+  for(int i = 0; i < 4; ++i) {
+    str += char((value >> (8 * i)) & 0xff);
+  }
+}
+
+guint32 get_u32(const char *data)
+{
+  guint32 value = 0;
+  for(int i = 3; i >= 0; --i) {
+    value = (value << 8) | guchar(data[i]);
+  }
+  return value;
+}
+
+void put_i64(std::string & str, gint64 value)
+{
+  guint64 bits = value;
+  for(int i = 0; i < 8; ++i) {
+    str += char((bits >> (8 * i)) & 0xff);
+  }
+}
+
+gint64 get_i64(const char *data)
+{
+  guint64 bits = 0;
+  for(int i = 7; i >= 0; --i) {
+    bits = (bits << 8) | guchar(data[i]);
+  }
+  return bits;
+}
+
+// FNV-1a, detects records torn by a crash
+guint32 checksum(const char *data, size_t length)
+{
+  guint32 hash = 2166136261u;
+  for(size_t i = 0; i < length; ++i) {
+    hash = (hash ^ guchar(data[i])) * 16777619u;
+  }
+  return hash;
+}
+
+}
+
+
+NoteHistory::NoteHistory(const Glib::ustring & directory)
+  : m_directory(directory)
+  , m_max_versions(0)
+  , m_max_age_days(0)
+  , m_compact_all(false)
+  , m_compaction_thread(NULL)
+  , m_compacting(false)
+  , m_stopping(false)
+{
+}
+
+NoteHistory::~NoteHistory()
+{
+  Glib::Threads::Thread *thread;
+  {
+    Glib::Threads::Mutex::Lock lock(m_mutex);
+    // let the running compaction finish the note at hand only
+    m_stopping = true;
+    m_compact_queue.clear();
+    thread = m_compaction_thread;
+    m_compaction_thread = NULL;
+  }
+  if(thread) {
+    thread->join();
+  }
+}
+
+void NoteHistory::limits(int max_versions, int max_age_days)
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  m_max_versions = max_versions;
+  m_max_age_days = max_age_days;
+}
+
+Glib::ustring NoteHistory::file_path(const Glib::ustring & guid) const
+{
+  return Glib::build_filename(m_directory, guid + HISTORY_EXTENSION);
+}
+
+std::string NoteHistory::make_record(gint64 time, RecordType type, const std::string & payload)
+{
+  std::string body;
+  body.reserve(RECORD_BODY_HEADER_LENGTH + payload.size());
+  put_i64(body, time);
+  body += char(type);
+  body += payload;
+
+  std::string record;
+  record.reserve(RECORD_HEADER_LENGTH + body.size());
+  put_u32(record, body.size());
+  put_u32(record, checksum(body.data(), body.size()));
+  record += body;
+  return record;
+}
+
+std::string NoteHistory::make_delta(const std::string & from, const std::string & to)
+{
+  size_t limit = std::min(from.size(), to.size());
+  size_t prefix = 0;
+  while(prefix < limit && from[prefix] == to[prefix]) {
+    ++prefix;
+  }
+  size_t suffix = 0;
+  limit -= prefix;
+  while(suffix < limit && from[from.size() - suffix - 1] == to[to.size() - suffix - 1]) {
+    ++suffix;
+  }
+
+  std::string delta;
+  delta.reserve(DELTA_HEADER_LENGTH + to.size() - prefix - suffix);
+  put_u32(delta, prefix);
+  put_u32(delta, suffix);
+  delta.append(to, prefix, to.size() - prefix - suffix);
+  return delta;
+}
+
+std::vector<NoteHistory::Record> NoteHistory::parse(const std::string & contents)
+{
+  std::vector<Record> records;
+  if(contents.compare(0, HISTORY_HEADER_LENGTH, HISTORY_MAGIC) != 0) {
+    return records;
+  }
+
+  size_t pos = HISTORY_HEADER_LENGTH;
+  while(contents.size() - pos >= RECORD_HEADER_LENGTH + RECORD_BODY_HEADER_LENGTH) {
+    const char *head = contents.data() + pos;
+    size_t length = get_u32(head);
+    if(length < RECORD_BODY_HEADER_LENGTH || length > contents.size() - pos - RECORD_HEADER_LENGTH) {
+      break;
+    }
+    const char *body = head + RECORD_HEADER_LENGTH;
+    if(checksum(body, length) != get_u32(head + 4)) {
+      break;
+    }
+    Record record;
+    record.time = get_i64(body);
+    record.type = RecordType(body[8]);
+    record.payload_offset = pos + RECORD_HEADER_LENGTH + RECORD_BODY_HEADER_LENGTH;
+    record.payload_length = length - RECORD_BODY_HEADER_LENGTH;
+    if(record.type != RECORD_FULL && record.type != RECORD_DELTA) {
+      break;
+    }
+    // deltas are only usable after a full copy
+    if(record.type == RECORD_DELTA && records.empty()) {
+      break;
+    }
+    records.push_back(record);
+    pos += RECORD_HEADER_LENGTH + length;
+  }
+  return records;
+}
+
+std::string NoteHistory::apply(const std::string & contents, const std::vector<Record> & records, unsigned index)
+{
+  unsigned start = index;
+  while(records[start].type != RECORD_FULL) {
+    --start;
+  }
+
+  std::string version = contents.substr(records[start].payload_offset, records[start].payload_length);
+  for(unsigned i = start + 1; i <= index; ++i) {
+    const Record & record = records[i];
+    if(record.payload_length < DELTA_HEADER_LENGTH) {
+      throw sharp::Exception("Corrupt note history");
+    }
+    const char *payload = contents.data() + record.payload_offset;
+    size_t prefix = get_u32(payload);
+    size_t suffix = get_u32(payload + 4);
+    if(prefix + suffix > version.size()) {
+      throw sharp::Exception("Corrupt note history");
+    }
+    std::string next;
+    next.reserve(prefix + record.payload_length - DELTA_HEADER_LENGTH + suffix);
+    next.append(version, 0, prefix);
+    next.append(payload + DELTA_HEADER_LENGTH, record.payload_length - DELTA_HEADER_LENGTH);
+    next.append(version, version.size() - suffix, suffix);
+    version.swap(next);
+  }
+  return version;
+}
+
+void NoteHistory::record(const Glib::ustring & guid, const std::string & xml)
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  auto iter = m_tails.find(guid);
+  if(iter != m_tails.end() && iter->second.last == xml) {
+    return;
+  }
+
+  // the first version this session is a full copy, the file is checked for a torn tail
+  // before it, unless compaction has done that already
+  bool first = iter == m_tails.end();
+  bool full = first || iter->second.since_full >= FULL_COPY_INTERVAL;
+  bool check_tail = first && m_checked.find(guid) == m_checked.end();
+  gint64 now = g_get_real_time();
+  try {
+    if(full) {
+      append(guid, make_record(now, RECORD_FULL, xml), check_tail);
+    }
+    else {
+      append(guid, make_record(now, RECORD_DELTA, make_delta(iter->second.last, xml)), false);
+    }
+  }
+  catch(...) {
+    // next version must not be a delta against something, that is not there
+    if(iter != m_tails.end()) {
+      m_tails.erase(iter);
+    }
+    throw;
+  }
+
+  Tail & tail = m_tails[guid];
+  tail.since_full = full ? 0 : tail.since_full + 1;
+  tail.last = xml;
+  if(m_max_versions > 0 && ++tail.appended >= unsigned(m_max_versions)) {
+    tail.appended = 0;
+    schedule_compaction(guid);
+  }
+}
+
+size_t NoteHistory::valid_length(const std::string & contents)
+{
+  if(contents.compare(0, HISTORY_HEADER_LENGTH, HISTORY_MAGIC) != 0) {
+    return 0;
+  }
+  std::vector<Record> records = parse(contents);
+  if(records.empty()) {
+    return HISTORY_HEADER_LENGTH;
+  }
+  return records.back().payload_offset + records.back().payload_length;
+}
+
+void NoteHistory::append(const Glib::ustring & guid, const std::string & record, bool check_tail)
+{
+  if(!sharp::directory_exists(m_directory)) {
+    g_mkdir_with_parents(m_directory.c_str(), S_IRWXU);
+  }
+  Glib::ustring path = file_path(guid);
+  int fd = g_open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+  if(fd < 0) {
+    throw sharp::Exception(Glib::ustring::compose("Failed to open file %1: %2", path, g_strerror(errno)));
+  }
+  off_t size = lseek(fd, 0, SEEK_END);
+  if(check_tail && size > 0) {
+    // anything after a record torn by a crash would be unreachable, cut it off
+    size_t length = 0;
+    try {
+      length = valid_length(Glib::file_get_contents(path));
+    }
+    catch(...) {
+      close(fd);
+      throw;
+    }
+    if(length < size_t(size)) {
+      DBG_OUT("Dropping %d damaged bytes at the end of %s", int(size - length), path.c_str());
+      if(ftruncate(fd, length) != 0) {
+        int err = errno;
+        close(fd);
+        throw sharp::Exception(Glib::ustring::compose("Failed to truncate file %1: %2", path, g_strerror(err)));
+      }
+      size = length;
+    }
+  }
+  std::string data;
+  if(size == 0) {
+    data = HISTORY_MAGIC;
+  }
+  data += record;
+  ssize_t written = write(fd, data.data(), data.size());
+  int err = errno;
+  close(fd);
+  if(written != ssize_t(data.size())) {
+    throw sharp::Exception(Glib::ustring::compose("Failed to write to file %1: %2", path, g_strerror(err)));
+  }
+}
+
+std::vector<gint64> NoteHistory::list(const Glib::ustring & guid)
+{
+  std::vector<gint64> times;
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  Glib::ustring path = file_path(guid);
+  if(!sharp::file_exists(path)) {
+    return times;
+  }
+  std::string contents = Glib::file_get_contents(path);
+  for(const Record & record : parse(contents)) {
+    times.push_back(record.time);
+  }
+  return times;
+}
+
+std::string NoteHistory::read(const Glib::ustring & guid, unsigned index)
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  Glib::ustring path = file_path(guid);
+  if(sharp::file_exists(path)) {
+    std::string contents = Glib::file_get_contents(path);
+    std::vector<Record> records = parse(contents);
+    if(index < records.size()) {
+      return apply(contents, records, index);
+    }
+  }
+  throw sharp::Exception(Glib::ustring::compose("No version %1 of note %2", index, guid));
+}
+
+void NoteHistory::remove(const Glib::ustring & guid)
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  m_compact_queue.erase(guid);
+  m_tails.erase(guid);
+  m_checked.erase(guid);
+  Glib::ustring path = file_path(guid);
+  if(g_unlink(path.c_str()) != 0 && errno != ENOENT) {
+    throw sharp::Exception(Glib::ustring::compose("Failed to delete file %1: %2", path, g_strerror(errno)));
+  }
+}
+
+void NoteHistory::compact(const Glib::ustring & guid)
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  do_compact(guid);
+}
+
+void NoteHistory::do_compact(const Glib::ustring & guid)
+{
+  Glib::ustring path = file_path(guid);
+  if(!sharp::file_exists(path)) {
+    return;
+  }
+  std::string contents = Glib::file_get_contents(path);
+  std::vector<Record> records = parse(contents);
+  if(records.empty()) {
+    g_unlink(path.c_str());
+    m_tails.erase(guid);
+    m_checked.insert(guid);
+    return;
+  }
+
+  gint64 cutoff = G_MININT64;
+  if(m_max_age_days > 0) {
+    cutoff = g_get_real_time() - gint64(m_max_age_days) * 24 * 3600 * G_USEC_PER_SEC;
+  }
+  // the latest version always stays, the next one is a delta against it
+  size_t first = records.size() - 1;
+  while(first > 0 && records[first - 1].time >= cutoff
+        && (m_max_versions <= 0 || records.size() - first < size_t(m_max_versions))) {
+    --first;
+  }
+  Record last = records.back();
+  size_t parsed_end = last.payload_offset + last.payload_length;
+  if(first == 0 && parsed_end == contents.size()) {
+    m_checked.insert(guid);
+    return;
+  }
+
+  std::string compacted = HISTORY_MAGIC;
+  std::string previous;
+  for(size_t i = first; i < records.size(); ++i) {
+    std::string version = apply(contents, records, i);
+    if((i - first) % FULL_COPY_INTERVAL == 0) {
+      compacted += make_record(records[i].time, RECORD_FULL, version);
+    }
+    else {
+      compacted += make_record(records[i].time, RECORD_DELTA, make_delta(previous, version));
+    }
+    previous.swap(version);
+  }
+  sharp::file_write_atomic(path, compacted, sharp::FILE_SYNC_NONE);
+  // a torn tail, if there was one, is gone too
+  m_checked.insert(guid);
+  DBG_OUT("Compacted history of %s, %zu versions dropped", guid.c_str(), first);
+
+  // full copy interval restarted, so start over with a full copy
+  m_tails.erase(guid);
+}
+
+void NoteHistory::compact_all()
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  m_compact_all = true;
+  schedule_compaction("");
+}
+
+void NoteHistory::schedule_compaction(const Glib::ustring & guid)
+{
+  // called with m_mutex held
+  if(!guid.empty()) {
+    m_compact_queue.insert(guid);
+  }
+  if(m_compacting || m_stopping) {
+    return;
+  }
+  m_compacting = true;
+  // the previous one has finished, reap it
+  if(m_compaction_thread) {
+    m_compaction_thread->join();
+  }
+  m_compaction_thread = Glib::Threads::Thread::create(sigc::mem_fun(*this, &NoteHistory::compaction_thread));
+}
+
+void NoteHistory::compaction_thread()
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  while(!m_stopping) {
+    if(m_compact_all) {
+      m_compact_all = false;
+      lock.release();
+      std::vector<Glib::ustring> files = sharp::directory_get_files_with_ext(m_directory, HISTORY_EXTENSION);
+      lock.acquire();
+      for(const Glib::ustring & file : files) {
+        m_compact_queue.insert(sharp::file_basename(file));
+      }
+    }
+    if(m_compact_queue.empty()) {
+      break;
+    }
+
+    Glib::ustring guid = *m_compact_queue.begin();
+    m_compact_queue.erase(m_compact_queue.begin());
+    try {
+      do_compact(guid);
+    }
+    catch(const Glib::Exception & e) {
+      ERR_OUT(_("Failed to compact history of %s: %s"), guid.c_str(), e.what().c_str());
+    }
+    catch(const std::exception & e) {
+      ERR_OUT(_("Failed to compact history of %s: %s"), guid.c_str(), e.what());
+    }
+    // give writers a chance between notes
+    lock.release();
+    lock.acquire();
+  }
+  m_compacting = false;
+}
+
+}
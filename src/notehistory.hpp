@@ -0,0 +1,124 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef _NOTEHISTORY_HPP_
+#define _NOTEHISTORY_HPP_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <glibmm/threads.h>
+#include <glibmm/ustring.h>
+
+
+namespace gnote {
+
+/**
+ * Earlier versions of notes.
+ * Each note has an append-only file in the history directory. A version is
+ * stored as a delta against the previous one: the length of common prefix and
+ * suffix plus the bytes in between. Every few versions a full copy is written,
+ * so that reading any version needs only a handful of deltas.
+ * Versions are appended without syncing, history is a convenience and a lost
+ * tail only costs the last few versions.
+ * Thread safe.
+ */
+class NoteHistory
+{
+public:
+  explicit NoteHistory(const Glib::ustring & directory);
+  ~NoteHistory();
+
+  // 0 means no limit. The latest version is always kept.
+  void limits(int max_versions, int max_age_days);
+
+  // Append xml as the newest version of note, unless it is the same as the last one.
+  void record(const Glib::ustring & guid, const std::string & xml);
+  // Times of kept versions in microseconds since epoch, oldest first.
+  std::vector<gint64> list(const Glib::ustring & guid);
+  // Throws sharp::Exception if there is no such version.
+  std::string read(const Glib::ustring & guid, unsigned index);
+
+  // Forget all versions of note, e.g. when it is deleted.
+  void remove(const Glib::ustring & guid);
+
+  // Drop versions beyond limits from all notes in a background thread.
+  // Damaged ends of files are cut off too, so that saves need not check them.
+  void compact_all();
+  // Drop versions beyond limits from a single note, blocks until done.
+  void compact(const Glib::ustring & guid);
+private:
+  enum RecordType {
+    RECORD_FULL = 1,
+    RECORD_DELTA = 2
+  };
+  struct Record
+  {
+    gint64 time;
+    RecordType type;
+    size_t payload_offset;
+    size_t payload_length;
+  };
+  // What is needed to append the next version without reading the file
+  struct Tail
+  {
+    Tail()
+      : since_full(0)
+      , appended(0)
+      {}
+
+    std::string last;
+    unsigned since_full;
+    unsigned appended;
+  };
+
+  static std::string make_record(gint64 time, RecordType type, const std::string & payload);
+  static std::string make_delta(const std::string & from, const std::string & to);
+  static std::vector<Record> parse(const std::string & contents);
+  static std::string apply(const std::string & contents, const std::vector<Record> & records, unsigned index);
+  // Length of the file up to the end of last good record.
+  static size_t valid_length(const std::string & contents);
+  Glib::ustring file_path(const Glib::ustring & guid) const;
+  // If check_tail is set, damaged end of file is cut off first.
+  void append(const Glib::ustring & guid, const std::string & record, bool check_tail);
+  void do_compact(const Glib::ustring & guid);
+  void schedule_compaction(const Glib::ustring & guid);
+  void compaction_thread();
+
+  Glib::ustring m_directory;
+  int m_max_versions;
+  int m_max_age_days;
+  std::map<Glib::ustring, Tail> m_tails;
+  // notes, whose files are known to end with a whole record
+  std::set<Glib::ustring> m_checked;
+  Glib::Threads::Mutex m_mutex;
+  std::set<Glib::ustring> m_compact_queue;
+  bool m_compact_all;
+  Glib::Threads::Thread *m_compaction_thread;
+  bool m_compacting;
+  bool m_stopping;
+};
+
+}
+
+#endif
@@ -23,23 +23,40 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
+#include <memory>
+
 #include <glibmm/i18n.h>
+#include <glibmm/main.h>
 #include <glibmm/miscutils.h>
 
 #include "applicationaddin.hpp"
 #include "debug.hpp"
 #include "notemanager.hpp"
+#include "notewindow.hpp"
 #include "addinmanager.hpp"
 #include "ignote.hpp"
 #include "itagmanager.hpp"
 #include "preferences.hpp"
 #include "sharp/directory.hpp"
 #include "sharp/dynamicmodule.hpp"
+#include "sharp/files.hpp"
+#include "utils.hpp"
 
 namespace gnote {
 
+  namespace {
+    // values of note-storage setting
+    const int NOTE_STORAGE_PACKED = 1;
+    // notes handed over for format update at once
+    const unsigned FORMAT_UPDATE_BATCH = 20;
+    const unsigned FORMAT_UPDATE_INTERVAL = 100;
+  }
+
   NoteManager::NoteManager(const Glib::ustring & directory)
     : NoteManagerBase(directory)
+    , m_format_updates_done(0)
+    , m_showing_write_error(false)
   {
     Glib::ustring backup = directory + "/Backup";
     
@@ -60,6 +77,11 @@ namespace gnote {
     // StartNoteUri property doesn't generate a call to
     // Preferences.Get () each time it's accessed.
     m_start_note_uri = settings->get_string(Preferences::START_NOTE_URI);
+    buffer_cache().set_budget(std::max(settings->get_int(Preferences::NOTE_BUFFER_CACHE_SIZE), 0) * 1024);
+    update_file_sync(settings->get_int(Preferences::NOTE_WRITE_SYNC));
+    update_backup_retention();
+    update_history();
+    update_undo_memory_limit();
     settings->signal_changed().connect(sigc::mem_fun(*this, &NoteManager::on_setting_changed));
 
     m_addin_mgr = create_addin_manager ();
@@ -100,6 +122,7 @@ namespace gnote {
 
   NoteManager::~NoteManager()
   {
+    m_format_update_timeout.disconnect();
     delete m_addin_mgr;
   }
 
@@ -109,6 +132,78 @@ namespace gnote {
       m_start_note_uri = Preferences::obj()
         .get_schema_settings(Preferences::SCHEMA_GNOTE)->get_string(Preferences::START_NOTE_URI);
     }
+    else if(key == Preferences::NOTE_BUFFER_CACHE_SIZE) {
+      int size = Preferences::obj()
+        .get_schema_settings(Preferences::SCHEMA_GNOTE)->get_int(Preferences::NOTE_BUFFER_CACHE_SIZE);
+      buffer_cache().set_budget(std::max(size, 0) * 1024);
+    }
+    else if(key == Preferences::NOTE_WRITE_SYNC) {
+      update_file_sync(Preferences::obj()
+        .get_schema_settings(Preferences::SCHEMA_GNOTE)->get_int(Preferences::NOTE_WRITE_SYNC));
+    }
+    else if(key == Preferences::BACKUP_RETENTION_DAYS || key == Preferences::BACKUP_VERSIONS_PER_NOTE) {
+      update_backup_retention();
+    }
+    else if(key == Preferences::NOTE_HISTORY || key == Preferences::NOTE_HISTORY_MAX_VERSIONS
+            || key == Preferences::NOTE_HISTORY_MAX_AGE_DAYS) {
+      update_history();
+    }
+    else if(key == Preferences::UNDO_MEMORY_LIMIT) {
+      update_undo_memory_limit();
+    }
+  }
+
+  void NoteManager::update_undo_memory_limit()
+  {
+    int limit = Preferences::obj()
+      .get_schema_settings(Preferences::SCHEMA_GNOTE)->get_int(Preferences::UNDO_MEMORY_LIMIT);
+    m_undo_memory_limit = std::max(limit, 0) * 1024;
+    for(const NoteBase::Ptr & iter : m_notes) {
+      Note::Ptr note(std::static_pointer_cast<Note>(iter));
+      if(note->has_buffer()) {
+        note->buffer()->undoer().set_memory_limit(m_undo_memory_limit);
+      }
+    }
+  }
+
+  void NoteManager::update_file_sync(int sync)
+  {
+    if(sync < sharp::FILE_SYNC_NONE || sync > sharp::FILE_SYNC_FILE_AND_DIR) {
+      sync = sharp::FILE_SYNC_FILE;
+    }
+    NoteArchiver::obj().file_sync(static_cast<sharp::FileSync>(sync));
+  }
+
+  void NoteManager::update_backup_retention()
+  {
+    NoteBackupStore *store = backups();
+    if(!store) {
+      return;
+    }
+    Glib::RefPtr<Gio::Settings> settings = Preferences::obj().get_schema_settings(Preferences::SCHEMA_GNOTE);
+    store->retention(std::max(settings->get_int(Preferences::BACKUP_RETENTION_DAYS), 0),
+                     std::max(settings->get_int(Preferences::BACKUP_VERSIONS_PER_NOTE), 0));
+    try {
+      store->prune();
+    }
+    catch(const Glib::Exception & e) {
+      ERR_OUT(_("Failed to prune note backups: %s"), e.what().c_str());
+    }
+    catch(const std::exception & e) {
+      ERR_OUT(_("Failed to prune note backups: %s"), e.what());
+    }
+  }
+
+  void NoteManager::update_history()
+  {
+    Glib::RefPtr<Gio::Settings> settings = Preferences::obj().get_schema_settings(Preferences::SCHEMA_GNOTE);
+    bool enabled = settings->get_boolean(Preferences::NOTE_HISTORY);
+    history().limits(std::max(settings->get_int(Preferences::NOTE_HISTORY_MAX_VERSIONS), 0),
+                     std::max(settings->get_int(Preferences::NOTE_HISTORY_MAX_AGE_DAYS), 0));
+    history_enabled(enabled);
+    if(enabled) {
+      history().compact_all();
+    }
   }
 
   AddinManager *NoteManager::create_addin_manager()
@@ -179,12 +274,12 @@ namespace gnote {
 
   void NoteManager::load_notes()
   {
-    std::vector<Glib::ustring> files = sharp::directory_get_files_with_ext(notes_dir(), ".note");
+    std::vector<Glib::ustring> files = storage().list_notes();
 
     for(auto file_path : files) {
       try {
         Note::Ptr note = Note::load(file_path, *this);
-        add_note(note);
+        add_loaded_note(note);
       } 
       catch (const std::exception & e) {
         /* TRANSLATORS: first %s is file, second is error */
@@ -254,6 +349,80 @@ namespace gnote {
     }
   }
 
+  NoteStorage *NoteManager::create_storage()
+  {
+    // Switching is done on startup, so that notes are never in both places
+    Glib::ustring pack_path = PackedNoteStorage::pack_path(notes_dir());
+    int kind = Preferences::obj().get_schema_settings(Preferences::SCHEMA_GNOTE)->get_int(Preferences::NOTE_STORAGE);
+    if(kind == NOTE_STORAGE_PACKED) {
+      bool convert = !sharp::file_exists(pack_path);
+      try {
+        std::unique_ptr<PackedNoteStorage> storage(new PackedNoteStorage(notes_dir()));
+        if(convert) {
+          std::vector<Glib::ustring> files = sharp::directory_get_files_with_ext(notes_dir(), ".note");
+          storage->import_directory(notes_dir());
+          for(const Glib::ustring & file : files) {
+            sharp::file_delete(file);
+          }
+        }
+        return storage.release();
+      }
+      catch(const std::exception & e) {
+        ERR_OUT(_("Failed to open note pack, using note files: %s"), e.what());
+        if(convert && sharp::file_exists(pack_path)) {
+          sharp::file_delete(pack_path);
+        }
+      }
+    }
+    else if(sharp::file_exists(pack_path)) {
+      try {
+        PackedNoteStorage(notes_dir()).export_directory(notes_dir());
+        sharp::file_move(pack_path, pack_path + ".bak");
+      }
+      catch(const std::exception & e) {
+        ERR_OUT(_("Failed to convert note pack to note files: %s"), e.what());
+      }
+    }
+
+    return NoteManagerBase::create_storage();
+  }
+
+  void NoteManager::queue_format_update(const Note::Ptr & note)
+  {
+    m_format_updates.push_back(note);
+    if(!m_format_update_timeout.connected()) {
+      // runs once main loop is up, low priority keeps it behind UI work
+      m_format_update_timeout = Glib::signal_timeout().connect(
+        sigc::mem_fun(*this, &NoteManager::on_format_update_timeout), FORMAT_UPDATE_INTERVAL, Glib::PRIORITY_LOW);
+    }
+  }
+
+  bool NoteManager::on_format_update_timeout()
+  {
+    // let the writer catch up first
+    if(save_queue().pending() >= FORMAT_UPDATE_BATCH) {
+      return true;
+    }
+
+    unsigned total = m_format_updates.size();
+    unsigned end = std::min(m_format_updates_done + FORMAT_UPDATE_BATCH, total);
+    for(; m_format_updates_done < end; ++m_format_updates_done) {
+      Note::Ptr note = m_format_updates[m_format_updates_done].lock();
+      if(note) {
+        note->rewrite();
+      }
+    }
+    DBG_OUT("Updated format of %u of %u notes", m_format_updates_done, total);
+    signal_format_update_progress(m_format_updates_done, total);
+
+    if(m_format_updates_done < total) {
+      return true;
+    }
+    m_format_updates.clear();
+    m_format_updates_done = 0;
+    return false;
+  }
+
   void NoteManager::on_exiting_event()
   {
     m_addin_mgr->shutdown_application_addins();
@@ -266,6 +435,15 @@ namespace gnote {
     for(const NoteBase::Ptr & note : notesCopy) {
       note->save();
     }
+    flush_saves();
+
+    // keep undo history for the next session
+    for(const NoteBase::Ptr & iter : notesCopy) {
+      Note::Ptr note(std::static_pointer_cast<Note>(iter));
+      if(note->has_buffer()) {
+        note->buffer()->undoer().save_history();
+      }
+    }
   }
 
   NoteBase::Ptr NoteManager::note_load(const Glib::ustring & file_name)
@@ -273,6 +451,40 @@ namespace gnote {
     return Note::load(file_name, *this);
   }
 
+  NoteBase::Ptr NoteManager::note_create_existing(NoteData *data, const Glib::ustring & file_name)
+  {
+    return Note::create_existing_note(data, file_name, *this);
+  }
+
+  void NoteManager::on_note_write_failed(const Glib::ustring & file_path, const Glib::ustring & error)
+  {
+    NoteManagerBase::on_note_write_failed(file_path, error);
+    // a full disk fails every note, one dialog at a time is enough
+    if(m_showing_write_error) {
+      return;
+    }
+
+    Gtk::Window *parent = NULL;
+    Note::Ptr note = std::static_pointer_cast<Note>(find_by_file_path(file_path));
+    if(note && note->has_window()) {
+      parent = dynamic_cast<Gtk::Window*>(note->get_window()->host());
+    }
+    utils::HIGMessageDialog dialog(
+                            parent,
+                            GTK_DIALOG_DESTROY_WITH_PARENT,
+                            Gtk::MESSAGE_ERROR,
+                            Gtk::BUTTONS_OK,
+                            _("Error saving note data."),
+                            _("An error occurred while saving your notes. "
+                              "Please check that you have sufficient disk "
+                              "space, and that you have appropriate rights "
+                              "on ~/.local/share/gnote. Error details can be found in "
+                              "~/.gnote.log."));
+    m_showing_write_error = true;
+    dialog.run();
+    m_showing_write_error = false;
+  }
+
 
   // Create a new note with the specified title from the default
   // template note. Optionally the body can be overridden.
@@ -25,6 +25,7 @@
 
 #include "notemanagerbase.hpp"
 #include "note.hpp"
+#include "notebuffercache.hpp"
 
 namespace gnote {
 
@@ -48,14 +49,20 @@ namespace gnote {
       }
 
     virtual NoteBase::Ptr get_or_create_template_note() override;
+    // Note was read in older format. Such notes are rewritten in batches
+    // once startup is done, so that loading is not slowed down by writing.
+    void queue_format_update(const Note::Ptr & note);
 
     ChangedHandler signal_note_buffer_changed;
+    // Notes updated to current format so far and the total to update
+    sigc::signal<void, unsigned, unsigned> signal_format_update_progress;
 
     using NoteManagerBase::create_note_from_template;
   protected:
     virtual void _common_init(const Glib::ustring & directory, const Glib::ustring & backup) override;
     virtual void post_load() override;
     virtual void migrate_notes(const Glib::ustring & old_note_dir) override;
+    virtual NoteStorage *create_storage() override;
     virtual NoteBase::Ptr create_note_from_template(const Glib::ustring & title,
                                                     const NoteBase::Ptr & template_note,
                                                     const Glib::ustring & guid) override;
@@ -64,13 +71,24 @@ namespace gnote {
                                           const Glib::ustring & guid) override;
     virtual NoteBase::Ptr note_create_new(const Glib::ustring & title, const Glib::ustring & file_name) override;
     virtual NoteBase::Ptr note_load(const Glib::ustring & file_name) override;
+    virtual NoteBase::Ptr note_create_existing(NoteData *data, const Glib::ustring & file_name) override;
+    virtual void on_note_write_failed(const Glib::ustring & file_path, const Glib::ustring & error) override;
   private:
     AddinManager *create_addin_manager();
     void create_start_notes();
     void load_notes();
     void on_exiting_event();
+    void update_file_sync(int sync);
+    void update_backup_retention();
+    void update_history();
+    void update_undo_memory_limit();
+    bool on_format_update_timeout();
 
     AddinManager   *m_addin_mgr;
+    std::vector<Note::WeakPtr> m_format_updates;
+    unsigned m_format_updates_done;
+    sigc::connection m_format_update_timeout;
+    bool m_showing_write_error;
   };
 
 
@@ -19,12 +19,18 @@
  */
 
 
+#include <algorithm>
+#include <atomic>
+#include <set>
+
 #include <glibmm/i18n.h>
 #include <glibmm/miscutils.h>
+#include <glibmm/threads.h>
 
 #include "debug.hpp"
 #include "ignote.hpp"
 #include "itagmanager.hpp"
+#include "notebuffercache.hpp"
 #include "notemanagerbase.hpp"
 #include "utils.hpp"
 #include "trie.hpp"
@@ -39,7 +45,7 @@ namespace gnote {
 
 bool compare_dates(const NoteBase::Ptr & a, const NoteBase::Ptr & b)
 {
-  return (std::static_pointer_cast<Note>(a)->change_date() > std::static_pointer_cast<Note>(b)->change_date());
+  return a->change_date() > b->change_date();
 }
 
 
@@ -57,6 +63,7 @@ public:
     }
 private:
   void on_note_added(const NoteBase::Ptr & added);
+  void on_notes_added(const NoteBase::List & added);
   void on_note_deleted (const NoteBase::Ptr & deleted);
   void on_note_renamed(const NoteBase::Ptr & renamed, const Glib::ustring & old_title);
 
@@ -90,8 +97,13 @@ Glib::ustring NoteManagerBase::sanitize_xml_content(const Glib::ustring & xml_co
 
 
 NoteManagerBase::NoteManagerBase(const Glib::ustring & directory)
-  : m_trie_controller(NULL)
+  : m_undo_memory_limit(0)
+  , m_trie_controller(NULL)
+  , m_bulk_add_depth(0)
   , m_notes_dir(directory)
+  , m_saves_written(0)
+  , m_saves_skipped(0)
+  , m_buffer_cache(new NoteBufferCache)
 {
 }
 
@@ -122,9 +134,34 @@ void NoteManagerBase::_common_init(const Glib::ustring & /*directory*/, const Gl
     is_first_run = false;
   }
 
+  m_storage.reset(create_storage());
+  m_save_queue.storage(m_storage.get());
+  m_save_queue.signal_write_failed.connect(sigc::mem_fun(*this, &NoteManagerBase::on_note_write_failed));
+  m_history.reset(new NoteHistory(Glib::build_filename(notes_dir(), "History")));
+  if(!m_backup_dir.empty()) {
+    try {
+      m_backups.reset(new NoteBackupStore(m_backup_dir));
+    }
+    catch(const Glib::Exception & e) {
+      ERR_OUT(_("Failed to open note backups in %s: %s"), m_backup_dir.c_str(), e.what().c_str());
+    }
+    catch(const std::exception & e) {
+      ERR_OUT(_("Failed to open note backups in %s: %s"), m_backup_dir.c_str(), e.what());
+    }
+  }
   m_trie_controller = create_trie_controller();
 }
 
+Glib::ustring NoteManagerBase::undo_history_path(const NoteBase & note) const
+{
+  return Glib::build_filename(notes_dir(), "Undo", note.id() + ".undo");
+}
+
+NoteStorage *NoteManagerBase::create_storage()
+{
+  return new FileNoteStorage(notes_dir());
+}
+
 bool NoteManagerBase::first_run() const
 {
   return !sharp::directory_exists(notes_dir());
@@ -190,24 +227,70 @@ NoteBase::List NoteManagerBase::get_notes_linking_to(const Glib::ustring & title
 }
 
 void NoteManagerBase::add_note(const NoteBase::Ptr & note)
+{
+  if(note) {
+    note->signal_renamed.connect(sigc::mem_fun(*this, &NoteManagerBase::on_note_rename));
+    note->signal_saved.connect(sigc::mem_fun(*this, &NoteManagerBase::on_note_save));
+    // keep the list ordered by change date, newest first, reorder_note() relies on it
+    m_notes.insert(std::upper_bound(m_notes.begin(), m_notes.end(), note, compare_dates), note);
+    add_title_suffix(note);
+  }
+}
+
+void NoteManagerBase::add_loaded_note(const NoteBase::Ptr & note)
 {
   if(note) {
     note->signal_renamed.connect(sigc::mem_fun(*this, &NoteManagerBase::on_note_rename));
     note->signal_saved.connect(sigc::mem_fun(*this, &NoteManagerBase::on_note_save));
     m_notes.push_back(note);
+    add_title_suffix(note);
   }
 }
 
 void NoteManagerBase::on_note_rename(const NoteBase::Ptr & note, const Glib::ustring & old_title)
 {
   signal_note_renamed(note, old_title);
-  std::sort(m_notes.begin(), m_notes.end(), compare_dates);
+  reorder_note(note);
 }
 
 void NoteManagerBase::on_note_save (const NoteBase::Ptr & note)
 {
   signal_note_saved(note);
-  std::sort(m_notes.begin(), m_notes.end(), compare_dates);
+  reorder_note(note);
+}
+
+// Move the note to its place in the list, which is ordered by change date, newest first.
+// Only this note's change date could have changed, so there is no need to sort the whole list.
+// The common case is the note being saved again becoming (or staying) the newest one.
+void NoteManagerBase::reorder_note(const NoteBase::Ptr & note)
+{
+  NoteBase::List::iterator pos = m_notes.begin();
+  for(; pos != m_notes.end(); ++pos) {
+    if(pos->get() == note.get()) {
+      break;
+    }
+  }
+  if(pos == m_notes.end()) {
+    return;
+  }
+
+  const sharp::DateTime & date = note->change_date();
+  NoteBase::List::iterator next = pos + 1;
+  if(pos != m_notes.begin() && (*(pos - 1))->change_date() < date) {
+    // became newer, move towards the front
+    if(m_notes.front()->change_date() <= date) {
+      std::rotate(m_notes.begin(), pos, next);
+    }
+    else {
+      NoteBase::List::iterator dest = std::upper_bound(m_notes.begin(), pos, note, compare_dates);
+      std::rotate(dest, pos, next);
+    }
+  }
+  else if(next != m_notes.end() && (*next)->change_date() > date) {
+    // became older, move towards the back
+    NoteBase::List::iterator dest = std::upper_bound(next, m_notes.end(), note, compare_dates);
+    std::rotate(pos, next, dest);
+  }
 }
 
 NoteBase::Ptr NoteManagerBase::find(const Glib::ustring & linked_title) const
@@ -220,10 +303,28 @@ NoteBase::Ptr NoteManagerBase::find(const Glib::ustring & linked_title) const
   return NoteBase::Ptr();
 }
 
+NoteBase::Ptr NoteManagerBase::find_by_file_path(const Glib::ustring & file_path) const
+{
+  for(const NoteBase::Ptr & note : m_notes) {
+    if(note->file_path() == file_path) {
+      return note;
+    }
+  }
+  return NoteBase::Ptr();
+}
+
+void NoteManagerBase::on_note_write_failed(const Glib::ustring & file_path, const Glib::ustring &)
+{
+  NoteBase::Ptr note = find_by_file_path(file_path);
+  if(note) {
+    note->write_failed();
+  }
+}
+
 NoteBase::Ptr NoteManagerBase::find_by_uri(const Glib::ustring & uri) const
 {
   for(const NoteBase::Ptr & note : m_notes) {
-    if (note->uri() == uri) {
+    if (note->has_uri(uri)) {
       return note;
     }
   }
@@ -284,15 +385,133 @@ NoteBase::Ptr NoteManagerBase::create_note_from_template(const Glib::ustring & t
 Glib::ustring NoteManagerBase::get_unique_name(const Glib::ustring & basename) const
 {
   int id = 1;  // starting point
-  Glib::ustring title;
-  while(true) {
-    title = Glib::ustring::compose("%1 %2", basename, id++);
-    if(!find (title)) {
-      break;
+  auto iter = m_title_suffixes.find(basename.lowercase());
+  if(iter != m_title_suffixes.end()) {
+    id = iter->second.first_free();
+  }
+
+  return Glib::ustring::compose("%1 %2", basename, id);
+}
+
+void NoteManagerBase::note_title_changed(const NoteBase::Ptr & note)
+{
+  // forget whatever was recorded for the old title
+  remove_title_suffix(note);
+  add_title_suffix(note);
+}
+
+// Split title of the form "basename N" into lowercase basename and N.
+// Only titles that get_unique_name() could produce are considered.
+bool NoteManagerBase::split_title_suffix(const Glib::ustring & title, Glib::ustring & basename, int & suffix)
+{
+  const std::string & raw = title.raw();
+  std::string::size_type pos = raw.rfind(' ');
+  if(pos == std::string::npos) {
+    return false;
+  }
+  std::string digits = raw.substr(pos + 1);
+  // no leading zeroes and small enough to never overflow
+  if(digits.empty() || digits.size() > 9 || digits[0] == '0') {
+    return false;
+  }
+  for(char c : digits) {
+    if(c < '0' || c > '9') {
+      return false;
     }
   }
 
-  return title;
+  basename = Glib::ustring(raw.substr(0, pos)).lowercase();
+  suffix = std::stoi(digits);
+  return true;
+}
+
+void NoteManagerBase::add_title_suffix(const NoteBase::Ptr & note)
+{
+  Glib::ustring basename;
+  int suffix;
+  if(split_title_suffix(note->get_title(), basename, suffix)) {
+    m_title_suffixes[basename].add(suffix);
+    m_note_title_suffixes[note.get()] = std::make_pair(basename, suffix);
+  }
+}
+
+void NoteManagerBase::remove_title_suffix(const NoteBase::Ptr & note)
+{
+  auto iter = m_note_title_suffixes.find(note.get());
+  if(iter == m_note_title_suffixes.end()) {
+    return;
+  }
+
+  auto suffixes = m_title_suffixes.find(iter->second.first);
+  if(suffixes != m_title_suffixes.end()) {
+    suffixes->second.remove(iter->second.second);
+    if(suffixes->second.empty()) {
+      m_title_suffixes.erase(suffixes);
+    }
+  }
+  m_note_title_suffixes.erase(iter);
+}
+
+
+void NoteManagerBase::TitleSuffixes::add(int suffix)
+{
+  if(m_counts[suffix]++ > 0) {
+    // several notes with the same title, range already covers it
+    return;
+  }
+
+  auto next = m_ranges.upper_bound(suffix);
+  auto prev = next;
+  bool merge_prev = next != m_ranges.begin() && (--prev)->second == suffix - 1;
+  bool merge_next = next != m_ranges.end() && next->first == suffix + 1;
+  if(merge_prev && merge_next) {
+    prev->second = next->second;
+    m_ranges.erase(next);
+  }
+  else if(merge_prev) {
+    prev->second = suffix;
+  }
+  else if(merge_next) {
+    int end = next->second;
+    m_ranges.erase(next);
+    m_ranges[suffix] = end;
+  }
+  else {
+    m_ranges[suffix] = suffix;
+  }
+}
+
+void NoteManagerBase::TitleSuffixes::remove(int suffix)
+{
+  auto count = m_counts.find(suffix);
+  if(count == m_counts.end()) {
+    return;
+  }
+  if(--count->second > 0) {
+    return;
+  }
+  m_counts.erase(count);
+
+  // find the range containing suffix and cut it out
+  auto range = m_ranges.upper_bound(suffix);
+  --range;
+  int start = range->first;
+  int end = range->second;
+  m_ranges.erase(range);
+  if(start < suffix) {
+    m_ranges[start] = suffix - 1;
+  }
+  if(suffix < end) {
+    m_ranges[suffix + 1] = end;
+  }
+}
+
+int NoteManagerBase::TitleSuffixes::first_free() const
+{
+  if(m_ranges.empty() || m_ranges.begin()->first != 1) {
+    return 1;
+  }
+  return m_ranges.begin()->second + 1;
 }
 
 // Create a new note with the specified title from the default
@@ -348,9 +567,11 @@ NoteBase::Ptr NoteManagerBase::create_new_note(const Glib::ustring & title, cons
   new_note->signal_renamed.connect(sigc::mem_fun(*this, &NoteManagerBase::on_note_rename));
   new_note->signal_saved.connect(sigc::mem_fun(*this, &NoteManagerBase::on_note_save));
 
-  m_notes.push_back(new_note);
+  // new note is the newest one
+  m_notes.insert(m_notes.begin(), new_note);
+  add_title_suffix(new_note);
 
-  signal_note_added(new_note);
+  notify_note_added(new_note);
 
   return new_note;
 }
@@ -446,23 +667,26 @@ NoteBase::Ptr NoteManagerBase::find_template_note() const
 
 void NoteManagerBase::delete_note(const NoteBase::Ptr & note)
 {
-  if(sharp::file_exists(note->file_path())) {
-    if(!m_backup_dir.empty()) {
-      if(!sharp::directory_exists(m_backup_dir)) {
-        sharp::directory_create(m_backup_dir);
-      }
-      Glib::ustring backup_path 
-        = Glib::build_filename(m_backup_dir, sharp::file_filename(note->file_path()));
-
-      if(sharp::file_exists(backup_path)) {
-        sharp::file_delete(backup_path);
-      }
-
-      sharp::file_move(note->file_path(), backup_path);
-    } 
-    else {
-      sharp::file_delete(note->file_path());
+  // don't let a pending save bring the file back
+  m_save_queue.cancel(note->file_path());
+  if(m_backups && m_storage->exists(note->file_path())) {
+    try {
+      m_backups->add(note->id(), note->get_title(), m_storage->read_xml(note->file_path()));
+    }
+    catch(const Glib::Exception & e) {
+      ERR_OUT(_("Failed to back up note %s: %s"), note->file_path().c_str(), e.what().c_str());
     }
+    catch(const std::exception & e) {
+      ERR_OUT(_("Failed to back up note %s: %s"), note->file_path().c_str(), e.what());
+    }
+  }
+  m_storage->remove(note->file_path());
+  try {
+    // history is kept under the same name the save queue records it with
+    m_history->remove(sharp::file_basename(note->file_path()));
+  }
+  catch(const std::exception & e) {
+    ERR_OUT(_("Failed to remove history of note %s: %s"), note->file_path().c_str(), e.what());
   }
 
   for(auto iter = m_notes.begin(); iter != m_notes.end(); ++iter) {
@@ -471,6 +695,7 @@ void NoteManagerBase::delete_note(const NoteBase::Ptr & note)
       break;
     }
   }
+  remove_title_suffix(note);
   note->delete_note();
 
   DBG_OUT("Deleting note '%s'.", note->get_title().c_str());
@@ -483,12 +708,12 @@ NoteBase::Ptr NoteManagerBase::import_note(const Glib::ustring & file_path)
   Glib::ustring dest_file = Glib::build_filename(notes_dir(), 
                                                  sharp::file_filename(file_path));
 
-  if(sharp::file_exists(dest_file)) {
+  if(m_storage->exists(dest_file)) {
     dest_file = make_new_file_name();
   }
   NoteBase::Ptr note;
   try {
-    sharp::file_copy(file_path, dest_file);
+    m_storage->import_file(file_path, dest_file);
 
     // TODO: make sure the title IS unique.
     note = note_load(dest_file);
@@ -501,6 +726,176 @@ NoteBase::Ptr NoteManagerBase::import_note(const Glib::ustring & file_path)
 }
 
 
+namespace {
+
+struct ImportJob
+{
+  Glib::ustring source;
+  Glib::ustring destination;
+  NoteData *data;
+  std::vector<Glib::ustring> tag_names;
+  Glib::ustring version;
+};
+
+void run_import_jobs(std::vector<ImportJob> & jobs, std::atomic<size_t> & next_job, NoteStorage & storage)
+{
+  for(size_t i = next_job++; i < jobs.size(); i = next_job++) {
+    ImportJob & job(jobs[i]);
+    try {
+      job.data = new NoteData(NoteBase::url_from_path(job.destination));
+      job.version = NoteArchiver::obj().read_file(job.source, *job.data, job.tag_names);
+      // notes in older format are written once tags are resolved
+      if(job.version == NoteArchiver::CURRENT_VERSION) {
+        storage.import_file(job.source, job.destination);
+      }
+    }
+    catch(const Glib::Exception & e) {
+      ERR_OUT(_("Failed to import note %s: %s"), job.source.c_str(), e.what().c_str());
+      delete job.data;
+      job.data = NULL;
+    }
+    catch(const std::exception & e) {
+      ERR_OUT(_("Failed to import note %s: %s"), job.source.c_str(), e.what());
+      delete job.data;
+      job.data = NULL;
+    }
+  }
+}
+
+}
+
+NoteBase::List NoteManagerBase::import_notes(const std::vector<Glib::ustring> & file_paths)
+{
+  // Pick destinations up front, so that concurrently copied files can't clash
+  std::vector<ImportJob> jobs;
+  std::set<Glib::ustring> destinations;
+  for(const Glib::ustring & file_path : file_paths) {
+    ImportJob job;
+    job.source = file_path;
+    job.destination = Glib::build_filename(notes_dir(), sharp::file_filename(file_path));
+    if(destinations.find(job.destination) != destinations.end() || m_storage->exists(job.destination)) {
+      job.destination = make_new_file_name();
+    }
+    destinations.insert(job.destination);
+    job.data = NULL;
+    jobs.push_back(job);
+  }
+
+  // Parse and store the files in worker threads
+  std::atomic<size_t> next_job(0);
+  unsigned thread_count = std::min<size_t>(std::max(g_get_num_processors(), 1u), jobs.size());
+  NoteStorage & storage(*m_storage);
+  std::vector<Glib::Threads::Thread*> threads;
+  for(unsigned i = 1; i < thread_count; ++i) {
+    threads.push_back(Glib::Threads::Thread::create([&jobs, &next_job, &storage]() {
+      run_import_jobs(jobs, next_job, storage);
+    }));
+  }
+  run_import_jobs(jobs, next_job, storage);
+  for(Glib::Threads::Thread *thread : threads) {
+    thread->join();
+  }
+
+  // Tags and notes can only be created in main thread
+  NoteBase::List notes;
+  begin_bulk_add();
+  for(ImportJob & job : jobs) {
+    if(!job.data) {
+      continue;
+    }
+    try {
+      for(const Glib::ustring & tag_name : job.tag_names) {
+        Tag::Ptr tag = ITagManager::obj().get_or_create_tag(tag_name);
+        job.data->tags().insert(tag);
+      }
+      bool rewrite = job.version != NoteArchiver::CURRENT_VERSION;
+      // the title can be taken by an existing or an earlier imported note
+      if(find(job.data->title())) {
+        Glib::ustring new_title = get_unique_name(job.data->title());
+        job.data->text() = sharp::string_replace_first(job.data->text(),
+                                                       utils::XmlEncoder::encode(job.data->title()),
+                                                       utils::XmlEncoder::encode(new_title));
+        job.data->title() = new_title;
+        rewrite = true;
+      }
+      if(rewrite) {
+        m_storage->write(job.destination, *job.data);
+      }
+
+      NoteBase::Ptr note = note_create_existing(job.data, job.destination);
+      job.data = NULL;
+      add_note(note);
+      notify_note_added(note);
+      notes.push_back(note);
+    }
+    catch(const std::exception & e) {
+      ERR_OUT(_("Failed to import note %s: %s"), job.source.c_str(), e.what());
+      delete job.data;
+    }
+  }
+  end_bulk_add();
+
+  return notes;
+}
+
+NoteBase::Ptr NoteManagerBase::restore_backup(const NoteBackupStore::Entry & backup)
+{
+  Glib::ustring file_path = make_new_file_name(backup.guid);
+  if(m_storage->exists(file_path)) {
+    file_path = make_new_file_name();
+  }
+
+  NoteData *data = new NoteData(NoteBase::url_from_path(file_path));
+  try {
+    NoteArchiver::obj().read_buffer(m_backups->read(backup), *data);
+    // the title could have been taken by another note since
+    if(find(data->title())) {
+      Glib::ustring new_title = get_unique_name(data->title());
+      data->text() = sharp::string_replace_first(data->text(),
+                                                 utils::XmlEncoder::encode(data->title()),
+                                                 utils::XmlEncoder::encode(new_title));
+      data->title() = new_title;
+    }
+    m_storage->write(file_path, *data);
+  }
+  catch(...) {
+    delete data;
+    throw;
+  }
+
+  NoteBase::Ptr note = note_create_existing(data, file_path);
+  add_note(note);
+  notify_note_added(note);
+  return note;
+}
+
+void NoteManagerBase::begin_bulk_add()
+{
+  ++m_bulk_add_depth;
+}
+
+void NoteManagerBase::end_bulk_add()
+{
+  if(--m_bulk_add_depth > 0 || m_bulk_added.empty()) {
+    return;
+  }
+
+  NoteBase::List added;
+  std::swap(added, m_bulk_added);
+  signal_notes_added(added);
+}
+
+void NoteManagerBase::notify_note_added(const NoteBase::Ptr & note)
+{
+  if(m_bulk_add_depth > 0) {
+    m_bulk_added.push_back(note);
+  }
+  else {
+    signal_note_added(note);
+  }
+}
+
+
 NoteBase::Ptr NoteManagerBase::create_with_guid(const Glib::ustring & title, const Glib::ustring & guid)
 {
   return create_new_note(title, guid);
@@ -514,6 +909,7 @@ TrieController::TrieController(NoteManagerBase & manager)
 {
   m_manager.signal_note_deleted.connect(sigc::mem_fun(*this, &TrieController::on_note_deleted));
   m_manager.signal_note_added.connect(sigc::mem_fun(*this, &TrieController::on_note_added));
+  m_manager.signal_notes_added.connect(sigc::mem_fun(*this, &TrieController::on_notes_added));
   m_manager.signal_note_renamed.connect(sigc::mem_fun(*this, &TrieController::on_note_renamed));
 
   update();
@@ -529,6 +925,11 @@ void TrieController::on_note_added(const NoteBase::Ptr & note)
   add_note(note);
 }
 
+void TrieController::on_notes_added(const NoteBase::List &)
+{
+  update();
+}
+
 void TrieController::on_note_deleted(const NoteBase::Ptr &)
 {
   update();
@@ -1,7 +1,7 @@
 /*
  * gnote
  *
- * Copyright (C) 2010-2014,2017 Aurimas Cernius
+ * Copyright (C) 2010-2014,2017,2019 Aurimas Cernius
  * Copyright (C) 2009 Hubert Figuiere
  *
  * This program is free software: you can redistribute it and/or modify
@@ -22,18 +22,27 @@
 #ifndef _NOTEMANAGERBASE_HPP_
 #define _NOTEMANAGERBASE_HPP_
 
+#include <map>
+#include <memory>
+
+#include "notebackupstore.hpp"
 #include "notebase.hpp"
+#include "notehistory.hpp"
+#include "notesavequeue.hpp"
+#include "notestorage.hpp"
 #include "triehit.hpp"
 
 
 namespace gnote {
 
+class NoteBufferCache;
 class TrieController;
 
 class NoteManagerBase
 {
 public:
   typedef sigc::signal<void, const NoteBase::Ptr &> ChangedHandler;
+  typedef sigc::signal<void, const NoteBase::List &> ListChangedHandler;
 
   static Glib::ustring sanitize_xml_content(const Glib::ustring & xml_content);
   static Glib::ustring get_note_template_content(const Glib::ustring & title);
@@ -63,10 +72,21 @@ public:
   virtual NoteBase::Ptr get_or_create_template_note();
   NoteBase::Ptr find_template_note() const;
   Glib::ustring get_unique_name(const Glib::ustring & basename) const;
+  // Called by note when its title changes, renames do not always emit signal_renamed
+  void note_title_changed(const NoteBase::Ptr & note);
   void delete_note(const NoteBase::Ptr & note);
   // Import a note read from file_path
   // Will ensure the sanity including the unique title.
   NoteBase::Ptr import_note(const Glib::ustring & file_path);
+  // Import many notes at once. Files are read in parallel and signal_notes_added
+  // is emitted once for all of them instead of signal_note_added for each.
+  NoteBase::List import_notes(const std::vector<Glib::ustring> & file_paths);
+  // Bring back a deleted note, keeping its GUID unless it is taken.
+  NoteBase::Ptr restore_backup(const NoteBackupStore::Entry & backup);
+  // Notes created between these calls are reported using a single signal_notes_added.
+  // Calls can be nested.
+  void begin_bulk_add();
+  void end_bulk_add();
   NoteBase::Ptr create_with_guid(const Glib::ustring & title, const Glib::ustring & guid);
 
   const Glib::ustring & notes_dir() const
@@ -83,8 +103,62 @@ public:
       return m_start_note_uri; 
     }
 
+  NoteStorage & storage()
+    {
+      return *m_storage;
+    }
+  // Copies of deleted notes, NULL if there is no backup directory.
+  NoteBackupStore *backups()
+    {
+      return m_backups.get();
+    }
+  NoteHistory & history()
+    {
+      return *m_history;
+    }
+  // Whether note saves are recorded in history.
+  void history_enabled(bool enabled)
+    {
+      m_save_queue.history(enabled ? m_history.get() : NULL);
+    }
+  NoteSaveQueue & save_queue()
+    {
+      return m_save_queue;
+    }
+  // Text buffers of notes, released when over the budget
+  NoteBufferCache & buffer_cache()
+    {
+      return *m_buffer_cache;
+    }
+  // in bytes, 0 for no limit
+  std::size_t undo_memory_limit() const
+    {
+      return m_undo_memory_limit;
+    }
+  Glib::ustring undo_history_path(const NoteBase & note) const;
+  // Wait until all queued note saves are written to disk
+  void flush_saves()
+    {
+      m_save_queue.flush();
+    }
+  // Note saves, that were handed over for writing and that were dropped
+  // because note had not changed since last write. Main thread only.
+  void count_save(bool written)
+    {
+      ++(written ? m_saves_written : m_saves_skipped);
+    }
+  unsigned saves_written() const
+    {
+      return m_saves_written;
+    }
+  unsigned saves_skipped() const
+    {
+      return m_saves_skipped;
+    }
+
   ChangedHandler signal_note_deleted;
   ChangedHandler signal_note_added;
+  ListChangedHandler signal_notes_added;
   NoteBase::RenamedHandler signal_note_renamed;
   NoteBase::SavedHandler signal_note_saved;
 protected:
@@ -92,10 +166,18 @@ protected:
   bool first_run() const;
   virtual void post_load();
   virtual void migrate_notes(const Glib::ustring & old_note_dir);
+  // Called once notes directory exists, plain .note files by default.
+  virtual NoteStorage *create_storage();
   /** add the note to the manager and setup signals */
   void add_note(const NoteBase::Ptr &);
+  // Same for notes read at startup, the list is only sorted in post_load().
+  void add_loaded_note(const NoteBase::Ptr &);
   void on_note_rename(const NoteBase::Ptr & note, const Glib::ustring & old_title);
   void on_note_save(const NoteBase::Ptr & note);
+  void reorder_note(const NoteBase::Ptr & note);
+  // Save queue failed to write the file, called in main thread.
+  virtual void on_note_write_failed(const Glib::ustring & file_path, const Glib::ustring & error);
+  NoteBase::Ptr find_by_file_path(const Glib::ustring & file_path) const;
   virtual NoteBase::Ptr create_note_from_template(const Glib::ustring & title,
                                                   const NoteBase::Ptr & template_note,
                                                   const Glib::ustring & guid);
@@ -106,19 +188,54 @@ protected:
   Glib::ustring make_new_file_name() const;
   Glib::ustring make_new_file_name(const Glib::ustring & guid) const;
   virtual NoteBase::Ptr note_load(const Glib::ustring & file_name) = 0;
+  virtual NoteBase::Ptr note_create_existing(NoteData *data, const Glib::ustring & file_name) = 0;
+  void notify_note_added(const NoteBase::Ptr & note);
 
   NoteBase::List m_notes;
   Glib::ustring m_start_note_uri;
   Glib::ustring m_backup_dir;
   Glib::ustring m_default_note_template_title;
+  std::size_t m_undo_memory_limit;
 private:
+  // Numeric suffixes in use for a single title base name, i.e. the N values of "basename N".
+  // Used suffixes are kept as ranges, so that the lowest free one is always at hand.
+  class TitleSuffixes
+  {
+  public:
+    void add(int suffix);
+    void remove(int suffix);
+    int first_free() const;
+    bool empty() const
+      {
+        return m_counts.empty();
+      }
+  private:
+    std::map<int, int> m_counts;
+    std::map<int, int> m_ranges;
+  };
+
+  static bool split_title_suffix(const Glib::ustring & title, Glib::ustring & basename, int & suffix);
   void create_notes_dir() const;
   bool create_directory(const Glib::ustring & directory) const;
   TrieController *create_trie_controller();
+  void add_title_suffix(const NoteBase::Ptr & note);
+  void remove_title_suffix(const NoteBase::Ptr & note);
 
   TrieController *m_trie_controller;
+  std::map<Glib::ustring, TitleSuffixes> m_title_suffixes;
+  std::map<const NoteBase*, std::pair<Glib::ustring, int>> m_note_title_suffixes;
+  int m_bulk_add_depth;
+  NoteBase::List m_bulk_added;
   Glib::ustring m_notes_dir;
   bool m_read_only;
+  unsigned m_saves_written;
+  unsigned m_saves_skipped;
+  // save queue writes through storage and history, so they must go first
+  std::unique_ptr<NoteStorage> m_storage;
+  std::unique_ptr<NoteHistory> m_history;
+  NoteSaveQueue m_save_queue;
+  std::unique_ptr<NoteBackupStore> m_backups;
+  std::unique_ptr<NoteBufferCache> m_buffer_cache;
 };
 
 }
@@ -0,0 +1,234 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <glibmm/i18n.h>
+
+#include "debug.hpp"
+#include "notehistory.hpp"
+#include "notesavequeue.hpp"
+#include "notestorage.hpp"
+#include "sharp/files.hpp"
+#include "utils.hpp"
+
+
+namespace gnote {
+
+NoteSaveQueue::NoteSaveQueue()
+  : m_thread(NULL)
+  , m_storage(NULL)
+  , m_history(NULL)
+  , m_stop(false)
+  , m_queued(0)
+  , m_written(0)
+  , m_coalesced(0)
+{
+}
+
+NoteSaveQueue::~NoteSaveQueue()
+{
+  Glib::Threads::Thread *thread;
+  {
+    Glib::Threads::Mutex::Lock lock(m_mutex);
+    m_stop = true;
+    m_pending_cond.signal();
+    thread = m_thread;
+    m_thread = NULL;
+  }
+  // writer finishes everything pending before exiting
+  if(thread) {
+    thread->join();
+  }
+}
+
+void NoteSaveQueue::storage(NoteStorage *storage)
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  m_storage = storage;
+}
+
+void NoteSaveQueue::history(NoteHistory *history)
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  m_history = history;
+}
+
+void NoteSaveQueue::enqueue(const Glib::ustring & file_path, NoteData *data)
+{
+  std::unique_ptr<NoteData> snapshot(data);
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  ++m_queued;
+  std::unique_ptr<NoteData> & pending = m_pending[file_path];
+  if(pending) {
+    ++m_coalesced;
+  }
+  pending.swap(snapshot);
+  if(!m_thread) {
+    m_thread = Glib::Threads::Thread::create(sigc::mem_fun(*this, &NoteSaveQueue::writer_thread));
+  }
+  m_pending_cond.signal();
+  // replaced snapshot, if any, is destroyed after the lock is released
+}
+
+void NoteSaveQueue::cancel(const Glib::ustring & file_path)
+{
+  std::unique_ptr<NoteData> snapshot;
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  auto iter = m_pending.find(file_path);
+  if(iter != m_pending.end()) {
+    snapshot.swap(iter->second);
+    m_pending.erase(iter);
+  }
+  while(m_writing == file_path) {
+    m_done_cond.wait(m_mutex);
+  }
+}
+
+void NoteSaveQueue::flush()
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  while(!m_pending.empty() || !m_writing.empty()) {
+    m_done_cond.wait(m_mutex);
+  }
+}
+
+unsigned NoteSaveQueue::pending() const
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  return m_pending.size() + (m_writing.empty() ? 0 : 1);
+}
+
+unsigned NoteSaveQueue::queued() const
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  return m_queued;
+}
+
+unsigned NoteSaveQueue::written() const
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  return m_written;
+}
+
+unsigned NoteSaveQueue::coalesced() const
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  return m_coalesced;
+}
+
+void NoteSaveQueue::writer_thread()
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  while(true) {
+    while(m_pending.empty() && !m_stop) {
+      m_pending_cond.wait(m_mutex);
+    }
+    if(m_pending.empty()) {
+      break;
+    }
+
+    auto iter = m_pending.begin();
+    Glib::ustring file_path = iter->first;
+    std::unique_ptr<NoteData> data(std::move(iter->second));
+    m_pending.erase(iter);
+    m_writing = file_path;
+    NoteStorage *storage = m_storage;
+    NoteHistory *history = m_history;
+    lock.release();
+
+    DBG_OUT("Writing note %s", file_path.c_str());
+    bool failed = false;
+    Glib::ustring error;
+    // history needs the XML too, so it is serialized once for both
+    std::string xml;
+    try {
+      if(history) {
+        xml = NoteArchiver::write_string(*data).raw();
+        if(storage) {
+          storage->write_xml(file_path, xml);
+        }
+        else {
+          sharp::file_write_atomic(file_path, xml, NoteArchiver::obj().file_sync());
+        }
+      }
+      else if(storage) {
+        storage->write(file_path, *data);
+      }
+      else {
+        NoteArchiver::write(file_path, *data);
+      }
+    }
+    catch(const Glib::Exception & e) {
+      ERR_OUT(_("Exception while saving note: %s"), e.what().c_str());
+      failed = true;
+      error = e.what();
+    }
+    catch(const std::exception & e) {
+      ERR_OUT(_("Exception while saving note: %s"), e.what());
+      failed = true;
+      error = e.what();
+    }
+    data.reset();
+
+    // note is saved, failure to keep its history is not a failed save
+    if(history && !failed) {
+      try {
+        history->record(sharp::file_basename(file_path), xml);
+      }
+      catch(const Glib::Exception & e) {
+        ERR_OUT(_("Failed to record note history: %s"), e.what().c_str());
+      }
+      catch(const std::exception & e) {
+        ERR_OUT(_("Failed to record note history: %s"), e.what());
+      }
+    }
+
+    lock.acquire();
+    if(failed) {
+      write_failed(file_path, error);
+    }
+    m_writing.clear();
+    ++m_written;
+    m_done_cond.broadcast();
+  }
+}
+
+void NoteSaveQueue::write_failed(const Glib::ustring & file_path, const Glib::ustring & error)
+{
+  // called with mutex locked, failures in a row are reported at once
+  if(m_failed.empty()) {
+    utils::main_context_invoke(sigc::mem_fun(*this, &NoteSaveQueue::report_failures));
+  }
+  m_failed.push_back(std::make_pair(file_path, error));
+}
+
+void NoteSaveQueue::report_failures()
+{
+  std::vector<std::pair<Glib::ustring, Glib::ustring>> failed;
+  {
+    Glib::Threads::Mutex::Lock lock(m_mutex);
+    failed.swap(m_failed);
+  }
+  for(auto & failure : failed) {
+    signal_write_failed(failure.first, failure.second);
+  }
+}
+
+}
@@ -0,0 +1,96 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef _NOTESAVEQUEUE_HPP_
+#define _NOTESAVEQUEUE_HPP_
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <glibmm/threads.h>
+
+#include "notebase.hpp"
+
+
+namespace gnote {
+
+class NoteHistory;
+class NoteStorage;
+
+/**
+ * Writes notes to disk on a dedicated thread.
+ * Main thread hands over a snapshot of note data, which is never touched
+ * by main thread afterwards. If a note is queued again before it has been
+ * written, the newer snapshot replaces the older one.
+ */
+class NoteSaveQueue
+{
+public:
+  NoteSaveQueue();
+  ~NoteSaveQueue();
+
+  // Where notes go, plain files if not set.
+  void storage(NoteStorage *storage);
+  // Written notes are also recorded there, if set.
+  void history(NoteHistory *history);
+
+  // Takes ownership of data.
+  void enqueue(const Glib::ustring & file_path, NoteData *data);
+  // Drop pending write for file, waits if it is being written right now.
+  void cancel(const Glib::ustring & file_path);
+  // Block until everything queued so far is on disk.
+  void flush();
+  // Number of notes waiting to be written, including the one being written.
+  unsigned pending() const;
+
+  unsigned queued() const;
+  unsigned written() const;
+  // Writes, that were replaced by newer ones before being done
+  unsigned coalesced() const;
+
+  // Emitted in main thread with file path and error message for each failed write.
+  typedef sigc::signal<void, const Glib::ustring &, const Glib::ustring &> WriteFailedHandler;
+  WriteFailedHandler signal_write_failed;
+private:
+  void writer_thread();
+  void write_failed(const Glib::ustring & file_path, const Glib::ustring & error);
+  void report_failures();
+
+  mutable Glib::Threads::Mutex m_mutex;
+  Glib::Threads::Cond m_pending_cond;
+  Glib::Threads::Cond m_done_cond;
+  Glib::Threads::Thread *m_thread;
+  NoteStorage *m_storage;
+  NoteHistory *m_history;
+  std::map<Glib::ustring, std::unique_ptr<NoteData>> m_pending;
+  Glib::ustring m_writing;
+  // failed writes, not yet reported in main thread
+  std::vector<std::pair<Glib::ustring, Glib::ustring>> m_failed;
+  bool m_stop;
+  unsigned m_queued;
+  unsigned m_written;
+  unsigned m_coalesced;
+};
+
+}
+
+#endif
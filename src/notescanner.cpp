@@ -0,0 +1,464 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <glib.h>
+
+#include "notescanner.hpp"
+
+
+namespace gnote {
+
+namespace {
+
+const char SUPPORTED_VERSION[] = "0.3";
+
+bool is_name_char(char c)
+{
+  return g_ascii_isalnum(c) || c == '-' || c == '_' || c == ':' || c == '.' || (c & 0x80);
+}
+
+bool equals(const NoteScanner::Span & span, const char *str)
+{
+  size_t len = strlen(str);
+  return size_t(span.end - span.begin) == len && memcmp(span.begin, str, len) == 0;
+}
+
+bool equals(const NoteScanner::Span & a, const NoteScanner::Span & b)
+{
+  return (a.end - a.begin) == (b.end - b.begin) && memcmp(a.begin, b.begin, a.end - a.begin) == 0;
+}
+
+bool starts_with(const char *pos, const char *end, const char *str, size_t len)
+{
+  return size_t(end - pos) >= len && memcmp(pos, str, len) == 0;
+}
+
+// Length of the entity reference at pos, 0 if it is not one we handle.
+// Apostrophe and quote entities are never produced when serializing text.
+size_t entity_length(const char *pos, const char *end, bool quotes, char *decoded = NULL)
+{
+  struct Entity {
+    const char *name;
+    size_t len;
+    char value;
+    bool quote;
+  };
+  static const Entity entities[] = {
+    { "&amp;", 5, '&', false },
+    { "&lt;", 4, '<', false },
+    { "&gt;", 4, '>', false },
+    { "&quot;", 6, '"', true },
+    { "&apos;", 6, '\'', true },
+  };
+  for(const Entity & entity : entities) {
+    if((quotes || !entity.quote) && starts_with(pos, end, entity.name, entity.len)) {
+      if(decoded) {
+        *decoded = entity.value;
+      }
+      return entity.len;
+    }
+  }
+  return 0;
+}
+
+}
+
+
+NoteScanner::NoteScanner(const char *contents, size_t length)
+  : m_pos(contents)
+  , m_end(contents + length)
+  , m_contents(contents)
+{
+}
+
+bool NoteScanner::scan()
+{
+  size_t length = m_end - m_contents;
+  if(length == 0 || !g_utf8_validate(m_contents, length, NULL)) {
+    return false;
+  }
+  // libxml2 normalizes line ends
+  if(memchr(m_contents, '\r', length)) {
+    return false;
+  }
+
+  m_pos = m_contents;
+  if(!skip_declaration()) {
+    return false;
+  }
+  skip_whitespace();
+  Span name;
+  if(!parse_start_tag(name, &m_version) || !equals(name, "note")) {
+    return false;
+  }
+  if(!m_version.is_set() || !equals(m_version, SUPPORTED_VERSION)) {
+    return false;
+  }
+
+  while(true) {
+    skip_whitespace();
+    if(skip("</note>")) {
+      skip_whitespace();
+      return m_pos == m_end && m_text.is_set();
+    }
+    if(!parse_start_tag(name, NULL)) {
+      return false;
+    }
+    if(equals(name, "text")) {
+      if(!parse_text()) {
+        return false;
+      }
+    }
+    else if(equals(name, "tags")) {
+      if(!parse_tags()) {
+        return false;
+      }
+    }
+    else {
+      Span content;
+      if(!parse_simple_element(name, content)) {
+        return false;
+      }
+      Span *target = field(name);
+      if(target) {
+        *target = content;
+      }
+    }
+  }
+}
+
+bool NoteScanner::skip_declaration()
+{
+  if(!skip("<?xml")) {
+    return true;
+  }
+  static const char decl_end[] = "?>";
+  const char *end = std::search(m_pos, m_end, decl_end, decl_end + 2);
+  if(end == m_end) {
+    return false;
+  }
+  static const char encoding[] = "encoding=";
+  const char *enc = std::search(m_pos, end, encoding, encoding + sizeof(encoding) - 1);
+  if(enc != end) {
+    enc += sizeof(encoding) - 1;
+    if(end - enc < 7 || (enc[0] != '"' && enc[0] != '\'')
+       || g_ascii_strncasecmp(enc + 1, "utf-8", 5) != 0 || enc[6] != enc[0]) {
+      return false;
+    }
+  }
+  m_pos = end + 2;
+  return true;
+}
+
+void NoteScanner::skip_whitespace()
+{
+  while(m_pos < m_end && (*m_pos == ' ' || *m_pos == '\n' || *m_pos == '\t')) {
+    ++m_pos;
+  }
+}
+
+bool NoteScanner::skip(const char *str)
+{
+  size_t len = strlen(str);
+  if(!starts_with(m_pos, m_end, str, len)) {
+    return false;
+  }
+  m_pos += len;
+  return true;
+}
+
+bool NoteScanner::parse_start_tag(Span & name, Span *version)
+{
+  if(m_pos >= m_end || *m_pos != '<') {
+    return false;
+  }
+  const char *name_begin = ++m_pos;
+  while(m_pos < m_end && is_name_char(*m_pos)) {
+    ++m_pos;
+  }
+  if(m_pos == name_begin) {
+    return false;
+  }
+  name = Span(name_begin, m_pos);
+
+  while(true) {
+    const char *attr_begin = m_pos;
+    skip_whitespace();
+    if(m_pos >= m_end) {
+      return false;
+    }
+    if(*m_pos == '>') {
+      ++m_pos;
+      return true;
+    }
+    if(attr_begin == m_pos) {
+      return false;
+    }
+    attr_begin = m_pos;
+    while(m_pos < m_end && is_name_char(*m_pos)) {
+      ++m_pos;
+    }
+    Span attr_name(attr_begin, m_pos);
+    if(attr_begin == m_pos || !skip("=\"")) {
+      return false;
+    }
+    const char *value_begin = m_pos;
+    while(m_pos < m_end && *m_pos != '"') {
+      if(*m_pos == '&' || *m_pos == '<') {
+        return false;
+      }
+      ++m_pos;
+    }
+    if(m_pos >= m_end) {
+      return false;
+    }
+    if(version && equals(attr_name, "version")) {
+      *version = Span(value_begin, m_pos);
+    }
+    ++m_pos;
+  }
+}
+
+bool NoteScanner::parse_simple_element(const Span & name, Span & content)
+{
+  const char *begin = m_pos;
+  while(m_pos < m_end && *m_pos != '<') {
+    ++m_pos;
+  }
+  content = Span(begin, m_pos);
+  if(!is_canonical_text(content, false)) {
+    return false;
+  }
+  if(!skip("</") || !starts_with(m_pos, m_end, name.begin, name.end - name.begin)) {
+    return false;
+  }
+  m_pos += name.end - name.begin;
+  return skip(">");
+}
+
+bool NoteScanner::parse_tags()
+{
+  static const char tag[] = "tag";
+  Span tag_name(tag, tag + 3);
+  while(true) {
+    skip_whitespace();
+    if(skip("</tags>")) {
+      return true;
+    }
+    if(!skip("<tag>")) {
+      return false;
+    }
+    Span content;
+    if(!parse_simple_element(tag_name, content)) {
+      return false;
+    }
+    m_tags.push_back(content);
+  }
+}
+
+bool NoteScanner::parse_text()
+{
+  static const char text_end[] = "</text>";
+  const char *end = std::search(m_pos, m_end, text_end, text_end + sizeof(text_end) - 1);
+  if(end == m_end) {
+    return false;
+  }
+  m_text = Span(m_pos, end);
+  if(!is_canonical_markup(m_text)) {
+    return false;
+  }
+  m_pos = end + sizeof(text_end) - 1;
+  return true;
+}
+
+NoteScanner::Span *NoteScanner::field(const Span & name)
+{
+  if(equals(name, "title")) {
+    return &m_title;
+  }
+  if(equals(name, "last-change-date")) {
+    return &m_last_change_date;
+  }
+  if(equals(name, "last-metadata-change-date")) {
+    return &m_last_metadata_change_date;
+  }
+  if(equals(name, "create-date")) {
+    return &m_create_date;
+  }
+  if(equals(name, "cursor-position")) {
+    return &m_cursor_position;
+  }
+  if(equals(name, "selection-bound-position")) {
+    return &m_selection_bound_position;
+  }
+  if(equals(name, "width")) {
+    return &m_width;
+  }
+  if(equals(name, "height")) {
+    return &m_height;
+  }
+  return NULL;
+}
+
+bool NoteScanner::is_canonical_text(const Span & span, bool markup)
+{
+  for(const char *pos = span.begin; pos < span.end; ) {
+    if(*pos == '&') {
+      size_t len = entity_length(pos, span.end, !markup);
+      if(len == 0) {
+        return false;
+      }
+      pos += len;
+    }
+    else if(*pos == '>' && markup) {
+      // serialized as &gt;
+      return false;
+    }
+    else {
+      ++pos;
+    }
+  }
+  return true;
+}
+
+bool NoteScanner::is_canonical_markup(const Span & span)
+{
+  std::vector<Span> open;
+  const char *last_start_tag_end = NULL;
+  const char *text_begin = span.begin;
+  const char *pos = span.begin;
+  while(pos < span.end) {
+    if(*pos != '<') {
+      ++pos;
+      continue;
+    }
+    if(!is_canonical_text(Span(text_begin, pos), true)) {
+      return false;
+    }
+    if(span.end - pos < 2) {
+      return false;
+    }
+    if(pos[1] == '/') {
+      // empty elements are serialized as <name/>
+      if(open.empty() || last_start_tag_end == pos) {
+        return false;
+      }
+      const char *name_begin = pos + 2;
+      pos = name_begin;
+      while(pos < span.end && is_name_char(*pos)) {
+        ++pos;
+      }
+      if(pos >= span.end || *pos != '>' || !equals(open.back(), Span(name_begin, pos))) {
+        return false;
+      }
+      open.pop_back();
+      text_begin = ++pos;
+      continue;
+    }
+
+    // start tag, comments, CDATA and processing instructions fail here
+    const char *name_begin = ++pos;
+    while(pos < span.end && is_name_char(*pos)) {
+      ++pos;
+    }
+    if(pos == name_begin) {
+      return false;
+    }
+    open.push_back(Span(name_begin, pos));
+    while(pos < span.end && *pos == ' ') {
+      const char *attr_begin = ++pos;
+      while(pos < span.end && is_name_char(*pos)) {
+        ++pos;
+      }
+      if(pos == attr_begin || !starts_with(pos, span.end, "=\"", 2)) {
+        return false;
+      }
+      pos += 2;
+      while(pos < span.end && *pos != '"') {
+        if(*pos == '&' || *pos == '<' || *pos == '>' || *pos == '\n' || *pos == '\t') {
+          return false;
+        }
+        ++pos;
+      }
+      if(pos >= span.end) {
+        return false;
+      }
+      ++pos;
+    }
+    if(pos >= span.end || *pos != '>') {
+      return false;
+    }
+    text_begin = ++pos;
+    last_start_tag_end = pos;
+  }
+
+  return open.empty() && is_canonical_text(Span(text_begin, span.end), true);
+}
+
+Glib::ustring NoteScanner::unescape(const Span & span)
+{
+  const char *amp = static_cast<const char*>(memchr(span.begin, '&', span.end - span.begin));
+  if(!amp) {
+    return span.ustr();
+  }
+
+  std::string result(span.begin, amp);
+  for(const char *pos = amp; pos < span.end; ) {
+    char decoded;
+    size_t len = *pos == '&' ? entity_length(pos, span.end, true, &decoded) : 0;
+    if(len) {
+      result += decoded;
+      pos += len;
+    }
+    else {
+      result += *pos++;
+    }
+  }
+  return result;
+}
+
+bool NoteScanner::to_int(const Span & span, int & value)
+{
+  const char *pos = span.begin;
+  bool negative = pos < span.end && *pos == '-';
+  if(negative) {
+    ++pos;
+  }
+  // keep well within int range
+  if(pos == span.end || span.end - pos > 9) {
+    return false;
+  }
+  int result = 0;
+  for(; pos < span.end; ++pos) {
+    if(!g_ascii_isdigit(*pos)) {
+      return false;
+    }
+    result = result * 10 + (*pos - '0');
+  }
+  value = negative ? -result : result;
+  return true;
+}
+
+}
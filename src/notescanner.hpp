@@ -0,0 +1,160 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef _NOTESCANNER_HPP_
+#define _NOTESCANNER_HPP_
+
+#include <string>
+#include <vector>
+
+#include <glibmm/ustring.h>
+
+
+namespace gnote {
+
+/**
+ * Scanner for note files as written by NoteArchiver (format 0.3).
+ * Locates the fields in the raw file contents without building any tree,
+ * results point into the scanned memory.
+ * Anything unusual (other format versions, comments, CDATA, character
+ * references, markup that libxml2 would serialize differently etc.)
+ * makes scan() fail, in which case the caller should use the libxml2 reader.
+ */
+class NoteScanner
+{
+public:
+  struct Span
+  {
+    Span()
+      : begin(NULL)
+      , end(NULL)
+      {}
+    Span(const char *b, const char *e)
+      : begin(b)
+      , end(e)
+      {}
+    bool is_set() const
+      {
+        return begin != NULL;
+      }
+    std::string str() const
+      {
+        return std::string(begin, end);
+      }
+    // Raw bytes as UTF-8 string, no unescaping done
+    Glib::ustring ustr() const
+      {
+        return Glib::ustring(begin, end);
+      }
+
+    const char *begin;
+    const char *end;
+  };
+
+  NoteScanner(const char *contents, size_t length);
+
+  bool scan();
+
+  const Span & version() const
+    {
+      return m_version;
+    }
+  const Span & title() const
+    {
+      return m_title;
+    }
+  // Inner XML of the text element, byte-identical to what libxml2 gives
+  const Span & text() const
+    {
+      return m_text;
+    }
+  const Span & last_change_date() const
+    {
+      return m_last_change_date;
+    }
+  const Span & last_metadata_change_date() const
+    {
+      return m_last_metadata_change_date;
+    }
+  const Span & create_date() const
+    {
+      return m_create_date;
+    }
+  const Span & cursor_position() const
+    {
+      return m_cursor_position;
+    }
+  const Span & selection_bound_position() const
+    {
+      return m_selection_bound_position;
+    }
+  const Span & width() const
+    {
+      return m_width;
+    }
+  const Span & height() const
+    {
+      return m_height;
+    }
+  const std::vector<Span> & tags() const
+    {
+      return m_tags;
+    }
+
+  // Text content of a simple element, with entities decoded
+  static Glib::ustring unescape(const Span & span);
+  // Parse an integer element, returns false if not a valid integer
+  static bool to_int(const Span & span, int & value);
+private:
+  bool skip_declaration();
+  void skip_whitespace();
+  bool skip(const char *str);
+  bool parse_start_tag(Span & name, Span *version);
+  bool parse_simple_element(const Span & name, Span & content);
+  bool parse_tags();
+  bool parse_text();
+  Span *field(const Span & name);
+
+  // Only entities unescape() knows are allowed; inside markup the text
+  // must also come back unchanged when libxml2 serializes it.
+  static bool is_canonical_text(const Span & span, bool markup);
+  static bool is_canonical_markup(const Span & span);
+
+  const char *m_pos;
+  const char *m_end;
+  const char *m_contents;
+
+  Span m_version;
+  Span m_title;
+  Span m_text;
+  Span m_last_change_date;
+  Span m_last_metadata_change_date;
+  Span m_create_date;
+  Span m_cursor_position;
+  Span m_selection_bound_position;
+  Span m_width;
+  Span m_height;
+  std::vector<Span> m_tags;
+};
+
+}
+
+#endif
@@ -0,0 +1,592 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <glib/gstdio.h>
+#include <glibmm/fileutils.h>
+#include <glibmm/i18n.h>
+#include <glibmm/miscutils.h>
+
+#include "debug.hpp"
+#include "notestorage.hpp"
+#include "sharp/directory.hpp"
+#include "sharp/exception.hpp"
+#include "sharp/files.hpp"
+
+
+namespace gnote {
+
+NoteStorage::~NoteStorage()
+{
+}
+
+
+FileNoteStorage::FileNoteStorage(const Glib::ustring & directory)
+  : m_directory(directory)
+{
+}
+
+std::vector<Glib::ustring> FileNoteStorage::list_notes()
+{
+  return sharp::directory_get_files_with_ext(m_directory, ".note");
+}
+
+bool FileNoteStorage::exists(const Glib::ustring & file_path)
+{
+  return sharp::file_exists(file_path);
+}
+
+Glib::ustring FileNoteStorage::read(const Glib::ustring & file_path, NoteData & data)
+{
+  return NoteArchiver::obj().read_file(file_path, data);
+}
+
+std::string FileNoteStorage::read_xml(const Glib::ustring & file_path)
+{
+  return Glib::file_get_contents(file_path);
+}
+
+void FileNoteStorage::write(const Glib::ustring & file_path, const NoteData & data)
+{
+  NoteArchiver::write(file_path, data);
+}
+
+void FileNoteStorage::write_xml(const Glib::ustring & file_path, const std::string & xml)
+{
+  sharp::file_write_atomic(file_path, xml, NoteArchiver::obj().file_sync());
+}
+
+void FileNoteStorage::import_file(const Glib::ustring & source, const Glib::ustring & file_path)
+{
+  sharp::file_copy(source, file_path);
+}
+
+void FileNoteStorage::remove(const Glib::ustring & file_path)
+{
+  if(sharp::file_exists(file_path)) {
+    sharp::file_delete(file_path);
+  }
+}
+
+
+namespace {
+
+const char PACK_FILE_NAME[] = "notes.pack";
+const char PACK_MAGIC[] = "GNOTEPK1";
+const size_t PACK_HEADER_LENGTH = sizeof(PACK_MAGIC) - 1;
+// type, key length, value length, checksum
+const size_t RECORD_HEADER_LENGTH = 1 + 4 + 4 + 4;
+// don't bother compacting small packs
+const size_t COMPACT_MIN_DEAD_BYTES = 1024 * 1024;
+
+void put_u32(std::string & str, guint32 value)
+{
+  for(int i = 0; i < 4; ++i) {
+    str += char((value >> (8 * i)) & 0xff);
+  }
+}
+
+guint32 get_u32(const char *data)
+{
+  guint32 value = 0;
+  for(int i = 3; i >= 0; --i) {
+    value = (value << 8) | guchar(data[i]);
+  }
+  return value;
+}
+
+// FNV-1a, detects records torn by a crash
+guint32 checksum(char type, const char *key, size_t key_length, const char *value, size_t value_length)
+{
+  guint32 hash = 2166136261u;
+  auto add = [&hash](const char *data, size_t length) {
+    for(size_t i = 0; i < length; ++i) {
+      hash = (hash ^ guchar(data[i])) * 16777619u;
+    }
+  };
+  add(&type, 1);
+  add(key, key_length);
+  add(value, value_length);
+  return hash;
+}
+
+void throw_errno(const char *what, const Glib::ustring & path, int err)
+{
+  throw sharp::Exception(Glib::ustring::compose("%1 %2: %3", what, path, g_strerror(err)));
+}
+
+void write_all(int fd, const char *data, size_t length, off_t offset, const Glib::ustring & path)
+{
+  while(length > 0) {
+    ssize_t written = pwrite(fd, data, length, offset);
+    if(written < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      throw_errno("Failed to write to file", path, errno);
+    }
+    data += written;
+    length -= written;
+    offset += written;
+  }
+}
+
+void read_all(int fd, char *data, size_t length, off_t offset, const Glib::ustring & path)
+{
+  while(length > 0) {
+    ssize_t count = pread(fd, data, length, offset);
+    if(count < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      throw_errno("Failed to read file", path, errno);
+    }
+    if(count == 0) {
+      throw sharp::Exception("Unexpected end of file " + path);
+    }
+    data += count;
+    length -= count;
+    offset += count;
+  }
+}
+
+void sync_directory(const Glib::ustring & directory)
+{
+  int dir_fd = g_open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+  if(dir_fd < 0) {
+    throw_errno("Failed to open directory", directory, errno);
+  }
+  int res = fsync(dir_fd);
+  int err = errno;
+  close(dir_fd);
+  if(res != 0) {
+    throw_errno("Failed to sync directory", directory, err);
+  }
+}
+
+}
+
+
+Glib::ustring PackedNoteStorage::pack_path(const Glib::ustring & directory)
+{
+  return Glib::build_filename(directory, PACK_FILE_NAME);
+}
+
+PackedNoteStorage::PackedNoteStorage(const Glib::ustring & directory)
+  : m_directory(directory)
+  , m_path(pack_path(directory))
+  , m_fd(-1)
+  , m_size(0)
+  , m_live(0)
+  , m_compaction_thread(NULL)
+  , m_compacting(false)
+{
+  load();
+}
+
+PackedNoteStorage::~PackedNoteStorage()
+{
+  if(m_compaction_thread) {
+    m_compaction_thread->join();
+  }
+  if(m_fd >= 0) {
+    close(m_fd);
+  }
+}
+
+void PackedNoteStorage::load()
+{
+  m_fd = g_open(m_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if(m_fd < 0) {
+    throw_errno("Failed to open file", m_path, errno);
+  }
+  struct stat st;
+  if(fstat(m_fd, &st) != 0) {
+    throw_errno("Failed to stat file", m_path, errno);
+  }
+
+  if(st.st_size == 0) {
+    write_all(m_fd, PACK_MAGIC, PACK_HEADER_LENGTH, 0, m_path);
+    m_size = PACK_HEADER_LENGTH;
+    return;
+  }
+
+  GMappedFile *mapped = g_mapped_file_new_from_fd(m_fd, FALSE, NULL);
+  if(!mapped) {
+    throw_errno("Failed to map file", m_path, errno);
+  }
+  const char *contents = g_mapped_file_get_contents(mapped);
+  size_t length = g_mapped_file_get_length(mapped);
+  if(length < PACK_HEADER_LENGTH || memcmp(contents, PACK_MAGIC, PACK_HEADER_LENGTH) != 0) {
+    g_mapped_file_unref(mapped);
+    close(m_fd);
+    m_fd = -1;
+    throw sharp::Exception("Not a note pack: " + m_path);
+  }
+
+  size_t pos = PACK_HEADER_LENGTH;
+  while(pos < length) {
+    RecordType type;
+    Glib::ustring key;
+    size_t value_offset, value_length;
+    size_t record_length = parse_record(contents + pos, length - pos, type, key, value_offset, value_length);
+    if(record_length == 0) {
+      // the tail was torn by a crash, drop it
+      ERR_OUT(_("Discarding %d damaged bytes at the end of %s"), int(length - pos), m_path.c_str());
+      if(ftruncate(m_fd, pos) != 0) {
+        g_mapped_file_unref(mapped);
+        throw_errno("Failed to truncate file", m_path, errno);
+      }
+      break;
+    }
+    apply_record(m_index, m_live, pos, record_length, type, key, value_offset, value_length);
+    pos += record_length;
+  }
+  m_size = pos;
+  g_mapped_file_unref(mapped);
+}
+
+std::string PackedNoteStorage::make_record_head(RecordType type, const Glib::ustring & key, const std::string & value)
+{
+  std::string head;
+  head.reserve(RECORD_HEADER_LENGTH + key.bytes());
+  head += char(type);
+  put_u32(head, key.bytes());
+  put_u32(head, value.size());
+  put_u32(head, checksum(char(type), key.data(), key.bytes(), value.data(), value.size()));
+  head += key.raw();
+  return head;
+}
+
+size_t PackedNoteStorage::parse_record(const char *data, size_t length, RecordType & type, Glib::ustring & key,
+                                       size_t & value_offset, size_t & value_length)
+{
+  if(length < RECORD_HEADER_LENGTH) {
+    return 0;
+  }
+  if(data[0] != RECORD_PUT && data[0] != RECORD_DELETE) {
+    return 0;
+  }
+  size_t key_length = get_u32(data + 1);
+  value_length = get_u32(data + 5);
+  if(key_length > length - RECORD_HEADER_LENGTH
+     || value_length > length - RECORD_HEADER_LENGTH - key_length) {
+    return 0;
+  }
+  const char *key_data = data + RECORD_HEADER_LENGTH;
+  value_offset = RECORD_HEADER_LENGTH + key_length;
+  if(checksum(data[0], key_data, key_length, data + value_offset, value_length) != get_u32(data + 9)) {
+    return 0;
+  }
+  type = RecordType(data[0]);
+  key = std::string(key_data, key_length);
+  return value_offset + value_length;
+}
+
+void PackedNoteStorage::apply_record(Index & index, size_t & live, off_t offset, size_t length, RecordType type,
+                                     const Glib::ustring & key, size_t value_offset, size_t value_length)
+{
+  auto iter = index.find(key);
+  if(iter != index.end()) {
+    live -= iter->second.length;
+    index.erase(iter);
+  }
+  if(type == RECORD_PUT) {
+    Entry entry;
+    entry.offset = offset;
+    entry.length = length;
+    entry.value_offset = offset + value_offset;
+    entry.value_length = value_length;
+    index[key] = entry;
+    live += length;
+  }
+}
+
+void PackedNoteStorage::append(RecordType type, const Glib::ustring & key, const std::string & value)
+{
+  // value is written separately to avoid copying the note, a torn record fails the checksum anyway
+  std::string head = make_record_head(type, key, value);
+  write_all(m_fd, head.data(), head.size(), m_size, m_path);
+  write_all(m_fd, value.data(), value.size(), m_size + head.size(), m_path);
+  if(NoteArchiver::obj().file_sync() != sharp::FILE_SYNC_NONE && fdatasync(m_fd) != 0) {
+    throw_errno("Failed to sync file", m_path, errno);
+  }
+  size_t length = head.size() + value.size();
+  apply_record(m_index, m_live, m_size, length, type, key, head.size(), value.size());
+  m_size += length;
+}
+
+std::string PackedNoteStorage::read_value(const Glib::ustring & key)
+{
+  auto iter = m_index.find(key);
+  if(iter == m_index.end()) {
+    throw sharp::Exception("Note not found in pack: " + key);
+  }
+  std::string value(iter->second.value_length, '\0');
+  read_all(m_fd, &value[0], value.size(), iter->second.value_offset, m_path);
+  return value;
+}
+
+std::vector<Glib::ustring> PackedNoteStorage::list_notes()
+{
+  std::vector<Glib::ustring> notes;
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  for(auto & entry : m_index) {
+    notes.push_back(Glib::build_filename(m_directory, entry.first));
+  }
+  return notes;
+}
+
+bool PackedNoteStorage::exists(const Glib::ustring & file_path)
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  return m_index.find(sharp::file_filename(file_path)) != m_index.end();
+}
+
+Glib::ustring PackedNoteStorage::read(const Glib::ustring & file_path, NoteData & data)
+{
+  std::string xml = read_xml(file_path);
+  return NoteArchiver::obj().read_buffer(xml, data);
+}
+
+std::string PackedNoteStorage::read_xml(const Glib::ustring & file_path)
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  return read_value(sharp::file_filename(file_path));
+}
+
+void PackedNoteStorage::write(const Glib::ustring & file_path, const NoteData & data)
+{
+  write_xml(file_path, NoteArchiver::write_string(data).raw());
+}
+
+void PackedNoteStorage::write_xml(const Glib::ustring & file_path, const std::string & xml)
+{
+  {
+    Glib::Threads::Mutex::Lock lock(m_mutex);
+    append(RECORD_PUT, sharp::file_filename(file_path), xml);
+  }
+  maybe_compact();
+}
+
+void PackedNoteStorage::import_file(const Glib::ustring & source, const Glib::ustring & file_path)
+{
+  std::string xml = Glib::file_get_contents(source);
+  {
+    Glib::Threads::Mutex::Lock lock(m_mutex);
+    append(RECORD_PUT, sharp::file_filename(file_path), xml);
+  }
+  maybe_compact();
+}
+
+void PackedNoteStorage::remove(const Glib::ustring & file_path)
+{
+  Glib::ustring key = sharp::file_filename(file_path);
+  {
+    Glib::Threads::Mutex::Lock lock(m_mutex);
+    if(m_index.find(key) == m_index.end()) {
+      return;
+    }
+    append(RECORD_DELETE, key, "");
+  }
+  maybe_compact();
+}
+
+void PackedNoteStorage::import_directory(const Glib::ustring & directory)
+{
+  std::vector<Glib::ustring> files = sharp::directory_get_files_with_ext(directory, ".note");
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  for(const Glib::ustring & file : files) {
+    append(RECORD_PUT, sharp::file_filename(file), Glib::file_get_contents(file));
+  }
+  if(fdatasync(m_fd) != 0) {
+    throw_errno("Failed to sync file", m_path, errno);
+  }
+  // pack may be new, its entry has to be on disk before the caller deletes the files
+  sync_directory(m_directory);
+}
+
+void PackedNoteStorage::export_directory(const Glib::ustring & directory)
+{
+  std::vector<Glib::ustring> keys;
+  {
+    Glib::Threads::Mutex::Lock lock(m_mutex);
+    for(auto & entry : m_index) {
+      keys.push_back(entry.first);
+    }
+  }
+  for(const Glib::ustring & key : keys) {
+    std::string xml;
+    {
+      Glib::Threads::Mutex::Lock lock(m_mutex);
+      if(m_index.find(key) == m_index.end()) {
+        continue;
+      }
+      xml = read_value(key);
+    }
+    sharp::file_write_atomic(Glib::build_filename(directory, key), xml, NoteArchiver::obj().file_sync());
+  }
+  sync_directory(directory);
+}
+
+size_t PackedNoteStorage::live_bytes() const
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  return m_live;
+}
+
+size_t PackedNoteStorage::dead_bytes() const
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  return m_size - PACK_HEADER_LENGTH - m_live;
+}
+
+void PackedNoteStorage::maybe_compact()
+{
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  size_t dead = m_size - PACK_HEADER_LENGTH - m_live;
+  if(m_compacting || dead < COMPACT_MIN_DEAD_BYTES || dead < m_live) {
+    return;
+  }
+  // previous one cleared m_compacting under this lock, so it is done with it, just reap it
+  if(m_compaction_thread) {
+    m_compaction_thread->join();
+    m_compaction_thread = NULL;
+  }
+  try {
+    m_compaction_thread = Glib::Threads::Thread::create(
+      sigc::mem_fun(*this, &PackedNoteStorage::compaction_thread));
+    m_compacting = true;
+  }
+  catch(const Glib::Threads::ThreadError & e) {
+    ERR_OUT(_("Failed to compact %s: %s"), m_path.c_str(), e.what().c_str());
+  }
+}
+
+void PackedNoteStorage::compaction_thread()
+{
+  try {
+    do_compact();
+  }
+  catch(const std::exception & e) {
+    ERR_OUT(_("Failed to compact %s: %s"), m_path.c_str(), e.what());
+  }
+  Glib::Threads::Mutex::Lock lock(m_mutex);
+  m_compacting = false;
+}
+
+void PackedNoteStorage::compact()
+{
+  do_compact();
+}
+
+void PackedNoteStorage::do_compact()
+{
+  Glib::Threads::Mutex::Lock compact_lock(m_compact_mutex);
+
+  // Records before end never change, so they can be copied without holding the lock.
+  Index old_index;
+  off_t end;
+  int old_fd;
+  {
+    Glib::Threads::Mutex::Lock lock(m_mutex);
+    old_index = m_index;
+    end = m_size;
+    old_fd = m_fd;
+  }
+
+  Glib::ustring tmp_path = m_path + ".compact";
+  int new_fd = g_open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if(new_fd < 0) {
+    throw_errno("Failed to open file", tmp_path, errno);
+  }
+
+  try {
+    Index new_index;
+    size_t new_live = 0;
+    off_t new_size = PACK_HEADER_LENGTH;
+    write_all(new_fd, PACK_MAGIC, PACK_HEADER_LENGTH, 0, tmp_path);
+    std::string record;
+    for(auto & entry : old_index) {
+      record.resize(entry.second.length);
+      read_all(old_fd, &record[0], record.size(), entry.second.offset, m_path);
+      write_all(new_fd, record.data(), record.size(), new_size, tmp_path);
+      Entry new_entry(entry.second);
+      new_entry.offset = new_size;
+      new_entry.value_offset = new_size + (entry.second.value_offset - entry.second.offset);
+      new_index[entry.first] = new_entry;
+      new_live += record.size();
+      new_size += record.size();
+    }
+
+    Glib::Threads::Mutex::Lock lock(m_mutex);
+    // replay whatever was appended in the meantime
+    if(m_size > end) {
+      std::string tail(m_size - end, '\0');
+      read_all(m_fd, &tail[0], tail.size(), end, m_path);
+      size_t pos = 0;
+      while(pos < tail.size()) {
+        RecordType type;
+        Glib::ustring key;
+        size_t value_offset, value_length;
+        size_t length = parse_record(tail.data() + pos, tail.size() - pos, type, key, value_offset, value_length);
+        if(length == 0) {
+          throw sharp::Exception("Damaged record in " + m_path);
+        }
+        write_all(new_fd, tail.data() + pos, length, new_size, tmp_path);
+        apply_record(new_index, new_live, new_size, length, type, key, value_offset, value_length);
+        new_size += length;
+        pos += length;
+      }
+    }
+
+    if(fsync(new_fd) != 0) {
+      throw_errno("Failed to sync file", tmp_path, errno);
+    }
+    if(g_rename(tmp_path.c_str(), m_path.c_str()) != 0) {
+      throw_errno("Failed to rename file to", m_path, errno);
+    }
+
+    // old file is gone now, switch to the new one before anything else can fail
+    DBG_OUT("Compacted %s from %d to %d bytes", m_path.c_str(), int(m_size), int(new_size));
+    close(m_fd);
+    m_fd = new_fd;
+    m_index.swap(new_index);
+    m_size = new_size;
+    m_live = new_live;
+  }
+  catch(...) {
+    close(new_fd);
+    g_unlink(tmp_path.c_str());
+    throw;
+  }
+
+  if(NoteArchiver::obj().file_sync() == sharp::FILE_SYNC_FILE_AND_DIR) {
+    sync_directory(m_directory);
+  }
+}
+
+}
@@ -0,0 +1,162 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef _NOTESTORAGE_HPP_
+#define _NOTESTORAGE_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <glibmm/threads.h>
+#include <glibmm/ustring.h>
+
+#include "notebase.hpp"
+
+
+namespace gnote {
+
+/**
+ * Where notes are kept on disk.
+ * Notes are always identified by their file path <notes dir>/<guid>.note,
+ * whether such file exists or not depends on the implementation.
+ * All methods may be called from any thread.
+ */
+class NoteStorage
+{
+public:
+  virtual ~NoteStorage();
+
+  virtual std::vector<Glib::ustring> list_notes() = 0;
+  virtual bool exists(const Glib::ustring & file_path) = 0;
+  // Returns note format version, notes in older format are not updated.
+  virtual Glib::ustring read(const Glib::ustring & file_path, NoteData & data) = 0;
+  // Note XML exactly as stored.
+  virtual std::string read_xml(const Glib::ustring & file_path) = 0;
+  virtual void write(const Glib::ustring & file_path, const NoteData & data) = 0;
+  // Same for note already serialized by NoteArchiver::write_string().
+  virtual void write_xml(const Glib::ustring & file_path, const std::string & xml) = 0;
+  // Store note from a .note file as is.
+  virtual void import_file(const Glib::ustring & source, const Glib::ustring & file_path) = 0;
+  virtual void remove(const Glib::ustring & file_path) = 0;
+};
+
+
+/**
+ * The classic layout, one .note file per note in notes directory.
+ */
+class FileNoteStorage
+  : public NoteStorage
+{
+public:
+  explicit FileNoteStorage(const Glib::ustring & directory);
+
+  virtual std::vector<Glib::ustring> list_notes() override;
+  virtual bool exists(const Glib::ustring & file_path) override;
+  virtual Glib::ustring read(const Glib::ustring & file_path, NoteData & data) override;
+  virtual std::string read_xml(const Glib::ustring & file_path) override;
+  virtual void write(const Glib::ustring & file_path, const NoteData & data) override;
+  virtual void write_xml(const Glib::ustring & file_path, const std::string & xml) override;
+  virtual void import_file(const Glib::ustring & source, const Glib::ustring & file_path) override;
+  virtual void remove(const Glib::ustring & file_path) override;
+private:
+  Glib::ustring m_directory;
+};
+
+
+/**
+ * All notes in a single append-only file in notes directory.
+ * Every save appends a record with the note XML, deletion appends a tombstone.
+ * Offsets of the latest records are kept in memory. Once most of the file
+ * is taken by stale records, it is rewritten in a background thread.
+ */
+class PackedNoteStorage
+  : public NoteStorage
+{
+public:
+  static Glib::ustring pack_path(const Glib::ustring & directory);
+
+  // Throws sharp::Exception if existing file is not a note pack.
+  explicit PackedNoteStorage(const Glib::ustring & directory);
+  ~PackedNoteStorage();
+
+  virtual std::vector<Glib::ustring> list_notes() override;
+  virtual bool exists(const Glib::ustring & file_path) override;
+  virtual Glib::ustring read(const Glib::ustring & file_path, NoteData & data) override;
+  virtual std::string read_xml(const Glib::ustring & file_path) override;
+  virtual void write(const Glib::ustring & file_path, const NoteData & data) override;
+  virtual void write_xml(const Glib::ustring & file_path, const std::string & xml) override;
+  virtual void import_file(const Glib::ustring & source, const Glib::ustring & file_path) override;
+  virtual void remove(const Glib::ustring & file_path) override;
+
+  // Add all .note files from directory, the pack and its directory entry are synced to disk afterwards.
+  void import_directory(const Glib::ustring & directory);
+  // Write every note as a .note file to directory and sync the directory.
+  void export_directory(const Glib::ustring & directory);
+  // Rewrite the pack without stale records, blocks until done.
+  void compact();
+
+  size_t live_bytes() const;
+  size_t dead_bytes() const;
+private:
+  enum RecordType {
+    RECORD_PUT = 1,
+    RECORD_DELETE = 2
+  };
+  struct Entry
+  {
+    off_t offset;
+    size_t length;
+    size_t value_offset;
+    size_t value_length;
+  };
+  typedef std::map<Glib::ustring, Entry> Index;
+
+  // Everything of the record, that goes before the value.
+  static std::string make_record_head(RecordType type, const Glib::ustring & key, const std::string & value);
+  static size_t parse_record(const char *data, size_t length, RecordType & type, Glib::ustring & key,
+                             size_t & value_offset, size_t & value_length);
+  static void apply_record(Index & index, size_t & live, off_t offset, size_t length, RecordType type,
+                           const Glib::ustring & key, size_t value_offset, size_t value_length);
+  void load();
+  void append(RecordType type, const Glib::ustring & key, const std::string & value);
+  std::string read_value(const Glib::ustring & key);
+  void maybe_compact();
+  void compaction_thread();
+  void do_compact();
+
+  Glib::ustring m_directory;
+  Glib::ustring m_path;
+  int m_fd;
+  off_t m_size;
+  Index m_index;
+  size_t m_live;
+  mutable Glib::Threads::Mutex m_mutex;
+  Glib::Threads::Mutex m_compact_mutex;
+  Glib::Threads::Thread *m_compaction_thread;
+  bool m_compacting;
+};
+
+}
+
+#endif
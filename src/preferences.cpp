@@ -35,6 +35,7 @@ namespace gnote {
   const char * Preferences::SCHEMA_DESKTOP_GNOME_INTERFACE = "org.gnome.desktop.interface";
 
   const char * Preferences::ENABLE_SPELLCHECKING = "enable-spellchecking";
+  const char * Preferences::ENABLE_DEFERRED_SPELLCHECKING = "enable-deferred-spellchecking";
   const char * Preferences::ENABLE_AUTO_LINKS = "enable-auto-links";
   const char * Preferences::ENABLE_URL_LINKS = "enable-url-links";
   const char * Preferences::ENABLE_WIKIWORDS = "enable-wikiwords";
@@ -65,6 +66,15 @@ namespace gnote {
   const char * Preferences::USE_STATUS_ICON = "use-status-icon";
   const char * Preferences::OPEN_NOTES_IN_NEW_WINDOW = "open-notes-in-new-window";
   const char * Preferences::AUTOSIZE_NOTE_WINDOW = "autosize-note-window";
+  const char * Preferences::NOTE_BUFFER_CACHE_SIZE = "note-buffer-cache-size";
+  const char * Preferences::UNDO_MEMORY_LIMIT = "undo-memory-limit";
+  const char * Preferences::NOTE_WRITE_SYNC = "note-write-sync";
+  const char * Preferences::NOTE_STORAGE = "note-storage";
+  const char * Preferences::BACKUP_RETENTION_DAYS = "backup-retention-days";
+  const char * Preferences::BACKUP_VERSIONS_PER_NOTE = "backup-versions-per-note";
+  const char * Preferences::NOTE_HISTORY = "note-history";
+  const char * Preferences::NOTE_HISTORY_MAX_VERSIONS = "note-history-max-versions";
+  const char * Preferences::NOTE_HISTORY_MAX_AGE_DAYS = "note-history-max-age-days";
   const char * Preferences::USE_CLIENT_SIDE_DECORATIONS = "use-client-side-decorations";
 
   const char * Preferences::MAIN_WINDOW_MAXIMIZED = "main-window-maximized";
@@ -44,6 +44,7 @@ namespace gnote {
     static const char *SCHEMA_DESKTOP_GNOME_INTERFACE;
 
     static const char *ENABLE_SPELLCHECKING;
+    static const char *ENABLE_DEFERRED_SPELLCHECKING;
     static const char *ENABLE_AUTO_LINKS;
     static const char *ENABLE_URL_LINKS;
     static const char *ENABLE_WIKIWORDS;
@@ -62,6 +63,15 @@ namespace gnote {
     static const char *USE_STATUS_ICON;
     static const char *OPEN_NOTES_IN_NEW_WINDOW;
     static const char *AUTOSIZE_NOTE_WINDOW;
+    static const char *NOTE_BUFFER_CACHE_SIZE;
+    static const char *UNDO_MEMORY_LIMIT;
+    static const char *NOTE_WRITE_SYNC;
+    static const char *NOTE_STORAGE;
+    static const char *BACKUP_RETENTION_DAYS;
+    static const char *BACKUP_VERSIONS_PER_NOTE;
+    static const char *NOTE_HISTORY;
+    static const char *NOTE_HISTORY_MAX_VERSIONS;
+    static const char *NOTE_HISTORY_MAX_AGE_DAYS;
 
     static const char *MAIN_WINDOW_MAXIMIZED;
     static const char *SEARCH_WINDOW_WIDTH;
@@ -92,6 +92,7 @@ namespace gnote {
     , m_reset_sync_addin_button(NULL)
     , m_save_sync_addin_button(NULL)
     , m_rename_behavior_combo(NULL)
+    , m_write_sync_combo(NULL)
     , m_addin_manager(note_manager.get_addin_manager())
     , m_note_manager(note_manager)
   {
@@ -309,6 +310,30 @@ namespace gnote {
       rename_behavior_box->show_all();
       options_list->attach(*rename_behavior_box, 0, options_list_row++, 1, 1);
 
+      // Durability of saved notes
+      Gtk::Grid * const write_sync_box = manage(new Gtk::Grid);
+      label = manage(make_label(_("Flush saved notes to disk: ")));
+      set_widget_tooltip(*label, _("Flushing makes notes survive a power loss, "
+                                   "at the cost of slower saving."));
+      label->set_hexpand(true);
+      write_sync_box->attach(*label, 0, 0, 1, 1);
+      m_write_sync_combo = manage(new Gtk::ComboBoxText());
+      m_write_sync_combo->append(_("Never"));
+      m_write_sync_combo->append(_("Note file"));
+      m_write_sync_combo->append(_("Note file and folder"));
+      int write_sync = settings->get_int(Preferences::NOTE_WRITE_SYNC);
+      if(0 > write_sync || 2 < write_sync) {
+        write_sync = 1;
+        settings->set_int(Preferences::NOTE_WRITE_SYNC, write_sync);
+      }
+      m_write_sync_combo->set_active(write_sync);
+      m_write_sync_combo->signal_changed().connect(
+        sigc::mem_fun(*this, &PreferencesDialog::on_write_sync_changed));
+      m_write_sync_combo->set_hexpand(true);
+      write_sync_box->attach(*m_write_sync_combo, 1, 0, 1, 1);
+      write_sync_box->show_all();
+      options_list->attach(*write_sync_box, 0, options_list_row++, 1, 1);
+
       // New Note Template
       Gtk::Grid *template_note_grid = manage(new Gtk::Grid);
       // TRANSLATORS: This is 'New Note' Template, not New 'Note Template'
@@ -987,6 +1012,12 @@ namespace gnote {
         m_rename_behavior_combo->set_active(rename_behavior);
       }
     }
+    else if(key == Preferences::NOTE_WRITE_SYNC) {
+      int write_sync = Preferences::obj().get_schema_settings(Preferences::SCHEMA_GNOTE)->get_int(key);
+      if(0 <= write_sync && write_sync <= 2 && m_write_sync_combo->get_active_row_number() != write_sync) {
+        m_write_sync_combo->set_active(write_sync);
+      }
+    }
     else if(key == Preferences::SYNC_AUTOSYNC_TIMEOUT) {
       int timeout = Preferences::obj().get_schema_settings(
           Preferences::SCHEMA_SYNC)->get_int(Preferences::SYNC_AUTOSYNC_TIMEOUT);
@@ -1014,6 +1045,13 @@ namespace gnote {
   }
 
 
+  void PreferencesDialog::on_write_sync_changed()
+  {
+    Preferences::obj().get_schema_settings(Preferences::SCHEMA_GNOTE)->set_int(
+        Preferences::NOTE_WRITE_SYNC, m_write_sync_combo->get_active_row_number());
+  }
+
+
   void PreferencesDialog::on_advanced_sync_config_button()
   {
     // Get saved behavior
@@ -74,6 +74,7 @@ private:
 
   void on_preferences_setting_changed(const Glib::ustring & key);
   void on_rename_behavior_changed();
+  void on_write_sync_changed();
 
   Glib::ustring get_selected_addin();
   void set_module_for_selected_addin(sharp::DynamicModule * module);
@@ -120,6 +121,7 @@ private:
   Gtk::CheckButton *m_autosync_check;
   Gtk::SpinButton *m_autosync_spinner;
   Gtk::ComboBoxText *m_rename_behavior_combo;
+  Gtk::ComboBoxText *m_write_sync_combo;
   AddinManager &m_addin_manager;
   NoteManager & m_note_manager;
     
@@ -94,6 +94,11 @@ namespace gnote {
     m_embed_box.set_hexpand(true);
     m_embed_box.set_vexpand(true);
     m_embed_box.show();
+    // shown only while notes in old format are being updated
+    m_format_update_progress.set_show_text(true);
+    m_content_vbox.attach(m_format_update_progress, 0, content_y_attach++, 1, 1);
+    m_note_manager.signal_format_update_progress
+      .connect(sigc::mem_fun(*this, &NoteRecentChanges::on_format_update_progress));
     m_content_vbox.show ();
 
     add (m_content_vbox);
@@ -815,6 +820,17 @@ namespace gnote {
     set_title(name);
   }
 
+  void NoteRecentChanges::on_format_update_progress(unsigned done, unsigned total)
+  {
+    if(done >= total) {
+      m_format_update_progress.hide();
+      return;
+    }
+    m_format_update_progress.set_fraction(double(done) / total);
+    m_format_update_progress.set_text(Glib::ustring::compose(_("Updating notes to current format: %1 of %2"), done, total));
+    m_format_update_progress.show();
+  }
+
   void NoteRecentChanges::on_popover_widgets_changed()
   {
     if(m_window_menu_embedded) {
@@ -28,6 +28,7 @@
 #include <gtkmm/applicationwindow.h>
 #include <gtkmm/grid.h>
 #include <gtkmm/popovermenu.h>
+#include <gtkmm/progressbar.h>
 
 #include "mainwindowaction.hpp"
 #include "note.hpp"
@@ -93,6 +94,7 @@ private:
   void on_close_window(const Glib::VariantBase&);
   void add_action(const MainWindowAction::Ptr & action);
   void on_popover_widgets_changed();
+  void on_format_update_progress(unsigned done, unsigned total);
 
   NoteManager        &m_note_manager;
   Gtk::Widget        *m_header_bar;
@@ -103,6 +105,7 @@ private:
   Gtk::ToggleButton   m_search_button;
   Gtk::Alignment      m_embedded_toolbar;
   Gtk::Grid           m_embed_box;
+  Gtk::ProgressBar    m_format_update_progress;
   Gtk::Button        *m_all_notes_button;
   Gtk::Button        *m_new_note_button;
   Gtk::Button        *m_window_actions_button;
@@ -91,6 +91,7 @@ SearchNotesWidget::SearchNotesWidget(NoteManager & m)
   // Update on changes to notes
   m.signal_note_deleted.connect(sigc::mem_fun(*this, &SearchNotesWidget::on_note_deleted));
   m.signal_note_added.connect(sigc::mem_fun(*this, &SearchNotesWidget::on_note_added));
+  m.signal_notes_added.connect(sigc::mem_fun(*this, &SearchNotesWidget::on_notes_added));
   m.signal_note_renamed.connect(sigc::mem_fun(*this, &SearchNotesWidget::on_note_renamed));
   m.signal_note_saved.connect(sigc::mem_fun(*this, &SearchNotesWidget::on_note_saved));
 
@@ -1162,6 +1163,12 @@ void SearchNotesWidget::on_note_added(const NoteBase::Ptr & note)
   add_note(std::static_pointer_cast<Note>(note));
 }
 
+void SearchNotesWidget::on_notes_added(const NoteBase::List &)
+{
+  restore_matches_window();
+  update_results();
+}
+
 void SearchNotesWidget::on_note_renamed(const NoteBase::Ptr & note,
                                         const Glib::ustring &)
 {
@@ -108,6 +108,7 @@ private:
   int compare_search_hits(const Gtk::TreeIter & , const Gtk::TreeIter &);
   void on_note_deleted(const NoteBase::Ptr & note);
   void on_note_added(const NoteBase::Ptr & note);
+  void on_notes_added(const NoteBase::List & notes);
   void on_note_renamed(const NoteBase::Ptr&, const Glib::ustring&);
   void on_note_saved(const NoteBase::Ptr&);
   void delete_note(const Note::Ptr & note);
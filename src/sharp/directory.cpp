@@ -26,12 +26,16 @@
 
 
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+
 #include <glib/gstdio.h>
 #include <glibmm/fileutils.h>
 #include <glibmm/miscutils.h>
 
 #include "sharp/directory.hpp"
-#include "sharp/fileinfo.hpp"
 #include "sharp/string.hpp"
 
 #include "debug.hpp"
@@ -39,28 +43,72 @@
 namespace sharp {
 
 
-  std::vector<Glib::ustring> directory_get_files_with_ext(const Glib::ustring & dir, const Glib::ustring & ext)
-  {
-    std::vector<Glib::ustring> list;
-    if (!Glib::file_test(dir, Glib::FILE_TEST_EXISTS))
-      return list;
-
-    if (!Glib::file_test(dir, Glib::FILE_TEST_IS_DIR))
-      return list;
+  namespace {
 
-    Glib::Dir d(dir);
+  // Calls func(path, stat) for every regular file in dir with given extension.
+  // Entry type comes from readdir when file system reports it, so files are only
+  // stat'ed when that is not known or when need_stat is set.
+  template <typename Func>
+  void for_each_file(const Glib::ustring & dir, const Glib::ustring & ext, bool need_stat, Func func)
+  {
+    DIR *d = opendir(dir.c_str());
+    if(!d) {
+      return;
+    }
 
-    for (Glib::Dir::iterator itr = d.begin(); itr != d.end(); ++itr) {
-      const Glib::ustring file(dir + "/" + *itr);
-      const sharp::FileInfo file_info(file);
-      const Glib::ustring extension = file_info.get_extension();
+    std::string prefix = dir.raw() + "/";
+    const char *suffix = ext.c_str();
+    size_t suffix_len = ext.bytes();
+    struct stat st;
+    while(struct dirent *entry = readdir(d)) {
+      size_t name_len = strlen(entry->d_name);
+      if(name_len < suffix_len
+         || g_ascii_strcasecmp(entry->d_name + name_len - suffix_len, suffix) != 0) {
+        continue;
+      }
 
-      if (Glib::file_test(file, Glib::FILE_TEST_IS_REGULAR)
-          && (ext.empty() || (Glib::ustring(extension).lowercase() == ext))) {
-        list.push_back(file);
+      bool is_regular;
+      bool have_stat = false;
+      if(entry->d_type == DT_REG && !need_stat) {
+        is_regular = true;
+      }
+      else if(entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+        is_regular = false;
+      }
+      else {
+        // follows symlinks, like Glib::file_test()
+        have_stat = fstatat(dirfd(d), entry->d_name, &st, 0) == 0;
+        is_regular = have_stat && S_ISREG(st.st_mode);
+      }
+      if(is_regular) {
+        func(prefix + entry->d_name, have_stat ? &st : NULL);
       }
     }
+    closedir(d);
+  }
+
+  }
+
 
+  std::vector<DirectoryEntry> directory_get_file_entries(const Glib::ustring & dir, const Glib::ustring & ext)
+  {
+    std::vector<DirectoryEntry> entries;
+    for_each_file(dir, ext, true, [&entries](std::string && path, const struct stat *st) {
+      DirectoryEntry entry;
+      entry.path = path;
+      entry.modification_time = gint64(st->st_mtim.tv_sec) * G_USEC_PER_SEC + st->st_mtim.tv_nsec / 1000;
+      entry.size = st->st_size;
+      entries.push_back(entry);
+    });
+    return entries;
+  }
+
+  std::vector<Glib::ustring> directory_get_files_with_ext(const Glib::ustring & dir, const Glib::ustring & ext)
+  {
+    std::vector<Glib::ustring> list;
+    for_each_file(dir, ext, false, [&list](std::string && path, const struct stat *) {
+      list.push_back(path);
+    });
     return list;
   }
 
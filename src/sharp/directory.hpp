@@ -35,6 +35,20 @@
 
 namespace sharp {
 
+  struct DirectoryEntry
+  {
+    Glib::ustring path;
+    gint64 modification_time; // microseconds since epoch
+    gint64 size;
+  };
+
+  /** 
+   * @param dir the directory to list
+   * @param ext the extension, matched case-insensitively. If empty, then all files are listed.
+   * @retval files regular files in dir along with their modification time and size
+   */
+  std::vector<DirectoryEntry> directory_get_file_entries(const Glib::ustring & dir, const Glib::ustring & ext);
+
   /** 
    * @param dir the directory to list
    * @param ext the extension. If empty, then all files are listed.
@@ -23,6 +23,10 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <fstream>
 
 #include <glib/gstdio.h>
@@ -152,5 +156,77 @@ namespace sharp {
     }
     fout.close();
   }
+
+
+  namespace {
+    void throw_errno(const char *what, const Glib::ustring & path, int err)
+    {
+      throw sharp::Exception(Glib::ustring::compose("%1 %2: %3", what, path, g_strerror(err)));
+    }
+  }
+
+  void file_write_atomic(const Glib::ustring & path, const std::string & content, FileSync sync)
+  {
+    file_write_atomic(path, [&path, &content](int fd) {
+      const char *data = content.c_str();
+      size_t remaining = content.size();
+      while(remaining > 0) {
+        ssize_t written = ::write(fd, data, remaining);
+        if(written < 0) {
+          if(errno == EINTR) {
+            continue;
+          }
+          throw_errno("Failed to write to file", path + ".tmp", errno);
+        }
+        data += written;
+        remaining -= written;
+      }
+    }, sync);
+  }
+
+  void file_write_atomic(const Glib::ustring & path, const sigc::slot<void, int> & writer, FileSync sync)
+  {
+    Glib::ustring tmp_path = path + ".tmp";
+    int fd = g_open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if(fd < 0) {
+      throw_errno("Failed to open file", tmp_path, errno);
+    }
+
+    try {
+      writer(fd);
+    }
+    catch(...) {
+      close(fd);
+      g_unlink(tmp_path.c_str());
+      throw;
+    }
+    if(sync != FILE_SYNC_NONE && fsync(fd) != 0) {
+      int err = errno;
+      close(fd);
+      throw_errno("Failed to sync file", tmp_path, err);
+    }
+    if(close(fd) != 0) {
+      throw_errno("Failed to close file", tmp_path, errno);
+    }
+
+    if(g_rename(tmp_path.c_str(), path.c_str()) != 0) {
+      throw_errno("Failed to rename file to", path, errno);
+    }
+
+    if(sync == FILE_SYNC_FILE_AND_DIR) {
+      // make the rename itself durable
+      Glib::ustring dir = Glib::path_get_dirname(path);
+      int dir_fd = g_open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+      if(dir_fd < 0) {
+        throw_errno("Failed to open directory", dir, errno);
+      }
+      int res = fsync(dir_fd);
+      int err = errno;
+      close(dir_fd);
+      if(res != 0) {
+        throw_errno("Failed to sync directory", dir, err);
+      }
+    }
+  }
 }
 
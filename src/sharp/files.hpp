@@ -30,9 +30,17 @@
 
 #include <giomm/file.h>
 #include <glibmm/ustring.h>
+#include <sigc++/sigc++.h>
 
 namespace sharp {
 
+  /** how far file_write_atomic() goes to make data survive a power loss */
+  enum FileSync {
+    FILE_SYNC_NONE,         // leave it to the OS
+    FILE_SYNC_FILE,         // fsync file contents before rename
+    FILE_SYNC_FILE_AND_DIR  // also fsync the directory after rename
+  };
+
   bool file_exists(const Glib::ustring & p);
   void file_delete(const Glib::ustring & p);
   void file_move(const Glib::ustring & from, const Glib::ustring & to);
@@ -49,6 +57,11 @@ namespace sharp {
   Glib::ustring file_read_all_text(const Glib::ustring & path);
   Glib::ustring file_read_all_text(const Glib::RefPtr<Gio::File> & path);
   void file_write_all_text(const Glib::ustring & path, const Glib::ustring & content);
+  /** write content to path.tmp and rename it over path, so that path always
+   *  has either the old or the new content; throws on failure */
+  void file_write_atomic(const Glib::ustring & path, const std::string & content, FileSync sync);
+  /** same, but content is produced by writer, which gets the temporary file descriptor */
+  void file_write_atomic(const Glib::ustring & path, const sigc::slot<void, int> & writer, FileSync sync);
 }
 
 
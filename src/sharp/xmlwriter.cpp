@@ -24,6 +24,9 @@
  */
 
 
+#include <errno.h>
+#include <unistd.h>
+
 #include <glibmm/i18n.h>
 #include <glibmm/ustring.h>
 
@@ -41,12 +44,51 @@ namespace {
     return msg;
   }
 
+  int write_to_ustring(void *context, const char *buffer, int len)
+  {
+    // byte range, chunks may end in the middle of a character
+    static_cast<Glib::ustring*>(context)->append(buffer, buffer + len);
+    return len;
+  }
+
+  int write_to_fd(void *context, const char *buffer, int len)
+  {
+    int fd = *static_cast<int*>(context);
+    int remaining = len;
+    while(remaining > 0) {
+      ssize_t written = write(fd, buffer, remaining);
+      if(written < 0) {
+        if(errno == EINTR) {
+          continue;
+        }
+        return -1;
+      }
+      buffer += written;
+      remaining -= written;
+    }
+    return len;
+  }
+
+  xmlTextWriterPtr new_text_writer(xmlOutputWriteCallback callback, void *context)
+  {
+    xmlOutputBufferPtr output = xmlOutputBufferCreateIO(callback, NULL, context, NULL);
+    if(!output) {
+      return NULL;
+    }
+    xmlTextWriterPtr writer = xmlNewTextWriter(output);
+    if(!writer) {
+      xmlOutputBufferClose(output);
+    }
+    return writer;
+  }
+
 }
 
 
 namespace sharp {
 
   XmlWriter::XmlWriter()
+    : m_fd(-1)
   {
     m_buf = xmlBufferCreate();
     m_writer = xmlNewTextWriterMemory(m_buf, 0);
@@ -54,6 +96,7 @@ namespace sharp {
 
   XmlWriter::XmlWriter(const Glib::ustring & filename)
     : m_buf(NULL)
+    , m_fd(-1)
   {
     m_writer = xmlNewTextWriterFilename(filename.c_str(), 0);
   }
@@ -61,11 +104,28 @@ namespace sharp {
   
   XmlWriter::XmlWriter(xmlDocPtr doc)
     : m_buf(NULL)
+    , m_fd(-1)
   {
     m_writer = xmlNewTextWriterTree(doc, NULL, 0);
   }
 
 
+  XmlWriter::XmlWriter(Glib::ustring *output)
+    : m_buf(NULL)
+    , m_fd(-1)
+  {
+    m_writer = new_text_writer(write_to_ustring, output);
+  }
+
+
+  XmlWriter::XmlWriter(int fd)
+    : m_buf(NULL)
+    , m_fd(fd)
+  {
+    m_writer = new_text_writer(write_to_fd, &m_fd);
+  }
+
+
   XmlWriter::~XmlWriter()
   {
     xmlFreeTextWriter(m_writer);
@@ -195,7 +255,10 @@ namespace sharp {
   int  XmlWriter::close()
   {
     int rc = xmlTextWriterEndDocument(m_writer);
-    xmlTextWriterFlush(m_writer);
+    // streamed output only fails here, if the last chunk can't be written
+    if(xmlTextWriterFlush(m_writer) < 0) {
+      throw Exception(make_write_failure_msg(__FUNCTION__, "xmlTextWriterFlush"));
+    }
     return rc;
   }
 
@@ -53,6 +53,10 @@ namespace sharp {
     XmlWriter();
     XmlWriter(const Glib::ustring & filename);
     XmlWriter(xmlDocPtr doc);
+    // Output is appended to output as it is produced, to_string() is not used.
+    explicit XmlWriter(Glib::ustring *output);
+    // Output is written to file descriptor as it is produced.
+    explicit XmlWriter(int fd);
     ~XmlWriter();
     int write_start_document();
     int write_end_document();
@@ -73,6 +77,7 @@ namespace sharp {
   private:
     xmlTextWriterPtr m_writer;
     xmlBufferPtr     m_buf;
+    int              m_fd;
   };
 
 }
@@ -26,6 +26,7 @@
 
 #include "debug.hpp"
 #include "filesystemsyncserver.hpp"
+#include "notemanagerbase.hpp"
 #include "sharp/directory.hpp"
 #include "sharp/files.hpp"
 #include "sharp/uuid.hpp"
@@ -107,8 +108,9 @@ void FileSystemSyncServer::upload_notes(const std::vector<Note::Ptr> & notes)
   for(auto & iter : notes) {
     try {
       auto server_note = m_new_revision_path->get_child(sharp::file_filename(iter->file_path()));
-      auto local_note = Gio::File::create_for_path(iter->file_path());
-      local_note->copy(server_note);
+      // local note is not necessarily a file, upload it as stored
+      std::string new_etag;
+      server_note->replace_contents(iter->manager().storage().read_xml(iter->file_path()), "", new_etag);
       m_updated_notes.push_back(sharp::file_basename(iter->file_path()));
     }
     catch(...) {
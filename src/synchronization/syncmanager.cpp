@@ -177,8 +177,8 @@ namespace sync {
         // TODO: Figure out a clever way to get the specific error up to the GUI
       }
 
-      // TODO: Call something that processes all queued note saves!
-      //       For now, only saving before uploading (not sufficient for note conflict handling)
+      // Make sure files on disk are up to date with the notes
+      note_mgr().flush_saves();
 
       set_state(ACQUIRING_LOCK);
       // TODO: We should really throw exceptions from BeginSyncTransaction ()
@@ -316,6 +316,8 @@ namespace sync {
 
       DBG_OUT("Sync: Uploading %d note updates", int(newOrModifiedNotes.size()));
       if(newOrModifiedNotes.size() > 0) {
+        // notes saved above are uploaded from files
+        note_mgr().flush_saves();
         set_state(UPLOADING);
         server->upload_notes(newOrModifiedNotes); // TODO: Callbacks to update GUI as upload progresses
       }
@@ -93,13 +93,13 @@ namespace sync {
   }
 
 
-  bool NoteUpdate::compare_tags(const std::map<Glib::ustring, Tag::Ptr> set1, const std::map<Glib::ustring, Tag::Ptr> set2) const
+  bool NoteUpdate::compare_tags(const NoteData::TagSet & set1, const NoteData::TagSet & set2) const
   {
     if(set1.size() != set2.size()) {
       return false;
     }
-    for(auto iter : set1) {
-      if(set2.find(iter.first) == set2.end()) {
+    for(const Tag::Ptr & tag : set1) {
+      if(!set2.contains(tag->normalized_name())) {
         return false;
       }
     }
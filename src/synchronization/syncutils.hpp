@@ -77,7 +77,7 @@ namespace sync {
     bool basically_equal_to(const Note::Ptr & existing_note);
   private:
     Glib::ustring get_inner_content(const Glib::ustring & full_content_element) const;
-    bool compare_tags(const std::map<Glib::ustring, Tag::Ptr> set1, const std::map<Glib::ustring, Tag::Ptr> set2) const;
+    bool compare_tags(const NoteData::TagSet & set1, const NoteData::TagSet & set2) const;
   };
 
 
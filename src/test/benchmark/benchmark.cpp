@@ -0,0 +1,159 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmarks are built with "make check", but not run as part of it.
+// Run ./gnotebenchmarks to run all of them, or pass benchmark names
+// to run only those.
+
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include <map>
+#include <string>
+
+#include <glibmm/fileutils.h>
+#include <glibmm/init.h>
+#include <glibmm/miscutils.h>
+#include <giomm/init.h>
+
+#include "sharp/directory.hpp"
+#include "sharp/uuid.hpp"
+#include "benchmark.hpp"
+
+namespace test {
+namespace benchmark {
+
+namespace {
+  std::map<std::string, BenchmarkFunc> & registry()
+  {
+    static std::map<std::string, BenchmarkFunc> s_registry;
+    return s_registry;
+  }
+}
+
+Registrar::Registrar(const char *name, BenchmarkFunc func)
+{
+  registry()[name] = func;
+}
+
+size_t heap_in_use()
+{
+#if defined(__GLIBC__)
+  struct mallinfo info = mallinfo();
+  return size_t(unsigned(info.uordblks)) + size_t(unsigned(info.hblkhd));
+#else
+  return 0;
+#endif
+}
+
+Glib::ustring synthetic_note_xml(int i)
+{
+  return Glib::ustring::compose(
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+    "<note version=\"0.3\" xmlns:link=\"http://beatniksoftware.com/tomboy/link\" "
+    "xmlns:size=\"http://beatniksoftware.com/tomboy/size\" xmlns=\"http://beatniksoftware.com/tomboy\">\n"
+    "  <title>Note %1</title>\n"
+    "  <text xml:space=\"preserve\"><note-content version=\"0.1\">Note %1\n\n"
+    "Some <bold>bold</bold> text, a link to <link:internal>Note %2</link:internal> and a "
+    "<link:url>http://example.com/%1</link:url>.\n"
+    "<list><list-item dir=\"ltr\">first &amp; second</list-item></list>\n"
+    "More text to make the note body look like a typical short note, "
+    "with a few lines of plain content in it.\n</note-content></text>\n"
+    "  <last-change-date>2019-06-01T10:00:00.0000000+01:00</last-change-date>\n"
+    "  <last-metadata-change-date>2019-06-01T10:00:00.0000000+01:00</last-metadata-change-date>\n"
+    "  <create-date>2019-05-01T10:00:00.0000000+01:00</create-date>\n"
+    "  <cursor-position>0</cursor-position>\n"
+    "  <selection-bound-position>-1</selection-bound-position>\n"
+    "  <width>450</width>\n"
+    "  <height>360</height>\n"
+    "  <tags>\n"
+    "    <tag>system:notebook:Notebook %3</tag>\n"
+    "    <tag>tag%4</tag>\n"
+    "  </tags>\n"
+    "</note>", i, i / 2, i % 10, i % 50);
+}
+
+Glib::ustring write_synthetic_corpus(int count)
+{
+  gchar *dir = g_dir_make_tmp("gnote-benchmark-XXXXXX", NULL);
+  if(!dir) {
+    return "";
+  }
+  Glib::ustring corpus = dir;
+  g_free(dir);
+  for(int i = 0; i < count; ++i) {
+    Glib::file_set_contents(Glib::build_filename(corpus, sharp::uuid().string() + ".note"),
+                            synthetic_note_xml(i));
+  }
+  return corpus;
+}
+
+void remove_corpus(const Glib::ustring & dir)
+{
+  if(!dir.empty()) {
+    sharp::directory_delete(dir, true);
+  }
+}
+
+void report(const char *benchmark, const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  printf("%-24s ", benchmark);
+  vprintf(format, args);
+  printf("\n");
+  va_end(args);
+}
+
+}
+}
+
+
+int main(int argc, char **argv)
+{
+  Glib::init();
+  Gio::init();
+
+  auto & benchmarks = test::benchmark::registry();
+  int failed = 0;
+  if(argc < 2) {
+    for(auto & benchmark : benchmarks) {
+      benchmark.second();
+    }
+  }
+  else {
+    for(int i = 1; i < argc; ++i) {
+      auto iter = benchmarks.find(argv[i]);
+      if(iter == benchmarks.end()) {
+        fprintf(stderr, "Unknown benchmark: %s\n", argv[i]);
+        ++failed;
+      }
+      else {
+        iter->second();
+      }
+    }
+  }
+
+  return failed;
+}
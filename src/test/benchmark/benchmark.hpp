@@ -0,0 +1,74 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _TEST_BENCHMARK_HPP_
+#define _TEST_BENCHMARK_HPP_
+
+#include <glibmm/ustring.h>
+
+namespace test {
+namespace benchmark {
+
+typedef void (*BenchmarkFunc)();
+
+class Registrar
+{
+public:
+  Registrar(const char *name, BenchmarkFunc func);
+};
+
+class Timer
+{
+public:
+  Timer()
+    : m_start(g_get_monotonic_time())
+    {}
+  void restart()
+    {
+      m_start = g_get_monotonic_time();
+    }
+  double elapsed_ms() const
+    {
+      return (g_get_monotonic_time() - m_start) / 1000.0;
+    }
+private:
+  gint64 m_start;
+};
+
+// Bytes currently allocated on the heap, 0 if unknown
+size_t heap_in_use();
+
+// Note file contents for the synthetic corpus, in current format
+Glib::ustring synthetic_note_xml(int i);
+// Write count synthetic notes to a new temporary directory, returns its path
+Glib::ustring write_synthetic_corpus(int count);
+void remove_corpus(const Glib::ustring & dir);
+
+void report(const char *benchmark, const char *format, ...) G_GNUC_PRINTF(2, 3);
+
+}
+}
+
+#define BENCHMARK(name) \
+  static void benchmark_##name(); \
+  static test::benchmark::Registrar benchmark_registrar_##name(#name, &benchmark_##name); \
+  static void benchmark_##name()
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+#include <glibmm/fileutils.h>
+
+#include "sharp/directory.hpp"
+#include "sharp/fileinfo.hpp"
+#include "benchmark.hpp"
+
+namespace {
+
+const int FILE_COUNT = 100000;
+
+// directory_get_files_with_ext as it was before, kept as the baseline
+std::vector<Glib::ustring> legacy_get_files_with_ext(const Glib::ustring & dir, const Glib::ustring & ext)
+{
+  std::vector<Glib::ustring> list;
+  if(!Glib::file_test(dir, Glib::FILE_TEST_EXISTS) || !Glib::file_test(dir, Glib::FILE_TEST_IS_DIR)) {
+    return list;
+  }
+
+  Glib::Dir d(dir);
+  for(Glib::Dir::iterator itr = d.begin(); itr != d.end(); ++itr) {
+    const Glib::ustring file(dir + "/" + *itr);
+    const sharp::FileInfo file_info(file);
+    const Glib::ustring extension = file_info.get_extension();
+    if(Glib::file_test(file, Glib::FILE_TEST_IS_REGULAR)
+       && (ext.empty() || (Glib::ustring(extension).lowercase() == ext))) {
+      list.push_back(file);
+    }
+  }
+  return list;
+}
+
+}
+
+
+BENCHMARK(directory_enumeration)
+{
+  gchar *tmp = g_dir_make_tmp("gnotebenchXXXXXX", NULL);
+  Glib::ustring dir(tmp);
+  g_free(tmp);
+  // empty files are enough, only names and types matter
+  for(int i = 0; i < FILE_COUNT; ++i) {
+    Glib::ustring name = Glib::ustring::compose("%1/%2.%3", dir, i, i % 10 ? "note" : "bak");
+    int fd = g_open(name.c_str(), O_WRONLY | O_CREAT, 0644);
+    close(fd);
+  }
+
+  test::benchmark::Timer timer;
+  size_t legacy_count = legacy_get_files_with_ext(dir, ".note").size();
+  double legacy_time = timer.elapsed_ms();
+
+  timer.restart();
+  size_t count = sharp::directory_get_files_with_ext(dir, ".note").size();
+  double time = timer.elapsed_ms();
+
+  timer.restart();
+  size_t entry_count = sharp::directory_get_file_entries(dir, ".note").size();
+  double entries_time = timer.elapsed_ms();
+
+  test::benchmark::report("directory_enumeration", "%d files, %d matching", FILE_COUNT, int(count));
+  test::benchmark::report("directory_enumeration", "FileInfo + stat per entry: %.1f ms", legacy_time);
+  test::benchmark::report("directory_enumeration", "readdir d_type: %.1f ms (%.1fx)", time, legacy_time / time);
+  test::benchmark::report("directory_enumeration", "readdir with mtime and size: %.1f ms (%.1fx)",
+                          entries_time, legacy_time / entries_time);
+  if(legacy_count != count || entry_count != count) {
+    test::benchmark::report("directory_enumeration", "MISMATCH: %d, %d, %d",
+                            int(legacy_count), int(count), int(entry_count));
+  }
+
+  test::benchmark::remove_corpus(dir);
+}
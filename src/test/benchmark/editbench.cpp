@@ -0,0 +1,160 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <glibmm/miscutils.h>
+#include <gtkmm/main.h>
+
+#include "addins/todo/todonoteaddin.hpp"
+#include "handlertiming.hpp"
+#include "note.hpp"
+#include "notebuffer.hpp"
+#include "watchers.hpp"
+#include "test/testnotemanager.hpp"
+#include "test/testtagmanager.hpp"
+#include "benchmark.hpp"
+
+namespace {
+
+const size_t NOTE_SIZES[] = { 10 * 1024, 100 * 1024, 1024 * 1024, 10 * 1024 * 1024 };
+const int KEYSTROKES = 400;
+// one autosave per this many keystrokes
+const int AUTOSAVE_INTERVAL = 50;
+
+// pasted log, the kind of note that gets this large
+Glib::ustring log_text(size_t size)
+{
+  Glib::ustring text;
+  for(int i = 0; text.bytes() < size; ++i) {
+    text += Glib::ustring::compose("2019-05-%1 12:%2:%3 INFO worker-%4 GET http://example.com/api/items/%5 took %6 ms\n",
+                                   1 + i % 28, i / 60 % 60, i % 60, i % 8, i, i % 97);
+  }
+  return text;
+}
+
+double percentile(std::vector<gint64> times, double p)
+{
+  std::sort(times.begin(), times.end());
+  size_t index = std::min(size_t(p * times.size()), times.size() - 1);
+  return times[index] / 1000.0;
+}
+
+gnote::Note::Ptr create_note(test::NoteManager & manager, size_t size)
+{
+  Glib::ustring title = Glib::ustring::compose("Pasted log %1 KB", size / 1024);
+  Glib::ustring file_path = Glib::build_filename(manager.notes_dir(), title + ".note");
+  gnote::NoteData *data = new gnote::NoteData(gnote::NoteBase::url_from_path(file_path));
+  data->title() = title;
+  data->text() = "<note-content version=\"0.1\">" + title + "\n" + log_text(size) + "</note-content>";
+  return gnote::Note::create_existing_note(data, file_path, manager);
+}
+
+// Typing, backspaces and bold in the middle of the note, with autosave every
+// AUTOSAVE_INTERVAL keystrokes
+void replay_session(const gnote::Note::Ptr & note, std::vector<gint64> & keystrokes, std::vector<gint64> & saves)
+{
+  static const char TYPED[] = "a note typed in the middle of a long log ";
+  gnote::NoteBuffer::Ptr buffer = note->get_buffer();
+  Gtk::TextIter middle = buffer->get_iter_at_offset(buffer->get_char_count() / 2);
+  middle.set_line_offset(0);
+  int offset = middle.get_offset();
+
+  for(int i = 1; i <= KEYSTROKES; ++i) {
+    gint64 start = g_get_monotonic_time();
+    if(i % 10 == 0) {
+      Gtk::TextIter end = buffer->get_iter_at_offset(offset);
+      Gtk::TextIter begin = end;
+      begin.backward_char();
+      buffer->erase(begin, end);
+      --offset;
+    }
+    else if(i % 100 == 1 && i > 1) {
+      buffer->apply_tag_by_name("bold", buffer->get_iter_at_offset(offset - 10), buffer->get_iter_at_offset(offset));
+    }
+    else {
+      char c = i % 60 == 0 ? '\n' : TYPED[i % (sizeof(TYPED) - 1)];
+      buffer->insert(buffer->get_iter_at_offset(offset), Glib::ustring(1, c));
+      ++offset;
+    }
+    keystrokes.push_back(g_get_monotonic_time() - start);
+
+    if(i % AUTOSAVE_INTERVAL == 0) {
+      start = g_get_monotonic_time();
+      note->save();
+      saves.push_back(g_get_monotonic_time() - start);
+    }
+  }
+}
+
+}
+
+
+// A real note, with its undo manager and the watchers that work on the buffer
+// alone: url, link, wiki word and todo. The ones that need a note window
+// (rename, spell checker, mouse hand) are left out. Autosave is the part of
+// saving done on the main thread, the file is written by the save queue.
+BENCHMARK(note_editing)
+{
+  Gtk::Main::init_gtkmm_internals();
+  test::TagManager::ensure_exists();
+  test::NoteManager manager(test::NoteManager::test_notes_dir());
+  todo::TodoModule todo_module;
+  bool was_enabled = gnote::HandlerTiming::enabled();
+  gnote::HandlerTiming::enable(true);
+
+  for(size_t size : NOTE_SIZES) {
+    gnote::Note::Ptr note = create_note(manager, size);
+    std::vector<std::unique_ptr<gnote::NoteAddin>> addins;
+    addins.emplace_back(gnote::NoteUrlWatcher::create());
+    addins.emplace_back(gnote::NoteLinkWatcher::create());
+    addins.emplace_back(gnote::NoteWikiWatcher::create());
+    addins.emplace_back(todo::Todo::create());
+    note->hold_buffer();
+    for(auto & addin : addins) {
+      addin->initialize(note);
+      addin->on_note_opened();
+    }
+
+    gnote::HandlerTiming::reset();
+    std::vector<gint64> keystrokes, saves;
+    replay_session(note, keystrokes, saves);
+
+    test::benchmark::report("note_editing", "%zu KB note, %d keystrokes: p50 %.3f ms, p99 %.3f ms",
+                            size / 1024, KEYSTROKES, percentile(keystrokes, 0.5), percentile(keystrokes, 0.99));
+    test::benchmark::report("note_editing", "  autosave: p50 %.2f ms, p99 %.2f ms",
+                            percentile(saves, 0.5), percentile(saves, 0.99));
+    for(const gnote::HandlerTiming::Stats & stats : gnote::HandlerTiming::stats()) {
+      test::benchmark::report("note_editing", "  %s: p50 %.3f ms, p99 %.3f ms, %zu calls",
+                              stats.handler.c_str(), stats.p50, stats.p99, stats.count);
+    }
+
+    for(auto & addin : addins) {
+      addin->dispose(true);
+    }
+    note->unhold_buffer();
+  }
+
+  gnote::HandlerTiming::reset();
+  gnote::HandlerTiming::enable(was_enabled);
+}
@@ -0,0 +1,74 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <algorithm>
+
+#include "notehistory.hpp"
+#include "sharp/directory.hpp"
+#include "benchmark.hpp"
+
+namespace {
+
+const int EDIT_COUNT = 2000;
+
+}
+
+
+BENCHMARK(note_history_record)
+{
+  gchar *tmp = g_dir_make_tmp("gnotebenchXXXXXX", NULL);
+  Glib::ustring dir(tmp);
+  g_free(tmp);
+
+  // typing into the middle of a large note, one save per edit
+  std::string xml = test::benchmark::synthetic_note_xml(0).raw();
+  while(xml.size() < 64 * 1024) {
+    xml += test::benchmark::synthetic_note_xml(int(xml.size())).raw();
+  }
+  size_t edit_pos = xml.size() / 2;
+
+  double total = 0, worst = 0;
+  {
+    gnote::NoteHistory history(dir);
+    for(int i = 0; i < EDIT_COUNT; ++i) {
+      xml.insert(edit_pos + i, 1, 'a' + i % 26);
+      test::benchmark::Timer timer;
+      history.record("note", xml);
+      double elapsed = timer.elapsed_ms();
+      total += elapsed;
+      worst = std::max(worst, elapsed);
+    }
+  }
+
+  test::benchmark::Timer timer;
+  gnote::NoteHistory history(dir);
+  std::string oldest = history.read("note", 0);
+  double read_time = timer.elapsed_ms();
+  gint64 size = sharp::directory_get_file_entries(dir, ".history")[0].size;
+
+  test::benchmark::report("note_history_record", "%d versions of %zu byte note: %.3f ms average, %.3f ms worst",
+                          EDIT_COUNT, xml.size(), total / EDIT_COUNT, worst);
+  test::benchmark::report("note_history_record", "history file %" G_GINT64_FORMAT " bytes, full copies would take %zu",
+                          size, xml.size() * EDIT_COUNT);
+  test::benchmark::report("note_history_record", "oldest version read in %.1f ms", read_time);
+
+  sharp::directory_delete(dir, true);
+}
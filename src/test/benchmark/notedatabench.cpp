@@ -0,0 +1,104 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "notebase.hpp"
+#include "sharp/uuid.hpp"
+#include "test/testtagmanager.hpp"
+#include "benchmark.hpp"
+
+namespace {
+
+const int NOTE_COUNT = 100000;
+
+// The NoteData layout before tags, URI and dates were packed,
+// kept here as the baseline to compare against
+struct LegacyNoteData
+{
+  explicit LegacyNoteData(const gnote::NoteData & data)
+    : uri(data.uri())
+    , title(data.title())
+    , text(data.text())
+    , create_date(data.create_date())
+    , change_date(data.change_date())
+    , metadata_change_date(data.metadata_change_date())
+    , cursor_pos(data.cursor_position())
+    , selection_bound_pos(data.selection_bound_position())
+    , width(data.width())
+    , height(data.height())
+    {
+      for(const gnote::Tag::Ptr & tag : data.tags()) {
+        tags[tag->normalized_name()] = tag;
+      }
+    }
+
+  const Glib::ustring uri;
+  Glib::ustring title;
+  Glib::ustring text;
+  sharp::DateTime create_date;
+  sharp::DateTime change_date;
+  sharp::DateTime metadata_change_date;
+  int cursor_pos;
+  int selection_bound_pos;
+  int width, height;
+  std::map<Glib::ustring, gnote::Tag::Ptr> tags;
+};
+
+}
+
+
+BENCHMARK(note_data_memory)
+{
+  test::TagManager::ensure_exists();
+
+  size_t payload = 0;
+  std::vector<std::unique_ptr<gnote::NoteData>> notes;
+  notes.reserve(NOTE_COUNT);
+  size_t heap_before = test::benchmark::heap_in_use();
+  test::benchmark::Timer timer;
+  for(int i = 0; i < NOTE_COUNT; ++i) {
+    gnote::NoteData *data = new gnote::NoteData(
+      gnote::NoteBase::url_from_path(sharp::uuid().string() + ".note"));
+    notes.emplace_back(data);
+    sharp::XmlReader xml;
+    xml.load_buffer(test::benchmark::synthetic_note_xml(i));
+    gnote::NoteArchiver::obj().read(xml, *data);
+    payload += data->title().bytes() + data->text().bytes();
+  }
+  double load_time = timer.elapsed_ms();
+  size_t compact = test::benchmark::heap_in_use() - heap_before;
+
+  std::vector<std::unique_ptr<LegacyNoteData>> legacy_notes;
+  legacy_notes.reserve(NOTE_COUNT);
+  heap_before = test::benchmark::heap_in_use();
+  for(auto & data : notes) {
+    legacy_notes.emplace_back(new LegacyNoteData(*data));
+  }
+  size_t legacy = test::benchmark::heap_in_use() - heap_before;
+
+  test::benchmark::report("note_data_memory", "loaded %d notes in %.1f ms", NOTE_COUNT, load_time);
+  test::benchmark::report("note_data_memory", "sizeof: before %zu, after %zu bytes",
+                          sizeof(LegacyNoteData), sizeof(gnote::NoteData));
+  test::benchmark::report("note_data_memory", "per note overhead: before %zu, after %zu bytes",
+                          (legacy - payload) / NOTE_COUNT, (compact - payload) / NOTE_COUNT);
+}
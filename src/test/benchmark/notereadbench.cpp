@@ -0,0 +1,60 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "notebase.hpp"
+#include "sharp/directory.hpp"
+#include "test/testtagmanager.hpp"
+#include "benchmark.hpp"
+
+namespace {
+
+const int NOTE_COUNT = 10000;
+
+}
+
+
+BENCHMARK(note_read)
+{
+  test::TagManager::ensure_exists();
+  Glib::ustring corpus = test::benchmark::write_synthetic_corpus(NOTE_COUNT);
+  std::vector<Glib::ustring> files = sharp::directory_get_files_with_ext(corpus, ".note");
+
+  test::benchmark::Timer timer;
+  for(const Glib::ustring & file : files) {
+    gnote::NoteData data(gnote::NoteBase::url_from_path(file));
+    sharp::XmlReader xml(file);
+    gnote::NoteArchiver::obj().read(xml, data);
+  }
+  double libxml_time = timer.elapsed_ms();
+
+  timer.restart();
+  for(const Glib::ustring & file : files) {
+    gnote::NoteData data(gnote::NoteBase::url_from_path(file));
+    gnote::NoteArchiver::read(file, data);
+  }
+  double mapped_time = timer.elapsed_ms();
+
+  test::benchmark::report("note_read", "libxml2 reader: %.2f us per note",
+                          libxml_time * 1000 / files.size());
+  test::benchmark::report("note_read", "mapped scanner: %.2f us per note (%.1fx)",
+                          mapped_time * 1000 / files.size(), libxml_time / mapped_time);
+
+  test::benchmark::remove_corpus(corpus);
+}
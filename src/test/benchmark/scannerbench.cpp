@@ -0,0 +1,124 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <algorithm>
+#include <vector>
+
+#include <glibmm/regex.h>
+
+#include "textscanner.hpp"
+#include "benchmark.hpp"
+
+namespace {
+
+// the expressions the url and wiki watchers used before
+const char *URL_REGEX = "((\\b((news|http|https|ftp|file|irc|ircs)://|mailto:|(www|ftp)\\.|\\S*@\\S*\\.)|(?<=^|\\s)/\\S+/|(?<=^|\\s)~/\\S+)\\S*\\b/?)";
+const char *WIKIWORD_REGEX = "\\b((\\p{Lu}+[\\p{Ll}0-9]+){2}([\\p{Lu}\\p{Ll}0-9])*)\\b";
+
+const char *LINES[] = {
+  "Meeting notes: ask JohnSmith about the ProjectPlan, see http://example.com/wiki/ProjectPlan for details.",
+  "2019-05-01 12:00:01 INFO worker-3 GET http://example.com/api/items/12345?expand=all took 12 ms",
+  "Mail bob@example.com or check ~/Documents/plans/2019 and /usr/share/doc/gnote/ before Friday.",
+  "Plain text without anything to link, just words, commas, and a sentence or two of prose in it.",
+  "Ąžuolas, čiuožykla ir ŠaltasVanduo: įdomūs žodžiai su www.pavyzdys.lt nuoroda.",
+};
+
+// What the watchers did on each keystroke: match against the block, the
+// found text, then against the rest after it
+int regex_matches(const Glib::RefPtr<Glib::Regex> & regex, Glib::ustring s)
+{
+  int matches = 0;
+  Glib::MatchInfo match_info;
+  while(regex->match(s, match_info)) {
+    Glib::ustring match = match_info.fetch(0);
+    Glib::ustring::size_type start_pos = s.find(match);
+    s = s.substr(start_pos + match.size());
+    ++matches;
+  }
+  return matches;
+}
+
+typedef bool (*ScanFunc)(const char*, std::size_t, std::size_t&, std::size_t&);
+
+int scanner_matches(ScanFunc scan, const Glib::ustring & s)
+{
+  int matches = 0;
+  std::size_t pos = 0, start, end;
+  while(scan(s.c_str() + pos, s.bytes() - pos, start, end)) {
+    pos += end;
+    ++matches;
+  }
+  return matches;
+}
+
+double percentile(std::vector<double> times, double p)
+{
+  std::sort(times.begin(), times.end());
+  return times[std::min(size_t(p * times.size()), times.size() - 1)];
+}
+
+}
+
+
+// Every line is typed character by character, each keystroke scanning the
+// line so far for URLs and WikiWords, as the watchers do with the block around
+// the insert.
+BENCHMARK(url_wikiword_scan)
+{
+  Glib::RefPtr<Glib::Regex> url_regex = Glib::Regex::create(URL_REGEX, Glib::REGEX_CASELESS);
+  Glib::RefPtr<Glib::Regex> wiki_regex = Glib::Regex::create(WIKIWORD_REGEX);
+
+  // each keystroke is repeated, a single one is below the timer resolution
+  const int REPEAT = 100;
+  std::vector<double> regex_times, scanner_times;
+  int keystrokes = 0, disagreements = 0;
+  for(const char *line : LINES) {
+    Glib::ustring text(line);
+    for(Glib::ustring::size_type typed = 1; typed <= text.size(); ++typed) {
+      Glib::ustring block = text.substr(0, typed);
+      int regex_found = 0, scanner_found = 0;
+
+      gint64 start = g_get_monotonic_time();
+      for(int i = 0; i < REPEAT; ++i) {
+        regex_found = regex_matches(url_regex, block) + regex_matches(wiki_regex, block);
+      }
+      regex_times.push_back(double(g_get_monotonic_time() - start) / REPEAT);
+
+      start = g_get_monotonic_time();
+      for(int i = 0; i < REPEAT; ++i) {
+        scanner_found = scanner_matches(gnote::textscanner::find_url, block)
+                      + scanner_matches(gnote::textscanner::find_wikiword, block);
+      }
+      scanner_times.push_back(double(g_get_monotonic_time() - start) / REPEAT);
+
+      ++keystrokes;
+      if(regex_found != scanner_found) {
+        ++disagreements;
+      }
+    }
+  }
+
+  test::benchmark::report("url_wikiword_scan", "%d keystrokes, match counts differ on %d", keystrokes, disagreements);
+  test::benchmark::report("url_wikiword_scan", "regex: p50 %.2f us, p99 %.2f us per keystroke",
+                          percentile(regex_times, 0.5), percentile(regex_times, 0.99));
+  test::benchmark::report("url_wikiword_scan", "scanner: p50 %.2f us, p99 %.2f us per keystroke",
+                          percentile(scanner_times, 0.5), percentile(scanner_times, 0.99));
+}
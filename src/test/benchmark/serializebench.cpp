@@ -0,0 +1,584 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <deque>
+#include <stack>
+
+#include <gtkmm/main.h>
+
+#include "debug.hpp"
+#include "notebuffer.hpp"
+#include "notetag.hpp"
+#include "sharp/xmlreader.hpp"
+#include "sharp/xmlwriter.hpp"
+#include "benchmark.hpp"
+
+namespace {
+
+const int SECTION_COUNT = 1000;
+
+void write_tag(const Glib::RefPtr<const Gtk::TextTag> & tag, sharp::XmlWriter & xml, bool start)
+{
+  gnote::NoteTag::ConstPtr note_tag = gnote::NoteTag::ConstPtr::cast_dynamic(tag);
+  if (note_tag) {
+    note_tag->write (xml, start);
+  } 
+  else if (gnote::NoteTagTable::tag_is_serializable (tag)) {
+    if (start) {
+      xml.write_start_element ("", tag->property_name().get_value(), "");
+    }
+    else {
+      xml.write_end_element ();
+    }
+  }
+}
+
+bool tag_ends_here (const Glib::RefPtr<const Gtk::TextTag> & tag,
+                    const Gtk::TextIter & iter,
+                    const Gtk::TextIter & next_iter)
+{
+  return (iter.has_tag (tag) && !next_iter.has_tag (tag)) || next_iter.is_end();
+}
+
+// NoteBufferArchiver::serialize as it was before, one character at a time,
+// kept as the baseline
+void legacy_serialize(const Glib::RefPtr<Gtk::TextBuffer> & buffer,
+                      const Gtk::TextIter & start,
+                      const Gtk::TextIter & end, sharp::XmlWriter & xml)
+{
+  std::stack<Glib::RefPtr<const Gtk::TextTag> > tag_stack;
+  std::stack<Glib::RefPtr<const Gtk::TextTag> > replay_stack;
+  std::stack<Glib::RefPtr<const Gtk::TextTag> > continue_stack;
+
+  Gtk::TextIter iter = start;
+  Gtk::TextIter next_iter = start;
+  next_iter.forward_char();
+
+  bool line_has_depth = false;
+  int prev_depth_line = -1;
+  int prev_depth = -1;
+
+  xml.write_start_element ("", "note-content", "");
+  xml.write_attribute_string ("", "version", "", "0.1");
+  xml.write_attribute_string("xmlns",
+                             "link",
+                             "",
+                             "http://beatniksoftware.com/tomboy/link");
+  xml.write_attribute_string("xmlns",
+                             "size",
+                             "",
+                             "http://beatniksoftware.com/tomboy/size");
+
+  // Insert any active tags at start into tag_stack...
+  Glib::SListHandle<Glib::RefPtr<const Gtk::TextTag> > tag_list = start.get_tags();
+  for(Glib::SListHandle<Glib::RefPtr<const Gtk::TextTag> >::const_iterator tag_iter = tag_list.begin();
+      tag_iter != tag_list.end(); ++tag_iter) {
+    const Glib::RefPtr<const Gtk::TextTag> & start_tag(*tag_iter);
+    if (!start.toggles_tag (start_tag)) {
+      tag_stack.push (start_tag);
+      write_tag (start_tag, xml, true);
+    }
+  }
+
+  while ((iter != end) && iter.get_char()) {
+    gnote::DepthNoteTag::Ptr depth_tag = gnote::NoteBuffer::find_depth_tag (iter);
+
+    // If we are at a character with a depth tag we are at the
+    // start of a bulleted line
+    if (depth_tag && iter.starts_line()) {
+      line_has_depth = true;
+
+      if (iter.get_line() == prev_depth_line + 1) {
+        // Line part of existing list
+
+        if (depth_tag->get_depth() == prev_depth) {
+          // Line same depth as previous
+          // Close previous <list-item>
+          xml.write_end_element ();
+
+        }
+        else if (depth_tag->get_depth() > prev_depth) {
+          // Line of greater depth
+          xml.write_start_element ("", "list", "");
+
+          for (int i = prev_depth + 2; i <= depth_tag->get_depth(); i++) {
+            // Start a new nested list
+            xml.write_start_element ("", "list-item", "");
+            xml.write_start_element ("", "list", "");
+          }
+        } 
+        else {
+          // Line of lesser depth
+          // Close previous <list-item>
+          // and nested <list>s
+          xml.write_end_element ();
+
+          for (int i = prev_depth; i > depth_tag->get_depth(); i--) {
+            // Close nested <list>
+            xml.write_end_element ();
+            // Close <list-item>
+            xml.write_end_element ();
+          }
+        }
+      } 
+      else {
+        // Start of new list
+        xml.write_start_element ("", "list", "");
+        for (int i = 1; i <= depth_tag->get_depth(); i++) {
+          xml.write_start_element ("", "list-item", "");
+          xml.write_start_element ("", "list", "");
+        }
+      }
+
+      prev_depth = depth_tag->get_depth();
+
+      // Start a new <list-item>
+      write_tag (depth_tag, xml, true);
+    }
+
+    // Output any tags that begin at the current position
+    Glib::SListHandle<Glib::RefPtr<Gtk::TextTag> > tag_list2 = iter.get_tags();
+    for(Glib::SListHandle<Glib::RefPtr<Gtk::TextTag> >::const_iterator tag_iter = tag_list2.begin();
+        tag_iter != tag_list2.end(); ++tag_iter) {
+      const Glib::RefPtr<Gtk::TextTag> & tag(*tag_iter);
+      if (iter.begins_tag (tag)) {
+
+        if (!(gnote::DepthNoteTag::Ptr::cast_dynamic(tag)) && gnote::NoteTagTable::tag_is_serializable(tag)) {
+          write_tag (tag, xml, true);
+          tag_stack.push (tag);
+        }
+      }
+    }
+
+    // Reopen tags that continued across indented lines
+    // or into or out of lines with a depth
+    while (!continue_stack.empty() &&
+           ((!depth_tag && iter.starts_line ()) || (iter.get_line_offset() == 1)))
+    {
+      Glib::RefPtr<const Gtk::TextTag> continue_tag = continue_stack.top();
+      continue_stack.pop();
+
+      if (!tag_ends_here (continue_tag, iter, next_iter)
+          && iter.has_tag (continue_tag))
+      {
+        write_tag (continue_tag, xml, true);
+        tag_stack.push (continue_tag);
+      }
+    }
+
+    // Hidden character representing an anchor
+    if (iter.get_char() == 0xFFFC) {
+      DBG_OUT("Got child anchor!!!");
+      if (iter.get_child_anchor()) {
+        const char * serialize = (const char*)(iter.get_child_anchor()->get_data(Glib::Quark("serialize")));
+        if (serialize)
+          xml.write_raw (serialize);
+      }
+      // Line Separator character
+    } 
+    else if (iter.get_char() == 0x2028) {
+      xml.write_char_entity (0x2028);
+    } 
+    else if (!depth_tag) {
+      xml.write_string (Glib::ustring(1, (gunichar)iter.get_char()));
+    }
+
+    bool end_of_depth_line = line_has_depth && next_iter.ends_line ();
+
+    bool next_line_has_depth = false;
+    if (iter.get_line() < buffer->get_line_count() - 1) {
+      Gtk::TextIter next_line = buffer->get_iter_at_line(iter.get_line()+1);
+      next_line_has_depth =
+        (bool)gnote::NoteBuffer::find_depth_tag (next_line);
+    }
+
+    bool at_empty_line = iter.ends_line () && iter.starts_line ();
+
+    if (end_of_depth_line ||
+        (next_line_has_depth && (next_iter.ends_line () || at_empty_line)))
+    {
+      // Close all tags in the tag_stack
+      while (!tag_stack.empty()) {
+        Glib::RefPtr<const Gtk::TextTag> existing_tag;
+        existing_tag = tag_stack.top();
+        tag_stack.pop ();
+
+        // Any tags which continue across the indented
+        // line are added to the continue_stack to be
+        // reopened at the start of the next <list-item>
+        if (!tag_ends_here (existing_tag, iter, next_iter)) {
+          continue_stack.push (existing_tag);
+        }
+
+        write_tag (existing_tag, xml, false);
+      }
+    } 
+    else {
+      Glib::SListHandle<Glib::RefPtr<Gtk::TextTag> > tag_list3 = iter.get_tags();
+      for(Glib::SListHandle<Glib::RefPtr<Gtk::TextTag> >::const_iterator tag_iter = tag_list3.begin();
+          tag_iter != tag_list3.end(); ++tag_iter) {
+        const Glib::RefPtr<Gtk::TextTag> & tag(*tag_iter);
+        if (tag_ends_here (tag, iter, next_iter) &&
+            gnote::NoteTagTable::tag_is_serializable(tag) && !(gnote::DepthNoteTag::Ptr::cast_dynamic(tag)))
+        {
+          while (!tag_stack.empty()) {
+            Glib::RefPtr<const Gtk::TextTag> existing_tag = tag_stack.top();
+            tag_stack.pop();
+
+            if (!tag_ends_here (existing_tag, iter, next_iter)) {
+              replay_stack.push (existing_tag);
+            }
+
+            write_tag (existing_tag, xml, false);
+          }
+
+          // Replay the replay queue.
+          // Restart any tags that
+          // overlapped with the ended
+          // tag...
+          while (!replay_stack.empty()) {
+            Glib::RefPtr<const Gtk::TextTag> replay_tag = replay_stack.top();
+            replay_stack.pop();
+            tag_stack.push (replay_tag);
+
+            write_tag (replay_tag, xml, true);
+          }
+        }
+      }
+    }
+
+    // At the end of the line record that it
+    // was the last line encountered with a depth
+    if (end_of_depth_line) {
+      line_has_depth = false;
+      prev_depth_line = iter.get_line();
+    }
+
+    // If we are at the end of a line with a depth and the
+    // next line does not have a depth line close all <list>
+    // and <list-item> tags that remain open
+    if (end_of_depth_line && !next_line_has_depth) {
+      for (int i = prev_depth; i > -1; i--) {
+        // Close <list>
+        xml.write_full_end_element ();
+        // Close <list-item>
+        xml.write_full_end_element ();
+      }
+
+      prev_depth = -1;
+    }
+
+    iter.forward_char();
+    next_iter.forward_char();
+  }
+
+  // Empty any trailing tags left in tag_stack..
+  while (!tag_stack.empty()) {
+    Glib::RefPtr<const Gtk::TextTag> tail_tag = tag_stack.top ();
+    tag_stack.pop();
+    write_tag (tail_tag, xml, false);
+  }
+
+  xml.write_end_element (); // </note-content>
+}
+
+struct TagStart
+{
+  TagStart()
+    : start(0)
+    {}
+  int start;
+  Glib::RefPtr<Gtk::TextTag> tag;
+};
+
+// NoteBufferArchiver::deserialize as it was before, inserting every text node
+// and applying every tag as it is read, kept as the baseline
+void legacy_deserialize(const Glib::RefPtr<Gtk::TextBuffer> & buffer,
+                        const Gtk::TextIter & start,
+                        sharp::XmlReader & xml)
+{
+  int offset = start.get_offset();
+  std::stack<TagStart> tag_stack;
+  TagStart tag_start;
+  Glib::ustring value;
+
+  gnote::NoteTagTable::Ptr note_table = gnote::NoteTagTable::Ptr::cast_dynamic(buffer->get_tag_table());
+
+  int curr_depth = -1;
+
+  // A stack of boolean values which mark if a
+  // list-item contains content other than another list
+  // For some reason, std::stack<bool> cause crashes.
+  std::deque<bool> list_stack;
+
+  try {
+    while (xml.read ()) {
+      Gtk::TextIter insert_at;
+      switch (xml.get_node_type()) {
+      case XML_READER_TYPE_ELEMENT:
+        if (xml.get_name() == "note-content")
+          break;
+
+        tag_start = TagStart();
+        tag_start.start = offset;
+
+        if (note_table &&
+            note_table->is_dynamic_tag_registered (xml.get_name())) {
+          tag_start.tag =
+            note_table->create_dynamic_tag (xml.get_name());
+        } 
+        else if (xml.get_name() == "list") {
+          curr_depth++;
+          // If we are inside a <list-item> mark off
+          // that we have encountered some content
+          if (!list_stack.empty()) {
+            list_stack.pop_front();
+            list_stack.push_front(true);
+          }
+          break;
+        } 
+        else if (xml.get_name() == "list-item") {
+          if (curr_depth >= 0) {
+            tag_start.tag = note_table->get_depth_tag(curr_depth);
+            list_stack.push_front (false);
+          } 
+          else {
+            ERR_OUT("</list> tag mismatch");
+          }
+        } 
+        else {
+          tag_start.tag = buffer->get_tag_table()->lookup (xml.get_name());
+        }
+
+        if (gnote::NoteTag::Ptr::cast_dynamic(tag_start.tag)) {
+          gnote::NoteTag::Ptr::cast_dynamic(tag_start.tag)->read (xml, true);
+        }
+
+        if(!xml.is_empty_element()) {
+          tag_stack.push (tag_start);
+        }
+        break;
+      case XML_READER_TYPE_TEXT:
+      case XML_READER_TYPE_WHITESPACE:
+      case XML_READER_TYPE_SIGNIFICANT_WHITESPACE:
+        insert_at = buffer->get_iter_at_offset (offset);
+        value = xml.get_value();
+        buffer->insert (insert_at, value);
+
+        // we need the # of chars *Unicode) and not bytes (ASCII)
+        // see bug #587070
+        offset += value.length();
+
+        // If we are inside a <list-item> mark off
+        // that we have encountered some content
+        if (!list_stack.empty()) {
+          list_stack.pop_front ();
+          list_stack.push_front (true);
+        }
+
+        break;
+      case XML_READER_TYPE_END_ELEMENT:
+        if (xml.get_name() == "note-content")
+          break;
+
+        if (xml.get_name() == "list") {
+          curr_depth--;
+          break;
+        }
+
+        tag_start = tag_stack.top();
+        tag_stack.pop();
+        if (tag_start.tag) {
+
+          Gtk::TextIter apply_start, apply_end;
+          apply_start = buffer->get_iter_at_offset (tag_start.start);
+          apply_end = buffer->get_iter_at_offset (offset);
+
+          if (gnote::NoteTag::Ptr::cast_dynamic(tag_start.tag)) {
+            gnote::NoteTag::Ptr::cast_dynamic(tag_start.tag)->read (xml, false);
+          }
+
+          // Insert a bullet if we have reached a closing
+          // <list-item> tag, but only if the <list-item>
+          // had content.
+          gnote::DepthNoteTag::Ptr depth_tag = gnote::DepthNoteTag::Ptr::cast_dynamic(tag_start.tag);
+
+          if (depth_tag && list_stack.front ()) {
+            // Do not insert bullet if it's already there
+            // this happens when using double identation in bullet list
+            if(!gnote::NoteBuffer::find_depth_tag(apply_start)) {
+              // NoteBuffer::insert_bullet() without the need for a note
+              apply_start = buffer->insert_with_tag(apply_start, gnote::NoteBuffer::get_bullet(depth_tag->get_depth()),
+                                                    depth_tag);
+              buffer->remove_all_tags (apply_start, apply_start);
+              offset += 2;
+            }
+            list_stack.pop_front();
+          } 
+          else if (!depth_tag) {
+            buffer->apply_tag (tag_start.tag, apply_start, apply_end);
+          }
+        }
+        break;
+      default:
+        DBG_OUT("Unhandled element %d. Value: '%s'",
+                xml.get_node_type(), xml.get_value().c_str());
+        break;
+      }
+    }
+  }
+  catch(const std::exception & e) {
+    ERR_OUT("Exception: %s", e.what());
+  }
+}
+
+Glib::ustring legacy_serialize(const Glib::RefPtr<Gtk::TextBuffer> & buffer)
+{
+  Glib::ustring serialized;
+  sharp::XmlWriter xml(&serialized);
+  legacy_serialize(buffer, buffer->begin(), buffer->end(), xml);
+  xml.close();
+  return serialized;
+}
+
+void insert_line(const Glib::RefPtr<Gtk::TextBuffer> & buffer, int depth, const Glib::ustring & text)
+{
+  if(depth >= 0) {
+    gnote::NoteTagTable::Ptr table = gnote::NoteTagTable::instance();
+    buffer->insert_with_tag(buffer->end(), Glib::ustring(1, gunichar(0x2022)) + " ", table->get_depth_tag(depth));
+  }
+  buffer->insert(buffer->end(), text + "\n");
+}
+
+void apply(const Glib::RefPtr<Gtk::TextBuffer> & buffer, const char *tag, int start, int end)
+{
+  buffer->apply_tag_by_name(tag, buffer->get_iter_at_offset(start), buffer->get_iter_at_offset(end));
+}
+
+// Paragraphs with overlapping styles and links, followed by a list going
+// five levels deep with formatting running across list items
+Glib::RefPtr<Gtk::TextBuffer> create_formatted_buffer()
+{
+  Glib::RefPtr<Gtk::TextBuffer> buffer = Gtk::TextBuffer::create(gnote::NoteTagTable::instance());
+  buffer->insert(buffer->end(), "Formatted note\n\n");
+  for(int i = 0; i < SECTION_COUNT; ++i) {
+    int start = buffer->end().get_offset();
+    insert_line(buffer, -1, Glib::ustring::compose(
+      "Section %1 has bold, italic & highlighted words, a link to http://example.com/%1 and "
+      "some <plain> text that goes on for a while to make a realistic paragraph.", i));
+    apply(buffer, "bold", start + 12, start + 30);
+    apply(buffer, "italic", start + 20, start + 45);
+    apply(buffer, "highlight", start + 38, start + 60);
+    apply(buffer, "link:url", start + 74, start + 94);
+    apply(buffer, "size:large", start + 100, start + 120);
+
+    int list_start = buffer->end().get_offset();
+    for(int depth = 0; depth < 5; ++depth) {
+      insert_line(buffer, depth, Glib::ustring::compose("item %1 at depth %2 with some text", i, depth));
+    }
+    insert_line(buffer, 2, "back up the list");
+    apply(buffer, "bold", list_start + 10, buffer->end().get_offset() - 5);
+    insert_line(buffer, -1, "");
+  }
+  return buffer;
+}
+
+}
+
+
+BENCHMARK(note_serialize)
+{
+  Gtk::Main::init_gtkmm_internals();
+  Glib::RefPtr<Gtk::TextBuffer> buffer = create_formatted_buffer();
+
+  test::benchmark::Timer timer;
+  Glib::ustring legacy = legacy_serialize(buffer);
+  double legacy_time = timer.elapsed_ms();
+
+  timer.restart();
+  Glib::ustring serialized = gnote::NoteBufferArchiver::serialize(buffer);
+  double time = timer.elapsed_ms();
+
+  test::benchmark::report("note_serialize", "%zu characters, %zu bytes of XML", size_t(buffer->get_char_count()),
+                          serialized.bytes());
+  test::benchmark::report("note_serialize", "per character: %.1f ms", legacy_time);
+  test::benchmark::report("note_serialize", "by runs: %.1f ms (%.1fx), output %s", time, legacy_time / time,
+                          legacy == serialized ? "identical" : "DIFFERENT");
+}
+
+
+BENCHMARK(note_deserialize)
+{
+  Gtk::Main::init_gtkmm_internals();
+  Glib::ustring xml = gnote::NoteBufferArchiver::serialize(create_formatted_buffer());
+
+  Glib::RefPtr<Gtk::TextBuffer> legacy = Gtk::TextBuffer::create(gnote::NoteTagTable::instance());
+  test::benchmark::Timer timer;
+  {
+    sharp::XmlReader reader;
+    reader.load_buffer(xml);
+    legacy_deserialize(legacy, legacy->begin(), reader);
+  }
+  double legacy_time = timer.elapsed_ms();
+
+  Glib::RefPtr<Gtk::TextBuffer> buffer = Gtk::TextBuffer::create(gnote::NoteTagTable::instance());
+  timer.restart();
+  gnote::NoteBufferArchiver::deserialize(buffer, xml);
+  double time = timer.elapsed_ms();
+
+  bool identical = legacy_serialize(legacy) == gnote::NoteBufferArchiver::serialize(buffer);
+  test::benchmark::report("note_deserialize", "%zu bytes of XML", xml.bytes());
+  test::benchmark::report("note_deserialize", "insert per text node: %.1f ms", legacy_time);
+  test::benchmark::report("note_deserialize", "single insert: %.1f ms (%.1fx), result %s", time, legacy_time / time,
+                          identical ? "identical" : "DIFFERENT");
+}
+
+
+BENCHMARK(note_serialize_after_edit)
+{
+  Gtk::Main::init_gtkmm_internals();
+  Glib::RefPtr<Gtk::TextBuffer> buffer = create_formatted_buffer();
+  gnote::NoteBufferSerializer serializer(buffer);
+  serializer.serialize();
+
+  const int EDIT_COUNT = 20;
+  double full_time = 0, time = 0;
+  bool identical = true;
+  for(int i = 0; i < EDIT_COUNT; ++i) {
+    // type a character somewhere in the middle, like autosave sees it
+    buffer->insert(buffer->get_iter_at_line(buffer->get_line_count() * i / EDIT_COUNT), "x");
+
+    test::benchmark::Timer timer;
+    Glib::ustring full = gnote::NoteBufferArchiver::serialize(buffer);
+    full_time += timer.elapsed_ms();
+
+    timer.restart();
+    Glib::ustring serialized = serializer.serialize();
+    time += timer.elapsed_ms();
+    identical = identical && full == serialized;
+  }
+
+  test::benchmark::report("note_serialize_after_edit", "%d edits of a %d character note",
+                          EDIT_COUNT, buffer->get_char_count());
+  test::benchmark::report("note_serialize_after_edit", "whole buffer: %.2f ms per save", full_time / EDIT_COUNT);
+  test::benchmark::report("note_serialize_after_edit", "changed blocks: %.2f ms per save (%.1fx), result %s",
+                          time / EDIT_COUNT, full_time / time, identical ? "identical" : "DIFFERENT");
+}
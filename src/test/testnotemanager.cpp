@@ -42,7 +42,7 @@ gnote::NoteBase::Ptr NoteManager::note_create_new(const Glib::ustring & title, c
   gnote::NoteData *note_data = new gnote::NoteData(gnote::NoteBase::url_from_path(file_name));
   note_data->title() = title;
   sharp::DateTime date(sharp::DateTime::now());
-  note_data->create_date() = date;
+  note_data->set_create_date(date);
   note_data->set_change_date(date);
 
   return Note::Ptr(new Note(note_data, file_name, *this));
@@ -53,5 +53,10 @@ gnote::NoteBase::Ptr NoteManager::note_load(const Glib::ustring & file_name)
   return gnote::NoteBase::Ptr();
 }
 
+gnote::NoteBase::Ptr NoteManager::note_create_existing(gnote::NoteData *data, const Glib::ustring & file_name)
+{
+  return Note::Ptr(new Note(data, file_name, *this));
+}
+
 }
 
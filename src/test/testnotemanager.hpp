@@ -32,6 +32,7 @@ public:
 protected:
   virtual gnote::NoteBase::Ptr note_create_new(const Glib::ustring & title, const Glib::ustring & file_name) override;
   virtual gnote::NoteBase::Ptr note_load(const Glib::ustring & file_name) override;
+  virtual gnote::NoteBase::Ptr note_create_existing(gnote::NoteData *data, const Glib::ustring & file_name) override;
 };
 
 }
@@ -18,6 +18,8 @@
  */
 
 
+#include <algorithm>
+
 #include <glibmm/miscutils.h>
 #include <UnitTest++/UnitTest++.h>
 
@@ -184,5 +186,19 @@ SUITE(directory)
   {
     directory_get_files_with_ext__same_return_test(".cpp");
   }
+
+  TEST(directory_get_file_entries)
+  {
+    Glib::ustring dir = Glib::path_get_dirname(__FILE__);
+
+    std::vector<Glib::ustring> files = sharp::directory_get_files_with_ext(dir, ".cpp");
+    std::vector<sharp::DirectoryEntry> entries = sharp::directory_get_file_entries(dir, ".cpp");
+    CHECK_EQUAL(files.size(), entries.size());
+    for(auto & entry : entries) {
+      CHECK(std::find(files.begin(), files.end(), entry.path) != files.end());
+      CHECK(entry.size > 0);
+      CHECK(entry.modification_time > 0);
+    }
+  }
 }
 
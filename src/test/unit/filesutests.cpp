@@ -18,8 +18,10 @@
  */
 
 #include <fstream>
+#include <signal.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/wait.h>
 
 #include <glibmm/miscutils.h>
 #include <UnitTest++/UnitTest++.h>
@@ -158,5 +160,57 @@ SUITE(files)
 
     CHECK_THROW(sharp::file_write_all_text("/usr/gnotetest", file_content), sharp::Exception);
   }
-}
 
+  TEST(write_atomic)
+  {
+    char temp_file_name[] = "/tmp/gnotetestXXXXXX";
+    int fd = mkstemp(temp_file_name);
+    close(fd);
+
+    sharp::file_write_atomic(temp_file_name, "first", sharp::FILE_SYNC_NONE);
+    CHECK_EQUAL("first", sharp::file_read_all_text(temp_file_name));
+    sharp::file_write_atomic(temp_file_name, "second", sharp::FILE_SYNC_FILE_AND_DIR);
+    CHECK_EQUAL("second", sharp::file_read_all_text(temp_file_name));
+    CHECK(!sharp::file_exists(Glib::ustring(temp_file_name) + ".tmp"));
+    sharp::file_delete(temp_file_name);
+
+    CHECK_THROW(sharp::file_write_atomic("/nonexistent/gnotetest", "x", sharp::FILE_SYNC_NONE), sharp::Exception);
+  }
+
+  // Kill a process in the middle of rewriting a file over and over,
+  // the file must always be left with one complete version
+  TEST(write_atomic_crash)
+  {
+    const size_t size = 256 * 1024;
+    char temp_file_name[] = "/tmp/gnotetestXXXXXX";
+    int fd = mkstemp(temp_file_name);
+    close(fd);
+    sharp::file_write_atomic(temp_file_name, std::string(size, 'a'), sharp::FILE_SYNC_NONE);
+
+    for(int attempt = 0; attempt < 20; ++attempt) {
+      pid_t pid = fork();
+      if(pid == 0) {
+        for(int i = 0; ; ++i) {
+          sharp::file_write_atomic(temp_file_name, std::string(size, 'a' + i % 26), sharp::FILE_SYNC_NONE);
+        }
+      }
+      CHECK(pid > 0);
+      if(pid <= 0) {
+        break;
+      }
+      g_usleep(g_random_int_range(100, 5000));
+      kill(pid, SIGKILL);
+      waitpid(pid, NULL, 0);
+
+      std::string content = sharp::file_read_all_text(temp_file_name);
+      CHECK_EQUAL(size, content.size());
+      CHECK(content.find_first_not_of(content[0]) == std::string::npos);
+    }
+
+    sharp::file_delete(temp_file_name);
+    Glib::ustring tmp_file = Glib::ustring(temp_file_name) + ".tmp";
+    if(sharp::file_exists(tmp_file)) {
+      sharp::file_delete(tmp_file);
+    }
+  }
+}
@@ -0,0 +1,152 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <glibmm/miscutils.h>
+#include <gtkmm/main.h>
+#include <UnitTest++/UnitTest++.h>
+
+#include "note.hpp"
+#include "notebuffercache.hpp"
+#include "test/testnotemanager.hpp"
+#include "test/testtagmanager.hpp"
+
+
+SUITE(NoteBufferCache)
+{
+  struct Fixture
+  {
+    test::NoteManager *manager;
+
+    Fixture()
+    {
+      Gtk::Main::init_gtkmm_internals();
+      new test::TagManager;
+      manager = new test::NoteManager(test::NoteManager::test_notes_dir());
+    }
+
+    ~Fixture()
+    {
+      delete manager;
+    }
+
+    // note with title and body of the given length, without buffer
+    gnote::Note::Ptr create_note(const Glib::ustring & title, unsigned length)
+    {
+      Glib::ustring file_path = Glib::build_filename(manager->notes_dir(), title + ".note");
+      gnote::NoteData *data = new gnote::NoteData(gnote::NoteBase::url_from_path(file_path));
+      data->title() = title;
+      data->text() = "<note-content version=\"0.1\">" + title + "\n"
+        + Glib::ustring(length, 'a') + "</note-content>";
+      return gnote::Note::create_existing_note(data, file_path, *manager);
+    }
+  };
+
+  TEST_FIXTURE(Fixture, least_recently_used_released)
+  {
+    gnote::Note::Ptr note1 = create_note("note1", 100);
+    gnote::Note::Ptr note2 = create_note("note2", 100);
+    gnote::Note::Ptr note3 = create_note("note3", 100);
+    note1->get_buffer();
+    note2->get_buffer();
+    note3->get_buffer();
+    gnote::NoteBufferCache & cache = manager->buffer_cache();
+    CHECK_EQUAL(3u, cache.resident_buffers());
+
+    // room for two of them
+    cache.set_budget(2 * note1->buffer_char_count());
+    cache.trim();
+    CHECK(!note1->has_buffer());
+    CHECK(note2->has_buffer());
+    CHECK(note3->has_buffer());
+    CHECK_EQUAL(2u, cache.resident_buffers());
+
+    note1->get_buffer();
+    cache.trim();
+    CHECK(note1->has_buffer());
+    CHECK(!note2->has_buffer());
+    CHECK(note3->has_buffer());
+  }
+
+  TEST_FIXTURE(Fixture, unlimited_budget_keeps_all)
+  {
+    gnote::Note::Ptr note1 = create_note("note1", 100);
+    gnote::Note::Ptr note2 = create_note("note2", 100);
+    note1->get_buffer();
+    note2->get_buffer();
+
+    manager->buffer_cache().set_budget(0);
+    manager->buffer_cache().trim();
+    CHECK(note1->has_buffer());
+    CHECK(note2->has_buffer());
+  }
+
+  TEST_FIXTURE(Fixture, held_buffer_kept)
+  {
+    gnote::Note::Ptr note = create_note("note", 100);
+    note->get_buffer();
+    note->hold_buffer();
+
+    gnote::NoteBufferCache & cache = manager->buffer_cache();
+    cache.set_budget(1);
+    cache.trim();
+    CHECK(note->has_buffer());
+
+    note->unhold_buffer();
+    cache.trim();
+    CHECK(!note->has_buffer());
+  }
+
+  TEST_FIXTURE(Fixture, changed_note_kept)
+  {
+    gnote::Note::Ptr note = create_note("note", 100);
+    note->get_buffer()->insert(note->get_buffer()->end(), "changed");
+
+    gnote::NoteBufferCache & cache = manager->buffer_cache();
+    cache.set_budget(1);
+    cache.trim();
+    CHECK(note->has_buffer());
+    CHECK(!note->release_buffer());
+  }
+
+  TEST_FIXTURE(Fixture, released_buffer_destroyed)
+  {
+    gnote::Note::Ptr note = create_note("note", 10);
+    gpointer buffer = note->get_buffer()->gobj();
+    g_object_add_weak_pointer(G_OBJECT(buffer), &buffer);
+    // serializer keeps blocks of the buffer from now on
+    note->xml_content();
+
+    CHECK(note->release_buffer());
+    CHECK(!note->has_buffer());
+    CHECK(buffer == NULL);
+    if(buffer) {
+      g_object_remove_weak_pointer(G_OBJECT(buffer), &buffer);
+    }
+  }
+
+  TEST_FIXTURE(Fixture, released_text_kept_in_data)
+  {
+    gnote::Note::Ptr note = create_note("note", 10);
+    Glib::ustring text = note->text_content();
+    CHECK(note->release_buffer());
+    CHECK(!note->has_buffer());
+    CHECK_EQUAL(text, note->text_content());
+  }
+}
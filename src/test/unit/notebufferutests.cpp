@@ -0,0 +1,159 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <random>
+
+#include <gtkmm/main.h>
+#include <UnitTest++/UnitTest++.h>
+
+#include "notebuffer.hpp"
+#include "notetag.hpp"
+
+SUITE(NoteBuffer)
+{
+  struct Fixture
+  {
+    gnote::NoteTagTable::Ptr table;
+    Glib::RefPtr<Gtk::TextBuffer> buffer;
+    std::mt19937 random;
+
+    Fixture()
+      : random(42)
+    {
+      Gtk::Main::init_gtkmm_internals();
+      table = gnote::NoteTagTable::instance();
+      buffer = Gtk::TextBuffer::create(table);
+    }
+
+    int random_int(int max)
+    {
+      return std::uniform_int_distribution<int>(0, max)(random);
+    }
+
+    Gtk::TextIter random_iter()
+    {
+      return buffer->get_iter_at_offset(random_int(buffer->get_char_count()));
+    }
+
+    void insert_line(int depth, const Glib::ustring & text)
+    {
+      if(depth >= 0) {
+        buffer->insert_with_tag(buffer->end(), gnote::NoteBuffer::get_bullet(depth), table->get_depth_tag(depth));
+      }
+      buffer->insert(buffer->end(), text + "\n");
+    }
+
+    void fill()
+    {
+      for(int i = 0; i < 100; ++i) {
+        insert_line(-1, Glib::ustring::compose("Paragraph %1 with <some> & a fair amount of plain text", i));
+        if(i % 10 == 0) {
+          for(int depth = 0; depth < 3; ++depth) {
+            insert_line(depth, Glib::ustring::compose("item %1 at depth %2", i, depth));
+          }
+        }
+      }
+    }
+
+    // one random edit of the kind a user makes: typing, deleting, styling and bullets
+    void edit()
+    {
+      static const char *tags[] = { "bold", "italic", "highlight", "link:url" };
+      Gtk::TextIter start = random_iter();
+      Gtk::TextIter end = start;
+      end.forward_chars(random_int(80));
+      switch(random_int(5)) {
+      case 0:
+        buffer->insert(start, random_int(3) ? "x" : "new\nlines\n");
+        break;
+      case 1:
+        buffer->erase(start, end);
+        break;
+      case 2:
+        buffer->apply_tag_by_name(tags[random_int(3)], start, end);
+        break;
+      case 3:
+        buffer->remove_tag_by_name(tags[random_int(3)], start, end);
+        break;
+      case 4:
+        start.set_line_offset(0);
+        if(!gnote::NoteBuffer::find_depth_tag(start)) {
+          int depth = random_int(2);
+          buffer->insert_with_tag(start, gnote::NoteBuffer::get_bullet(depth), table->get_depth_tag(depth));
+        }
+        break;
+      case 5:
+        end = start;
+        if(!end.ends_line()) {
+          end.forward_to_line_end();
+        }
+        buffer->remove_all_tags(start, end);
+        break;
+      }
+    }
+  };
+
+  TEST_FIXTURE(Fixture, serializer_empty)
+  {
+    gnote::NoteBufferSerializer serializer(buffer);
+    CHECK_EQUAL(gnote::NoteBufferArchiver::serialize(buffer), serializer.serialize());
+    buffer->insert(buffer->end(), "a");
+    CHECK_EQUAL(gnote::NoteBufferArchiver::serialize(buffer), serializer.serialize());
+    buffer->erase(buffer->begin(), buffer->end());
+    CHECK_EQUAL(gnote::NoteBufferArchiver::serialize(buffer), serializer.serialize());
+  }
+
+  TEST_FIXTURE(Fixture, serializer_matches_full_serialization)
+  {
+    fill();
+    gnote::NoteBufferSerializer serializer(buffer);
+    CHECK_EQUAL(gnote::NoteBufferArchiver::serialize(buffer), serializer.serialize());
+
+    for(int i = 0; i < 500; ++i) {
+      edit();
+      if(random_int(3) == 0) {
+        Glib::ustring expected = gnote::NoteBufferArchiver::serialize(buffer);
+        Glib::ustring serialized = serializer.serialize();
+        CHECK_EQUAL(expected, serialized);
+        if(expected != serialized) {
+          break;
+        }
+      }
+    }
+    CHECK_EQUAL(gnote::NoteBufferArchiver::serialize(buffer), serializer.serialize());
+
+    // and after the cached blocks are dropped
+    serializer.invalidate();
+    CHECK_EQUAL(gnote::NoteBufferArchiver::serialize(buffer), serializer.serialize());
+  }
+
+  TEST_FIXTURE(Fixture, serializer_replaced_buffer)
+  {
+    fill();
+    gnote::NoteBufferSerializer serializer(buffer);
+    serializer.serialize();
+    Glib::ustring xml = gnote::NoteBufferArchiver::serialize(buffer);
+    buffer->erase(buffer->begin(), buffer->end());
+    gnote::NoteBufferArchiver::deserialize(buffer, xml);
+    CHECK_EQUAL(xml, serializer.serialize());
+  }
+}
+
@@ -18,8 +18,11 @@
  */
 
 
+#include <glib/gstdio.h>
+#include <glibmm/miscutils.h>
 #include <UnitTest++/UnitTest++.h>
 
+#include "sharp/files.hpp"
 #include "test/testnotemanager.hpp"
 #include "test/testtagmanager.hpp"
 
@@ -43,5 +46,273 @@ SUITE(NoteManager)
     CHECK(manager.find("test note") == test_note);
     CHECK(manager.find_by_uri(test_note->uri()) == test_note);
   }
-}
 
+  TEST(notes_ordered_by_change_date)
+  {
+    char notes_dir_tmpl[] = "/tmp/gnotetestnotesXXXXXX";
+    char *notes_dir = g_mkdtemp(notes_dir_tmpl);
+    CHECK(notes_dir != NULL);
+
+    new test::TagManager;
+    test::NoteManager manager(notes_dir);
+    gnote::NoteBase::Ptr note1 = manager.create("note 1");
+    gnote::NoteBase::Ptr note2 = manager.create("note 2");
+    gnote::NoteBase::Ptr note3 = manager.create("note 3");
+    note1->queue_save(gnote::CONTENT_CHANGED);
+    note2->queue_save(gnote::CONTENT_CHANGED);
+    note3->queue_save(gnote::CONTENT_CHANGED);
+    CHECK(manager.get_notes()[0] == note3);
+    CHECK(manager.get_notes()[1] == note2);
+    CHECK(manager.get_notes()[2] == note1);
+
+    // saving makes note the newest
+    note1->queue_save(gnote::CONTENT_CHANGED);
+    CHECK(manager.get_notes()[0] == note1);
+    CHECK(manager.get_notes()[1] == note3);
+    CHECK(manager.get_notes()[2] == note2);
+
+    // change date from the past moves note back
+    sharp::DateTime older(note2->change_date());
+    older.add_seconds(-1);
+    note1->data().set_change_date(older);
+    note1->queue_save(gnote::NO_CHANGE);
+    CHECK_EQUAL(4, manager.get_notes().size());
+    CHECK(manager.get_notes()[0] == note3);
+    CHECK(manager.get_notes()[1] == note2);
+    CHECK(manager.get_notes()[3] == note1);
+  }
+
+  TEST(unique_name)
+  {
+    char notes_dir_tmpl[] = "/tmp/gnotetestnotesXXXXXX";
+    char *notes_dir = g_mkdtemp(notes_dir_tmpl);
+    CHECK(notes_dir != NULL);
+
+    new test::TagManager;
+    test::NoteManager manager(notes_dir);
+    CHECK_EQUAL("Note 1", manager.get_unique_name("Note"));
+    manager.create("Note 1");
+    gnote::NoteBase::Ptr note2 = manager.create("note 2");
+    manager.create("Note 3");
+    manager.create("Note 05");
+    CHECK_EQUAL("Note 4", manager.get_unique_name("Note"));
+    manager.delete_note(note2);
+    CHECK_EQUAL("Note 2", manager.get_unique_name("Note"));
+    gnote::NoteBase::Ptr note = manager.create(manager.get_unique_name("Note"));
+    CHECK_EQUAL("Note 2", note->get_title());
+    CHECK_EQUAL("Note 4", manager.get_unique_name("Note"));
+    note->set_title("Other");
+    CHECK_EQUAL("Note 2", manager.get_unique_name("Note"));
+    CHECK_EQUAL("Other 1", manager.get_unique_name("Other"));
+  }
+
+  TEST(unique_name_after_user_rename)
+  {
+    char notes_dir_tmpl[] = "/tmp/gnotetestnotesXXXXXX";
+    char *notes_dir = g_mkdtemp(notes_dir_tmpl);
+    CHECK(notes_dir != NULL);
+
+    new test::TagManager;
+    test::NoteManager manager(notes_dir);
+    gnote::NoteBase::Ptr note = manager.create("Other");
+    // no notes link to it, so no signal_renamed is emitted
+    note->set_title("Note 1", true);
+    CHECK_EQUAL("Note 2", manager.get_unique_name("Note"));
+    gnote::NoteBase::Ptr note2 = manager.create(manager.get_unique_name("Note"));
+    CHECK_EQUAL("Note 2", note2->get_title());
+    note->set_title("Other", true);
+    CHECK_EQUAL("Note 1", manager.get_unique_name("Note"));
+  }
+
+  TEST(import_notes)
+  {
+    char notes_dir_tmpl[] = "/tmp/gnotetestnotesXXXXXX";
+    char *notes_dir = g_mkdtemp(notes_dir_tmpl);
+    CHECK(notes_dir != NULL);
+    char import_dir_tmpl[] = "/tmp/gnotetestimportXXXXXX";
+    char *import_dir = g_mkdtemp(import_dir_tmpl);
+    CHECK(import_dir != NULL);
+
+    std::vector<Glib::ustring> files;
+    for(int i = 1; i <= 5; ++i) {
+      Glib::ustring file = Glib::build_filename(import_dir, Glib::ustring::compose("note%1.note", i));
+      sharp::file_write_all_text(file, Glib::ustring::compose(
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+        "<note version=\"0.3\" xmlns:link=\"http://beatniksoftware.com/tomboy/link\" "
+        "xmlns:size=\"http://beatniksoftware.com/tomboy/size\" xmlns=\"http://beatniksoftware.com/tomboy\">"
+        "<title>Imported %1</title>"
+        "<text xml:space=\"preserve\"><note-content version=\"0.1\">Imported %1\n\nbody</note-content></text>"
+        "<last-change-date>2019-01-01T12:00:00.0000000+00:00</last-change-date>"
+        "<tags><tag>imported</tag></tags>"
+        "</note>", i));
+      files.push_back(file);
+    }
+
+    new test::TagManager;
+    test::NoteManager manager(notes_dir);
+    int single_added = 0;
+    int bulk_added = 0;
+    manager.signal_note_added.connect([&single_added](const gnote::NoteBase::Ptr &) { ++single_added; });
+    manager.signal_notes_added.connect([&bulk_added](const gnote::NoteBase::List & notes) { bulk_added += notes.size(); });
+
+    gnote::NoteBase::List notes = manager.import_notes(files);
+    CHECK_EQUAL(5, notes.size());
+    CHECK_EQUAL(5, manager.get_notes().size());
+    CHECK_EQUAL(0, single_added);
+    CHECK_EQUAL(5, bulk_added);
+    gnote::NoteBase::Ptr note = manager.find("Imported 3");
+    CHECK(note != NULL);
+    CHECK_EQUAL(1, note->get_tags().size());
+    CHECK_EQUAL("Imported 6", manager.get_unique_name("Imported"));
+  }
+
+  TEST(import_notes_unique_title)
+  {
+    char notes_dir_tmpl[] = "/tmp/gnotetestnotesXXXXXX";
+    char *notes_dir = g_mkdtemp(notes_dir_tmpl);
+    CHECK(notes_dir != NULL);
+    char import_dir_tmpl[] = "/tmp/gnotetestimportXXXXXX";
+    char *import_dir = g_mkdtemp(import_dir_tmpl);
+    CHECK(import_dir != NULL);
+
+    std::vector<Glib::ustring> files;
+    for(int i = 1; i <= 2; ++i) {
+      Glib::ustring file = Glib::build_filename(import_dir, Glib::ustring::compose("note%1.note", i));
+      sharp::file_write_all_text(file,
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+        "<note version=\"0.3\" xmlns:link=\"http://beatniksoftware.com/tomboy/link\" "
+        "xmlns:size=\"http://beatniksoftware.com/tomboy/size\" xmlns=\"http://beatniksoftware.com/tomboy\">"
+        "<title>Clash</title>"
+        "<text xml:space=\"preserve\"><note-content version=\"0.1\">Clash\n\nbody</note-content></text>"
+        "<last-change-date>2019-01-01T12:00:00.0000000+00:00</last-change-date>"
+        "</note>");
+      files.push_back(file);
+    }
+
+    new test::TagManager;
+    test::NoteManager manager(notes_dir);
+    gnote::NoteBase::Ptr existing = manager.create("Clash");
+    gnote::NoteBase::List notes = manager.import_notes(files);
+    CHECK_EQUAL(2, notes.size());
+    CHECK(manager.find("Clash") == existing);
+    gnote::NoteBase::Ptr first = manager.find("Clash 1");
+    gnote::NoteBase::Ptr second = manager.find("Clash 2");
+    CHECK(first != NULL);
+    CHECK(second != NULL);
+    CHECK(first != second);
+    CHECK(second->xml_content().find("Clash 2") != Glib::ustring::npos);
+  }
+
+  TEST(restore_backup_unique_title)
+  {
+    char notes_dir_tmpl[] = "/tmp/gnotetestnotesXXXXXX";
+    char *notes_dir = g_mkdtemp(notes_dir_tmpl);
+    CHECK(notes_dir != NULL);
+
+    new test::TagManager;
+    test::NoteManager manager(notes_dir);
+    gnote::NoteBase::Ptr note = manager.create("Restored");
+    note->save();
+    manager.delete_note(note);
+    CHECK(manager.backups() != NULL);
+    std::vector<gnote::NoteBackupStore::Entry> backups = manager.backups()->list();
+    CHECK_EQUAL(1, backups.size());
+
+    gnote::NoteBase::Ptr other = manager.create("Restored");
+    gnote::NoteBase::Ptr restored = manager.restore_backup(backups[0]);
+    CHECK_EQUAL("Restored 1", restored->get_title());
+    CHECK(manager.find("Restored") == other);
+    CHECK(manager.find("Restored 1") == restored);
+    CHECK(restored->xml_content().find("Restored 1") != Glib::ustring::npos);
+  }
+
+  TEST(imported_notes_ordered_by_change_date)
+  {
+    char notes_dir_tmpl[] = "/tmp/gnotetestnotesXXXXXX";
+    char *notes_dir = g_mkdtemp(notes_dir_tmpl);
+    CHECK(notes_dir != NULL);
+    char import_dir_tmpl[] = "/tmp/gnotetestimportXXXXXX";
+    char *import_dir = g_mkdtemp(import_dir_tmpl);
+    CHECK(import_dir != NULL);
+
+    std::vector<Glib::ustring> files;
+    const char *dates[] = { "2000-01-01", "2100-01-01" };
+    for(int i = 0; i < 2; ++i) {
+      Glib::ustring file = Glib::build_filename(import_dir, Glib::ustring::compose("note%1.note", i));
+      sharp::file_write_all_text(file, Glib::ustring::compose(
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+        "<note version=\"0.3\" xmlns:link=\"http://beatniksoftware.com/tomboy/link\" "
+        "xmlns:size=\"http://beatniksoftware.com/tomboy/size\" xmlns=\"http://beatniksoftware.com/tomboy\">"
+        "<title>Imported %1</title>"
+        "<text xml:space=\"preserve\"><note-content version=\"0.1\">Imported %1\n\nbody</note-content></text>"
+        "<last-change-date>%2T12:00:00.0000000+00:00</last-change-date>"
+        "</note>", i, dates[i]));
+      files.push_back(file);
+    }
+
+    new test::TagManager;
+    test::NoteManager manager(notes_dir);
+    gnote::NoteBase::Ptr note = manager.create("note");
+    note->queue_save(gnote::CONTENT_CHANGED);
+    manager.import_notes(files);
+    // 2 imported notes, created note and template note
+    CHECK_EQUAL(4, manager.get_notes().size());
+    CHECK(manager.get_notes()[0] == manager.find("Imported 1"));
+    CHECK(manager.get_notes()[3] == manager.find("Imported 0"));
+
+    // saved note is placed correctly after import
+    note->queue_save(gnote::CONTENT_CHANGED);
+    CHECK(manager.get_notes()[0] == manager.find("Imported 1"));
+    CHECK(manager.get_notes()[1] == note);
+    CHECK(manager.get_notes()[3] == manager.find("Imported 0"));
+  }
+
+  TEST(unchanged_note_not_written)
+  {
+    char notes_dir_tmpl[] = "/tmp/gnotetestnotesXXXXXX";
+    char *notes_dir = g_mkdtemp(notes_dir_tmpl);
+    CHECK(notes_dir != NULL);
+
+    new test::TagManager;
+    test::NoteManager manager(notes_dir);
+    gnote::NoteBase::Ptr note = manager.create("note");
+    note->save();
+    unsigned written = manager.saves_written();
+    unsigned skipped = manager.saves_skipped();
+
+    note->save();
+    note->queue_save(gnote::NO_CHANGE);
+    CHECK_EQUAL(written, manager.saves_written());
+    CHECK_EQUAL(skipped + 2, manager.saves_skipped());
+
+    note->data().set_cursor_position(3);
+    note->save();
+    CHECK_EQUAL(written + 1, manager.saves_written());
+  }
+
+  TEST(failed_write_retried)
+  {
+    char notes_dir_tmpl[] = "/tmp/gnotetestnotesXXXXXX";
+    char *notes_dir = g_mkdtemp(notes_dir_tmpl);
+    CHECK(notes_dir != NULL);
+    Glib::ustring moved_dir = Glib::ustring(notes_dir) + ".moved";
+
+    new test::TagManager;
+    test::NoteManager manager(notes_dir);
+    gnote::NoteBase::Ptr note = manager.create("note");
+    note->save();
+
+    // notes directory gone, so the write fails
+    CHECK_EQUAL(0, g_rename(notes_dir, moved_dir.c_str()));
+    note->data().set_cursor_position(3);
+    note->save();
+    CHECK_EQUAL(0, g_rename(moved_dir.c_str(), notes_dir));
+
+    unsigned written = manager.saves_written();
+    note->save();
+    CHECK_EQUAL(written + 1, manager.saves_written());
+    gnote::NoteData read("note://gnote/1");
+    gnote::NoteArchiver::read(note->file_path(), read);
+    CHECK_EQUAL(3, read.cursor_position());
+  }
+}
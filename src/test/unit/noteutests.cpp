@@ -19,10 +19,27 @@
 
 
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <glib/gstdio.h>
+#include <glibmm/fileutils.h>
+#include <glibmm/main.h>
+#include <glibmm/miscutils.h>
 #include <libxml/tree.h>
 #include <UnitTest++/UnitTest++.h>
 
 #include "note.hpp"
+#include "notebackupstore.hpp"
+#include "notehistory.hpp"
+#include "notesavequeue.hpp"
+#include "notestorage.hpp"
+#include "sharp/directory.hpp"
+#include "sharp/exception.hpp"
+#include "sharp/files.hpp"
+#include "test/testtagmanager.hpp"
 
 SUITE(Note)
 {
@@ -40,5 +57,384 @@ SUITE(Note)
       xmlFreeDoc(doc);
     }
   }
-}
 
+  TEST(data_uri)
+  {
+    gnote::NoteData guid_note("note://gnote/0e0f9e3a-4cf8-4c6b-8d2e-2a1b3c4d5e6f");
+    CHECK_EQUAL("note://gnote/0e0f9e3a-4cf8-4c6b-8d2e-2a1b3c4d5e6f", guid_note.uri());
+    CHECK(guid_note.has_uri("note://gnote/0e0f9e3a-4cf8-4c6b-8d2e-2a1b3c4d5e6f"));
+    CHECK(!guid_note.has_uri("note://gnote/0E0F9E3A-4CF8-4C6B-8D2E-2A1B3C4D5E6F"));
+
+    gnote::NoteData other_note("note://gnote/Not a GUID");
+    CHECK_EQUAL("note://gnote/Not a GUID", other_note.uri());
+    CHECK(other_note.has_uri("note://gnote/Not a GUID"));
+  }
+
+  TEST(data_dates)
+  {
+    gnote::NoteData data("note://gnote/1");
+    CHECK(!data.create_date().is_valid());
+    CHECK(!data.change_date().is_valid());
+
+    sharp::DateTime date(1234567890, 12345);
+    data.set_change_date(date);
+    CHECK(data.change_date() == date);
+    CHECK(data.metadata_change_date() == date);
+
+    sharp::DateTime early(-100, 500000);
+    data.set_create_date(early);
+    CHECK(data.create_date() == early);
+  }
+
+  TEST(data_tags)
+  {
+    test::TagManager::ensure_exists();
+    gnote::NoteData data("note://gnote/1");
+    gnote::Tag::Ptr tag_b = gnote::ITagManager::obj().get_or_create_tag("b");
+    gnote::Tag::Ptr tag_a = gnote::ITagManager::obj().get_or_create_tag("a");
+    CHECK(data.tags().insert(tag_b));
+    CHECK(data.tags().insert(tag_a));
+    CHECK(!data.tags().insert(tag_a));
+    CHECK_EQUAL(2, data.tags().size());
+    CHECK(*data.tags().begin() == tag_a);
+    CHECK(data.tags().contains("b"));
+    CHECK(data.tags().erase("b"));
+    CHECK(!data.tags().erase("b"));
+    CHECK(!data.tags().contains("b"));
+  }
+
+  TEST(read_mapped)
+  {
+    test::TagManager::ensure_exists();
+    const char *notes[] = {
+      // current format, read by the scanner
+      "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+      "<note version=\"0.3\" xmlns:link=\"http://beatniksoftware.com/tomboy/link\" "
+      "xmlns:size=\"http://beatniksoftware.com/tomboy/size\" xmlns=\"http://beatniksoftware.com/tomboy\">\n"
+      "  <title>Fish &amp; chips</title>\n"
+      "  <text xml:space=\"preserve\"><note-content version=\"0.1\">Fish &amp; chips\n\n"
+      "<bold>x</bold> &lt;y&gt; <link:internal>Other</link:internal></note-content></text>\n"
+      "  <last-change-date>2019-06-01T10:00:00.0000000+01:00</last-change-date>\n"
+      "  <create-date>2019-05-01T10:00:00.0000000+01:00</create-date>\n"
+      "  <cursor-position>7</cursor-position>\n"
+      "  <width>450</width>\n"
+      "  <tags>\n    <tag>a &amp; b</tag>\n    <tag>system:notebook:N</tag>\n  </tags>\n"
+      "</note>\n",
+      // unusual content, left to libxml2
+      "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+      "<note version=\"0.3\" xmlns=\"http://beatniksoftware.com/tomboy\">\n"
+      "  <title>Ch&#101;ck</title>\n"
+      "  <text xml:space=\"preserve\"><note-content version=\"0.1\">Check &quot;it&quot;<!-- x --></note-content></text>\n"
+      "</note>\n",
+    };
+
+    for(const char *note : notes) {
+      char temp_file_name[] = "/tmp/gnotetestXXXXXX";
+      int fd = mkstemp(temp_file_name);
+      close(fd);
+      sharp::file_write_all_text(temp_file_name, note);
+
+      gnote::NoteData mapped("note://gnote/1");
+      gnote::NoteArchiver::obj().read_file(temp_file_name, mapped);
+      gnote::NoteData parsed("note://gnote/1");
+      sharp::XmlReader xml(temp_file_name);
+      gnote::NoteArchiver::obj().read(xml, parsed);
+      sharp::file_delete(temp_file_name);
+
+      CHECK_EQUAL(parsed.title(), mapped.title());
+      CHECK_EQUAL(parsed.text(), mapped.text());
+      CHECK_EQUAL(0, mapped.text().find("<note-content version=\"0.1\" "
+                                        "xmlns:link=\"http://beatniksoftware.com/tomboy/link\" "
+                                        "xmlns:size=\"http://beatniksoftware.com/tomboy/size\">"));
+      CHECK(parsed.change_date() == mapped.change_date());
+      CHECK(parsed.create_date() == mapped.create_date());
+      CHECK_EQUAL(parsed.cursor_position(), mapped.cursor_position());
+      CHECK_EQUAL(parsed.width(), mapped.width());
+      CHECK_EQUAL(parsed.tags().size(), mapped.tags().size());
+    }
+  }
+
+  TEST(write_streamed)
+  {
+    // long enough to be written in several chunks, which split characters
+    Glib::ustring text = "<note-content version=\"0.1\">Title\n\n";
+    for(int i = 0; i < 2000; ++i) {
+      text += "\xc4\x85\xe2\x82\xac & ";
+    }
+    text += "</note-content>";
+    gnote::NoteData data("note://gnote/1");
+    data.title() = "Title \xc4\x85";
+    data.text() = text;
+
+    Glib::ustring xml = gnote::NoteArchiver::write_string(data);
+    CHECK(xml.validate());
+    CHECK(xml.find(text) != Glib::ustring::npos);
+
+    char temp_file_name[] = "/tmp/gnotetestXXXXXX";
+    int fd = mkstemp(temp_file_name);
+    close(fd);
+    gnote::NoteArchiver::write(temp_file_name, data);
+    CHECK_EQUAL(xml.raw(), Glib::file_get_contents(temp_file_name));
+    sharp::file_delete(temp_file_name);
+  }
+
+  TEST(save_queue)
+  {
+    char temp_file_name[] = "/tmp/gnotetestXXXXXX";
+    int fd = mkstemp(temp_file_name);
+    close(fd);
+
+    gnote::NoteSaveQueue queue;
+    for(int i = 0; i < 5; ++i) {
+      gnote::NoteData *data = new gnote::NoteData("note://gnote/1");
+      data->title() = Glib::ustring::compose("Title %1", i);
+      data->text() = "<note-content>text</note-content>";
+      queue.enqueue(temp_file_name, data);
+    }
+    queue.flush();
+
+    CHECK_EQUAL(5, queue.queued());
+    CHECK_EQUAL(queue.queued(), queue.written() + queue.coalesced());
+    gnote::NoteData read("note://gnote/1");
+    gnote::NoteArchiver::read(temp_file_name, read);
+    CHECK_EQUAL("Title 4", read.title());
+
+    gnote::NoteData *data = new gnote::NoteData("note://gnote/1");
+    data->title() = "Cancelled";
+    queue.enqueue(temp_file_name, data);
+    queue.cancel(temp_file_name);
+    queue.flush();
+    sharp::file_delete(temp_file_name);
+  }
+
+  TEST(save_queue_reports_failure)
+  {
+    const Glib::ustring file_path = "/nonexistent/gnotetest/1.note";
+    gnote::NoteData data("note://gnote/1");
+    data.text() = "<note-content>text</note-content>";
+    CHECK_THROW(gnote::NoteArchiver::write(file_path, data), sharp::Exception);
+
+    gnote::NoteSaveQueue queue;
+    std::vector<Glib::ustring> failed;
+    queue.signal_write_failed.connect([&failed](const Glib::ustring & path, const Glib::ustring &) {
+      failed.push_back(path);
+    });
+    queue.enqueue(file_path, new gnote::NoteData(data));
+    queue.flush();
+    // failures are reported in main thread
+    while(Glib::MainContext::get_default()->iteration(false)) {
+    }
+    CHECK_EQUAL(1, failed.size());
+    CHECK(failed.size() == 1 && failed[0] == file_path);
+  }
+
+  TEST(packed_storage)
+  {
+    gchar *temp_dir = g_dir_make_tmp("gnotetestXXXXXX", NULL);
+    Glib::ustring notes_dir(temp_dir);
+    g_free(temp_dir);
+    Glib::ustring note1 = Glib::build_filename(notes_dir, "1.note");
+    Glib::ustring note2 = Glib::build_filename(notes_dir, "2.note");
+
+    {
+      gnote::PackedNoteStorage storage(notes_dir);
+      for(int i = 0; i < 3; ++i) {
+        gnote::NoteData data("note://gnote/1");
+        data.title() = Glib::ustring::compose("Title %1", i);
+        data.text() = "<note-content>text</note-content>";
+        storage.write(note1, data);
+      }
+      gnote::NoteData data("note://gnote/2");
+      data.title() = "Deleted";
+      data.text() = "<note-content>text</note-content>";
+      storage.write(note2, data);
+      storage.remove(note2);
+
+      CHECK(storage.exists(note1));
+      CHECK(!storage.exists(note2));
+      CHECK(storage.dead_bytes() > storage.live_bytes());
+    }
+
+    // reopen, compact and export
+    {
+      gnote::PackedNoteStorage storage(notes_dir);
+      std::vector<Glib::ustring> notes = storage.list_notes();
+      CHECK_EQUAL(1U, notes.size());
+      CHECK_EQUAL(note1, notes[0]);
+      storage.compact();
+      CHECK_EQUAL(0U, storage.dead_bytes());
+
+      gnote::NoteData read("note://gnote/1");
+      storage.read(note1, read);
+      CHECK_EQUAL("Title 2", read.title());
+
+      Glib::ustring export_dir = Glib::build_filename(notes_dir, "export");
+      sharp::directory_create(export_dir);
+      storage.export_directory(export_dir);
+      gnote::NoteData exported("note://gnote/1");
+      gnote::NoteArchiver::read(Glib::build_filename(export_dir, "1.note"), exported);
+      CHECK_EQUAL("Title 2", exported.title());
+    }
+
+    // record torn by a crash is dropped
+    {
+      FILE *pack = fopen(gnote::PackedNoteStorage::pack_path(notes_dir).c_str(), "ab");
+      fputs("\001torn", pack);
+      fclose(pack);
+      gnote::PackedNoteStorage storage(notes_dir);
+      CHECK_EQUAL(1U, storage.list_notes().size());
+      CHECK_EQUAL(0U, storage.dead_bytes());
+    }
+
+    sharp::directory_delete(notes_dir, true);
+  }
+
+  TEST(backup_store)
+  {
+    gchar *temp_dir = g_dir_make_tmp("gnotetestXXXXXX", NULL);
+    Glib::ustring backup_dir(temp_dir);
+    g_free(temp_dir);
+    std::string xml1 = "<note><title>One</title></note>";
+    std::string xml2 = "<note><title>Two</title></note>";
+    // backup from before the store existed
+    Glib::ustring old_backup = Glib::build_filename(backup_dir, "3.note");
+    Glib::file_set_contents(old_backup, "<note><title>Three</title></note>");
+    struct utimbuf old_time = { 1000, 1000 };
+    g_utime(old_backup.c_str(), &old_time);
+
+    gint64 import_time = g_get_real_time();
+    {
+      gnote::NoteBackupStore store(backup_dir);
+      CHECK(!sharp::file_exists(old_backup));
+      store.add("1", "One", xml1);
+      store.add("1", "One", xml1);
+      store.add("2", "Two", xml2);
+
+      std::vector<gnote::NoteBackupStore::Entry> entries = store.list();
+      CHECK_EQUAL(4U, entries.size());
+      CHECK_EQUAL("2", entries[0].guid);
+      CHECK_EQUAL("3", entries[3].guid);
+      CHECK_EQUAL("Three", entries[3].title);
+      // old file time is not used, it would make the backup expire right away
+      CHECK(entries[3].time >= import_time);
+      // same content is stored once
+      CHECK_EQUAL(entries[1].hash, entries[2].hash);
+      CHECK_EQUAL(xml2, store.read(entries[0]));
+    }
+
+    // reopen and apply retention
+    {
+      gnote::NoteBackupStore store(backup_dir);
+      CHECK_EQUAL(4U, store.list().size());
+      store.retention(1, 1);
+      store.prune();
+      std::vector<gnote::NoteBackupStore::Entry> entries = store.list();
+      // only one copy of note 1, imported note 3 is kept
+      CHECK_EQUAL(3U, entries.size());
+      CHECK_EQUAL("2", entries[0].guid);
+      CHECK_EQUAL("1", entries[1].guid);
+      CHECK_EQUAL("3", entries[2].guid);
+      CHECK_EQUAL(xml1, store.read(entries[1]));
+    }
+
+    {
+      gnote::NoteBackupStore store(backup_dir);
+      std::vector<gnote::NoteBackupStore::Entry> entries = store.list();
+      CHECK_EQUAL(3U, entries.size());
+      // left by a crash while writing content
+      std::string hash = entries[0].hash;
+      Glib::ustring stray = Glib::build_filename(backup_dir, "objects", hash.substr(0, 2), hash + ".gz.tmp");
+      Glib::file_set_contents(stray, "partial");
+      store.prune();
+      CHECK(!sharp::file_exists(stray));
+      CHECK_EQUAL(xml2, store.read(entries[0]));
+    }
+
+    sharp::directory_delete(backup_dir, true);
+  }
+
+  TEST(note_history)
+  {
+    gchar *temp_dir = g_dir_make_tmp("gnotetestXXXXXX", NULL);
+    Glib::ustring history_dir(temp_dir);
+    g_free(temp_dir);
+    std::vector<std::string> versions;
+    for(int i = 0; i < 40; ++i) {
+      versions.push_back(Glib::ustring::compose("<note><title>Title</title><text>%1 text %2</text></note>",
+                                                std::string(i, 'a'), i).raw());
+    }
+
+    {
+      gnote::NoteHistory history(history_dir);
+      for(const std::string & version : versions) {
+        history.record("1", version);
+      }
+      // same as the last one
+      history.record("1", versions.back());
+      CHECK_EQUAL(40U, history.list("1").size());
+      for(unsigned i = 0; i < versions.size(); ++i) {
+        CHECK_EQUAL(versions[i], history.read("1", i));
+      }
+      CHECK(history.list("2").empty());
+      CHECK_THROW(history.read("1", 40), sharp::Exception);
+    }
+
+    // new session, reads what was written and continues
+    {
+      gnote::NoteHistory history(history_dir);
+      history.record("1", "<note><title>Title</title></note>");
+      CHECK_EQUAL(41U, history.list("1").size());
+      CHECK_EQUAL(versions[20], history.read("1", 20));
+      CHECK_EQUAL("<note><title>Title</title></note>", history.read("1", 40));
+
+      history.limits(10, 0);
+      history.compact("1");
+      CHECK_EQUAL(10U, history.list("1").size());
+      CHECK_EQUAL(versions[31], history.read("1", 0));
+      CHECK_EQUAL("<note><title>Title</title></note>", history.read("1", 9));
+      history.record("1", versions[0]);
+      CHECK_EQUAL(versions[0], history.read("1", 10));
+    }
+
+    // record torn by a crash is dropped
+    {
+      FILE *file = fopen(Glib::build_filename(history_dir, "1.history").c_str(), "ab");
+      fputs("\001torn", file);
+      fclose(file);
+      gnote::NoteHistory history(history_dir);
+      CHECK_EQUAL(11U, history.list("1").size());
+
+      // versions recorded after it can be read back
+      history.record("1", versions[1]);
+      history.record("1", versions[2]);
+      CHECK_EQUAL(13U, history.list("1").size());
+      CHECK_EQUAL(versions[0], history.read("1", 10));
+      CHECK_EQUAL(versions[1], history.read("1", 11));
+      CHECK_EQUAL(versions[2], history.read("1", 12));
+
+      history.limits(10, 0);
+      history.compact("1");
+      CHECK_EQUAL(10U, history.list("1").size());
+      CHECK_EQUAL(versions[2], history.read("1", 9));
+    }
+
+    // compaction cuts off a torn record before the next save
+    {
+      Glib::ustring history_file = Glib::build_filename(history_dir, "1.history");
+      FILE *file = fopen(history_file.c_str(), "ab");
+      fputs("\001torn", file);
+      fclose(file);
+      gnote::NoteHistory history(history_dir);
+      history.compact("1");
+      history.record("1", versions[3]);
+      CHECK_EQUAL(11U, history.list("1").size());
+      CHECK_EQUAL(versions[3], history.read("1", 10));
+
+      history.remove("1");
+      CHECK(history.list("1").empty());
+      CHECK(!sharp::file_exists(history_file));
+    }
+
+    sharp::directory_delete(history_dir, true);
+  }
+}
@@ -0,0 +1,96 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <UnitTest++/UnitTest++.h>
+
+#include "textscanner.hpp"
+
+
+SUITE(TextScanner)
+{
+  Glib::ustring url(const Glib::ustring & text)
+  {
+    std::size_t start, end;
+    if(gnote::textscanner::find_url(text.c_str(), text.bytes(), start, end)) {
+      return Glib::ustring(text.c_str() + start, text.c_str() + end);
+    }
+    return "";
+  }
+
+  Glib::ustring wikiword(const Glib::ustring & text)
+  {
+    std::size_t start, end;
+    if(gnote::textscanner::find_wikiword(text.c_str(), text.bytes(), start, end)) {
+      return Glib::ustring(text.c_str() + start, text.c_str() + end);
+    }
+    return "";
+  }
+
+  TEST(find_url)
+  {
+    CHECK_EQUAL("http://example.com/path", url("see http://example.com/path."));
+    CHECK_EQUAL("HTTPS://example.com/", url("(HTTPS://example.com/)"));
+    CHECK_EQUAL("www.gnome.org", url("at www.gnome.org, or"));
+    CHECK_EQUAL("ftp.gnome.org", url("ftp.gnome.org"));
+    CHECK_EQUAL("mailto:someone@example.com", url("mailto:someone@example.com"));
+    CHECK_EQUAL("someone@example.com", url("<someone@example.com>"));
+    CHECK_EQUAL("/home/user/file.txt", url("open /home/user/file.txt now"));
+    CHECK_EQUAL("~/notes/todo", url("in ~/notes/todo"));
+    CHECK_EQUAL("ąž@example.lt", url("ąž@example.lt"));
+    CHECK_EQUAL("", url("no links here"));
+    CHECK_EQUAL("", url("a/b/c"));
+    CHECK_EQUAL("", url("xhttp://"));
+    CHECK_EQUAL("", url("www."));
+    CHECK_EQUAL("", url(""));
+  }
+
+  TEST(find_url_start)
+  {
+    Glib::ustring text = "ąčę http://example.com";
+    std::size_t start, end;
+    CHECK(gnote::textscanner::find_url(text.c_str(), text.bytes(), start, end));
+    // bytes, each of the first three letters takes two
+    CHECK_EQUAL(7, start);
+    CHECK_EQUAL(text.bytes(), end);
+  }
+
+  TEST(find_wikiword)
+  {
+    CHECK_EQUAL("WikiWord", wikiword("a WikiWord here"));
+    CHECK_EQUAL("CamelCase2Words", wikiword("CamelCase2Words."));
+    CHECK_EQUAL("ĄčĘė", wikiword("ĄčĘė"));
+    CHECK_EQUAL("", wikiword("Wiki"));
+    CHECK_EQUAL("", wikiword("wikiWord"));
+    CHECK_EQUAL("", wikiword("WikiWord_x"));
+    CHECK_EQUAL("", wikiword("xWikiWord"));
+    CHECK_EQUAL("NextWord", wikiword("wikiWord NextWord"));
+  }
+
+  TEST(is_email_address)
+  {
+    CHECK(gnote::textscanner::is_email_address("someone@example.com"));
+    CHECK(gnote::textscanner::is_email_address("a@bc"));
+    CHECK(!gnote::textscanner::is_email_address("a@b"));
+    CHECK(!gnote::textscanner::is_email_address("@example.com"));
+    CHECK(!gnote::textscanner::is_email_address("http://user@example.com"));
+    CHECK(!gnote::textscanner::is_email_address("Mailto:someone@example.com"));
+  }
+}
@@ -0,0 +1,176 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <stdlib.h>
+
+#include <glib/gstdio.h>
+#include <glibmm/miscutils.h>
+#include <gtkmm/main.h>
+#include <UnitTest++/UnitTest++.h>
+
+#include "notetag.hpp"
+#include "undo.hpp"
+#include "undohistory.hpp"
+
+SUITE(UndoHistory)
+{
+  struct Fixture
+  {
+    gnote::NoteTagTable::Ptr table;
+    Glib::RefPtr<Gtk::TextBuffer> buffer;
+    gnote::ChopBuffer::Ptr chop;
+    Glib::ustring dir;
+    Glib::ustring path;
+
+    Fixture()
+    {
+      Gtk::Main::init_gtkmm_internals();
+      table = gnote::NoteTagTable::instance();
+      buffer = Gtk::TextBuffer::create(table);
+      chop = gnote::ChopBuffer::Ptr(new gnote::ChopBuffer(table));
+      char temp_dir[] = "/tmp/gnotetestXXXXXX";
+      dir = mkdtemp(temp_dir);
+      path = Glib::build_filename(dir, "Undo", "note.undo");
+    }
+
+    ~Fixture()
+    {
+      g_remove(path.c_str());
+      g_rmdir(Glib::path_get_dirname(path).c_str());
+      g_rmdir(dir.c_str());
+    }
+
+    // edits "hello world" to " big world" with "big" in bold, returns actions for them
+    std::vector<gnote::EditAction*> edit()
+    {
+      std::vector<gnote::EditAction*> actions;
+      buffer->set_text("hello world");
+      Gtk::TextIter pos = buffer->insert(buffer->get_iter_at_offset(5), " big");
+      actions.push_back(new gnote::InsertAction(pos, " big", 4, chop));
+      Gtk::TextIter start = buffer->get_iter_at_offset(6);
+      Gtk::TextIter end = buffer->get_iter_at_offset(9);
+      buffer->apply_tag_by_name("bold", start, end);
+      actions.push_back(new gnote::TagApplyAction(table->lookup("bold"), start, end));
+      actions.push_back(new gnote::EraseAction(buffer->begin(), buffer->get_iter_at_offset(5), chop));
+      buffer->erase(buffer->begin(), buffer->get_iter_at_offset(5));
+      return actions;
+    }
+
+    void save(const std::vector<gnote::EditAction*> & actions)
+    {
+      gnote::UndoHistory history(path, chop);
+      for(gnote::EditAction *action : actions) {
+        CHECK(history.push(*action));
+        action->destroy();
+        delete action;
+      }
+      history.push_state(*buffer.operator->());
+    }
+  };
+
+  TEST_FIXTURE(Fixture, undo_from_saved_history)
+  {
+    save(edit());
+    CHECK_EQUAL(" big world", buffer->get_text());
+
+    gnote::UndoHistory history(path, chop);
+    CHECK(history.pop_state(*buffer.operator->()));
+    CHECK(!history.empty());
+    std::vector<gnote::EditAction*> actions = history.pop(10);
+    CHECK_EQUAL(3u, actions.size());
+    CHECK(history.empty());
+
+    for(auto iter = actions.rbegin(); iter != actions.rend(); ++iter) {
+      (*iter)->undo(buffer.operator->());
+      (*iter)->destroy();
+      delete *iter;
+    }
+    CHECK_EQUAL("hello world", buffer->get_text());
+    CHECK(!buffer->get_iter_at_offset(7).has_tag(table->lookup("bold")));
+  }
+
+  TEST_FIXTURE(Fixture, pop_newest_first)
+  {
+    save(edit());
+    gnote::UndoHistory history(path, chop);
+    CHECK(history.pop_state(*buffer.operator->()));
+
+    std::vector<gnote::EditAction*> erase = history.pop(1);
+    CHECK_EQUAL(1u, erase.size());
+    CHECK(dynamic_cast<gnote::EraseAction*>(erase[0]) != NULL);
+    erase[0]->undo(buffer.operator->());
+    CHECK_EQUAL("hello big world", buffer->get_text());
+
+    std::vector<gnote::EditAction*> rest = history.pop(10);
+    CHECK_EQUAL(2u, rest.size());
+    CHECK(dynamic_cast<gnote::InsertAction*>(rest[0]) != NULL);
+    CHECK(dynamic_cast<gnote::TagApplyAction*>(rest[1]) != NULL);
+    for(gnote::EditAction *action : rest) {
+      action->destroy();
+      delete action;
+    }
+    erase[0]->destroy();
+    delete erase[0];
+  }
+
+  TEST_FIXTURE(Fixture, discarded_for_changed_text)
+  {
+    save(edit());
+    buffer->insert(buffer->end(), "!");
+
+    gnote::UndoHistory history(path, chop);
+    CHECK(!history.pop_state(*buffer.operator->()));
+    CHECK(history.empty());
+    CHECK(history.pop(10).empty());
+  }
+
+  TEST_FIXTURE(Fixture, file_created_on_first_action)
+  {
+    buffer->set_text("hello world");
+    gnote::UndoHistory history(path, chop);
+    CHECK(history.pop_state(*buffer.operator->()));
+    history.push_state(*buffer.operator->());
+    history.clear();
+    CHECK(history.empty());
+    CHECK(!g_file_test(path.c_str(), G_FILE_TEST_EXISTS));
+
+    CHECK(history.push(gnote::EditActionGroup(true)));
+    CHECK(!history.empty());
+    CHECK(g_file_test(path.c_str(), G_FILE_TEST_EXISTS));
+  }
+
+  TEST_FIXTURE(Fixture, unknown_action_clears_history)
+  {
+    class CustomAction
+      : public gnote::EditActionGroup
+    {
+    public:
+      CustomAction()
+        : gnote::EditActionGroup(true)
+      {}
+    };
+
+    gnote::UndoHistory history(path, chop);
+    CHECK(history.push(gnote::EditActionGroup(true)));
+    CHECK(!history.push(CustomAction()));
+    CHECK(history.empty());
+  }
+}
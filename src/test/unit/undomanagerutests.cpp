@@ -0,0 +1,151 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <glibmm/miscutils.h>
+#include <gtkmm/main.h>
+#include <UnitTest++/UnitTest++.h>
+
+#include "note.hpp"
+#include "notebuffer.hpp"
+#include "undo.hpp"
+#include "test/testnotemanager.hpp"
+#include "test/testtagmanager.hpp"
+
+
+SUITE(UndoManager)
+{
+  struct Fixture
+  {
+    test::NoteManager *manager;
+
+    Fixture()
+    {
+      Gtk::Main::init_gtkmm_internals();
+      test::TagManager::ensure_exists();
+      manager = new test::NoteManager(test::NoteManager::test_notes_dir());
+    }
+
+    ~Fixture()
+    {
+      delete manager;
+    }
+
+    gnote::Note::Ptr create_note(const Glib::ustring & title)
+    {
+      Glib::ustring file_path = Glib::build_filename(manager->notes_dir(), title + ".note");
+      gnote::NoteData *data = new gnote::NoteData(gnote::NoteBase::url_from_path(file_path));
+      data->title() = title;
+      data->text() = "<note-content version=\"0.1\">" + title + "\nbody</note-content>";
+      return gnote::Note::create_existing_note(data, file_path, *manager);
+    }
+  };
+
+  TEST_FIXTURE(Fixture, group_with_latest_action_kept)
+  {
+    gnote::Note::Ptr note = create_note("note");
+    gnote::NoteBuffer::Ptr buffer = note->get_buffer();
+    gnote::UndoManager & undoer = buffer->undoer();
+    undoer.add_undo_action(new gnote::EditActionGroup(true));
+    buffer->insert(buffer->end(), " first");
+    buffer->insert(buffer->end(), " second");
+    undoer.add_undo_action(new gnote::EditActionGroup(false));
+
+    undoer.set_memory_limit(1);
+    CHECK(undoer.get_memory_size() > 0);
+    undoer.undo();
+    CHECK_EQUAL("note\nbody", buffer->get_text());
+  }
+
+  TEST_FIXTURE(Fixture, redo_not_counted)
+  {
+    gnote::Note::Ptr note = create_note("note");
+    gnote::NoteBuffer::Ptr buffer = note->get_buffer();
+    gnote::UndoManager & undoer = buffer->undoer();
+    std::size_t initial = undoer.get_memory_size();
+    buffer->insert(buffer->end(), " text");
+    std::size_t edited = undoer.get_memory_size();
+    CHECK(edited > initial);
+
+    undoer.undo();
+    CHECK_EQUAL(initial, undoer.get_memory_size());
+    undoer.redo();
+    CHECK_EQUAL(edited, undoer.get_memory_size());
+    CHECK_EQUAL("note\nbody text", buffer->get_text());
+  }
+
+  TEST_FIXTURE(Fixture, undo_into_history_file)
+  {
+    gnote::Note::Ptr note = create_note("note");
+    gnote::NoteBuffer::Ptr buffer = note->get_buffer();
+    gnote::UndoManager & undoer = buffer->undoer();
+    undoer.add_undo_action(new gnote::EditActionGroup(true));
+    buffer->insert(buffer->end(), " first");
+    buffer->insert(buffer->end(), " more");
+    undoer.add_undo_action(new gnote::EditActionGroup(false));
+    buffer->insert(buffer->end(), " second");
+
+    // the group goes to the file
+    undoer.set_memory_limit(1);
+    undoer.undo();
+    CHECK_EQUAL("note\nbody first more", buffer->get_text());
+    CHECK(undoer.get_can_undo());
+    // read back from the file and undone as a whole
+    undoer.undo();
+    CHECK_EQUAL("note\nbody", buffer->get_text());
+    CHECK(!undoer.get_can_undo());
+
+    undoer.redo();
+    CHECK_EQUAL("note\nbody first more", buffer->get_text());
+    undoer.redo();
+    CHECK_EQUAL("note\nbody first more second", buffer->get_text());
+  }
+
+  TEST_FIXTURE(Fixture, saved_history_reopened)
+  {
+    gnote::Note::Ptr note = create_note("note");
+    gnote::NoteBuffer::Ptr buffer = note->get_buffer();
+    gnote::UndoManager & undoer = buffer->undoer();
+    buffer->insert(buffer->end(), " text");
+    undoer.save_history();
+    CHECK(undoer.get_can_undo());
+
+    // as when the buffer is created again for the same text
+    undoer.set_history_file(manager->undo_history_path(*note));
+    CHECK(undoer.get_can_undo());
+    undoer.undo();
+    CHECK_EQUAL("note\nbody", buffer->get_text());
+    CHECK(!undoer.get_can_undo());
+  }
+
+  TEST_FIXTURE(Fixture, saved_history_dropped_for_changed_text)
+  {
+    gnote::Note::Ptr note = create_note("note");
+    gnote::NoteBuffer::Ptr buffer = note->get_buffer();
+    gnote::UndoManager & undoer = buffer->undoer();
+    buffer->insert(buffer->end(), " text");
+    undoer.save_history();
+
+    undoer.freeze_undo();
+    buffer->insert(buffer->end(), "!");
+    undoer.thaw_undo();
+    undoer.set_history_file(manager->undo_history_path(*note));
+    CHECK(!undoer.get_can_undo());
+  }
+}
@@ -0,0 +1,287 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <algorithm>
+#include <cstring>
+
+#include <glib.h>
+
+#include "textscanner.hpp"
+
+
+namespace gnote {
+namespace textscanner {
+
+namespace {
+
+const std::size_t NPOS = std::size_t(-1);
+
+inline gunichar char_at(const char *text, std::size_t pos)
+{
+  unsigned char c = text[pos];
+  return c < 0x80 ? c : g_utf8_get_char(text + pos);
+}
+
+inline std::size_t next_char(const char *text, std::size_t pos)
+{
+  return g_utf8_next_char(text + pos) - text;
+}
+
+inline std::size_t prev_char(const char *text, std::size_t pos)
+{
+  return g_utf8_prev_char(text + pos) - text;
+}
+
+// \w and \s as GRegex has them, it compiles patterns with Unicode properties
+bool is_word(gunichar c)
+{
+  if(c < 0x80) {
+    return g_ascii_isalnum(c) || c == '_';
+  }
+  return g_unichar_isalnum(c);
+}
+
+bool is_space(gunichar c)
+{
+  if(c < 0x80) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+  }
+  return c == 0x85 || g_unichar_isspace(c);
+}
+
+// \b, the start and the end of the text count as non-word characters
+bool is_boundary(const char *text, std::size_t length, std::size_t pos)
+{
+  bool word_before = pos > 0 && is_word(char_at(text, prev_char(text, pos)));
+  bool word_after = pos < length && is_word(char_at(text, pos));
+  return word_before != word_after;
+}
+
+std::size_t find_byte(const char *text, std::size_t from, std::size_t to, char c)
+{
+  if(from >= to) {
+    return NPOS;
+  }
+  const void *found = std::memchr(text + from, c, to - from);
+  return found ? static_cast<const char*>(found) - text : NPOS;
+}
+
+bool has_prefix(const char *text, std::size_t length, const char *prefix)
+{
+  std::size_t prefix_length = std::strlen(prefix);
+  return length >= prefix_length && g_ascii_strncasecmp(text, prefix, prefix_length) == 0;
+}
+
+// Length of the scheme://, mailto:, www. or ftp. at the start of text, 0 if none
+std::size_t url_prefix_length(const char *text, std::size_t length)
+{
+  static const char *PREFIXES[] = {
+    "news://", "http://", "https://", "ftp://", "file://", "irc://", "ircs://", "mailto:", "www.", "ftp.",
+  };
+  for(const char *prefix : PREFIXES) {
+    if(has_prefix(text, length, prefix)) {
+      return std::strlen(prefix);
+    }
+  }
+  return 0;
+}
+
+// The URL in the whitespace delimited token [token_start, token_end), if any.
+// Every alternative of the expression is followed by \S*\b/?, which takes the
+// rest of the token back to its last word boundary. A position starts a match,
+// if one of the alternatives ends there or before it.
+bool find_url_in_token(const char *text, std::size_t length, std::size_t token_start, std::size_t token_end,
+                       std::size_t & start, std::size_t & end)
+{
+  std::size_t last_boundary = NPOS;
+  std::size_t pos = token_end;
+  while(true) {
+    if(is_boundary(text, length, pos)) {
+      last_boundary = pos;
+      break;
+    }
+    if(pos == token_start) {
+      return false;
+    }
+    pos = prev_char(text, pos);
+  }
+
+  // the first '@' at or after the position, and the first '.' after it
+  bool at_known = false;
+  std::size_t at = NPOS;
+  std::size_t at_dot = NPOS;
+  for(std::size_t p = token_start; p < last_boundary; p = next_char(text, p)) {
+    // where the shortest alternative matching at p ends
+    std::size_t prefix_end = NPOS;
+    if(p == token_start) {
+      if(text[p] == '/' && p + 1 < token_end) {
+        // /\S+/
+        std::size_t slash = find_byte(text, next_char(text, p + 1), token_end, '/');
+        if(slash != NPOS) {
+          prefix_end = slash + 1;
+        }
+      }
+      else if(text[p] == '~' && p + 2 < token_end && text[p + 1] == '/') {
+        // ~/\S+
+        prefix_end = next_char(text, p + 2);
+      }
+    }
+    if(is_boundary(text, length, p)) {
+      std::size_t prefix = url_prefix_length(text + p, token_end - p);
+      if(prefix) {
+        prefix_end = std::min(prefix_end, p + prefix);
+      }
+      // \S*@\S*\.
+      if(!at_known || (at != NPOS && at < p)) {
+        at = find_byte(text, p, token_end, '@');
+        at_dot = at == NPOS ? NPOS : find_byte(text, at + 1, token_end, '.');
+        at_known = true;
+      }
+      if(at_dot != NPOS) {
+        prefix_end = std::min(prefix_end, at_dot + 1);
+      }
+    }
+
+    if(prefix_end != NPOS && prefix_end <= last_boundary) {
+      start = p;
+      end = last_boundary;
+      if(end < token_end && text[end] == '/') {
+        ++end;
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+enum WikiWordState
+{
+  WIKI_START,
+  WIKI_UPPER1,
+  WIKI_LOWER1,
+  WIKI_UPPER2,
+  WIKI_DONE,  // (\p{Lu}+[\p{Ll}0-9]+){2} matched
+  WIKI_FAIL
+};
+
+}
+
+
+bool find_url(const char *text, std::size_t length, std::size_t & start, std::size_t & end)
+{
+  std::size_t pos = 0;
+  while(pos < length) {
+    if(is_space(char_at(text, pos))) {
+      pos = next_char(text, pos);
+      continue;
+    }
+    std::size_t token_start = pos;
+    while(pos < length && !is_space(char_at(text, pos))) {
+      pos = next_char(text, pos);
+    }
+    if(find_url_in_token(text, length, token_start, pos, start, end)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+bool find_wikiword(const char *text, std::size_t length, std::size_t & start, std::size_t & end)
+{
+  std::size_t pos = 0;
+  while(pos < length) {
+    gunichar c = char_at(text, pos);
+    if(!is_word(c)) {
+      pos = next_char(text, pos);
+      continue;
+    }
+
+    // start of a word, so a word boundary
+    std::size_t word_start = pos;
+    WikiWordState state = WIKI_START;
+    for(; pos < length; pos = next_char(text, pos)) {
+      c = char_at(text, pos);
+      bool upper = c < 0x80 ? (c >= 'A' && c <= 'Z') : g_unichar_isupper(c);
+      bool lower = !upper && (c < 0x80 ? g_ascii_islower(c) || g_ascii_isdigit(c) : g_unichar_islower(c));
+      if(!upper && !lower) {
+        break;
+      }
+      switch(state) {
+      case WIKI_START:
+        state = upper ? WIKI_UPPER1 : WIKI_FAIL;
+        break;
+      case WIKI_UPPER1:
+        state = upper ? WIKI_UPPER1 : WIKI_LOWER1;
+        break;
+      case WIKI_LOWER1:
+        state = upper ? WIKI_UPPER2 : WIKI_LOWER1;
+        break;
+      case WIKI_UPPER2:
+        state = upper ? WIKI_UPPER2 : WIKI_DONE;
+        break;
+      default:
+        break;
+      }
+    }
+
+    // the word has to end where the letters and digits do
+    if(state == WIKI_DONE && (pos == length || !is_word(char_at(text, pos)))) {
+      start = word_start;
+      end = pos;
+      return true;
+    }
+    while(pos < length && is_word(char_at(text, pos))) {
+      pos = next_char(text, pos);
+    }
+  }
+  return false;
+}
+
+
+bool is_email_address(const Glib::ustring & url)
+{
+  static const char *SCHEMES[] = { "news:", "mailto:", "http:", "https:", "ftp:", "file:", "irc:" };
+
+  const char *text = url.c_str();
+  std::size_t length = url.bytes();
+  for(const char *scheme : SCHEMES) {
+    if(has_prefix(text, length, scheme)) {
+      return false;
+    }
+  }
+
+  // . does not match a new line, $ matches before one at the end
+  if(length > 0 && text[length - 1] == '\n') {
+    --length;
+  }
+  if(find_byte(text, 0, length, '\n') != NPOS) {
+    return false;
+  }
+
+  // .+@.{2,}
+  std::size_t at = find_byte(text, 1, length, '@');
+  return at != NPOS && g_utf8_strlen(text + at + 1, length - at - 1) >= 2;
+}
+
+}
+}
@@ -0,0 +1,52 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef _TEXTSCANNER_HPP_
+#define _TEXTSCANNER_HPP_
+
+#include <cstddef>
+
+#include <glibmm/ustring.h>
+
+
+namespace gnote {
+namespace textscanner {
+
+// Scanners for the text the watchers highlight as the user types. They work
+// on UTF-8 bytes in a single pass, in place of PCRE regular expressions.
+// Offsets are in bytes, the match is [start, end).
+
+// Finds the first URL, e-mail address or file path, matching what the
+// regular expression below does in GRegex with case folding:
+// ((\b((news|http|https|ftp|file|irc|ircs)://|mailto:|(www|ftp)\.|\S*@\S*\.)|(?<=^|\s)/\S+/|(?<=^|\s)~/\S+)\S*\b/?)
+bool find_url(const char *text, std::size_t length, std::size_t & start, std::size_t & end);
+
+// Finds the first WikiWord, matching \b((\p{Lu}+[\p{Ll}0-9]+){2}([\p{Lu}\p{Ll}0-9])*)\b
+bool find_wikiword(const char *text, std::size_t length, std::size_t & start, std::size_t & end);
+
+// Whether a URL found by find_url() with no scheme is an e-mail address,
+// as ^(?!(news|mailto|http|https|ftp|file|irc):).+@.{2,}$ with case folding
+bool is_email_address(const Glib::ustring & url);
+
+}
+}
+
+#endif
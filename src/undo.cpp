@@ -21,13 +21,26 @@
 
 
 
+#include <algorithm>
+
+#include <glibmm/i18n.h>
+
 #include "sharp/exception.hpp"
 #include "debug.hpp"
+#include "handlertiming.hpp"
+#include "note.hpp"
 #include "notetag.hpp"
 #include "undo.hpp"
+#include "undohistory.hpp"
 
 namespace gnote {
 
+  std::size_t EditAction::memory_size() const
+  {
+    // the object, its heap block and the slot in the undo stack
+    return 64;
+  }
+
   EditActionGroup::EditActionGroup(bool start)
     : m_start(start)
   {
@@ -78,6 +91,17 @@ namespace gnote {
   {
   }
 
+  std::size_t SplitterAction::memory_size() const
+  {
+    // two marks and the chopped text, counting a byte per character
+    std::size_t size = EditAction::memory_size() + 2 * 64 + m_splitTags.size() * sizeof(TagData);
+    if(m_chop.buffer()) {
+      size += m_chop.end().get_offset() - m_chop.start().get_offset();
+    }
+    return size;
+  }
+
+
   void SplitterAction::split(Gtk::TextIter iter, 
                              Gtk::TextBuffer * buffer)
   {
@@ -157,6 +181,13 @@ namespace gnote {
   }
 
 
+  InsertAction::InsertAction()
+    : m_index(0)
+    , m_is_paste(false)
+  {
+  }
+
+
   InsertAction::InsertAction(const Gtk::TextIter & start, 
                              const Glib::ustring & , int length,
                              const ChopBuffer::Ptr & chop_buf)
@@ -251,6 +282,15 @@ namespace gnote {
 
   
 
+  EraseAction::EraseAction()
+    : m_start(0)
+    , m_end(0)
+    , m_is_forward(false)
+    , m_is_cut(false)
+  {
+  }
+
+
   EraseAction::EraseAction(const Gtk::TextIter & start_iter, 
                            const Gtk::TextIter & end_iter,
                            const ChopBuffer::Ptr & chop_buf)
@@ -372,6 +412,13 @@ namespace gnote {
 
 
 
+  TagApplyAction::TagApplyAction()
+    : m_start(0)
+    , m_end(0)
+  {
+  }
+
+
   TagApplyAction::TagApplyAction(const Glib::RefPtr<Gtk::TextTag> & tag, 
                                  const Gtk::TextIter & start, 
                                  const Gtk::TextIter & end)
@@ -406,15 +453,20 @@ namespace gnote {
   }
 
 
-  void TagApplyAction::merge (EditAction * )
+  void TagApplyAction::merge (EditAction * action)
   {
-    throw sharp::Exception ("TagApplyActions cannot be merged");
+    TagApplyAction *apply = dynamic_cast<TagApplyAction*>(action);
+    m_start = std::min(m_start, apply->m_start);
+    m_end = std::max(m_end, apply->m_end);
   }
 
 
-  bool TagApplyAction::can_merge (const EditAction * ) const
+  bool TagApplyAction::can_merge (const EditAction * action) const
   {
-    return false;
+    // same tag on touching ranges, undoing them one by one clears the union
+    const TagApplyAction *apply = dynamic_cast<const TagApplyAction*>(action);
+    return apply && apply->m_tag == m_tag
+      && apply->m_start <= m_end && m_start <= apply->m_end;
   }
 
 
@@ -423,6 +475,13 @@ namespace gnote {
   }
 
 
+  TagRemoveAction::TagRemoveAction()
+    : m_start(0)
+    , m_end(0)
+  {
+  }
+
+
   TagRemoveAction::TagRemoveAction(const Glib::RefPtr<Gtk::TextTag> & tag, 
                                    const Gtk::TextIter & start, 
                                    const Gtk::TextIter & end)
@@ -457,15 +516,19 @@ namespace gnote {
   }
 
 
-  void TagRemoveAction::merge (EditAction * )
+  void TagRemoveAction::merge (EditAction * action)
   {
-    throw sharp::Exception ("TagRemoveActions cannot be merged");
+    TagRemoveAction *remove = dynamic_cast<TagRemoveAction*>(action);
+    m_start = std::min(m_start, remove->m_start);
+    m_end = std::max(m_end, remove->m_end);
   }
 
 
-  bool TagRemoveAction::can_merge (const EditAction * ) const
+  bool TagRemoveAction::can_merge (const EditAction * action) const
   {
-    return false;
+    const TagRemoveAction *remove = dynamic_cast<const TagRemoveAction*>(action);
+    return remove && remove->m_tag == m_tag
+      && remove->m_start <= m_end && m_start <= remove->m_end;
   }
 
 
@@ -477,6 +540,7 @@ namespace gnote {
   ChangeDepthAction::ChangeDepthAction(int line, bool direction)
     : m_line(line)
     , m_direction(direction)
+    , m_count(1)
   {
   }
 
@@ -487,11 +551,13 @@ namespace gnote {
 
     NoteBuffer* note_buffer = dynamic_cast<NoteBuffer*>(buffer);
     if(note_buffer) {
-      if (m_direction) {
-        note_buffer->decrease_depth (iter);
-      }
-      else {
-        note_buffer->increase_depth (iter);
+      for(int i = 0; i < m_count; ++i) {
+        if (m_direction) {
+          note_buffer->decrease_depth (iter);
+        }
+        else {
+          note_buffer->increase_depth (iter);
+        }
       }
 
       buffer->move_mark (buffer->get_insert(), iter);
@@ -506,11 +572,13 @@ namespace gnote {
 
     NoteBuffer* note_buffer = dynamic_cast<NoteBuffer*>(buffer);
     if(note_buffer) {    
-      if (m_direction) {
-        note_buffer->increase_depth (iter);
-      } 
-      else {
-        note_buffer->decrease_depth (iter);
+      for(int i = 0; i < m_count; ++i) {
+        if (m_direction) {
+          note_buffer->increase_depth (iter);
+        } 
+        else {
+          note_buffer->decrease_depth (iter);
+        }
       }
 
       buffer->move_mark (buffer->get_insert(), iter);
@@ -519,15 +587,17 @@ namespace gnote {
   }
 
 
-  void ChangeDepthAction::merge (EditAction * )
+  void ChangeDepthAction::merge (EditAction * action)
   {
-    throw sharp::Exception ("ChangeDepthActions cannot be merged");
+    m_count += dynamic_cast<ChangeDepthAction*>(action)->m_count;
   }
 
 
-  bool ChangeDepthAction::can_merge (const EditAction * ) const
+  bool ChangeDepthAction::can_merge (const EditAction * action) const
   {
-    return false;
+    // repeated indenting of a line, e.g. a pasted bullet, is one step
+    const ChangeDepthAction *change = dynamic_cast<const ChangeDepthAction*>(action);
+    return change && change->m_line == m_line && change->m_direction == m_direction;
   }
 
 
@@ -593,6 +663,8 @@ namespace gnote {
     , m_try_merge(false)
     , m_buffer(buffer)
     , m_chop_buffer(new ChopBuffer(buffer->get_tag_table()))
+    , m_memory_size(0)
+    , m_memory_limit(0)
   {
     
     buffer->signal_insert_text_with_tags
@@ -615,16 +687,24 @@ namespace gnote {
     clear_action_stack(m_undo_stack);
     clear_action_stack(m_redo_stack);
   }
+
+  bool UndoManager::get_can_undo()
+  {
+    return !m_undo_stack.empty() || (m_history && !m_history->empty());
+  }
   
-  void UndoManager::undo_redo(std::stack<EditAction *> & pop_from,
-                              std::stack<EditAction *> & push_to, bool is_undo)
+  void UndoManager::undo_redo(std::deque<EditAction *> & pop_from,
+                              std::deque<EditAction *> & push_to, bool is_undo)
   {
+    if(is_undo) {
+      load_history();
+    }
     if (!pop_from.empty()) {
       bool loop = false;
       freeze_undo();
       do {
-        EditAction *action = pop_from.top();
-        pop_from.pop();
+        EditAction *action = pop_from.back();
+        pop_from.pop_back();
         EditActionGroup *group = dynamic_cast<EditActionGroup*>(action);
         if(group) {
           // in case of undo group-end is at the top, for redo it's the opposite
@@ -633,9 +713,20 @@ namespace gnote {
 
         undo_redo_action(*action, is_undo);
 
-        push_to.push(action);
+        // only the undo stack counts against the limit
+        if(is_undo) {
+          m_memory_size -= std::min(m_memory_size, action->memory_size());
+        }
+        else {
+          m_memory_size += action->memory_size();
+        }
+        push_to.push_back(action);
+        if(loop && is_undo) {
+          load_history();
+        }
 
-      } while(loop);
+        // the start of the group may have been dropped from the history
+      } while(loop && !pop_from.empty());
       thaw_undo();
 
       // Lock merges until a new undoable event comes in...
@@ -659,41 +750,185 @@ namespace gnote {
   }
 
   
-  void UndoManager::clear_action_stack(std::stack<EditAction *> & stack)
+  void UndoManager::clear_action_stack(std::deque<EditAction *> & stack)
   {
     while(!stack.empty()) {
-      delete stack.top();
-      stack.pop();
+      discard_action(stack.back());
+      stack.pop_back();
     }
   }
 
+  void UndoManager::discard_action(EditAction *action)
+  {
+    // frees the text kept in the chop buffer
+    action->destroy();
+    delete action;
+  }
+
+  void UndoManager::set_memory_limit(std::size_t limit)
+  {
+    m_memory_limit = limit;
+    trim_undo_history();
+  }
+
+  void UndoManager::trim_undo_history()
+  {
+    if(m_memory_limit == 0 || m_memory_size <= m_memory_limit) {
+      return;
+    }
+
+    std::size_t dropped = 0;
+    // the latest action is kept, however large;
+    // with a history file the older ones are moved there
+    while(m_memory_size > m_memory_limit && m_undo_stack.size() > 1) {
+      // groups are dropped as a whole, but not the one holding the latest action
+      std::size_t count = 0;
+      int depth = 0;
+      do {
+        EditActionGroup *group = dynamic_cast<EditActionGroup*>(m_undo_stack[count]);
+        if(group) {
+          depth += group->is_start() ? 1 : -1;
+        }
+        ++count;
+      } while(depth > 0 && count < m_undo_stack.size());
+      if(count >= m_undo_stack.size()) {
+        break;
+      }
+
+      for(; count > 0; --count) {
+        EditAction *action = m_undo_stack.front();
+        m_undo_stack.pop_front();
+        if(m_history) {
+          store_action(*action);
+        }
+        m_memory_size -= std::min(m_memory_size, action->memory_size());
+        discard_action(action);
+        ++dropped;
+      }
+    }
+    DBG_OUT("Dropped %u undo actions of %s, undo history uses %u bytes",
+            (unsigned) dropped, m_buffer->note().get_title().c_str(), (unsigned) m_memory_size);
+  }
+
   void UndoManager::clear_undo_history()
   {
     clear_action_stack(m_undo_stack);
     clear_action_stack(m_redo_stack);
+    m_memory_size = 0;
+    if(m_history) {
+      try {
+        m_history->clear();
+      }
+      catch(const sharp::Exception & e) {
+        ERR_OUT(_("Failed to clear undo history: %s"), e.what());
+        m_history.reset();
+      }
+    }
+    m_undo_changed();
+  }
+
+  void UndoManager::set_history_file(const Glib::ustring & path)
+  {
+    try {
+      m_history.reset(new UndoHistory(path, m_chop_buffer));
+      if(!m_history->pop_state(*m_buffer)) {
+        DBG_OUT("Undo history %s is for different text, discarded", path.c_str());
+      }
+    }
+    catch(const sharp::Exception & e) {
+      ERR_OUT(_("Failed to open undo history %s: %s"), path.c_str(), e.what());
+      m_history.reset();
+    }
     m_undo_changed();
   }
 
+  void UndoManager::save_history()
+  {
+    while(m_history && !m_undo_stack.empty()) {
+      EditAction *action = m_undo_stack.front();
+      m_undo_stack.pop_front();
+      store_action(*action);
+      m_memory_size -= std::min(m_memory_size, action->memory_size());
+      discard_action(action);
+    }
+    if(!m_history) {
+      return;
+    }
+    // redo is not kept, it would have to be undone first
+    clear_action_stack(m_redo_stack);
+    try {
+      m_history->push_state(*m_buffer);
+    }
+    catch(const sharp::Exception & e) {
+      ERR_OUT(_("Failed to save undo history: %s"), e.what());
+      m_history.reset();
+    }
+  }
+
+  void UndoManager::close_history()
+  {
+    m_history.reset();
+    m_undo_changed();
+  }
+
+  void UndoManager::store_action(const EditAction & action)
+  {
+    try {
+      if(!m_history->push(action)) {
+        DBG_OUT("Undo action can not be stored, older history discarded");
+      }
+    }
+    catch(const sharp::Exception & e) {
+      ERR_OUT(_("Failed to save undo history: %s"), e.what());
+      m_history.reset();
+    }
+  }
+
+  void UndoManager::load_history()
+  {
+    // actions read at once, the file is mapped for each read
+    static const unsigned HISTORY_BATCH = 64;
+
+    if(!m_history || !m_undo_stack.empty()) {
+      return;
+    }
+    try {
+      for(EditAction *action : m_history->pop(HISTORY_BATCH)) {
+        m_undo_stack.push_back(action);
+        m_memory_size += action->memory_size();
+      }
+    }
+    catch(const sharp::Exception & e) {
+      ERR_OUT(_("Failed to read undo history: %s"), e.what());
+      m_history.reset();
+    }
+  }
+
 
   void UndoManager::add_undo_action(EditAction * action)
   {
     DBG_ASSERT(action, "action is NULL");
     if (m_try_merge && !m_undo_stack.empty()) {
-      EditAction *top = m_undo_stack.top();
+      EditAction *top = m_undo_stack.back();
 
       if (top->can_merge (action)) {
+        std::size_t top_size = top->memory_size();
         // Merging object should handle freeing
         // action's resources, if needed.
         top->merge (action);
         delete action;
+        m_memory_size = m_memory_size - top_size + top->memory_size();
+        trim_undo_history();
         return;
       }
     }
 
-    m_undo_stack.push (action);
+    m_undo_stack.push_back (action);
+    m_memory_size += action->memory_size();
 
     // Clear the redo stack
     clear_action_stack (m_redo_stack);
+    trim_undo_history();
 
     // Try to merge new incoming actions...
     m_try_merge = true;
@@ -708,6 +943,7 @@ namespace gnote {
   void UndoManager::on_insert_text(const Gtk::TextIter & pos, 
                                    const Glib::ustring & text, int)
   {
+    HandlerTimer timer("UndoManager::on_insert_text");
     if (m_frozen_cnt) {
       return;
     }
@@ -732,6 +968,7 @@ namespace gnote {
   void UndoManager::on_delete_range(const Gtk::TextIter & start, 
                                     const Gtk::TextIter & end)
   {
+    HandlerTimer timer("UndoManager::on_delete_range");
     if (m_frozen_cnt) {
       return;
     }
@@ -755,6 +992,7 @@ namespace gnote {
                                    const Gtk::TextIter & start_char, 
                                    const Gtk::TextIter & end_char)
   {
+    HandlerTimer timer("UndoManager::on_tag_applied");
     if(m_frozen_cnt) {
       return;
     }
@@ -769,6 +1007,7 @@ namespace gnote {
                                    const Gtk::TextIter & start_char, 
                                    const Gtk::TextIter & end_char)
   {
+    HandlerTimer timer("UndoManager::on_tag_removed");
     if(m_frozen_cnt) {
       return;
     }
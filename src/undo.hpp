@@ -23,7 +23,8 @@
 #ifndef __UNDO_HPP_
 #define __UNDO_HPP_
 
-#include <stack>
+#include <deque>
+#include <memory>
 
 #include <sigc++/signal.h>
 #include <gtkmm/textbuffer.h>
@@ -36,6 +37,7 @@
 
 namespace gnote {
 
+class UndoHistory;
 
 class EditAction
 {
@@ -46,6 +48,8 @@ public:
   virtual void merge (EditAction * action) = 0;
   virtual bool can_merge (const EditAction * action) const = 0;
   virtual void destroy () = 0;
+  // approximate number of bytes held by the action
+  virtual std::size_t memory_size() const;
 };
 
 class EditActionGroup
@@ -97,7 +101,9 @@ public:
   void split(Gtk::TextIter iter, Gtk::TextBuffer *);
   void add_split_tag(const Gtk::TextIter &, const Gtk::TextIter &, 
                      const Glib::RefPtr<Gtk::TextTag> tag);
+  virtual std::size_t memory_size() const override;
 protected:
+  friend class UndoHistory;
   SplitterAction();
   int get_split_offset() const;
   void apply_split_tag(Gtk::TextBuffer *);
@@ -121,6 +127,9 @@ public:
   virtual void destroy() override;
 
 private:
+  friend class UndoHistory;
+  InsertAction();
+
   int m_index;
   bool m_is_paste;
 };
@@ -139,6 +148,9 @@ public:
   virtual void destroy() override;
 
 private:
+  friend class UndoHistory;
+  EraseAction();
+
   int m_start;
   int m_end;
   bool m_is_forward;
@@ -159,6 +171,9 @@ public:
   virtual void destroy() override;
 
 private:
+  friend class UndoHistory;
+  TagApplyAction();
+
   Glib::RefPtr<Gtk::TextTag> m_tag;
   int m_start;
   int m_end;
@@ -176,6 +191,9 @@ public:
   virtual bool can_merge(const EditAction * action) const override;
   virtual void destroy() override;
 private:
+  friend class UndoHistory;
+  TagRemoveAction();
+
   Glib::RefPtr<Gtk::TextTag> m_tag;
   int m_start;
   int m_end;
@@ -193,8 +211,11 @@ public:
   virtual bool can_merge(const EditAction * action) const override;
   virtual void destroy() override;
 private:
+  friend class UndoHistory;
+
   int m_line;
   bool m_direction;
+  int m_count;
 };
 
 
@@ -210,6 +231,8 @@ public:
   virtual bool can_merge(const EditAction * action) const override;
   virtual void destroy() override;
 private:
+  friend class UndoHistory;
+
   int m_offset;
   int m_depth;
 };
@@ -224,10 +247,22 @@ public:
    */
   UndoManager(NoteBuffer * buffer);
   ~UndoManager();
-  bool get_can_undo()
+  bool get_can_undo();
+  // memory limit for the undo history in bytes, 0 for no limit;
+  // the oldest actions are dropped when it is exceeded, redo is not counted
+  void set_memory_limit(std::size_t limit);
+  // memory used by the undo stack
+  std::size_t get_memory_size() const
     {
-      return !m_undo_stack.empty();
+      return m_memory_size;
     }
+  // keep undo history in the file, when it is over the memory limit
+  // and after the buffer is gone
+  void set_history_file(const Glib::ustring & path);
+  // move the undo history to the file, done before the buffer goes away
+  void save_history();
+  // stop using the history file, before it is deleted with the note
+  void close_history();
   bool get_can_redo()
     {
       return !m_redo_stack.empty();
@@ -249,7 +284,7 @@ public:
       --m_frozen_cnt;
     }
 
-  void undo_redo(std::stack<EditAction *> &, std::stack<EditAction *> &, bool);
+  void undo_redo(std::deque<EditAction *> &, std::deque<EditAction *> &, bool);
   void undo_redo_action(EditAction & action, bool);
   void clear_undo_history();
   void add_undo_action(EditAction * action);
@@ -259,7 +294,11 @@ public:
 
 private:
 
-  void clear_action_stack(std::stack<EditAction *> &);
+  void clear_action_stack(std::deque<EditAction *> &);
+  void discard_action(EditAction *action);
+  void trim_undo_history();
+  void store_action(const EditAction & action);
+  void load_history();
   void on_insert_text(const Gtk::TextIter &, const Glib::ustring &, int);
   void on_delete_range(const Gtk::TextIter &, const Gtk::TextIter &);
   void on_tag_applied(const Glib::RefPtr<Gtk::TextTag> &,
@@ -274,8 +313,12 @@ private:
   bool m_try_merge;
   NoteBuffer * m_buffer;
   ChopBuffer::Ptr m_chop_buffer;
-  std::stack<EditAction *> m_undo_stack;
-  std::stack<EditAction *> m_redo_stack;
+  // used as stacks, the oldest undo actions are dropped from the front
+  std::deque<EditAction *> m_undo_stack;
+  std::deque<EditAction *> m_redo_stack;
+  std::size_t m_memory_size;
+  std::size_t m_memory_limit;
+  std::unique_ptr<UndoHistory> m_history;
   sigc::signal<void> m_undo_changed;
 };
 
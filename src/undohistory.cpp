@@ -0,0 +1,675 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+
+#include <algorithm>
+#include <cstdlib>
+#include <typeinfo>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <glib/gstdio.h>
+#include <glibmm/miscutils.h>
+
+#include "debug.hpp"
+#include "notetag.hpp"
+#include "undohistory.hpp"
+#include "sharp/exception.hpp"
+
+
+namespace gnote {
+
+namespace {
+
+const char HISTORY_MAGIC[] = "GNOTEUH1";
+const off_t HISTORY_HEADER_LENGTH = sizeof(HISTORY_MAGIC) - 1;
+// type before the payload, payload length and checksum after it,
+// so that the file can be read from the end
+const size_t RECORD_OVERHEAD = 1 + 4 + 4;
+
+void put_u8(std::string & str, guint8 value)
+{
+  str += char(value);
+}
+
+void put_u32(std::string & str, guint32 value)
+{
+  for(int i = 0; i < 4; ++i) {
+    str += char((value >> (8 * i)) & 0xff);
+  }
+}
+
+void put_string(std::string & str, const std::string & value)
+{
+  put_u32(str, value.size());
+  str += value;
+}
+
+guint32 get_u32(const char *data)
+{
+  guint32 value = 0;
+  for(int i = 3; i >= 0; --i) {
+    value = (value << 8) | guchar(data[i]);
+  }
+  return value;
+}
+
+// readers advance data and fail at the end of the payload
+bool read_u8(const char *& data, const char *end, guint8 & value)
+{
+  if(end - data < 1) {
+    return false;
+  }
+  value = guchar(*data++);
+  return true;
+}
+
+bool read_u32(const char *& data, const char *end, guint32 & value)
+{
+  if(end - data < 4) {
+    return false;
+  }
+  value = get_u32(data);
+  data += 4;
+  return true;
+}
+
+bool read_string(const char *& data, const char *end, std::string & value)
+{
+  guint32 length;
+  if(!read_u32(data, end, length) || guint32(end - data) < length) {
+    return false;
+  }
+  value.assign(data, length);
+  data += length;
+  return true;
+}
+
+// FNV-1a, detects records torn by a crash and text changed since the history was saved
+guint32 checksum(const char *data, size_t length)
+{
+  guint32 hash = 2166136261u;
+  for(size_t i = 0; i < length; ++i) {
+    hash = (hash ^ guchar(data[i])) * 16777619u;
+  }
+  return hash;
+}
+
+void throw_errno(const char *what, const Glib::ustring & path, int err)
+{
+  throw sharp::Exception(Glib::ustring::compose("%1 %2: %3", what, path, g_strerror(err)));
+}
+
+void write_all(int fd, const char *data, size_t length, off_t offset, const Glib::ustring & path)
+{
+  while(length > 0) {
+    ssize_t written = pwrite(fd, data, length, offset);
+    if(written < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      throw_errno("Failed to write to file", path, errno);
+    }
+    data += written;
+    length -= written;
+    offset += written;
+  }
+}
+
+Glib::ustring buffer_text(Gtk::TextBuffer & buffer)
+{
+  return buffer.begin().get_slice(buffer.end());
+}
+
+struct TagRun
+{
+  Glib::RefPtr<Gtk::TextTag> tag;
+  int start;
+};
+
+}
+
+
+UndoHistory::UndoHistory(const Glib::ustring & path, const ChopBuffer::Ptr & chop_buffer)
+  : m_path(path)
+  , m_chop_buffer(chop_buffer)
+  , m_fd(-1)
+  , m_size(0)
+  , m_state_offset(-1)
+{
+  // the file is created when the first action is stored
+  m_fd = g_open(path.c_str(), O_RDWR | O_CLOEXEC, 0);
+  if(m_fd < 0) {
+    if(errno == ENOENT) {
+      return;
+    }
+    throw_errno("Failed to open file", path, errno);
+  }
+  try {
+    struct stat st;
+    if(fstat(m_fd, &st) != 0) {
+      throw_errno("Failed to stat file", path, errno);
+    }
+    m_size = st.st_size;
+    char magic[HISTORY_HEADER_LENGTH];
+    if(m_size < HISTORY_HEADER_LENGTH
+       || pread(m_fd, magic, HISTORY_HEADER_LENGTH, 0) != HISTORY_HEADER_LENGTH
+       || memcmp(magic, HISTORY_MAGIC, HISTORY_HEADER_LENGTH) != 0) {
+      truncate(0);
+      write_all(m_fd, HISTORY_MAGIC, HISTORY_HEADER_LENGTH, 0, m_path);
+      m_size = HISTORY_HEADER_LENGTH;
+    }
+  }
+  catch(...) {
+    close(m_fd);
+    throw;
+  }
+}
+
+UndoHistory::~UndoHistory()
+{
+  if(m_fd >= 0) {
+    close(m_fd);
+  }
+}
+
+bool UndoHistory::empty() const
+{
+  return (m_state_offset >= 0 ? m_state_offset : m_size) <= HISTORY_HEADER_LENGTH;
+}
+
+bool UndoHistory::push(const EditAction & action)
+{
+  drop_state();
+  std::string payload;
+  RecordType type;
+  if(!encode(action, payload, type)) {
+    clear();
+    return false;
+  }
+  create();
+  append(type, payload);
+  return true;
+}
+
+std::vector<EditAction*> UndoHistory::pop(unsigned count)
+{
+  drop_state();
+  std::vector<EditAction*> actions;
+  if(empty()) {
+    return actions;
+  }
+
+  GMappedFile *mapped = g_mapped_file_new_from_fd(m_fd, FALSE, NULL);
+  if(!mapped) {
+    throw_errno("Failed to map file", m_path, errno);
+  }
+  const char *contents = g_mapped_file_get_contents(mapped);
+  off_t end = std::min<off_t>(m_size, g_mapped_file_get_length(mapped));
+  // groups are read from their end, depth is the number of open ones
+  int depth = 0;
+  while(end > HISTORY_HEADER_LENGTH && (actions.size() < count || depth > 0)) {
+    RecordType type;
+    const char *payload;
+    size_t payload_length;
+    off_t start = find_record(contents, end, type, payload, payload_length);
+    EditAction *action = start < 0 ? NULL : decode(type, payload, payload_length);
+    if(!action) {
+      ERR_OUT("Undo history %s is damaged, discarding older actions", m_path.c_str());
+      end = HISTORY_HEADER_LENGTH;
+      break;
+    }
+    EditActionGroup *group = dynamic_cast<EditActionGroup*>(action);
+    if(group) {
+      depth += group->is_start() ? -1 : 1;
+    }
+    actions.push_back(action);
+    end = start;
+  }
+  g_mapped_file_unref(mapped);
+
+  truncate(end);
+  std::reverse(actions.begin(), actions.end());
+  return actions;
+}
+
+void UndoHistory::push_state(Gtk::TextBuffer & buffer)
+{
+  drop_state();
+  if(empty()) {
+    return;
+  }
+  Glib::ustring text = buffer_text(buffer);
+  std::string payload;
+  put_u32(payload, text.bytes());
+  put_u32(payload, checksum(text.data(), text.bytes()));
+  off_t offset = m_size;
+  append(RECORD_STATE, payload);
+  m_state_offset = offset;
+}
+
+bool UndoHistory::pop_state(Gtk::TextBuffer & buffer)
+{
+  if(m_size <= HISTORY_HEADER_LENGTH) {
+    return true;
+  }
+
+  bool matches = false;
+  GMappedFile *mapped = g_mapped_file_new_from_fd(m_fd, FALSE, NULL);
+  if(!mapped) {
+    throw_errno("Failed to map file", m_path, errno);
+  }
+  RecordType type;
+  const char *payload;
+  size_t payload_length;
+  off_t start = -1;
+  if(off_t(g_mapped_file_get_length(mapped)) >= m_size) {
+    start = find_record(g_mapped_file_get_contents(mapped), m_size, type, payload, payload_length);
+  }
+  if(start >= 0 && type == RECORD_STATE && payload_length == 8) {
+    Glib::ustring text = buffer_text(buffer);
+    matches = get_u32(payload) == text.bytes()
+      && get_u32(payload + 4) == checksum(text.data(), text.bytes());
+  }
+  g_mapped_file_unref(mapped);
+
+  if(matches) {
+    truncate(start);
+  }
+  else {
+    clear();
+  }
+  return matches;
+}
+
+void UndoHistory::clear()
+{
+  truncate(HISTORY_HEADER_LENGTH);
+}
+
+bool UndoHistory::encode(const EditAction & action, std::string & payload, RecordType & type)
+{
+  // exact types only, add-ins derive their own actions
+  const std::type_info & action_type = typeid(action);
+  if(action_type == typeid(EditActionGroup)) {
+    type = RECORD_GROUP;
+    put_u8(payload, static_cast<const EditActionGroup&>(action).is_start());
+  }
+  else if(action_type == typeid(InsertAction)) {
+    const InsertAction & insert = static_cast<const InsertAction&>(action);
+    type = RECORD_INSERT;
+    put_u32(payload, insert.m_index);
+    put_u8(payload, insert.m_is_paste);
+    encode_chop(insert.m_chop, payload);
+    encode_split_tags(insert, payload);
+  }
+  else if(action_type == typeid(EraseAction)) {
+    const EraseAction & erase = static_cast<const EraseAction&>(action);
+    type = RECORD_ERASE;
+    put_u32(payload, erase.m_start);
+    put_u32(payload, erase.m_end);
+    put_u8(payload, erase.m_is_forward);
+    put_u8(payload, erase.m_is_cut);
+    encode_chop(erase.m_chop, payload);
+    encode_split_tags(erase, payload);
+  }
+  else if(action_type == typeid(TagApplyAction)) {
+    const TagApplyAction & apply = static_cast<const TagApplyAction&>(action);
+    type = RECORD_TAG_APPLY;
+    put_string(payload, apply.m_tag->property_name().get_value().raw());
+    put_u32(payload, apply.m_start);
+    put_u32(payload, apply.m_end);
+  }
+  else if(action_type == typeid(TagRemoveAction)) {
+    const TagRemoveAction & remove = static_cast<const TagRemoveAction&>(action);
+    type = RECORD_TAG_REMOVE;
+    put_string(payload, remove.m_tag->property_name().get_value().raw());
+    put_u32(payload, remove.m_start);
+    put_u32(payload, remove.m_end);
+  }
+  else if(action_type == typeid(ChangeDepthAction)) {
+    const ChangeDepthAction & change = static_cast<const ChangeDepthAction&>(action);
+    type = RECORD_CHANGE_DEPTH;
+    put_u32(payload, change.m_line);
+    put_u8(payload, change.m_direction);
+    put_u32(payload, change.m_count);
+  }
+  else if(action_type == typeid(InsertBulletAction)) {
+    const InsertBulletAction & bullet = static_cast<const InsertBulletAction&>(action);
+    type = RECORD_INSERT_BULLET;
+    put_u32(payload, bullet.m_offset);
+    put_u32(payload, bullet.m_depth);
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+void UndoHistory::encode_chop(const utils::TextRange & chop, std::string & payload)
+{
+  Gtk::TextIter start = chop.start();
+  Gtk::TextIter end = chop.end();
+  put_string(payload, start.get_slice(end).raw());
+
+  // runs of serializable tags, in characters from the start of the chop
+  std::string runs;
+  guint32 run_count = 0;
+  int base = start.get_offset();
+  std::vector<TagRun> open;
+  auto close_run = [&](const Glib::RefPtr<Gtk::TextTag> & tag, int offset) {
+    for(auto iter = open.begin(); iter != open.end(); ++iter) {
+      if(iter->tag == tag) {
+        if(iter->start < offset) {
+          put_string(runs, tag->property_name().get_value().raw());
+          put_u32(runs, iter->start);
+          put_u32(runs, offset);
+          ++run_count;
+        }
+        open.erase(iter);
+        break;
+      }
+    }
+  };
+  auto open_run = [&](const Glib::RefPtr<Gtk::TextTag> & tag, int offset) {
+    if(NoteTagTable::tag_is_serializable(tag) && !tag->property_name().get_value().empty()) {
+      TagRun run;
+      run.tag = tag;
+      run.start = offset;
+      open.push_back(run);
+    }
+  };
+
+  for(const Glib::RefPtr<Gtk::TextTag> & tag : start.get_tags()) {
+    open_run(tag, 0);
+  }
+  Gtk::TextIter iter = start;
+  while(iter.forward_to_tag_toggle(Glib::RefPtr<Gtk::TextTag>()) && iter < end) {
+    int offset = iter.get_offset() - base;
+    for(const Glib::RefPtr<Gtk::TextTag> & tag : iter.get_toggled_tags(false)) {
+      close_run(tag, offset);
+    }
+    for(const Glib::RefPtr<Gtk::TextTag> & tag : iter.get_toggled_tags(true)) {
+      open_run(tag, offset);
+    }
+  }
+  int length = end.get_offset() - base;
+  while(!open.empty()) {
+    close_run(open.back().tag, length);
+  }
+
+  put_u32(payload, run_count);
+  payload += runs;
+}
+
+void UndoHistory::encode_split_tags(const SplitterAction & action, std::string & payload)
+{
+  put_u32(payload, action.m_splitTags.size());
+  for(const SplitterAction::TagData & data : action.m_splitTags) {
+    put_string(payload, data.tag->property_name().get_value().raw());
+    put_u32(payload, data.start);
+    put_u32(payload, data.end);
+  }
+}
+
+EditAction *UndoHistory::decode(RecordType type, const char *data, size_t length)
+{
+  const char *end = data + length;
+  guint8 flag, flag2;
+  guint32 value, value2, value3;
+  std::string name;
+
+  switch(type) {
+  case RECORD_GROUP:
+    if(!read_u8(data, end, flag)) {
+      return NULL;
+    }
+    return new EditActionGroup(flag);
+  case RECORD_INSERT:
+  {
+    if(!read_u32(data, end, value) || !read_u8(data, end, flag)) {
+      return NULL;
+    }
+    InsertAction *insert = new InsertAction;
+    insert->m_index = value;
+    insert->m_is_paste = flag;
+    if(!decode_chop(insert->m_chop, data, end)) {
+      delete insert;
+      return NULL;
+    }
+    if(!decode_split_tags(*insert, data, end)) {
+      insert->destroy();
+      delete insert;
+      return NULL;
+    }
+    return insert;
+  }
+  case RECORD_ERASE:
+  {
+    if(!read_u32(data, end, value) || !read_u32(data, end, value2)
+       || !read_u8(data, end, flag) || !read_u8(data, end, flag2)) {
+      return NULL;
+    }
+    EraseAction *erase = new EraseAction;
+    erase->m_start = value;
+    erase->m_end = value2;
+    erase->m_is_forward = flag;
+    erase->m_is_cut = flag2;
+    if(!decode_chop(erase->m_chop, data, end)) {
+      delete erase;
+      return NULL;
+    }
+    if(!decode_split_tags(*erase, data, end)) {
+      erase->destroy();
+      delete erase;
+      return NULL;
+    }
+    return erase;
+  }
+  case RECORD_TAG_APPLY:
+  case RECORD_TAG_REMOVE:
+  {
+    if(!read_string(data, end, name) || !read_u32(data, end, value) || !read_u32(data, end, value2)) {
+      return NULL;
+    }
+    Glib::RefPtr<Gtk::TextTag> tag = lookup_tag(name);
+    if(!tag) {
+      return NULL;
+    }
+    if(type == RECORD_TAG_APPLY) {
+      TagApplyAction *apply = new TagApplyAction;
+      apply->m_tag = tag;
+      apply->m_start = value;
+      apply->m_end = value2;
+      return apply;
+    }
+    TagRemoveAction *remove = new TagRemoveAction;
+    remove->m_tag = tag;
+    remove->m_start = value;
+    remove->m_end = value2;
+    return remove;
+  }
+  case RECORD_CHANGE_DEPTH:
+  {
+    if(!read_u32(data, end, value) || !read_u8(data, end, flag) || !read_u32(data, end, value3)) {
+      return NULL;
+    }
+    ChangeDepthAction *change = new ChangeDepthAction(value, flag);
+    change->m_count = value3;
+    return change;
+  }
+  case RECORD_INSERT_BULLET:
+    if(!read_u32(data, end, value) || !read_u32(data, end, value2)) {
+      return NULL;
+    }
+    return new InsertBulletAction(value, value2);
+  default:
+    return NULL;
+  }
+}
+
+bool UndoHistory::decode_chop(utils::TextRange & chop, const char *& data, const char *end)
+{
+  std::string text;
+  guint32 run_count;
+  if(!read_string(data, end, text) || !g_utf8_validate(text.data(), text.size(), NULL)
+     || !read_u32(data, end, run_count)) {
+    return false;
+  }
+
+  int base = m_chop_buffer->end().get_offset();
+  m_chop_buffer->insert(m_chop_buffer->end(), text);
+  chop = utils::TextRange(m_chop_buffer->get_iter_at_offset(base), m_chop_buffer->end());
+
+  guint32 length = chop.end().get_offset() - base;
+  for(guint32 i = 0; i < run_count; ++i) {
+    std::string name;
+    guint32 start, run_end;
+    if(!read_string(data, end, name) || !read_u32(data, end, start) || !read_u32(data, end, run_end)
+       || start > run_end || run_end > length) {
+      chop.erase();
+      chop.destroy();
+      return false;
+    }
+    Glib::RefPtr<Gtk::TextTag> tag = lookup_tag(name);
+    if(tag) {
+      m_chop_buffer->apply_tag(tag, m_chop_buffer->get_iter_at_offset(base + start),
+                               m_chop_buffer->get_iter_at_offset(base + run_end));
+    }
+  }
+  return true;
+}
+
+bool UndoHistory::decode_split_tags(SplitterAction & action, const char *& data, const char *end)
+{
+  guint32 count;
+  if(!read_u32(data, end, count)) {
+    return false;
+  }
+  for(guint32 i = 0; i < count; ++i) {
+    std::string name;
+    SplitterAction::TagData tag_data;
+    guint32 start, tag_end;
+    if(!read_string(data, end, name) || !read_u32(data, end, start) || !read_u32(data, end, tag_end)) {
+      return false;
+    }
+    tag_data.start = start;
+    tag_data.end = tag_end;
+    tag_data.tag = lookup_tag(name);
+    if(!tag_data.tag) {
+      return false;
+    }
+    action.m_splitTags.push_back(tag_data);
+  }
+  return true;
+}
+
+Glib::RefPtr<Gtk::TextTag> UndoHistory::lookup_tag(const Glib::ustring & name)
+{
+  Glib::RefPtr<Gtk::TextTag> tag = m_chop_buffer->get_tag_table()->lookup(name);
+  if(!tag && name.find("depth:") == 0) {
+    // depth tags are created when first used
+    NoteTagTable::Ptr table = NoteTagTable::Ptr::cast_dynamic(m_chop_buffer->get_tag_table());
+    if(table) {
+      tag = table->get_depth_tag(std::atoi(name.c_str() + 6));
+    }
+  }
+  return tag;
+}
+
+void UndoHistory::append(RecordType type, const std::string & payload)
+{
+  std::string record;
+  record.reserve(RECORD_OVERHEAD + payload.size());
+  put_u8(record, type);
+  record += payload;
+  guint32 sum = checksum(record.data(), record.size());
+  put_u32(record, payload.size());
+  put_u32(record, sum);
+  // not synced, a torn record fails the checksum and only older history is lost
+  write_all(m_fd, record.data(), record.size(), m_size, m_path);
+  m_size += record.size();
+}
+
+off_t UndoHistory::find_record(const char *contents, off_t end, RecordType & type,
+                               const char *& payload, size_t & payload_length)
+{
+  if(end - HISTORY_HEADER_LENGTH < off_t(RECORD_OVERHEAD)) {
+    return -1;
+  }
+  const char *trailer = contents + end - 8;
+  payload_length = get_u32(trailer);
+  if(payload_length > size_t(end - HISTORY_HEADER_LENGTH) - RECORD_OVERHEAD) {
+    return -1;
+  }
+  off_t start = end - RECORD_OVERHEAD - payload_length;
+  if(checksum(contents + start, 1 + payload_length) != get_u32(trailer + 4)) {
+    return -1;
+  }
+  type = RecordType(guchar(contents[start]));
+  payload = contents + start + 1;
+  return start;
+}
+
+void UndoHistory::create()
+{
+  if(m_fd >= 0) {
+    return;
+  }
+  Glib::ustring directory = Glib::path_get_dirname(m_path);
+  if(g_mkdir_with_parents(directory.c_str(), S_IRWXU) != 0) {
+    throw_errno("Failed to create directory", directory, errno);
+  }
+  m_fd = g_open(m_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if(m_fd < 0) {
+    throw_errno("Failed to open file", m_path, errno);
+  }
+  m_size = 0;
+  write_all(m_fd, HISTORY_MAGIC, HISTORY_HEADER_LENGTH, 0, m_path);
+  m_size = HISTORY_HEADER_LENGTH;
+}
+
+void UndoHistory::truncate(off_t size)
+{
+  if(m_fd < 0) {
+    return;
+  }
+  if(ftruncate(m_fd, size) != 0) {
+    throw_errno("Failed to truncate file", m_path, errno);
+  }
+  m_size = size;
+  if(m_state_offset >= size) {
+    m_state_offset = -1;
+  }
+}
+
+void UndoHistory::drop_state()
+{
+  if(m_state_offset >= 0) {
+    truncate(m_state_offset);
+  }
+}
+
+}
@@ -0,0 +1,108 @@
+/*
+ * gnote
+ *
+ * Copyright (C) 2019 Aurimas Cernius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+
+#ifndef _UNDOHISTORY_HPP_
+#define _UNDOHISTORY_HPP_
+
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <glibmm/ustring.h>
+
+#include "noncopyable.hpp"
+#include "undo.hpp"
+
+
+namespace gnote {
+
+/**
+ * Undo actions of a note, that no longer fit in memory or outlived the buffer.
+ * The file is used as the bottom of the undo stack: the oldest actions are
+ * appended as they leave the memory and read back, newest first, when undo
+ * reaches them. Actions are stored as offsets and text with tag runs.
+ * A state record with the checksum of the buffer text is appended, when the
+ * buffer goes away, so that the history is only used for the same text.
+ * The file is only created, when the first action is stored.
+ * Methods throw sharp::Exception on I/O errors.
+ */
+class UndoHistory
+  : public NonCopyable
+{
+public:
+  UndoHistory(const Glib::ustring & path, const ChopBuffer::Ptr & chop_buffer);
+  ~UndoHistory();
+
+  bool empty() const;
+  // Returns false, if action can not be stored. The history is then cleared,
+  // as the older actions can not be reached anymore.
+  bool push(const EditAction & action);
+  // Removes up to count newest actions, returned oldest first.
+  // Action groups are not split.
+  std::vector<EditAction*> pop(unsigned count);
+  void push_state(Gtk::TextBuffer & buffer);
+  // Keeps the history, if it was saved for the buffer text as it is now.
+  bool pop_state(Gtk::TextBuffer & buffer);
+  void clear();
+private:
+  enum RecordType {
+    RECORD_GROUP = 1,
+    RECORD_INSERT = 2,
+    RECORD_ERASE = 3,
+    RECORD_TAG_APPLY = 4,
+    RECORD_TAG_REMOVE = 5,
+    RECORD_CHANGE_DEPTH = 6,
+    RECORD_INSERT_BULLET = 7,
+    RECORD_STATE = 8
+  };
+
+  static bool encode(const EditAction & action, std::string & payload, RecordType & type);
+  static void encode_chop(const utils::TextRange & chop, std::string & payload);
+  static void encode_split_tags(const SplitterAction & action, std::string & payload);
+  // These return NULL or false, if the record is damaged.
+  EditAction *decode(RecordType type, const char *data, size_t length);
+  bool decode_chop(utils::TextRange & chop, const char *& data, const char *end);
+  bool decode_split_tags(SplitterAction & action, const char *& data, const char *end);
+  Glib::RefPtr<Gtk::TextTag> lookup_tag(const Glib::ustring & name);
+  void append(RecordType type, const std::string & payload);
+  // Finds the record ending at end, returns its offset or -1 if damaged.
+  off_t find_record(const char *contents, off_t end, RecordType & type,
+                    const char *& payload, size_t & payload_length);
+  // creates the file, if it does not exist yet
+  void create();
+  // does nothing, if there is no file
+  void truncate(off_t size);
+  void drop_state();
+
+  Glib::ustring m_path;
+  ChopBuffer::Ptr m_chop_buffer;
+  // -1 until the file exists
+  int m_fd;
+  off_t m_size;
+  // offset of the state record at the end of file, -1 if none
+  off_t m_state_offset;
+};
+
+}
+
+#endif
@@ -30,12 +30,14 @@
 
 #include "sharp/string.hpp"
 #include "debug.hpp"
+#include "handlertiming.hpp"
 #include "iactionmanager.hpp"
 #include "mainwindow.hpp"
 #include "noteeditor.hpp"
 #include "notemanager.hpp"
 #include "notewindow.hpp"
 #include "preferences.hpp"
+#include "textscanner.hpp"
 #include "itagmanager.hpp"
 #include "triehit.hpp"
 #include "watchers.hpp"
@@ -127,6 +129,7 @@ namespace gnote {
 
   void NoteRenameWatcher::on_insert_text(const Gtk::TextIter & pos, const Glib::ustring &, int)
   {
+    HandlerTimer timer("NoteRenameWatcher::on_insert_text");
     update ();
 
     Gtk::TextIter end = pos;
@@ -142,6 +145,7 @@ namespace gnote {
 
   void NoteRenameWatcher::on_delete_range(const Gtk::TextIter &,const Gtk::TextIter &)
   {
+    HandlerTimer timer("NoteRenameWatcher::on_delete_range");
     update();
   }
 
@@ -348,8 +352,13 @@ namespace gnote {
       GspellTextBuffer *gspell_buffer = gspell_text_buffer_get_from_gtk_text_buffer (buffer->gobj());
       gspell_text_buffer_set_spell_checker (gspell_buffer, m_obj_ptr);
       GspellTextView *gspell_view = gspell_text_view_get_from_gtk_text_view (get_window()->editor()->gobj());
-      gspell_text_view_set_inline_spell_checking (gspell_view, TRUE);
+      bool deferred = Preferences::obj().get_schema_settings(Preferences::SCHEMA_GNOTE)
+        ->get_boolean(Preferences::ENABLE_DEFERRED_SPELLCHECKING);
+      gspell_text_view_set_inline_spell_checking (gspell_view, !deferred);
       gspell_text_view_set_enable_language_menu (gspell_view, TRUE);
+      if(deferred) {
+        attach_deferred();
+      }
       m_enabled = true;
     }
     else {
@@ -369,6 +378,9 @@ namespace gnote {
   void NoteSpellChecker::detach_checker()
   {
     m_tag_applied_cid.disconnect();
+    if(m_deferred) {
+      detach_deferred();
+    }
     
     if(m_obj_ptr) {
       Glib::RefPtr<Gtk::TextBuffer> buffer = get_window()->editor()->get_buffer();
@@ -381,6 +393,13 @@ namespace gnote {
 
   void NoteSpellChecker::on_enable_spellcheck_changed(const Glib::ustring & key)
   {
+    if(key == Preferences::ENABLE_DEFERRED_SPELLCHECKING) {
+      if(m_obj_ptr) {
+        detach_checker();
+        attach_checker();
+      }
+      return;
+    }
     if (key != Preferences::ENABLE_SPELLCHECKING) {
       return;
     }
@@ -448,6 +467,12 @@ namespace gnote {
     tag = ITagManager::obj().get_or_create_tag(tag_name);
     get_note()->add_tag(tag);
     DBG_OUT("Added language tag %s", tag_name.c_str());
+
+    if(m_deferred) {
+      const NoteBuffer::Ptr & buffer = get_buffer();
+      buffer->remove_tag_by_name("gtkspell-misspelled", buffer->begin(), buffer->end());
+      add_pending(buffer->begin(), buffer->end());
+    }
   }
 
   Tag::Ptr NoteSpellChecker::get_language_tag()
@@ -508,17 +533,211 @@ namespace gnote {
   {
     m_enable_cid.disconnect();
   }
+
+  void NoteSpellChecker::attach_deferred()
+  {
+    if(!m_pending_tag) {
+      m_pending_tag = NoteTag::Ptr::cast_dynamic(get_note()->get_tag_table()->lookup("spellcheck-pending"));
+      if(!m_pending_tag) {
+        m_pending_tag = NoteTag::create("spellcheck-pending", NoteTag::CAN_SPELL_CHECK);
+        m_pending_tag->set_can_serialize(false);
+        get_note()->get_tag_table()->add(m_pending_tag);
+      }
+    }
+    m_deferred = true;
+
+    const NoteBuffer::Ptr & buffer = get_buffer();
+    m_deferred_cids.push_back(buffer->signal_insert().connect(
+      sigc::mem_fun(*this, &NoteSpellChecker::on_insert_text)));
+    m_deferred_cids.push_back(buffer->signal_erase().connect(
+      sigc::mem_fun(*this, &NoteSpellChecker::on_delete_range)));
+    m_deferred_cids.push_back(buffer->signal_mark_set().connect(
+      sigc::mem_fun(*this, &NoteSpellChecker::on_mark_set)));
+    // scrolling and resizing bring unchecked text into view
+    Glib::RefPtr<Gtk::Adjustment> vadjustment = get_window()->editor()->get_vadjustment();
+    if(vadjustment) {
+      m_deferred_cids.push_back(vadjustment->signal_value_changed().connect(
+        sigc::mem_fun(*this, &NoteSpellChecker::queue_check)));
+      m_deferred_cids.push_back(vadjustment->signal_changed().connect(
+        sigc::mem_fun(*this, &NoteSpellChecker::queue_check)));
+    }
+
+    add_pending(buffer->begin(), buffer->end());
+  }
+
+  void NoteSpellChecker::detach_deferred()
+  {
+    for(sigc::connection & cid : m_deferred_cids) {
+      cid.disconnect();
+    }
+    m_deferred_cids.clear();
+    m_check_cid.disconnect();
+    m_deferred = false;
+
+    if(has_buffer()) {
+      const NoteBuffer::Ptr & buffer = get_buffer();
+      buffer->remove_tag(m_pending_tag, buffer->begin(), buffer->end());
+      buffer->remove_tag_by_name("gtkspell-misspelled", buffer->begin(), buffer->end());
+    }
+  }
+
+  void NoteSpellChecker::on_insert_text(const Gtk::TextIter & pos, const Glib::ustring & text, int)
+  {
+    HandlerTimer timer("NoteSpellChecker::on_insert_text");
+    // pos is at the end of inserted text, length is in bytes
+    Gtk::TextIter start = pos;
+    start.backward_chars(text.size());
+    add_pending(start, pos);
+  }
+
+  void NoteSpellChecker::on_delete_range(const Gtk::TextIter & start, const Gtk::TextIter & end)
+  {
+    HandlerTimer timer("NoteSpellChecker::on_delete_range");
+    add_pending(start, end);
+  }
+
+  void NoteSpellChecker::on_mark_set(const Gtk::TextIter &, const Glib::RefPtr<Gtk::TextMark> & mark)
+  {
+    // the word under the cursor is left unchecked until the cursor moves away
+    if(mark == get_buffer()->get_insert()) {
+      queue_check();
+    }
+  }
+
+  void NoteSpellChecker::add_pending(const Gtk::TextIter & s, const Gtk::TextIter & e)
+  {
+    Gtk::TextIter start = s;
+    Gtk::TextIter end = e;
+    start.set_line_offset(0);
+    if(!end.ends_line()) {
+      end.forward_to_line_end();
+    }
+    get_buffer()->apply_tag(m_pending_tag, start, end);
+    queue_check();
+  }
+
+  void NoteSpellChecker::queue_check()
+  {
+    if(!m_check_cid.connected()) {
+      m_check_cid = Glib::signal_idle().connect(sigc::mem_fun(*this, &NoteSpellChecker::on_check_idle));
+    }
+  }
+
+  bool NoteSpellChecker::on_check_idle()
+  {
+    // dictionary lookups per main loop iteration
+    static const int CHUNK_WORDS = 256;
+
+    if(!has_window()) {
+      return false;
+    }
+
+    // only the visible text is checked, the rest waits until it is scrolled to
+    Gtk::TextIter visible_start, visible_end;
+    get_window()->editor()->get_visible_range(visible_start, visible_end);
+
+    int budget = CHUNK_WORDS;
+    Gtk::TextIter pos = visible_start;
+    while(budget > 0) {
+      if(!pos.has_tag(m_pending_tag) && !pos.forward_to_tag_toggle(m_pending_tag)) {
+        break;
+      }
+      if(visible_end <= pos) {
+        break;
+      }
+      Gtk::TextIter pending_end = pos;
+      pending_end.forward_to_tag_toggle(m_pending_tag);
+      if(visible_end < pending_end) {
+        pending_end = visible_end;
+      }
+      // checking only changes tags, so the iterators are still valid
+      pos = check_range(pos, pending_end, budget);
+    }
+
+    return budget == 0;
+  }
+
+  Gtk::TextIter NoteSpellChecker::check_range(const Gtk::TextIter & range_start,
+                                              const Gtk::TextIter & range_end, int & budget)
+  {
+    const NoteBuffer::Ptr & buffer = get_buffer();
+    Gtk::TextIter start = range_start;
+    Gtk::TextIter end = range_end;
+    if(start.inside_word() && !start.starts_word()) {
+      start.backward_word_start();
+    }
+    if(end.inside_word() && !end.starts_word()) {
+      end.forward_word_end();
+    }
+
+    Gtk::TextIter cursor = buffer->get_iter_at_mark(buffer->get_insert());
+    Gtk::TextIter skipped_start, skipped_end;
+    bool skipped = false;
+
+    Gtk::TextIter pos = start;
+    while(pos < end && budget > 0) {
+      Gtk::TextIter word_end = pos;
+      word_end.forward_word_end();
+      if(word_end <= pos || !word_end.ends_word() || end < word_end) {
+        buffer->remove_tag_by_name("gtkspell-misspelled", pos, end);
+        pos = end;
+        break;
+      }
+      Gtk::TextIter word_start = word_end;
+      word_start.backward_word_start();
+      buffer->remove_tag_by_name("gtkspell-misspelled", pos, word_end);
+      if(word_start <= cursor && cursor <= word_end) {
+        // probably still being typed
+        skipped_start = word_start;
+        skipped_end = word_end;
+        skipped = true;
+      }
+      else {
+        check_word(word_start, word_end);
+        --budget;
+      }
+      pos = word_end;
+    }
+
+    buffer->remove_tag(m_pending_tag, start, pos);
+    if(skipped) {
+      buffer->apply_tag(m_pending_tag, skipped_start, skipped_end);
+    }
+    return pos;
+  }
+
+  void NoteSpellChecker::check_word(const Gtk::TextIter & start, const Gtk::TextIter & end)
+  {
+    // save the lookup for links and other text that is never marked
+    Glib::SListHandle<Glib::RefPtr<const Gtk::TextTag> > tag_list = start.get_tags();
+    for(Glib::SListHandle<Glib::RefPtr<const Gtk::TextTag> >::const_iterator tag_iter = tag_list.begin();
+        tag_iter != tag_list.end(); ++tag_iter) {
+      if(!NoteTagTable::tag_is_spell_checkable(*tag_iter)) {
+        return;
+      }
+    }
+
+    Glib::ustring word = start.get_text(end);
+    GError *error = NULL;
+    if(gspell_checker_check_word(m_obj_ptr, word.c_str(), -1, &error)) {
+      return;
+    }
+    if(error) {
+      ERR_OUT("Failed to check spelling of '%s': %s", word.c_str(), error->message);
+      g_error_free(error);
+      return;
+    }
+    get_buffer()->apply_tag_by_name("gtkspell-misspelled", start, end);
+  }
 #endif
   
   ////////////////////////////////////////////////////////////////////////
 
 
-  const char * NoteUrlWatcher::URL_REGEX = "((\\b((news|http|https|ftp|file|irc|ircs)://|mailto:|(www|ftp)\\.|\\S*@\\S*\\.)|(?<=^|\\s)/\\S+/|(?<=^|\\s)~/\\S+)\\S*\\b/?)";
   bool NoteUrlWatcher::s_text_event_connected = false;
   
 
   NoteUrlWatcher::NoteUrlWatcher()
-    : m_regex(Glib::Regex::create(URL_REGEX, Glib::REGEX_CASELESS))
   {
   }
 
@@ -564,6 +783,10 @@ namespace gnote {
     get_buffer()->signal_erase().connect(
       sigc::mem_fun(*this, &NoteUrlWatcher::on_delete_range));
 
+    // no editor when only the buffer is watched, as in benchmarks
+    if(!has_window()) {
+      return;
+    }
     Gtk::TextView * editor(get_window()->editor());
     editor->signal_button_press_event().connect(
       sigc::mem_fun(*this, &NoteUrlWatcher::on_button_press), false);
@@ -598,8 +821,7 @@ namespace gnote {
           sharp::string_substring(url, 2);
       }
     }
-    else if (sharp::string_match_iregex(url, 
-                                        "^(?!(news|mailto|http|https|ftp|file|irc):).+@.{2,}$")) {
+    else if (textscanner::is_email_address(url)) {
       url = "mailto:" + url;
     }
 
@@ -633,34 +855,37 @@ namespace gnote {
     get_buffer()->remove_tag (m_url_tag, start, end);
 
     Glib::ustring s(start.get_slice(end));
-    Glib::MatchInfo match_info;
-    while(m_regex->match(s, match_info)) {
-      Glib::ustring match = match_info.fetch(0);
-      Glib::ustring::size_type start_pos = s.find(match);
-
+    const char *text = s.c_str();
+    std::size_t length = s.bytes();
+    std::size_t match_start, match_end;
+    // start is at byte pos of the text, search continues after each match
+    std::size_t pos = 0;
+    while(textscanner::find_url(text + pos, length - pos, match_start, match_end)) {
       Gtk::TextIter start_cpy = start;
-      start_cpy.forward_chars(start_pos);
+      start_cpy.forward_chars(g_utf8_strlen(text + pos, match_start));
 
       Gtk::TextIter end_cpy = start_cpy;
-      end_cpy.forward_chars(match.size());
+      end_cpy.forward_chars(g_utf8_strlen(text + pos + match_start, match_end - match_start));
 
       DBG_OUT("url is %s", start_cpy.get_slice(end_cpy).c_str());
       get_buffer()->apply_tag(m_url_tag, start_cpy, end_cpy);
 
       start = end_cpy;
-      s = start.get_slice(end);
+      pos += match_end;
     }
   }
 
 
   void NoteUrlWatcher::on_delete_range(const Gtk::TextIter & start, const Gtk::TextIter &end)
   {
+    HandlerTimer timer("NoteUrlWatcher::on_delete_range");
     apply_url_to_block(start, end);
   }
 
 
   void NoteUrlWatcher::on_insert_text(const Gtk::TextIter & pos, const Glib::ustring &, int len)
   {
+    HandlerTimer timer("NoteUrlWatcher::on_insert_text");
     Gtk::TextIter start = pos;
     start.backward_chars (len);
 
@@ -670,10 +895,12 @@ namespace gnote {
   void NoteUrlWatcher::on_apply_tag(const Glib::RefPtr<Gtk::TextBuffer::Tag> & tag,
                                     const Gtk::TextIter & start, const Gtk::TextIter & end)
   {
+    HandlerTimer timer("NoteUrlWatcher::on_apply_tag");
     if(tag != m_url_tag)
       return;
     Glib::ustring s(start.get_slice(end));
-    if(!m_regex->match(s)) {
+    std::size_t match_start, match_end;
+    if(!textscanner::find_url(s.c_str(), s.bytes(), match_start, match_end)) {
       get_buffer()->remove_tag(m_url_tag, start, end);
     }
   }
@@ -764,6 +991,11 @@ namespace gnote {
     return new NoteLinkWatcher;
   }
 
+  NoteLinkWatcher::NoteLinkWatcher()
+    : m_highlight_all(false)
+  {
+  }
+
 
   void NoteLinkWatcher::initialize ()
   {
@@ -771,6 +1003,8 @@ namespace gnote {
       sigc::mem_fun(*this, &NoteLinkWatcher::on_note_deleted));
     m_on_note_added_cid = manager().signal_note_added.connect(
       sigc::mem_fun(*this, &NoteLinkWatcher::on_note_added));
+    m_on_notes_added_cid = manager().signal_notes_added.connect(
+      sigc::mem_fun(*this, &NoteLinkWatcher::on_notes_added));
     m_on_note_renamed_cid = manager().signal_note_renamed.connect(
       sigc::mem_fun(*this, &NoteLinkWatcher::on_note_renamed));
 
@@ -783,7 +1017,9 @@ namespace gnote {
   {
     m_on_note_deleted_cid.disconnect();
     m_on_note_added_cid.disconnect();
+    m_on_notes_added_cid.disconnect();
     m_on_note_renamed_cid.disconnect();
+    cancel_highlight();
   }
 
 
@@ -831,7 +1067,19 @@ namespace gnote {
     }
 
     // Highlight previously unlinked text
-    highlight_in_block (get_buffer()->begin(), get_buffer()->end());
+    queue_highlight(NoteBase::Ptr());
+  }
+
+  void NoteLinkWatcher::on_notes_added(const NoteBase::List & added)
+  {
+    Glib::ustring body = get_note()->text_content().lowercase();
+    for(const NoteBase::Ptr & note : added) {
+      if(note != get_note() && body.find(note->get_title().lowercase()) != Glib::ustring::npos) {
+        // Highlight previously unlinked text, once for all notes
+        queue_highlight(NoteBase::Ptr());
+        return;
+      }
+    }
   }
 
   void NoteLinkWatcher::on_note_deleted(const NoteBase::Ptr & deleted)
@@ -867,7 +1115,7 @@ namespace gnote {
 
     // Highlight previously unlinked text
     if (contains_text (renamed->get_title())) {
-      highlight_note_in_block(std::static_pointer_cast<Note>(renamed), get_buffer()->begin(), get_buffer()->end());
+      queue_highlight(renamed);
     }
   }
 
@@ -970,6 +1218,126 @@ namespace gnote {
     }
   }
 
+  // Queues a full buffer highlight of the note's title, or of all titles
+  // for a null note. A new request restarts the pass over the buffer, with
+  // the titles of any pass in progress added to it.
+  void NoteLinkWatcher::queue_highlight(const NoteBase::Ptr & note)
+  {
+    if(note) {
+      m_highlight_notes.push_back(note);
+    }
+    else {
+      m_highlight_all = true;
+    }
+
+    if(!m_highlight_buffer) {
+      m_highlight_buffer = get_buffer();
+      get_note()->hold_buffer();
+    }
+    const NoteBuffer::Ptr & buffer = m_highlight_buffer;
+    for(MarkRange & range : m_highlight_ranges) {
+      buffer->delete_mark(range.first);
+      buffer->delete_mark(range.second);
+    }
+    m_highlight_ranges.clear();
+
+    Gtk::TextIter visible_start = buffer->begin();
+    Gtk::TextIter visible_end = buffer->end();
+    if(has_window()) {
+      get_window()->editor()->get_visible_range(visible_start, visible_end);
+    }
+    add_highlight_range(visible_start, visible_end);
+    add_highlight_range(visible_end, buffer->end());
+    add_highlight_range(buffer->begin(), visible_start);
+
+    if(!m_highlight_cid.connected()) {
+      m_highlight_cid = Glib::signal_idle().connect(sigc::mem_fun(*this, &NoteLinkWatcher::on_highlight_idle));
+    }
+  }
+
+  void NoteLinkWatcher::add_highlight_range(const Gtk::TextIter & start, const Gtk::TextIter & end)
+  {
+    if(start < end) {
+      const NoteBuffer::Ptr & buffer = m_highlight_buffer;
+      // text typed at the end of a range is part of it
+      m_highlight_ranges.push_back(MarkRange(buffer->create_mark(start, true), buffer->create_mark(end, false)));
+    }
+  }
+
+  void NoteLinkWatcher::cancel_highlight()
+  {
+    m_highlight_cid.disconnect();
+    if(m_highlight_buffer) {
+      for(MarkRange & range : m_highlight_ranges) {
+        m_highlight_buffer->delete_mark(range.first);
+        m_highlight_buffer->delete_mark(range.second);
+      }
+      m_highlight_buffer.reset();
+      get_note()->unhold_buffer();
+    }
+    m_highlight_ranges.clear();
+    m_highlight_notes.clear();
+    m_highlight_all = false;
+  }
+
+  bool NoteLinkWatcher::on_highlight_idle()
+  {
+    // characters per main loop iteration, rounded up to the end of the line,
+    // as titles do not span lines
+    static const int CHUNK_CHARS = 16384;
+
+    if(m_highlight_ranges.empty()) {
+      cancel_highlight();
+      return false;
+    }
+
+    const NoteBuffer::Ptr & buffer = m_highlight_buffer;
+    MarkRange & range = m_highlight_ranges.front();
+    Gtk::TextIter start = buffer->get_iter_at_mark(range.first);
+    Gtk::TextIter end = buffer->get_iter_at_mark(range.second);
+    Gtk::TextIter chunk_end = start;
+    chunk_end.forward_chars(CHUNK_CHARS);
+    if(!chunk_end.ends_line()) {
+      chunk_end.forward_to_line_end();
+    }
+    if(end < chunk_end) {
+      chunk_end = end;
+    }
+
+    if(start < chunk_end) {
+      if(m_highlight_all) {
+        highlight_in_block(start, chunk_end);
+      }
+      else {
+        for(const NoteBase::WeakPtr & weak_note : m_highlight_notes) {
+          NoteBase::Ptr note = weak_note.lock();
+          if(note) {
+            highlight_note_in_block(note, start, chunk_end);
+          }
+        }
+      }
+    }
+
+    // highlighting only applies tags, so the iterators are still valid
+    if(chunk_end < end) {
+      buffer->move_mark(range.first, chunk_end);
+    }
+    else {
+      buffer->delete_mark(range.first);
+      buffer->delete_mark(range.second);
+      m_highlight_ranges.pop_front();
+    }
+
+    if(m_highlight_ranges.empty()) {
+      m_highlight_notes.clear();
+      m_highlight_all = false;
+      m_highlight_buffer.reset();
+      get_note()->unhold_buffer();
+      return false;
+    }
+    return true;
+  }
+
   void NoteLinkWatcher::unhighlight_in_block(const Gtk::TextIter & start,
                                            const Gtk::TextIter & end)
   {
@@ -980,6 +1348,7 @@ namespace gnote {
   void NoteLinkWatcher::on_delete_range(const Gtk::TextIter & s,
                                         const Gtk::TextIter & e)
   {
+    HandlerTimer timer("NoteLinkWatcher::on_delete_range");
     Gtk::TextIter start = s;
     Gtk::TextIter end = e;
 
@@ -995,6 +1364,7 @@ namespace gnote {
   void NoteLinkWatcher::on_insert_text(const Gtk::TextIter & pos, 
                                        const Glib::ustring &, int length)
   {
+    HandlerTimer timer("NoteLinkWatcher::on_insert_text");
     Gtk::TextIter start = pos;
     start.backward_chars (length);
 
@@ -1012,6 +1382,7 @@ namespace gnote {
   void NoteLinkWatcher::on_apply_tag(const Glib::RefPtr<Gtk::TextBuffer::Tag> & tag,
                                      const Gtk::TextIter & start, const Gtk::TextIter &end)
   {
+    HandlerTimer timer("NoteLinkWatcher::on_apply_tag");
     if (tag->property_name() != get_note()->get_tag_table()->get_link_tag()->property_name())
       return;
     Glib::ustring link_name = start.get_text (end);
@@ -1070,10 +1441,6 @@ namespace gnote {
 
   ////////////////////////////////////////////////////////////////////////
 
-  // This is a PCRE regex.
-  const char * NoteWikiWatcher::WIKIWORD_REGEX = "\\b((\\p{Lu}+[\\p{Ll}0-9]+){2}([\\p{Lu}\\p{Ll}0-9])*)\\b";
-
-
   NoteAddin * NoteWikiWatcher::create()
   {
     return new NoteWikiWatcher();
@@ -1110,10 +1477,14 @@ namespace gnote {
     get_buffer()->remove_tag (m_broken_link_tag, start, end);
 
     Glib::ustring s(start.get_slice(end));
-    Glib::MatchInfo match_info;
-    while(m_regex->match(s, match_info)) {
-      Glib::ustring match = match_info.fetch(0);
-      Glib::ustring::size_type start_pos = s.find(match);
+    const char *text = s.c_str();
+    std::size_t length = s.bytes();
+    std::size_t match_start, match_end;
+    // start is at byte pos of the text, search continues after each match
+    std::size_t pos = 0;
+    while(textscanner::find_wikiword(text + pos, length - pos, match_start, match_end)) {
+      Glib::ustring match(text + pos + match_start, text + pos + match_end);
+      int start_pos = g_utf8_strlen(text + pos, match_start);
 
       Gtk::TextIter start_cpy = start;
       start_cpy.forward_chars(start_pos);
@@ -1126,19 +1497,20 @@ namespace gnote {
       }
 
       DBG_OUT("Highlighting wikiword: '%s' at offset %d",
-              start_cpy.get_slice(end_cpy).c_str(), int(start_pos));
+              start_cpy.get_slice(end_cpy).c_str(), start_pos);
 
       if(!manager().find(match)) {
 	get_buffer()->apply_tag (m_broken_link_tag, start_cpy, end_cpy);
       }
 
       start = end_cpy;
-      s = start.get_slice(end);
+      pos += match_end;
     }
   }
 
   void NoteWikiWatcher::on_delete_range(const Gtk::TextIter & start, const Gtk::TextIter & end)
   {
+    HandlerTimer timer("NoteWikiWatcher::on_delete_range");
     apply_wikiword_to_block (start, end);
   }
 
@@ -1146,6 +1518,7 @@ namespace gnote {
   void NoteWikiWatcher::on_insert_text(const Gtk::TextIter & pos, const Glib::ustring &, 
                                        int length)
   {
+    HandlerTimer timer("NoteWikiWatcher::on_insert_text");
     Gtk::TextIter start = pos;
     start.backward_chars(length);
     
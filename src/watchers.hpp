@@ -34,8 +34,9 @@ extern "C" {
 }
 #endif
 
+#include <deque>
+
 #include <gdkmm/cursor.h>
-#include <glibmm/regex.h>
 #include <gtkmm/textiter.h>
 #include <gtkmm/texttag.h>
 
@@ -101,6 +102,7 @@ namespace gnote {
     NoteSpellChecker()
       : m_obj_ptr(NULL)
       , m_enabled(false)
+      , m_deferred(false)
       {}
   private:
     static const char *LANG_PREFIX;
@@ -119,11 +121,27 @@ namespace gnote {
     void on_note_window_foregrounded();
     void on_note_window_backgrounded();
     void on_spell_check_enable_action(const Glib::VariantBase & state);
+    // deferred mode: words are checked from an idle handler, visible text only
+    void attach_deferred();
+    void detach_deferred();
+    void on_insert_text(const Gtk::TextIter &, const Glib::ustring &, int);
+    void on_delete_range(const Gtk::TextIter &, const Gtk::TextIter &);
+    void on_mark_set(const Gtk::TextIter &, const Glib::RefPtr<Gtk::TextMark> &);
+    void add_pending(const Gtk::TextIter & start, const Gtk::TextIter & end);
+    void queue_check();
+    bool on_check_idle();
+    Gtk::TextIter check_range(const Gtk::TextIter & start, const Gtk::TextIter & end, int & words);
+    void check_word(const Gtk::TextIter & start, const Gtk::TextIter & end);
 
     GspellChecker *m_obj_ptr;
     sigc::connection  m_tag_applied_cid;
     sigc::connection m_enable_cid;
     bool m_enabled;
+    bool m_deferred;
+    // text not yet checked in deferred mode
+    NoteTag::Ptr m_pending_tag;
+    std::vector<sigc::connection> m_deferred_cids;
+    sigc::connection m_check_cid;
   };
 #else
   class NoteSpellChecker 
@@ -171,8 +189,6 @@ namespace gnote {
 
     NoteTag::Ptr                m_url_tag;
     Glib::RefPtr<Gtk::TextMark> m_click_mark;
-    Glib::RefPtr<Glib::Regex>   m_regex;
-    static const char * URL_REGEX;
     static bool  s_text_event_connected;
   };
 
@@ -186,9 +202,12 @@ namespace gnote {
     virtual void shutdown() override;
     virtual void on_note_opened() override;
 
+  protected:
+    NoteLinkWatcher();
   private:
     bool contains_text(const Glib::ustring & text);
     void on_note_added(const NoteBase::Ptr &);
+    void on_notes_added(const NoteBase::List &);
     void on_note_deleted(const NoteBase::Ptr &);
     void on_note_renamed(const NoteBase::Ptr&, const Glib::ustring&);
     void do_highlight(const TrieHit<NoteBase::WeakPtr> & , const Gtk::TextIter &,const Gtk::TextIter &);
@@ -206,12 +225,29 @@ namespace gnote {
     bool open_or_create_link(const NoteEditor &, const Gtk::TextIter &,const Gtk::TextIter &);
     bool on_link_tag_activated(const NoteEditor &,
                                const Gtk::TextIter &, const Gtk::TextIter &);
+    void queue_highlight(const NoteBase::Ptr & note);
+    void add_highlight_range(const Gtk::TextIter & start, const Gtk::TextIter & end);
+    void cancel_highlight();
+    bool on_highlight_idle();
+
+    typedef std::pair<Glib::RefPtr<Gtk::TextMark>, Glib::RefPtr<Gtk::TextMark> > MarkRange;
 
     NoteTag::Ptr m_link_tag;
     NoteTag::Ptr m_broken_link_tag;
 
+    // Highlighting the whole buffer after a note is added or renamed is done
+    // in chunks from an idle handler, the visible part first. The buffer is
+    // held by note for the whole pass, so that it is not released with the marks.
+    NoteBuffer::Ptr m_highlight_buffer;
+    std::deque<MarkRange> m_highlight_ranges;
+    // titles to look for, all of them if m_highlight_all
+    std::vector<NoteBase::WeakPtr> m_highlight_notes;
+    bool m_highlight_all;
+    sigc::connection m_highlight_cid;
+
     sigc::connection m_on_note_deleted_cid;
     sigc::connection m_on_note_added_cid;
+    sigc::connection m_on_notes_added_cid;
     sigc::connection m_on_note_renamed_cid;
     static bool s_text_event_connected;
   };
@@ -228,7 +264,6 @@ namespace gnote {
 
   protected:
     NoteWikiWatcher()
-      : m_regex(Glib::Regex::create(WIKIWORD_REGEX))
       {
       }
   private:
@@ -237,9 +272,7 @@ namespace gnote {
     void on_insert_text(const Gtk::TextIter &, const Glib::ustring &, int);
 
 
-    static const char * WIKIWORD_REGEX;
     Glib::RefPtr<Gtk::TextTag>   m_broken_link_tag;
-    Glib::RefPtr<Glib::Regex>    m_regex;
   };
 
 